@@ -0,0 +1,175 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BLONSTECH_GRAPHICS_BVH_H_
+#define BLONSTECH_GRAPHICS_BVH_H_
+
+// Includes
+#include <cstdint>
+#include <vector>
+// Public Includes
+#include <blons/graphics/model.h>
+#include <blons/math/math.h>
+
+namespace blons
+{
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Bounding volume hierarchy over the triangles of a set of meshes, for
+/// tracing rays and finding nearby geometry on the CPU
+////////////////////////////////////////////////////////////////////////////////
+class BVH
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Mesh placed in the world, as given to the BVH
+    ////////////////////////////////////////////////////////////////////////////////
+    struct Instance
+    {
+        const MeshData* mesh; ///< Mesh to build over, must use the TRIANGLES draw mode to be included
+        Matrix world_matrix;  ///< Transform from mesh to world space
+    };
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Result of a query, describing the closest point found on a triangle
+    ////////////////////////////////////////////////////////////////////////////////
+    struct Hit
+    {
+        units::world distance; ///< Distance from the query origin to the hit
+        Vector3 pos;           ///< World space position of the hit
+        Vector3 normal;        ///< Geometric normal of the triangle, following its winding order
+        Vector2 barycentric;   ///< Weights of the triangle's 2nd and 3rd vertices at the hit
+        std::size_t instance;  ///< Index of the instance (or model) that was hit
+        std::size_t triangle;  ///< Index of the triangle within the instance's mesh
+    };
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Builds a BVH over the meshes of the supplied models. Positions are
+    /// taken from Model::world_matrix, which only updates when models are rendered
+    ///
+    /// \param models Models to build over, Hit::instance indexes into this list
+    ////////////////////////////////////////////////////////////////////////////////
+    BVH(const std::vector<Model*>& models);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Builds a BVH over the supplied meshes. Building is spread across
+    /// the worker threads and gives the same tree no matter how many are running
+    ///
+    /// \param instances Meshes to build over, must outlive the constructor call
+    ////////////////////////////////////////////////////////////////////////////////
+    BVH(const std::vector<Instance>& instances);
+    ~BVH() {}
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Finds the closest triangle hit by a ray. Both sides of a triangle
+    /// can be hit
+    ///
+    /// \param origin Starting point of the ray
+    /// \param direction Direction of the ray, must be normalized
+    /// \param max_distance Hits further away than this are ignored
+    /// \param[out] hit Closest hit, if any. Can be nullptr
+    /// \return True if a triangle was hit
+    ////////////////////////////////////////////////////////////////////////////////
+    bool Raycast(const Vector3& origin, const Vector3& direction, units::world max_distance, Hit* hit) const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Checks whether any triangle crosses a line segment. Stops at the
+    /// first triangle found, so it's much cheaper than a raycast for visibility
+    ///
+    /// \param start First end point of the segment
+    /// \param end Second end point of the segment
+    /// \return True if the segment is blocked
+    ////////////////////////////////////////////////////////////////////////////////
+    bool SegmentIntersects(const Vector3& start, const Vector3& end) const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Finds the closest point on any triangle to the given point
+    ///
+    /// \param point Position to search around
+    /// \param max_distance Points further away than this are ignored
+    /// \param[out] hit Closest point, if any. Can be nullptr
+    /// \return True if a point was found within range
+    ////////////////////////////////////////////////////////////////////////////////
+    bool NearestPoint(const Vector3& point, units::world max_distance, Hit* hit) const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the number of triangles in the hierarchy
+    ///
+    /// \return Triangle count
+    ////////////////////////////////////////////////////////////////////////////////
+    std::size_t triangle_count() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the number of nodes in the hierarchy, including leaves
+    ///
+    /// \return Node count
+    ////////////////////////////////////////////////////////////////////////////////
+    std::size_t node_count() const;
+
+private:
+    class Builder;
+    // 32 bytes, so 2 nodes fit in a cache line. Siblings are stored next to each other, so inner
+    // nodes only need the index of their first child. The bounds are each followed by 4 bytes so
+    // they can be loaded straight into SSE registers
+    struct Node
+    {
+        float bounds_min[3];
+        uint32_t offset; // First child of inner nodes, or first triangle of leaves
+        float bounds_max[3];
+        uint32_t count;  // Triangles in leaves, or 0 for inner nodes
+    };
+    // Stored in leaf order with edges precomputed for ray intersection
+    struct Triangle
+    {
+        Vector3 v0;
+        Vector3 edge1;
+        Vector3 edge2;
+        uint32_t instance;
+        uint32_t index;
+    };
+
+    void Build(const std::vector<Instance>& instances);
+    Hit MakeHit(const Triangle& triangle, units::world distance, const Vector3& pos, float u, float v) const;
+
+    std::vector<Node> nodes_;
+    std::vector<Triangle> triangles_;
+};
+} // namespace blons
+
+////////////////////////////////////////////////////////////////////////////////
+/// \class blons::BVH
+/// \ingroup graphics
+///
+/// ### Example:
+/// \code
+/// // Build over every model in a scene
+/// blons::BVH bvh(scene.models);
+///
+/// // Find what's in front of the camera
+/// blons::BVH::Hit hit;
+/// if (bvh.Raycast(camera_pos, camera_dir, 100.0f, &hit))
+/// {
+///     blons::log::Debug("Hit model %i at %.2f units\n", static_cast<int>(hit.instance), hit.distance);
+/// }
+///
+/// // Check line of sight between two points
+/// bool visible = !bvh.SegmentIntersects(light_pos, surface_pos);
+/// \endcode
+////////////////////////////////////////////////////////////////////////////////
+
+#endif // BLONSTECH_GRAPHICS_BVH_H_
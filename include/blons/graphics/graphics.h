@@ -29,6 +29,7 @@
 #include <set>
 #include <Windows.h>
 // Public Includes
+#include <blons/graphics/bvh.h>
 #include <blons/graphics/camera.h>
 #include <blons/graphics/framebuffer.h>
 #include <blons/graphics/model.h>
@@ -76,6 +77,11 @@ public:
     /// \brief Bakes the precomputed radiance transfer data for the scene
     ////////////////////////////////////////////////////////////////////////////////
     void BakeRadianceTransfer();
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Updates the precomputed radiance transfer data for any models that
+    /// have moved, been added, or been removed since the last bake
+    ////////////////////////////////////////////////////////////////////////////////
+    void RebakeRadianceTransfer();
 
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Creates a new model from the given mesh file. Models created with
@@ -141,6 +147,14 @@ public:
     /// \return Pointer to the GUI manager
     ////////////////////////////////////////////////////////////////////////////////
     gui::Manager* gui() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves how far along a radiance transfer bake is. Bakes only
+    /// run across frames while `light:bake-progressive` is set, otherwise they
+    /// finish before BakeRadianceTransfer() and RebakeRadianceTransfer() return
+    ///
+    /// \return Progress from 0 to 1, or 1 if no bake is in progress
+    ////////////////////////////////////////////////////////////////////////////////
+    float bake_progress() const;
 
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Determines which stage of the rendering pipeline is displayed to the
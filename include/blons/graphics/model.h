@@ -93,6 +93,20 @@ public:
     ////////////////////////////////////////////////////////////////////////////////
     const TextureResource* lightmap() const;
     ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the pixel data the albedo texture was loaded from, for
+    /// use on the CPU
+    ///
+    /// \return Albedo pixel data, or nullptr if unavailable
+    ////////////////////////////////////////////////////////////////////////////////
+    const PixelData* albedo_pixels() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the pixel data the normal texture was loaded from, for
+    /// use on the CPU
+    ///
+    /// \return Normal pixel data, or nullptr if unavailable
+    ////////////////////////////////////////////////////////////////////////////////
+    const PixelData* normal_pixels() const;
+    ////////////////////////////////////////////////////////////////////////////////
     /// \brief Retrieves the position of the model
     ///
     /// \return %Model position
@@ -125,6 +125,20 @@ public:
     /// \param scene Contains scene information for baking
     ////////////////////////////////////////////////////////////////////////////////
     void BakeRadianceTransfer(const Scene& scene);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Updates the precomputed radiance transfer data for any changes to
+    /// the scene since the last bake
+    ///
+    /// \param scene Contains scene information for baking
+    ////////////////////////////////////////////////////////////////////////////////
+    void RebakeRadianceTransfer(const Scene& scene);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves how far along a progressive radiance transfer bake is.
+    /// Bakes are progressive while `light:bake-progressive` is set
+    ///
+    /// \return Progress from 0 to 1, or 1 if no bake is in progress
+    ////////////////////////////////////////////////////////////////////////////////
+    float bake_progress() const;
 
 private:
     bool Init();
@@ -146,6 +160,8 @@ private:
     std::unique_ptr<stage::SpecularLocal> specular_local_;
     std::unique_ptr<stage::Lighting> lighting_;
     std::unique_ptr<stage::Composite> composite_;
+    // Specular probes were rebaked and need relighting even if the light sector doesn't
+    bool relight_specular_;
 
     // Debug stuff
     std::unique_ptr<stage::debug::DebugOutput> debug_output_;
@@ -112,7 +112,12 @@ const int kIrradianceVolumeHeight = 16;
 ////////////////////////////////////////////////////////////////////////////////
 /// \brief **Temporary** config option for irradiance volume resolution
 ////////////////////////////////////////////////////////////////////////////////
-const int kIrradianceVolumeDepth = 16;
+const int kIrradianceVolumeDepth = 32;
+////////////////////////////////////////////////////////////////////////////////
+/// \brief **Temporary** Number of camera-centred irradiance volume levels, each
+/// twice the size of the last. Copied in shaders/lib/irradiance.lib.glsl
+////////////////////////////////////////////////////////////////////////////////
+const int kIrradianceClipmapLevels = 3;
 } // namespace pipeline
 } // namespace blons
 
@@ -69,7 +69,7 @@ public:
 
 private:
     // Full init is deferred until first Render() because it's optional and adds significant startup time
-    void InitMeshBuffers(const IrradianceVolume& irradiance);
+    void InitMeshBuffers();
 
     std::unique_ptr<DrawBatcher> grid_mesh_;
     std::unique_ptr<DrawBatcher> voxel_meshes_;
@@ -74,6 +74,8 @@ private:
     std::unique_ptr<DrawBatcher> probe_network_mesh_;
     std::unique_ptr<Shader> probe_shader_;
     std::unique_ptr<Shader> grid_shader_;
+    // Cell the camera was in last frame, to start the next search from
+    int camera_cell_;
 };
 } // namespace debug
 } // namespace stage
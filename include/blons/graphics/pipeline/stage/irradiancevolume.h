@@ -26,6 +26,7 @@
 
 // Includes
 #include <array>
+#include <vector>
 // Public Includes
 #include <blons/graphics/pipeline/scene.h>
 #include <blons/graphics/pipeline/stage/lightsector/lightsector.h>
@@ -40,13 +41,15 @@ namespace stage
 {
 ////////////////////////////////////////////////////////////////////////////////
 /// \brief Turns blons::pipeline::stage::LightSector data into a volumetric grid
-/// of directional light for shading
+/// of directional light for shading. The grid is a clipmap of levels centred on
+/// the camera, each with voxels twice the size of the last
 ////////////////////////////////////////////////////////////////////////////////
 class IrradianceVolume
 {
 public:
     ////////////////////////////////////////////////////////////////////////////////
-    /// \brief Used to specify which output of the stage to retrieve
+    /// \brief Used to specify which output of the stage to retrieve. Every
+    /// clipmap level is stacked along the depth of each output, finest first
     ////////////////////////////////////////////////////////////////////////////////
     enum Output
     {
@@ -58,16 +61,40 @@ public:
         IRRADIANCE_VOLUME_NZ = AxisAlignedNormal::NEGATIVE_Z  ///< 3D volume texture of ambient cube coefficient for -Z
     };
 
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Box of voxels in a clipmap level, in units of that level's voxels
+    ////////////////////////////////////////////////////////////////////////////////
+    struct VoxelRegion
+    {
+        std::array<int, 3> min;  ///< First voxel of the region
+        std::array<int, 3> size; ///< Number of voxels along each axis
+    };
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Memory use and update cost of a single clipmap level
+    ////////////////////////////////////////////////////////////////////////////////
+    struct LevelStats
+    {
+        units::world voxel_size; ///< Edge length of the level's voxels
+        std::size_t memory;      ///< Bytes of texture memory used by the level, across all 6 outputs
+        int updated_voxels;      ///< Voxels recomputed by the last call to Relight
+        int updated_regions;     ///< Compute dispatches made by the last call to Relight
+    };
+
 public:
     IrradianceVolume();
     ~IrradianceVolume() {}
 
     ////////////////////////////////////////////////////////////////////////////////
-    /// \brief Injects supplied light probe data and fills volume grid
+    /// \brief Moves the clipmap to follow the camera, and fills in voxels from
+    /// supplied light probe data. Only voxels that scrolled into a level are
+    /// computed, along with those sampling probes the sector relit this frame.
+    /// Changing the volume's storage settings updates every voxel. Storage is set
+    /// by the `light:irradiance-half` and `light:irradiance-voxel-size` variables
     ///
     /// \param sector Handle to sector data
+    /// \param camera_pos Position to centre the clipmap on
     ////////////////////////////////////////////////////////////////////////////////
-    bool Relight(const LightSector& sector);
+    bool Relight(const LightSector& sector, const Vector3& camera_pos);
 
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Retrieves the rendering output from the pipeline stage
@@ -78,17 +105,77 @@ public:
     const TextureResource* output(Output buffer) const;
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Retrieves a world matrix that scales and transforms a cube with
-    /// vertices of [0,1] to a rectangular prism containing this IrradianceVolume.
-    /// Used for transforming UVW space positions to world space positions
+    /// vertices of [0,1] to a rectangular prism containing the finest level of
+    /// this IrradianceVolume. Used for transforming UVW space positions to world
+    /// space positions
     ///
     /// \return Irradiance volume world matrix
     ////////////////////////////////////////////////////////////////////////////////
     Matrix world_matrix() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the first voxel of each clipmap level, in units of that
+    /// level's voxels. Voxel coordinates wrap around each level's textures
+    ///
+    /// \return Voxel origin of every level, from finest to coarsest
+    ////////////////////////////////////////////////////////////////////////////////
+    std::array<Vector3, kIrradianceClipmapLevels> clipmap_origins() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the edge length of voxels in the finest clipmap level
+    ///
+    /// \return Voxel size in world units
+    ////////////////////////////////////////////////////////////////////////////////
+    units::world voxel_size() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the memory use and update cost of each clipmap level
+    ///
+    /// \return Stats of every level, from finest to coarsest
+    ////////////////////////////////////////////////////////////////////////////////
+    const std::array<LevelStats, kIrradianceClipmapLevels>& level_stats() const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Finds the first voxel of a clipmap level centred on a position
+    ///
+    /// \param camera_pos Position the level is centred on
+    /// \param voxel_size Edge length of the level's voxels
+    /// \return Voxel origin of the level
+    ////////////////////////////////////////////////////////////////////////////////
+    static std::array<int, 3> LevelOrigin(const Vector3& camera_pos, units::world voxel_size);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Finds the voxels that scroll into a clipmap level when its origin
+    /// moves. Regions never overlap, and cover the whole level if it moved further
+    /// than its own size
+    ///
+    /// \param old_origin Voxel origin of the level before moving
+    /// \param new_origin Voxel origin of the level after moving
+    /// \return List of regions that need updating, empty if the level didn't move
+    ////////////////////////////////////////////////////////////////////////////////
+    static std::vector<VoxelRegion> ScrollRegions(const std::array<int, 3>& old_origin, const std::array<int, 3>& new_origin);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Finds the voxels of a clipmap level that are sampled from inside of
+    /// a world space box. Voxels are sampled at their centres
+    ///
+    /// \param origin Voxel origin of the level
+    /// \param bounds_min Lowest corner of the box, can be infinite
+    /// \param bounds_max Highest corner of the box, can be infinite
+    /// \param voxel_size Edge length of the level's voxels
+    /// \param[out] region Voxels of the level inside of the box
+    /// \return False if none of the level is inside of the box
+    ////////////////////////////////////////////////////////////////////////////////
+    static bool BoundsRegion(const std::array<int, 3>& origin, const Vector3& bounds_min, const Vector3& bounds_max,
+                             units::world voxel_size, VoxelRegion* region);
 
 private:
+    void InitTextures(bool half_precision);
+    bool UpdateRegion(int level, const VoxelRegion& region);
+
     std::array<std::unique_ptr<Texture3D>, 6> irradiance_volume_; // Stores all 6 ambient cube coefficients
     std::unique_ptr<ComputeShader> irradiance_volume_shader_;
-    Matrix world_matrix_;
+    std::array<std::array<int, 3>, kIrradianceClipmapLevels> origins_;
+    std::array<LevelStats, kIrradianceClipmapLevels> stats_;
+    units::world voxel_size_;
+    bool half_precision_;
+    // Whether every level has been filled in since the textures or voxel size last changed
+    bool filled_;
 };
 } // namespace stage
 } // namespace pipeline
@@ -29,6 +29,7 @@
 #include <blons/graphics/pipeline/stage/shadow.h>
 #include <blons/graphics/render/computeshader.h>
 #include <blons/graphics/render/shaderdata.h>
+#include <blons/system/timer.h>
 
 namespace blons
 {
@@ -36,6 +37,11 @@ namespace pipeline
 {
 namespace stage
 {
+// Forward declarations
+class ProbeNetworkSearch;
+class RadianceTransferBaker;
+class RelightTracker;
+
 ////////////////////////////////////////////////////////////////////////////////
 /// \brief Manages light probes used to calculate indirect diffuse illumination
 /// at runtime through the use of precomputed radiance transfer
@@ -151,6 +157,15 @@ public:
     /// \brief Carries the results of a Probe network interpolation search
     ////////////////////////////////////////////////////////////////////////////////
     using ProbeSearchWeights = std::array<ProbeWeight, 4>;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Result of a Probe network search, along with the ProbeSearchCell it
+    /// was found in so that it can be passed back as a hint next time
+    ////////////////////////////////////////////////////////////////////////////////
+    struct ProbeSearchResult
+    {
+        ProbeSearchWeights weights; ///< Interpolated weights of the Probe%s around the point
+        int cell_id;                ///< ID of the cell containing the point, or INVALID_ID if none was found
+    };
 
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Contains a sample of geometry data used to simulate bounced indirect
@@ -203,17 +218,56 @@ public:
     /// initialization.
     ////////////////////////////////////////////////////////////////////////////////
     LightSector();
-    ~LightSector() {}
+    ~LightSector();
 
     ////////////////////////////////////////////////////////////////////////////////
-    /// \brief Bakes the precomputed radiance transfer data for a given scene
+    /// \brief Bakes the precomputed radiance transfer data for a given scene.
+    /// When `light:probe-placement` is set the Probe%s are first placed from the
+    /// scene's geometry. When `light:bake-progressive` is set the bake is only
+    /// started here, and is carried out by ContinueBake() over the following frames
     ///
     /// \param scene Contains scene information for baking
     ////////////////////////////////////////////////////////////////////////////////
     void BakeRadianceTransfer(const Scene& scene);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Updates the precomputed radiance transfer data after models have
+    /// been moved, added, or removed since the last bake. Only Probe%s that could
+    /// see the changes are rebaked, and only the changed ranges of GPU memory are
+    /// updated. Falls back to a full bake if the last bake was loaded from cache.
+    /// Probe%s are placed again first when `light:probe-placement` is set
+    ///
+    /// \param scene Contains scene information for baking
+    ////////////////////////////////////////////////////////////////////////////////
+    void RebakeRadianceTransfer(const Scene& scene);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Moves the sector's Probe%s to a new layout and updates the
+    /// precomputed radiance transfer data to match. Probe%s that kept their
+    /// position reuse their previous bake where possible
+    ///
+    /// \param scene Contains scene information for baking
+    /// \param probe_positions World space position of every Probe in the new
+    /// layout
+    ////////////////////////////////////////////////////////////////////////////////
+    void RebakeRadianceTransfer(const Scene& scene, const std::vector<Vector3>& probe_positions);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Works through a progressive bake a slice at a time. Each call
+    /// renders environment maps for up to `light:bake-slice-probes` Probe%s and
+    /// leaves the rest of the work to background jobs, so frames keep rendering.
+    /// Relighting uses the previous results until the bake is done, when they are
+    /// all swapped out at once. Rebakes requested in the meantime are started
+    /// once it finishes. Does nothing if no bake is in progress
+    ///
+    /// \param scene Contains scene information for baking
+    ////////////////////////////////////////////////////////////////////////////////
+    void ContinueBake(const Scene& scene);
 
     ////////////////////////////////////////////////////////////////////////////////
-    /// \brief Computes the lighting for all Probe%s contained in this sector
+    /// \brief Computes the lighting for all Probe%s contained in this sector.
+    /// Runs on the GPU unless `light:relight-cpu` is set, in which case the
+    /// results are also kept in probes(), surfels() and surfel_bricks().
+    /// Frames where the sun, sky, shadow map and models haven't changed are
+    /// skipped once lighting has settled, and moving models only relight what
+    /// they shadow. Set `light:relight-skip` to 0 to relight everything always
     ///
     /// \param scene Contains scene information for rendering
     /// \param shadow Handle to the shadow buffer pass performed earlier in the
@@ -222,6 +276,31 @@ public:
     /// providing shadow
     ////////////////////////////////////////////////////////////////////////////////
     bool Relight(const Scene& scene, const Shadow& shadow, Matrix light_vp_matrix);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Checks whether the last call to Relight changed any lighting. When
+    /// it didn't, anything lit from this sector can skip relighting as well
+    ///
+    /// \return True if lighting was updated
+    ////////////////////////////////////////////////////////////////////////////////
+    bool relit() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Checks whether the last call to Relight changed the irradiance of
+    /// any Probe%s. Anything sampled from the probes alone, like the irradiance
+    /// volume, only needs resampling when it did
+    ///
+    /// \return True if any Probe was relit
+    ////////////////////////////////////////////////////////////////////////////////
+    bool probes_relit() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Finds a box around everywhere that samples a Probe relit by the last
+    /// call to Relight, padded out to the ProbeSearchCell%s those probes are part
+    /// of. Sides facing out of the probe network's hull are infinite
+    ///
+    /// \param[out] bounds_min Lowest corner of the box in world space
+    /// \param[out] bounds_max Highest corner of the box in world space
+    /// \return False if no Probe was relit, leaving the box untouched
+    ////////////////////////////////////////////////////////////////////////////////
+    bool RelitProbeBounds(Vector3* bounds_min, Vector3* bounds_max) const;
 
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Determines if a given ProbeSearchCell contains a volume outside the
@@ -239,6 +318,32 @@ public:
     /// \return List of 4 Probe%s and interpolated weights
     ////////////////////////////////////////////////////////////////////////////////
     ProbeSearchWeights FindProbeWeights(const Vector3& point) const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Finds the interpolated Probe weights for many points at once,
+    /// spread across the worker threads. Searches are fastest when each point
+    /// is given the cell it was found in last time as a hint
+    ///
+    /// \param points World space positions to find associated Probe%s and weights
+    /// \param hint_cells ProbeSearchResult::cell_id of each point from an earlier
+    /// search, or INVALID_ID for points without one. Can be nullptr
+    /// \param count Number of points to search for
+    /// \param[out] results Weights and cell of each point, must fit count results
+    ////////////////////////////////////////////////////////////////////////////////
+    void FindProbeWeights(const Vector3* points, const int* hint_cells, std::size_t count, ProbeSearchResult* results) const;
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Checks whether there's radiance transfer data to relight with,
+    /// which isn't the case until the first bake has finished
+    ///
+    /// \return True if the sector has been baked
+    ////////////////////////////////////////////////////////////////////////////////
+    bool baked() const;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves how far along the current progressive bake is
+    ///
+    /// \return Progress from 0 to 1, or 1 if no bake is in progress
+    ////////////////////////////////////////////////////////////////////////////////
+    float bake_progress() const;
 
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Retrieves list of Probe%s for this sector
@@ -304,6 +409,14 @@ public:
     const ShaderDataResource* surfel_brick_factor_shader_data() const;
 
 private:
+    void BakeProbes(const Scene& scene, const std::vector<Probe>& probes);
+    void RebakeProbes(const Scene& scene, const std::vector<Probe>& probes);
+    void UpdateRadianceTransfer(const Scene& scene);
+    void UploadRadianceTransfer();
+    void PatchRadianceTransfer(const Scene& scene);
+    void RelightCPU(const Scene& scene, const Shadow& shadow, Matrix light_vp_matrix);
+    void ValidateRelight();
+
     std::vector<Probe> probes_;
     std::vector<ProbeSearchCell> probe_network_;
     std::vector<Surfel> surfels_;
@@ -316,6 +429,25 @@ private:
     std::unique_ptr<ShaderData<Surfel>> surfel_shader_data_;
     std::unique_ptr<ShaderData<SurfelBrick>> surfel_brick_shader_data_;
     std::unique_ptr<ShaderData<SurfelBrickFactor>> surfel_brick_factor_shader_data_;
+    // Built alongside the probe network to speed up weight searches
+    std::unique_ptr<ProbeNetworkSearch> probe_search_;
+    // Kept between bakes so rebakes can reuse the samples of unchanged probes
+    std::unique_ptr<RadianceTransferBaker> baker_;
+    // Layout being baked by the baker, and whether it's a rebake of the current results
+    std::vector<Probe> bake_probes_;
+    bool rebaking_;
+    // Rebake to start once the progressive bake in progress is done
+    std::vector<Probe> queued_probes_;
+    bool rebake_queued_;
+    Timer bake_stats_;
+    // Decides which bricks and probes need relighting, if any
+    std::unique_ptr<RelightTracker> relight_tracker_;
+    int relight_mode_;
+    bool relit_;
+    bool probes_relit_;
+    // Box around everything sampling the probes that were relit
+    Vector3 relit_min_;
+    Vector3 relit_max_;
 };
 } // namespace stage
 } // namespace pipeline
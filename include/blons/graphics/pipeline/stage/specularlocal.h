@@ -72,7 +72,18 @@ public:
     void BakeRadianceTransfer(const Scene& scene);
 
     ////////////////////////////////////////////////////////////////////////////////
-    /// \brief Relights and filters environment cubemaps
+    /// \brief Marks the lighting of every probe as out of date, to be relit over
+    /// the following calls to Relight
+    ////////////////////////////////////////////////////////////////////////////////
+    void QueueRelight();
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Relights and filters environment cubemaps of out of date probes.
+    /// Each call does at most `light:specular-relight-budget` steps of work, where
+    /// a step is one cubemap face of the base level or one filtered mip level.
+    /// Probes closest to the camera with the most lighting changes go first.
+    /// Probes are relit into back buffers that are only swapped in once complete,
+    /// so outputs never show a partially relit probe. Does nothing once every
+    /// probe is up to date
     ///
     /// \param scene Contains scene information for rendering
     /// \param shadow Handle to the shadow buffer pass performed earlier in the
@@ -106,9 +117,23 @@ private:
         } g_buffer;
         std::unique_ptr<TextureCubemap> environment; ///< Lighting environment with mipmaps
         std::unique_ptr<TextureCubemap> ld_term;     ///< Filtered lighting term with mipmaps for varying roughness
+        // Relit a step at a time and swapped with the above when complete
+        std::unique_ptr<TextureCubemap> back_environment;
+        std::unique_ptr<TextureCubemap> back_ld_term;
+        // Lighting changes queued since the probe's current relight began
+        int stale_count;
+        // Next face or mip level to relight into the back buffers, 0 if not being relit
+        int next_step;
+        // Whether the front buffers have ever been relit
+        bool lit;
     };
 
+    int NextProbe(const Vector3& camera_pos) const;
+    bool RelightSteps(SpecularProbe* probe, int max_steps);
+
     std::vector<SpecularProbe> probes_;
+    // Probe whose back buffers are partway through a relight, or -1
+    int relighting_probe_;
     std::unique_ptr<Shader> relight_shader_;
     std::unique_ptr<Shader> relight_distribution_shader_;
     std::unique_ptr<Framebuffer> relight_buffer_;
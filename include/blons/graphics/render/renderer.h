@@ -667,6 +667,20 @@ public:
     ////////////////////////////////////////////////////////////////////////////////
     virtual PixelData GetTextureData(const TextureResource* texture, unsigned int mip_level)=0;
     ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves a rectangle of pixel data from a supplied texture on the
+    /// GPU, with rows counted from the bottom of the texture
+    ///
+    /// \param texture Texture to fetch
+    /// \param mip_level Mipmap level to get data of, with 0 being the base
+    /// \param x Left edge of the rectangle in pixels
+    /// \param y Bottom edge of the rectangle in pixels
+    /// \param width Width of the rectangle in pixels
+    /// \param height Height of the rectangle in pixels
+    /// \return Pixel data and information, sized to the rectangle
+    ////////////////////////////////////////////////////////////////////////////////
+    virtual PixelData GetTextureData(const TextureResource* texture, unsigned int mip_level,
+                                     units::pixel x, units::pixel y, units::pixel width, units::pixel height)=0;
+    ////////////////////////////////////////////////////////////////////////////////
     /// \copydoc GetTextureData(const TextureResource*, unsigned int)
     ////////////////////////////////////////////////////////////////////////////////
     virtual PixelData3D GetTextureData3D(const TextureResource* texture, unsigned int mip_level)=0;
@@ -88,6 +88,14 @@ public:
     ////////////////////////////////////////////////////////////////////////////////
     const PixelData* pixels(bool force_gpu_sync);
     ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the pixel data the texture was created from, without
+    /// reading anything back from the GPU. Textures loaded from a DDS file hold
+    /// the file's compressed contents
+    ///
+    /// \return Pixel buffer and info, or nullptr if no longer cached
+    ////////////////////////////////////////////////////////////////////////////////
+    const PixelData* source_pixels() const;
+    ////////////////////////////////////////////////////////////////////////////////
     /// \brief Retrieves a pointer to the texture resource for rendering
     ///
     /// \return Texture resource reference
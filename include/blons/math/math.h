@@ -635,6 +635,20 @@ SHCoeffs2 SHProjectDirection2(Vector3 direction);
 /// \copydoc SHProjectDirection2
 ////////////////////////////////////////////////////////////////////////////////
 SHCoeffs3 SHProjectDirection3(Vector3 direction);
+////////////////////////////////////////////////////////////////////////////////
+/// \ingroup math
+/// \brief Projects a batch of weighted directions and adds their sum onto a set
+/// of coefficients. Equivalent to summing SHProjectDirection3() * weight for
+/// each direction, but processes several at once with SIMD instructions where
+/// they're available. Results may differ from the one at a time sum by
+/// rounding
+///
+/// \param directions List of directions to be projected
+/// \param weights Weight of each direction
+/// \param count Number of directions
+/// \param[out] out Coefficients to add the weighted projections onto
+////////////////////////////////////////////////////////////////////////////////
+void SHProjectDirections3(const Vector3* directions, const units::world* weights, std::size_t count, SHCoeffs3* out);
 
 ////////////////////////////////////////////////////////////////////////////////
 /// \ingroup math
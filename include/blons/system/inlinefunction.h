@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BLONSTECH_SYSTEM_INLINEFUNCTION_H_
+#define BLONSTECH_SYSTEM_INLINEFUNCTION_H_
+
+// Includes
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace blons
+{
+template <typename Signature, std::size_t Capacity>
+class InlineFunction;
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Function wrapper similar to std::function, except the callable is
+/// always stored inside the object itself and never on the heap. Callables
+/// larger than the capacity are rejected at compile time
+///
+/// \tparam R Return type of the function
+/// \tparam Args Argument types of the function
+/// \tparam Capacity Maximum size in bytes of the stored callable
+////////////////////////////////////////////////////////////////////////////////
+template <typename R, typename... Args, std::size_t Capacity>
+class InlineFunction<R(Args...), Capacity>
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Creates an empty function that must not be called
+    ////////////////////////////////////////////////////////////////////////////////
+    InlineFunction() : invoke_(nullptr), manage_(nullptr) {}
+    InlineFunction(std::nullptr_t) : InlineFunction() {}
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Copies a callable, such as a lambda, into inline storage
+    ///
+    /// \param func Callable to be stored
+    ////////////////////////////////////////////////////////////////////////////////
+    template <typename Func, typename = typename std::enable_if<!std::is_same<typename std::decay<Func>::type, InlineFunction>::value>::type>
+    InlineFunction(Func&& func)
+    {
+        using Callable = typename std::decay<Func>::type;
+        static_assert(sizeof(Callable) <= Capacity, "Callable is too large for inline storage, try capturing by reference");
+        static_assert(alignof(Callable) <= alignof(Storage), "Callable is over-aligned for inline storage");
+        new (&storage_) Callable(std::forward<Func>(func));
+        invoke_ = &Invoke<Callable>;
+        manage_ = &Manage<Callable>;
+    }
+    InlineFunction(const InlineFunction& other) : invoke_(other.invoke_), manage_(other.manage_)
+    {
+        if (manage_ != nullptr)
+        {
+            manage_(COPY, &storage_, const_cast<Storage*>(&other.storage_));
+        }
+    }
+    InlineFunction(InlineFunction&& other) : invoke_(other.invoke_), manage_(other.manage_)
+    {
+        if (manage_ != nullptr)
+        {
+            manage_(MOVE, &storage_, &other.storage_);
+        }
+    }
+    ~InlineFunction()
+    {
+        clear();
+    }
+
+    InlineFunction& operator=(const InlineFunction& other)
+    {
+        if (this != &other)
+        {
+            clear();
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+            if (manage_ != nullptr)
+            {
+                manage_(COPY, &storage_, const_cast<Storage*>(&other.storage_));
+            }
+        }
+        return *this;
+    }
+    InlineFunction& operator=(InlineFunction&& other)
+    {
+        if (this != &other)
+        {
+            clear();
+            invoke_ = other.invoke_;
+            manage_ = other.manage_;
+            if (manage_ != nullptr)
+            {
+                manage_(MOVE, &storage_, &other.storage_);
+            }
+        }
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Calls the stored callable
+    ///
+    /// \param args Arguments to pass to the callable
+    /// \return Value returned by the callable
+    ////////////////////////////////////////////////////////////////////////////////
+    R operator()(Args... args) const
+    {
+        return invoke_(const_cast<Storage*>(&storage_), std::forward<Args>(args)...);
+    }
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Checks if a callable is stored
+    ///
+    /// \return True if the function can be called
+    ////////////////////////////////////////////////////////////////////////////////
+    explicit operator bool() const
+    {
+        return invoke_ != nullptr;
+    }
+
+private:
+    enum Operation
+    {
+        COPY,
+        MOVE,
+        DESTROY
+    };
+    using Storage = typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type;
+    using InvokeFunction = R(*)(void*, Args&&...);
+    using ManageFunction = void(*)(Operation, void*, void*);
+
+    // Type erasure is done with a pair of function pointers rather than virtual calls
+    template <typename Callable>
+    static R Invoke(void* storage, Args&&... args)
+    {
+        return (*static_cast<Callable*>(storage))(std::forward<Args>(args)...);
+    }
+    template <typename Callable>
+    static void Manage(Operation operation, void* dest, void* src)
+    {
+        switch (operation)
+        {
+        case COPY:
+            new (dest) Callable(*static_cast<const Callable*>(src));
+            break;
+        case MOVE:
+            new (dest) Callable(std::move(*static_cast<Callable*>(src)));
+            break;
+        case DESTROY:
+            static_cast<Callable*>(dest)->~Callable();
+            break;
+        }
+    }
+
+    void clear()
+    {
+        if (manage_ != nullptr)
+        {
+            manage_(DESTROY, &storage_, nullptr);
+            invoke_ = nullptr;
+            manage_ = nullptr;
+        }
+    }
+
+    Storage storage_;
+    InvokeFunction invoke_;
+    ManageFunction manage_;
+};
+} // namespace blons
+
+////////////////////////////////////////////////////////////////////////////////
+/// \class blons::InlineFunction
+/// \ingroup system
+///
+/// ### Example:
+/// \code
+/// int total = 0;
+/// // Up to 32 bytes of captures, anything larger fails to compile
+/// blons::InlineFunction<void(int), 32> add([&total](int value) { total += value; });
+/// add(5);
+/// add(10);
+/// blons::log::Debug("Total: %i\n", total);
+/// \endcode
+////////////////////////////////////////////////////////////////////////////////
+
+#endif // BLONSTECH_SYSTEM_INLINEFUNCTION_H_
\ No newline at end of file
@@ -26,12 +26,22 @@
 
 // Includes
 #include <atomic>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+// Public Includes
+#include <blons/system/inlinefunction.h>
 
 namespace blons
 {
 // Forward declarations
 namespace internal { class ThreadPool; }
+namespace internal { struct PooledJob; }
+class JobGroup;
+class WhenAny;
 
 ////////////////////////////////////////////////////////////////////////////////
 /// \brief Asynchronous task to be run by internal worker threads
@@ -39,10 +49,28 @@ namespace internal { class ThreadPool; }
 class Job
 {
 public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Maximum size in bytes of a function's captured state. Functions are
+    /// stored inline so creating a job never allocates
+    ////////////////////////////////////////////////////////////////////////////////
+    static const std::size_t kFunctionCapacity = 64;
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Function prototype for a Job to run
     ////////////////////////////////////////////////////////////////////////////////
-    using Function = std::function<void()>;
+    using Function = InlineFunction<void(), kFunctionCapacity>;
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Order in which queued jobs are picked up by worker threads. A job is
+    /// only started when no job of a higher priority is waiting
+    ////////////////////////////////////////////////////////////////////////////////
+    enum Priority
+    {
+        HIGH,      ///< Frame critical work that must start as soon as possible
+        NORMAL,    ///< Default for most jobs
+        BACKGROUND ///< Long running work that can take several frames. Only runs
+                   ///< on a limited number of workers set by `sys:background-workers`,
+                   ///< and is never picked up by threads waiting on unrelated jobs
+    };
+    static const int kPriorityCount = 3;
 
 public:
     ////////////////////////////////////////////////////////////////////////////////
@@ -50,8 +78,9 @@ public:
     /// after it has been queued
     ///
     /// \param func Function to be executed
+    /// \param priority Priority the job is queued with
     ////////////////////////////////////////////////////////////////////////////////
-    Job(Function func);
+    Job(Function func, Priority priority = NORMAL);
     ////////////////////////////////////////////////////////////////////////////////
     /// \brief Automatically calls Wait() on destruction to prevent data races and
     /// ensure job completion
@@ -59,22 +88,340 @@ public:
     ~Job();
 
     ////////////////////////////////////////////////////////////////////////////////
-    /// \brief Adds self to a global job queue to be consumed by worker threads
+    /// \brief Adds self to a job queue to be consumed by worker threads. Jobs
+    /// enqueued from a worker thread go to that worker's own queue, where idle
+    /// workers can steal them
     ////////////////////////////////////////////////////////////////////////////////
     void Enqueue();
     ////////////////////////////////////////////////////////////////////////////////
-    /// \brief Blocks until all invocations of this job have been completed
+    /// \brief Blocks until all invocations of this job have been completed. While
+    /// waiting, the calling thread runs this job if it's still queued, along with
+    /// any jobs queued while running it and any dependencies holding it back, of
+    /// any priority. Once none are left it sleeps until the job finishes. If an
+    /// invocation threw, the first exception is rethrown here. Exceptions are kept
+    /// until the job is next enqueued after finishing
     ////////////////////////////////////////////////////////////////////////////////
     void Wait();
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Prevents this job from starting until the given job has finished.
+    /// Once enqueued, this job is held back and is handed to the worker threads
+    /// by whichever dependency finishes last, so no thread blocks waiting on it.
+    ///
+    /// Every enqueue of this job consumes one finished invocation from each of its
+    /// dependencies, so a graph of jobs should be enqueued once each per use.
+    /// Dependencies must be added before any job in the graph is enqueued, must
+    /// not form cycles, and must outlive this job's last invocation. A dependency
+    /// that is never enqueued will hold this job back forever.
+    ///
+    /// \param dependency Job that must finish before this one starts
+    ////////////////////////////////////////////////////////////////////////////////
+    void AddDependency(Job* dependency);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Attaches a continuation to run once this job has finished. Shorthand
+    /// for `continuation->AddDependency(this)`, with the same restrictions
+    ///
+    /// \param continuation Job to start after this one
+    ////////////////////////////////////////////////////////////////////////////////
+    void Then(Job* continuation);
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Rebuilds the worker thread pool with the given settings. Blocks
+    /// until every job queued on the old workers has finished, background jobs
+    /// included, before starting the new ones. Must not be called from inside a
+    /// job, or while other threads are queueing jobs.
+    ///
+    /// By default the pool is built when the first Job is queued, using the
+    /// `sys:worker-threads` and `sys:worker-affinity` console variables.
+    ///
+    /// \param worker_threads Number of worker threads to run. A value of 0 or less
+    /// uses one worker per hardware thread, minus one for the calling thread
+    /// \param pin_affinity True to pin each worker to its own logical core
+    ////////////////////////////////////////////////////////////////////////////////
+    static void ConfigureWorkers(int worker_threads, bool pin_affinity);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the number of worker threads consuming queued jobs
+    ///
+    /// \return Number of worker threads
+    ////////////////////////////////////////////////////////////////////////////////
+    static int worker_count();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves the priority the job is queued with
+    ///
+    /// \return Job priority
+    ////////////////////////////////////////////////////////////////////////////////
+    Priority priority() const;
+
+protected:
+    // Same as Wait() but never throws, used on destruction
+    void Join();
 
 private:
     // Actual function can only be started by worker threads
     friend class internal::ThreadPool;
+    friend class JobGroup;
+    friend class WhenAny;
     void Run();
+    // Called once on enqueue and once per finished dependency, queues the job on the last call
+    void Release();
+
+    // Number of parent jobs remembered on enqueue, deeper nesting is treated as unrelated
+    static const int kAncestorCount = 8;
 
     Function func_;
+    Priority priority_;
     std::atomic<int> running_;
+    // Jobs that were running on the enqueuing thread, innermost first. Copied rather than linked
+    // through each parent, since a parent can be destroyed while its children are still queued
+    std::atomic<const Job*> ancestors_[kAncestorCount];
+    std::vector<Job*> dependents_;
+    int dependency_count_;
+    std::atomic<int> unreleased_count_;
+    std::atomic<bool> failed_;
+    std::exception_ptr exception_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Job that produces a value, which can be retrieved once it finishes.
+/// The value is stored inline in the future itself
+///
+/// \tparam T Type of value returned by the job's function
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class JobFuture : public Job
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Function prototype for a JobFuture to run
+    ////////////////////////////////////////////////////////////////////////////////
+    using Function = InlineFunction<T(), kFunctionCapacity>;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Creates a new JobFuture that will execute the given function
+    /// asynchronously after it has been queued. Should not be enqueued again
+    /// while an invocation is still running, as each one overwrites the result
+    ///
+    /// \param func Function returning the job's result
+    /// \param priority Priority the job is queued with
+    ////////////////////////////////////////////////////////////////////////////////
+    JobFuture(Function func, Priority priority = NORMAL)
+        : Job([this]() { set_result(result_func_()); }, priority), result_func_(func), has_result_(false) {}
+    ~JobFuture()
+    {
+        Join();
+        clear_result();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Blocks until the job has finished and returns its result. If the
+    /// job threw, the exception is rethrown instead
+    ///
+    /// \return Value returned by the job's function
+    ////////////////////////////////////////////////////////////////////////////////
+    T& get()
+    {
+        Wait();
+        return *reinterpret_cast<T*>(&result_);
+    }
+
+private:
+    void set_result(T&& result)
+    {
+        clear_result();
+        new (&result_) T(std::move(result));
+        has_result_ = true;
+    }
+    void clear_result()
+    {
+        if (has_result_)
+        {
+            reinterpret_cast<T*>(&result_)->~T();
+            has_result_ = false;
+        }
+    }
+
+    Function result_func_;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type result_;
+    bool has_result_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Specialization for jobs that don't return a value, so they can be
+/// used alongside other futures. get() only waits and rethrows
+////////////////////////////////////////////////////////////////////////////////
+template <>
+class JobFuture<void> : public Job
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Function prototype for a JobFuture to run
+    ////////////////////////////////////////////////////////////////////////////////
+    using Function = InlineFunction<void(), kFunctionCapacity>;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Creates a new JobFuture that will execute the given function
+    /// asynchronously after it has been queued
+    ///
+    /// \param func Function to be executed
+    /// \param priority Priority the job is queued with
+    ////////////////////////////////////////////////////////////////////////////////
+    JobFuture(Function func, Priority priority = NORMAL) : Job(func, priority) {}
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Blocks until the job has finished. If the job threw, the exception
+    /// is rethrown
+    ////////////////////////////////////////////////////////////////////////////////
+    void get()
+    {
+        Wait();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Runs any number of fire and forget functions and waits on them as a
+/// whole. Job records are taken from a free list owned by the calling thread
+/// and handed back on Wait(), so after the first use no memory is allocated
+////////////////////////////////////////////////////////////////////////////////
+class JobGroup
+{
+public:
+    JobGroup() : jobs_(nullptr) {}
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Waits on any remaining jobs, discarding their exceptions
+    ////////////////////////////////////////////////////////////////////////////////
+    ~JobGroup();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Queues a function to be run by the worker threads
+    ///
+    /// \param func Function to be executed
+    /// \param priority Priority the function is queued with
+    ////////////////////////////////////////////////////////////////////////////////
+    void Enqueue(Job::Function func, Job::Priority priority = Job::NORMAL);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Blocks until every queued function has completed, then recycles
+    /// their job records. If any of them threw, the first exception is rethrown
+    ////////////////////////////////////////////////////////////////////////////////
+    void Wait();
+
+private:
+    internal::PooledJob* jobs_;
 };
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Makes a continuation wait on every job in a list. Shorthand for
+/// calling `continuation->AddDependency()` with each job, with the same
+/// restrictions. A job that throws still counts as finished, and its
+/// exception can be retrieved through its own Wait() or get() call
+///
+/// \param jobs Jobs that must all finish before the continuation starts
+/// \param continuation Job to start after all the others
+////////////////////////////////////////////////////////////////////////////////
+void WhenAll(const std::vector<Job*>& jobs, Job* continuation);
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Starts a continuation as soon as any one job in a list finishes,
+/// without waiting for the others. Can only be used once, and must outlive
+/// the given jobs' invocations
+////////////////////////////////////////////////////////////////////////////////
+class WhenAny
+{
+public:
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Links the continuation to the given jobs. Must be created before
+    /// any of the jobs are enqueued
+    ///
+    /// \param jobs Jobs to race against each other
+    /// \param continuation Job to start after the first one finishes
+    ////////////////////////////////////////////////////////////////////////////////
+    WhenAny(const std::vector<Job*>& jobs, Job* continuation);
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Waits for every job in the list to finish, not just the first
+    ////////////////////////////////////////////////////////////////////////////////
+    ~WhenAny();
+
+    ////////////////////////////////////////////////////////////////////////////////
+    /// \brief Retrieves which job finished first. Only valid once the
+    /// continuation has started
+    ///
+    /// \return Index into the job list the WhenAny was created with
+    ////////////////////////////////////////////////////////////////////////////////
+    std::size_t first() const;
+
+private:
+    std::vector<std::unique_ptr<Job>> triggers_;
+    std::atomic<bool> triggered_;
+    std::size_t first_;
+};
+
+namespace internal { void ParallelForRange(std::size_t, std::size_t, std::size_t, const InlineFunction<void(std::size_t, std::size_t), Job::kFunctionCapacity>&); }
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Calls a function for every index in a range, split into chunks that
+/// are spread across the worker threads. The calling thread works on chunks
+/// as well and blocks until the whole range has been processed. If any call
+/// throws, the first exception is rethrown on the calling thread once all
+/// running chunks have finished
+///
+/// \param begin First index of the range
+/// \param end One past the last index of the range
+/// \param grain Number of indices handed out to a thread at a time. Should be
+/// large enough that each chunk outweighs the cost of dispatching it
+/// \param func Function taking a `std::size_t` index, called once per index
+////////////////////////////////////////////////////////////////////////////////
+template <typename Func>
+void ParallelFor(std::size_t begin, std::size_t end, std::size_t grain, Func func)
+{
+    internal::ParallelForRange(begin, end, grain, [&func](std::size_t chunk_begin, std::size_t chunk_end)
+    {
+        for (auto i = chunk_begin; i < chunk_end; i++)
+        {
+            func(i);
+        }
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Maps every index in a range to a value and combines them into a
+/// single result using the worker threads. Each chunk is reduced on its own
+/// and the chunk results are then combined in index order, so the result is
+/// the same no matter how many threads took part
+///
+/// \param begin First index of the range
+/// \param end One past the last index of the range
+/// \param grain Number of indices reduced per chunk
+/// \param identity Starting value of every chunk, such as 0 for a sum
+/// \param map Function taking a `std::size_t` index and returning a `T`
+/// \param reduce Function combining two `T` values into one
+/// \return Reduced value of the whole range, or identity if it is empty
+////////////////////////////////////////////////////////////////////////////////
+template <typename T, typename MapFunc, typename ReduceFunc>
+T ParallelReduce(std::size_t begin, std::size_t end, std::size_t grain, T identity, MapFunc map, ReduceFunc reduce)
+{
+    if (end <= begin)
+    {
+        return identity;
+    }
+    grain = grain > 0 ? grain : 1;
+    std::vector<T> chunk_results((end - begin + grain - 1) / grain, identity);
+    internal::ParallelForRange(begin, end, grain, [&](std::size_t chunk_begin, std::size_t chunk_end)
+    {
+        T result = identity;
+        for (auto i = chunk_begin; i < chunk_end; i++)
+        {
+            result = reduce(result, map(i));
+        }
+        chunk_results[(chunk_begin - begin) / grain] = result;
+    });
+    T result = identity;
+    for (const auto& chunk_result : chunk_results)
+    {
+        result = reduce(result, chunk_result);
+    }
+    return result;
+}
 } // namespace blons
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -92,6 +439,55 @@ private:
 /// job.Wait();
 /// // And we're done!
 /// blons::log::Debug("Job complete!");
+///
+/// // Jobs can be chained into a graph and submitted all at once
+/// blons::Job load([]() { blons::log::Debug("Loading..."); });
+/// blons::Job parse([]() { blons::log::Debug("Parsing..."); });
+/// blons::Job build([]() { blons::log::Debug("Building..."); });
+/// // Parse starts after load, and build starts after both
+/// load.Then(&parse);
+/// build.AddDependency(&load);
+/// build.AddDependency(&parse);
+/// // Order of submission doesn't matter, jobs are held back until their dependencies finish
+/// build.Enqueue();
+/// parse.Enqueue();
+/// load.Enqueue();
+/// build.Wait();
+///
+/// // Long running work can be kept out of the way of everything else
+/// blons::Job rebake([]() { blons::log::Debug("This could take a while..."); }, blons::Job::BACKGROUND);
+/// rebake.Enqueue();
+///
+/// // Jobs can also return values, including from a failed job's exception
+/// blons::JobFuture<int> answer([]() { return 42; });
+/// blons::JobFuture<int> failure([]() -> int { throw "Something went wrong"; });
+/// answer.Enqueue();
+/// failure.Enqueue();
+/// blons::log::Debug("The answer is %i\n", answer.get());
+/// try
+/// {
+///     failure.get();
+/// }
+/// catch (const char* error)
+/// {
+///     blons::log::Debug("Job failed: %s\n", error);
+/// }
+///
+/// // Lots of small jobs can be queued together without allocating memory
+/// std::vector<int> results(1000);
+/// blons::JobGroup group;
+/// for (int i = 0; i < 1000; i++)
+/// {
+///     group.Enqueue([&results, i]() { results[i] = i * i; });
+/// }
+/// group.Wait();
+///
+/// // Data parallel loops can be split up across all worker threads
+/// std::vector<float> values(100000);
+/// blons::ParallelFor(0, values.size(), 1024, [&](std::size_t i) { values[i] = sqrt(static_cast<float>(i)); });
+/// float sum = blons::ParallelReduce(0, values.size(), 1024, 0.0f,
+///                                   [&](std::size_t i) { return values[i]; },
+///                                   [](float a, float b) { return a + b; });
 /// \endcode
 ////////////////////////////////////////////////////////////////////////////////
 
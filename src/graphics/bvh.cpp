@@ -0,0 +1,855 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <blons/graphics/bvh.h>
+
+// Includes
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define BLONS_BVH_SSE
+#endif
+// Public Includes
+#include <blons/system/job.h>
+
+namespace blons
+{
+namespace
+{
+// Number of buckets primitives are sorted into along each axis when looking for the best split
+const int kSAHBins = 16;
+// Cost of visiting a node relative to intersecting a triangle
+const float kTraversalCost = 1.0f;
+// Nodes larger than this are always split, even when the SAH says a leaf would be cheaper
+const std::size_t kMaxLeafTriangles = 8;
+// Past this depth nodes are split in half by count, which keeps the tree shallow enough for the traversal stack
+const int kMaxBalancedDepth = 64;
+const int kTraversalStackSize = 128;
+// Ranges with at least this many primitives are binned by all worker threads
+const std::size_t kParallelBinThreshold = 1 << 16;
+const std::size_t kParallelBinGrain = 1 << 14;
+// Once a range has fewer primitives than this, its whole subtree is built on a single worker thread
+const std::size_t kParallelSubtreeThreshold = 1 << 14;
+
+struct Bounds
+{
+    Vector3 min;
+    Vector3 max;
+
+    Bounds() : min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max()) {}
+
+    void Grow(const Vector3& p)
+    {
+        min.x = std::min(min.x, p.x);
+        min.y = std::min(min.y, p.y);
+        min.z = std::min(min.z, p.z);
+        max.x = std::max(max.x, p.x);
+        max.y = std::max(max.y, p.y);
+        max.z = std::max(max.z, p.z);
+    }
+    void Grow(const Bounds& b)
+    {
+        min.x = std::min(min.x, b.min.x);
+        min.y = std::min(min.y, b.min.y);
+        min.z = std::min(min.z, b.min.z);
+        max.x = std::max(max.x, b.max.x);
+        max.y = std::max(max.y, b.max.y);
+        max.z = std::max(max.z, b.max.z);
+    }
+    float SurfaceArea() const
+    {
+        if (min.x > max.x)
+        {
+            return 0.0f;
+        }
+        float dx = max.x - min.x;
+        float dy = max.y - min.y;
+        float dz = max.z - min.z;
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+    }
+};
+
+struct BuildPrimitive
+{
+    Bounds bounds;
+    Vector3 centroid;
+    uint32_t triangle;
+};
+
+struct SAHBin
+{
+    Bounds bounds;
+    std::size_t count = 0;
+};
+
+struct SAHBins
+{
+    SAHBin bins[3][kSAHBins];
+};
+
+// Range of primitives whose subtree is built on its own thread, then spliced in at the given node
+struct BuildTask
+{
+    std::size_t node;
+    std::size_t begin;
+    std::size_t end;
+    int depth;
+};
+
+float Axis(const Vector3& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+Vector3 TransformPoint(const Vector3& p, const Matrix& mat)
+{
+    return Vector3(p.x * mat.m[0][0] + p.y * mat.m[1][0] + p.z * mat.m[2][0] + mat.m[3][0],
+                   p.x * mat.m[0][1] + p.y * mat.m[1][1] + p.z * mat.m[2][1] + mat.m[3][1],
+                   p.x * mat.m[0][2] + p.y * mat.m[1][2] + p.z * mat.m[2][2] + mat.m[3][2]);
+}
+
+// Plain float math, since the Vector3 helpers go through DirectXMath and are far too slow for inner loops
+Vector3 Sub(const Vector3& a, const Vector3& b)
+{
+    return Vector3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+Vector3 Cross(const Vector3& a, const Vector3& b)
+{
+    return Vector3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+float Dot(const Vector3& a, const Vector3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Ray with its reciprocal direction precomputed for slab tests
+struct TraversalRay
+{
+#ifdef BLONS_BVH_SSE
+    __m128 origin;
+    __m128 inverse_direction;
+#else
+    float origin[3];
+    float inverse_direction[3];
+#endif
+
+    TraversalRay(const Vector3& o, const Vector3& d)
+    {
+        float inv[3] = { 1.0f / d.x, 1.0f / d.y, 1.0f / d.z };
+#ifdef BLONS_BVH_SSE
+        origin = _mm_setr_ps(o.x, o.y, o.z, 0.0f);
+        inverse_direction = _mm_setr_ps(inv[0], inv[1], inv[2], 0.0f);
+#else
+        origin[0] = o.x; origin[1] = o.y; origin[2] = o.z;
+        std::copy(inv, inv + 3, inverse_direction);
+#endif
+    }
+};
+
+// Slab test of a ray against a node's bounds, where each bounds array is followed by 4 bytes of padding.
+// Returns the distance the ray enters the box at through entry
+bool IntersectBox(const float* bounds_min, const float* bounds_max, const TraversalRay& ray, float max_distance, float* entry)
+{
+#ifdef BLONS_BVH_SSE
+    // Lane 3 holds the node's index fields, which are ignored by only reducing lanes 0-2
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds_min), ray.origin), ray.inverse_direction);
+    __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds_max), ray.origin), ray.inverse_direction);
+    __m128 near4 = _mm_min_ps(t1, t2);
+    __m128 far4 = _mm_max_ps(t1, t2);
+    __m128 t_near = _mm_max_ss(_mm_max_ss(near4, _mm_shuffle_ps(near4, near4, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(near4, near4));
+    __m128 t_far = _mm_min_ss(_mm_min_ss(far4, _mm_shuffle_ps(far4, far4, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(far4, far4));
+    t_near = _mm_max_ss(t_near, _mm_setzero_ps());
+    t_far = _mm_min_ss(t_far, _mm_set_ss(max_distance));
+    *entry = _mm_cvtss_f32(t_near);
+    return _mm_comile_ss(t_near, t_far) != 0;
+#else
+    float t_near = 0.0f;
+    float t_far = max_distance;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float t1 = (bounds_min[axis] - ray.origin[axis]) * ray.inverse_direction[axis];
+        float t2 = (bounds_max[axis] - ray.origin[axis]) * ray.inverse_direction[axis];
+        t_near = std::max(t_near, std::min(t1, t2));
+        t_far = std::min(t_far, std::max(t1, t2));
+    }
+    *entry = t_near;
+    return t_near <= t_far;
+#endif
+}
+
+// Squared distance from a point to a node's bounds, 0 when inside
+float BoxDistanceSquared(const float* bounds_min, const float* bounds_max, const Vector3& p)
+{
+    float dx = std::max(std::max(bounds_min[0] - p.x, p.x - bounds_max[0]), 0.0f);
+    float dy = std::max(std::max(bounds_min[1] - p.y, p.y - bounds_max[1]), 0.0f);
+    float dz = std::max(std::max(bounds_min[2] - p.z, p.z - bounds_max[2]), 0.0f);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// Moller-Trumbore ray/triangle intersection, hitting both sides
+bool IntersectTriangle(const Vector3& v0, const Vector3& edge1, const Vector3& edge2, const Vector3& origin, const Vector3& direction,
+                       float max_distance, float* distance, float* u, float* v)
+{
+    Vector3 p = Cross(direction, edge2);
+    float det = Dot(edge1, p);
+    if (std::abs(det) < 1e-12f)
+    {
+        return false;
+    }
+    float inv_det = 1.0f / det;
+    Vector3 s = Sub(origin, v0);
+    float hit_u = Dot(s, p) * inv_det;
+    if (hit_u < 0.0f || hit_u > 1.0f)
+    {
+        return false;
+    }
+    Vector3 q = Cross(s, edge1);
+    float hit_v = Dot(direction, q) * inv_det;
+    if (hit_v < 0.0f || hit_u + hit_v > 1.0f)
+    {
+        return false;
+    }
+    float t = Dot(edge2, q) * inv_det;
+    if (t < 0.0f || t > max_distance)
+    {
+        return false;
+    }
+    *distance = t;
+    *u = hit_u;
+    *v = hit_v;
+    return true;
+}
+
+// Closest point on a triangle to p, from Real-Time Collision Detection 5.1.5. Outputs the weights of v1 and v2
+Vector3 ClosestPointOnTriangle(const Vector3& p, const Vector3& a, const Vector3& ab, const Vector3& ac, float* u, float* v)
+{
+    Vector3 ap = Sub(p, a);
+    float d1 = Dot(ab, ap);
+    float d2 = Dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+    {
+        *u = 0.0f; *v = 0.0f;
+        return a;
+    }
+    Vector3 bp = Sub(ap, ab);
+    float d3 = Dot(ab, bp);
+    float d4 = Dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3)
+    {
+        *u = 1.0f; *v = 0.0f;
+        return a + ab;
+    }
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+    {
+        float w = d1 / (d1 - d3);
+        *u = w; *v = 0.0f;
+        return a + ab * w;
+    }
+    Vector3 cp = Sub(ap, ac);
+    float d5 = Dot(ab, cp);
+    float d6 = Dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6)
+    {
+        *u = 0.0f; *v = 1.0f;
+        return a + ac;
+    }
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+    {
+        float w = d2 / (d2 - d6);
+        *u = 0.0f; *v = w;
+        return a + ac * w;
+    }
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+    {
+        float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        *u = 1.0f - w; *v = w;
+        return a + ab + (ac - ab) * w;
+    }
+    float denom = 1.0f / (va + vb + vc);
+    *u = vb * denom;
+    *v = vc * denom;
+    return a + ab * *u + ac * *v;
+}
+} // namespace
+
+// Top-down binned SAH builder. Large ranges are split on the calling thread with binning spread across
+// the workers, and the small subtrees left over are each built by a single worker and spliced in after
+class BVH::Builder
+{
+public:
+    Builder(std::vector<BuildPrimitive>* primitives) : primitives_(primitives) {}
+
+    void Build(std::vector<Node>* nodes)
+    {
+        std::vector<BuildTask> tasks;
+        nodes->resize(1);
+        Split({ 0, 0, primitives_->size(), 0 }, nodes, &tasks);
+
+        // Build each subtree into its own node list
+        std::vector<std::vector<Node>> subtrees(tasks.size());
+        ParallelFor(0, tasks.size(), 1, [&](std::size_t i)
+        {
+            subtrees[i].resize(1);
+            Split({ 0, tasks[i].begin, tasks[i].end, tasks[i].depth }, &subtrees[i], nullptr);
+        });
+
+        // Splice subtrees in task order so the layout doesn't depend on which thread finished first
+        for (std::size_t i = 0; i < tasks.size(); i++)
+        {
+            const auto& subtree = subtrees[i];
+            // Local index 0 becomes the task's node, everything else is appended
+            uint32_t base = static_cast<uint32_t>(nodes->size()) - 1;
+            auto relocate = [base](Node node)
+            {
+                if (node.count == 0)
+                {
+                    node.offset += base;
+                }
+                return node;
+            };
+            (*nodes)[tasks[i].node] = relocate(subtree[0]);
+            for (std::size_t j = 1; j < subtree.size(); j++)
+            {
+                nodes->push_back(relocate(subtree[j]));
+            }
+        }
+    }
+
+private:
+    // Builds the subtree of primitives [begin, end) with its root at task.node. When tasks is non-null,
+    // small subtrees are left for later and queued up instead
+    void Split(BuildTask task, std::vector<Node>* nodes, std::vector<BuildTask>* tasks)
+    {
+        auto& primitives = *primitives_;
+        std::size_t count = task.end - task.begin;
+        if (tasks != nullptr && count < kParallelSubtreeThreshold)
+        {
+            tasks->push_back(task);
+            return;
+        }
+
+        Bounds bounds, centroid_bounds;
+        ComputeBounds(task.begin, task.end, &bounds, &centroid_bounds);
+        auto make_leaf = [&]()
+        {
+            Node& node = (*nodes)[task.node];
+            SetBounds(bounds, &node);
+            node.offset = static_cast<uint32_t>(task.begin);
+            node.count = static_cast<uint32_t>(count);
+        };
+        if (count <= 1)
+        {
+            make_leaf();
+            return;
+        }
+
+        // Find the cheapest split across every axis
+        std::size_t mid = task.begin;
+        float leaf_cost = static_cast<float>(count) * bounds.SurfaceArea();
+        float best_cost = std::numeric_limits<float>::max();
+        int best_axis = -1;
+        int best_bin = 0;
+        if (task.depth < kMaxBalancedDepth)
+        {
+            SAHBins bins = BinPrimitives(task.begin, task.end, centroid_bounds);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                // Sweep from the right to find the cost of every right hand side, then from the left to finish
+                float right_area[kSAHBins];
+                std::size_t right_count[kSAHBins];
+                Bounds right_bounds;
+                std::size_t right_total = 0;
+                for (int i = kSAHBins - 1; i > 0; i--)
+                {
+                    right_bounds.Grow(bins.bins[axis][i].bounds);
+                    right_total += bins.bins[axis][i].count;
+                    right_area[i] = right_bounds.SurfaceArea();
+                    right_count[i] = right_total;
+                }
+                Bounds left_bounds;
+                std::size_t left_total = 0;
+                for (int i = 1; i < kSAHBins; i++)
+                {
+                    left_bounds.Grow(bins.bins[axis][i - 1].bounds);
+                    left_total += bins.bins[axis][i - 1].count;
+                    if (left_total == 0 || right_count[i] == 0)
+                    {
+                        continue;
+                    }
+                    float cost = left_bounds.SurfaceArea() * static_cast<float>(left_total) + right_area[i] * static_cast<float>(right_count[i]);
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = i;
+                    }
+                }
+            }
+            best_cost += kTraversalCost * bounds.SurfaceArea();
+        }
+
+        if (best_axis >= 0 && (best_cost < leaf_cost || count > kMaxLeafTriangles))
+        {
+            float axis_min = Axis(centroid_bounds.min, best_axis);
+            float scale = kSAHBins / (Axis(centroid_bounds.max, best_axis) - axis_min);
+            auto split = std::partition(primitives.begin() + task.begin, primitives.begin() + task.end, [&](const BuildPrimitive& p)
+            {
+                return BinIndex(Axis(p.centroid, best_axis), axis_min, scale) < best_bin;
+            });
+            mid = split - primitives.begin();
+        }
+        else if (best_axis >= 0 || count <= kMaxLeafTriangles)
+        {
+            make_leaf();
+            return;
+        }
+        // Primitives that can't be told apart by their centroids, or that are too deep, get split down the middle
+        if (mid == task.begin || mid == task.end)
+        {
+            mid = task.begin + count / 2;
+        }
+
+        uint32_t first_child = static_cast<uint32_t>(nodes->size());
+        nodes->resize(nodes->size() + 2);
+        Node& node = (*nodes)[task.node];
+        SetBounds(bounds, &node);
+        node.offset = first_child;
+        node.count = 0;
+        Split({ first_child, task.begin, mid, task.depth + 1 }, nodes, tasks);
+        Split({ first_child + 1, mid, task.end, task.depth + 1 }, nodes, tasks);
+    }
+
+    void ComputeBounds(std::size_t begin, std::size_t end, Bounds* bounds, Bounds* centroid_bounds) const
+    {
+        const auto& primitives = *primitives_;
+        auto bound_range = [&](std::size_t range_begin, std::size_t range_end, Bounds* b, Bounds* c)
+        {
+            for (auto i = range_begin; i < range_end; i++)
+            {
+                b->Grow(primitives[i].bounds);
+                c->Grow(primitives[i].centroid);
+            }
+        };
+        if (end - begin < kParallelBinThreshold)
+        {
+            bound_range(begin, end, bounds, centroid_bounds);
+            return;
+        }
+        std::size_t chunk_count = (end - begin + kParallelBinGrain - 1) / kParallelBinGrain;
+        std::vector<Bounds> chunk_bounds(chunk_count), chunk_centroids(chunk_count);
+        ParallelFor(0, chunk_count, 1, [&](std::size_t chunk)
+        {
+            std::size_t chunk_begin = begin + chunk * kParallelBinGrain;
+            bound_range(chunk_begin, std::min(chunk_begin + kParallelBinGrain, end), &chunk_bounds[chunk], &chunk_centroids[chunk]);
+        });
+        for (std::size_t chunk = 0; chunk < chunk_count; chunk++)
+        {
+            bounds->Grow(chunk_bounds[chunk]);
+            centroid_bounds->Grow(chunk_centroids[chunk]);
+        }
+    }
+
+    SAHBins BinPrimitives(std::size_t begin, std::size_t end, const Bounds& centroid_bounds) const
+    {
+        const auto& primitives = *primitives_;
+        float axis_min[3], scale[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            axis_min[axis] = Axis(centroid_bounds.min, axis);
+            float extent = Axis(centroid_bounds.max, axis) - axis_min[axis];
+            // Flat axes put everything in the first bin, which never produces a split
+            scale[axis] = extent > 0.0f ? kSAHBins / extent : 0.0f;
+        }
+        auto bin_range = [&](std::size_t range_begin, std::size_t range_end, SAHBins* bins)
+        {
+            for (auto i = range_begin; i < range_end; i++)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    auto& bin = bins->bins[axis][BinIndex(Axis(primitives[i].centroid, axis), axis_min[axis], scale[axis])];
+                    bin.bounds.Grow(primitives[i].bounds);
+                    bin.count++;
+                }
+            }
+        };
+        SAHBins bins;
+        if (end - begin < kParallelBinThreshold)
+        {
+            bin_range(begin, end, &bins);
+            return bins;
+        }
+        std::size_t chunk_count = (end - begin + kParallelBinGrain - 1) / kParallelBinGrain;
+        std::vector<SAHBins> chunk_bins(chunk_count);
+        ParallelFor(0, chunk_count, 1, [&](std::size_t chunk)
+        {
+            std::size_t chunk_begin = begin + chunk * kParallelBinGrain;
+            bin_range(chunk_begin, std::min(chunk_begin + kParallelBinGrain, end), &chunk_bins[chunk]);
+        });
+        for (const auto& chunk : chunk_bins)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                for (int i = 0; i < kSAHBins; i++)
+                {
+                    bins.bins[axis][i].bounds.Grow(chunk.bins[axis][i].bounds);
+                    bins.bins[axis][i].count += chunk.bins[axis][i].count;
+                }
+            }
+        }
+        return bins;
+    }
+
+    static int BinIndex(float value, float axis_min, float scale)
+    {
+        return std::min(static_cast<int>((value - axis_min) * scale), kSAHBins - 1);
+    }
+
+    static void SetBounds(const Bounds& bounds, Node* node)
+    {
+        node->bounds_min[0] = bounds.min.x;
+        node->bounds_min[1] = bounds.min.y;
+        node->bounds_min[2] = bounds.min.z;
+        node->bounds_max[0] = bounds.max.x;
+        node->bounds_max[1] = bounds.max.y;
+        node->bounds_max[2] = bounds.max.z;
+    }
+
+    std::vector<BuildPrimitive>* primitives_;
+};
+
+BVH::BVH(const std::vector<Model*>& models)
+{
+    std::vector<Instance> instances;
+    for (const auto& model : models)
+    {
+        instances.push_back({ &model->mesh(), model->world_matrix() });
+    }
+    Build(instances);
+}
+
+BVH::BVH(const std::vector<Instance>& instances)
+{
+    Build(instances);
+}
+
+bool BVH::Raycast(const Vector3& origin, const Vector3& direction, units::world max_distance, Hit* hit) const
+{
+    if (triangles_.empty())
+    {
+        return false;
+    }
+    struct StackEntry
+    {
+        uint32_t node;
+        float entry;
+    };
+    StackEntry stack[kTraversalStackSize];
+    int stack_size = 0;
+    TraversalRay ray(origin, direction);
+    float closest = max_distance;
+    const Triangle* closest_triangle = nullptr;
+    float closest_u = 0.0f, closest_v = 0.0f;
+
+    float root_entry;
+    if (IntersectBox(nodes_[0].bounds_min, nodes_[0].bounds_max, ray, closest, &root_entry))
+    {
+        stack[stack_size++] = { 0, root_entry };
+    }
+    while (stack_size > 0)
+    {
+        auto current = stack[--stack_size];
+        // Skip anything that's further away than a hit found since it was pushed
+        if (current.entry > closest)
+        {
+            continue;
+        }
+        const Node* node = &nodes_[current.node];
+        // Walk down towards the nearest child, leaving the other one for later
+        while (node->count == 0)
+        {
+            const Node& left = nodes_[node->offset];
+            const Node& right = nodes_[node->offset + 1];
+            float left_entry, right_entry;
+            bool hit_left = IntersectBox(left.bounds_min, left.bounds_max, ray, closest, &left_entry);
+            bool hit_right = IntersectBox(right.bounds_min, right.bounds_max, ray, closest, &right_entry);
+            if (hit_left && hit_right)
+            {
+                if (left_entry <= right_entry)
+                {
+                    stack[stack_size++] = { node->offset + 1, right_entry };
+                    node = &left;
+                }
+                else
+                {
+                    stack[stack_size++] = { node->offset, left_entry };
+                    node = &right;
+                }
+            }
+            else if (hit_left || hit_right)
+            {
+                node = hit_left ? &left : &right;
+            }
+            else
+            {
+                node = nullptr;
+                break;
+            }
+        }
+        if (node == nullptr)
+        {
+            continue;
+        }
+        for (uint32_t i = node->offset; i < node->offset + node->count; i++)
+        {
+            const auto& triangle = triangles_[i];
+            float distance, u, v;
+            if (IntersectTriangle(triangle.v0, triangle.edge1, triangle.edge2, origin, direction, closest, &distance, &u, &v))
+            {
+                closest = distance;
+                closest_triangle = &triangle;
+                closest_u = u;
+                closest_v = v;
+            }
+        }
+    }
+
+    if (closest_triangle == nullptr)
+    {
+        return false;
+    }
+    if (hit != nullptr)
+    {
+        *hit = MakeHit(*closest_triangle, closest, origin + direction * closest, closest_u, closest_v);
+    }
+    return true;
+}
+
+bool BVH::SegmentIntersects(const Vector3& start, const Vector3& end) const
+{
+    Vector3 delta = Sub(end, start);
+    float length = std::sqrt(Dot(delta, delta));
+    if (triangles_.empty() || length <= 0.0f)
+    {
+        return false;
+    }
+    Vector3 direction = delta / length;
+    TraversalRay ray(start, direction);
+    uint32_t stack[kTraversalStackSize];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const Node& node = nodes_[stack[--stack_size]];
+        float entry;
+        if (!IntersectBox(node.bounds_min, node.bounds_max, ray, length, &entry))
+        {
+            continue;
+        }
+        if (node.count == 0)
+        {
+            stack[stack_size++] = node.offset + 1;
+            stack[stack_size++] = node.offset;
+            continue;
+        }
+        // Any hit will do, so there's no need to find the closest one
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+        {
+            const auto& triangle = triangles_[i];
+            float distance, u, v;
+            if (IntersectTriangle(triangle.v0, triangle.edge1, triangle.edge2, start, direction, length, &distance, &u, &v))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool BVH::NearestPoint(const Vector3& point, units::world max_distance, Hit* hit) const
+{
+    if (triangles_.empty())
+    {
+        return false;
+    }
+    struct StackEntry
+    {
+        uint32_t node;
+        float distance_squared;
+    };
+    StackEntry stack[kTraversalStackSize];
+    int stack_size = 0;
+    float closest_squared = max_distance * max_distance;
+    const Triangle* closest_triangle = nullptr;
+    Vector3 closest_pos;
+    float closest_u = 0.0f, closest_v = 0.0f;
+
+    stack[stack_size++] = { 0, BoxDistanceSquared(nodes_[0].bounds_min, nodes_[0].bounds_max, point) };
+    while (stack_size > 0)
+    {
+        auto current = stack[--stack_size];
+        if (current.distance_squared > closest_squared)
+        {
+            continue;
+        }
+        const Node& node = nodes_[current.node];
+        if (node.count == 0)
+        {
+            // Visit the nearer child first so the search radius shrinks as quickly as possible
+            const Node& left = nodes_[node.offset];
+            const Node& right = nodes_[node.offset + 1];
+            float left_distance = BoxDistanceSquared(left.bounds_min, left.bounds_max, point);
+            float right_distance = BoxDistanceSquared(right.bounds_min, right.bounds_max, point);
+            if (left_distance <= right_distance)
+            {
+                stack[stack_size++] = { node.offset + 1, right_distance };
+                stack[stack_size++] = { node.offset, left_distance };
+            }
+            else
+            {
+                stack[stack_size++] = { node.offset, left_distance };
+                stack[stack_size++] = { node.offset + 1, right_distance };
+            }
+            continue;
+        }
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+        {
+            const auto& triangle = triangles_[i];
+            float u, v;
+            Vector3 pos = ClosestPointOnTriangle(point, triangle.v0, triangle.edge1, triangle.edge2, &u, &v);
+            Vector3 delta = Sub(pos, point);
+            float distance_squared = Dot(delta, delta);
+            if (distance_squared <= closest_squared)
+            {
+                closest_squared = distance_squared;
+                closest_triangle = &triangle;
+                closest_pos = pos;
+                closest_u = u;
+                closest_v = v;
+            }
+        }
+    }
+
+    if (closest_triangle == nullptr)
+    {
+        return false;
+    }
+    if (hit != nullptr)
+    {
+        *hit = MakeHit(*closest_triangle, std::sqrt(closest_squared), closest_pos, closest_u, closest_v);
+    }
+    return true;
+}
+
+std::size_t BVH::triangle_count() const
+{
+    return triangles_.size();
+}
+
+std::size_t BVH::node_count() const
+{
+    return nodes_.size();
+}
+
+void BVH::Build(const std::vector<Instance>& instances)
+{
+    static_assert(sizeof(Node) == 32, "BVH nodes must stay 32 bytes");
+
+    // Only triangle meshes are traced, everything else is left out
+    std::vector<std::size_t> instance_starts(instances.size() + 1, 0);
+    for (std::size_t i = 0; i < instances.size(); i++)
+    {
+        const auto& mesh = *instances[i].mesh;
+        std::size_t triangles = mesh.draw_mode == TRIANGLES ? mesh.indices.size() / 3 : 0;
+        instance_starts[i + 1] = instance_starts[i] + triangles;
+    }
+    std::size_t triangle_count = instance_starts.back();
+    if (triangle_count > std::numeric_limits<uint32_t>::max() / 2)
+    {
+        throw "Too many triangles for BVH";
+    }
+
+    // Transform every triangle into world space
+    std::vector<Triangle> triangles(triangle_count);
+    std::vector<BuildPrimitive> primitives(triangle_count);
+    std::vector<Vector3> world_vertices;
+    for (std::size_t i = 0; i < instances.size(); i++)
+    {
+        const auto& mesh = *instances[i].mesh;
+        const auto& world_matrix = instances[i].world_matrix;
+        if (instance_starts[i + 1] == instance_starts[i])
+        {
+            continue;
+        }
+        world_vertices.resize(mesh.vertices.size());
+        ParallelFor(0, mesh.vertices.size(), 4096, [&](std::size_t v)
+        {
+            world_vertices[v] = TransformPoint(mesh.vertices[v].pos, world_matrix);
+        });
+        ParallelFor(0, instance_starts[i + 1] - instance_starts[i], 4096, [&](std::size_t t)
+        {
+            const Vector3& v0 = world_vertices[mesh.indices[t * 3 + 0]];
+            const Vector3& v1 = world_vertices[mesh.indices[t * 3 + 1]];
+            const Vector3& v2 = world_vertices[mesh.indices[t * 3 + 2]];
+            std::size_t id = instance_starts[i] + t;
+            triangles[id] = { v0, Sub(v1, v0), Sub(v2, v0), static_cast<uint32_t>(i), static_cast<uint32_t>(t) };
+            auto& primitive = primitives[id];
+            primitive.bounds.Grow(v0);
+            primitive.bounds.Grow(v1);
+            primitive.bounds.Grow(v2);
+            primitive.centroid = Vector3((v0.x + v1.x + v2.x) / 3.0f, (v0.y + v1.y + v2.y) / 3.0f, (v0.z + v1.z + v2.z) / 3.0f);
+            primitive.triangle = static_cast<uint32_t>(id);
+        });
+    }
+
+    Builder builder(&primitives);
+    builder.Build(&nodes_);
+
+    // Store triangles in leaf order so each leaf reads one contiguous run
+    triangles_.resize(triangle_count);
+    ParallelFor(0, triangle_count, 4096, [&](std::size_t i)
+    {
+        triangles_[i] = triangles[primitives[i].triangle];
+    });
+}
+
+BVH::Hit BVH::MakeHit(const Triangle& triangle, units::world distance, const Vector3& pos, float u, float v) const
+{
+    Hit hit;
+    hit.distance = distance;
+    hit.pos = pos;
+    Vector3 normal = Cross(triangle.edge1, triangle.edge2);
+    float length = std::sqrt(Dot(normal, normal));
+    hit.normal = length > 0.0f ? normal / length : Vector3(0.0f);
+    hit.barycentric = Vector2(u, v);
+    hit.instance = triangle.instance;
+    hit.triangle = triangle.index;
+    return hit;
+}
+} // namespace blons
@@ -152,6 +152,18 @@ void Graphics::BakeRadianceTransfer()
     pipeline_->BakeRadianceTransfer(scene);
 }
 
+void Graphics::RebakeRadianceTransfer()
+{
+    pipeline::Scene scene;
+    scene.lights = { sun_.get() };
+    scene.models.assign(models_.begin(), models_.end());
+    scene.sky_box = sky_box_;
+    scene.sky_luminance = sky_luminance_;
+    scene.view = *camera_;
+
+    pipeline_->RebakeRadianceTransfer(scene);
+}
+
 std::unique_ptr<Model> Graphics::MakeModel(std::string filename)
 {
     auto model = new ManagedModel(filename);
@@ -226,12 +238,18 @@ bool Graphics::Render()
     auto oldest_frame_index = (perf_timers_index_ + 1) % kPerfTimerBuffer;
     const auto& root = perf_timers_[oldest_frame_index].root();
     // Buld up the UI's draw batches while we do all of the scene rendering
-    Job gui_batch_job([&,frame_time]()
+    Job metrics_job([&,frame_time]()
     {
         debug_overlay_->UpdateMetrics(root, frame_time);
+    }, Job::HIGH);
+    Job gui_batch_job([&]()
+    {
         gui_->BuildDrawCalls();
-    });
+    }, Job::HIGH);
+    // Overlay text has to be updated before it can be batched
+    metrics_job.Then(&gui_batch_job);
     gui_batch_job.Enqueue();
+    metrics_job.Enqueue();
 
     // Clear buffers
     context->BeginScene(Vector4(0, 0, 0, 1));
@@ -340,6 +358,11 @@ gui::Manager* Graphics::gui() const
     return gui_.get();
 }
 
+float Graphics::bake_progress() const
+{
+    return pipeline_->bake_progress();
+}
+
 void Graphics::set_output(pipeline::Deferred::Output output, pipeline::Deferred::Output alt_output)
 {
     pipeline_->set_output(output, alt_output);
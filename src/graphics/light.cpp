@@ -27,6 +27,7 @@
 #include <algorithm>
 // Public Includes
 #include <blons/graphics/camera.h>
+#include <blons/graphics/pipeline/scene.h>
 
 namespace blons
 {
@@ -51,7 +52,7 @@ Matrix Light::ViewFrustum(Matrix frustum, units::world depth) const
     // Z ranges from [0,1] because -1 would be behind the camera. This represents
     // the screen near/far distances and would be where to apply split points
     Vector3 ndc_box[8];
-    Vector3 min, max;
+    Vector3 centre;
     for (int x = 0; x < 2; x++)
     {
         for (int y = 0; y < 2; y++)
@@ -67,22 +68,33 @@ Matrix Light::ViewFrustum(Matrix frustum, units::world depth) const
                 ndc_box[i] *= inv_frustum;
                 // Align the box to the light's view space
                 ndc_box[i] *= light_view_matrix;
-                if (i == 0)
-                {
-                    min.x = max.x = ndc_box[i].x;
-                    min.y = max.y = ndc_box[i].y;
-                    min.z = max.z = ndc_box[i].z;
-                }
-                // Form a bounding box aligned to the light around the camera's frustum
-                min.x = std::min(ndc_box[i].x, min.x);
-                min.y = std::min(ndc_box[i].y, min.y);
-                min.z = std::min(ndc_box[i].z, min.z);
-                max.x = std::max(ndc_box[i].x, max.x);
-                max.y = std::max(ndc_box[i].y, max.y);
-                max.z = std::max(ndc_box[i].z, max.z);
+                centre += ndc_box[i];
             }
         }
     }
+    // Bound the frustum with a sphere instead of a box. The sphere is the same size
+    // no matter which way the camera faces, so turning never rescales the shadow map
+    centre /= 8.0f;
+    units::world radius = 0.0f;
+    for (const auto& corner : ndc_box)
+    {
+        radius = std::max(VectorLength(corner - centre), radius);
+    }
+    // Rounded up so that floating point error can't change the size either
+    radius = ceil(radius);
+    // The sides also get a bit of a buffer to help the accuracy of indirect lighting
+    units::world half_size = radius + 10.0f;
+    // Only move in whole texels, so that moving the camera slides the shadow map
+    // along instead of resampling everything on it (helps with swimming)
+    units::world texel_size = (half_size * 2.0f) / pipeline::kShadowMapResolution;
+    centre.x = floor(centre.x / texel_size) * texel_size;
+    centre.y = floor(centre.y / texel_size) * texel_size;
+    // Depth moves in big steps for the same reason, which is fine since there's a
+    // lot of slack behind the camera anyway
+    const units::world depth_step = depth * 0.25f;
+    centre.z = floor(centre.z / depth_step) * depth_step;
+    Vector3 min(centre.x - half_size, centre.y - half_size, centre.z - radius);
+    Vector3 max(centre.x + half_size, centre.y + half_size, centre.z + radius);
     // Modify the clip range to max out at the camera view distance and bottom out
     // at a negative kScreenFar away from the player, allowing distant objects
     // to cast shadows from off screen
@@ -91,18 +103,6 @@ Matrix Light::ViewFrustum(Matrix frustum, units::world depth) const
     // imprecision behind the player when facing a light
     max.z =  depth * 1.5f - max.z;
     min.z = -depth - min.z;
-    // The sides also get a bit of a buffer to help the accuracy of indirect lighting
-    min.x -= 10.0f;
-    max.x += 10.0f;
-    min.y -= 10.0f;
-    max.y += 10.0f;
-
-    // TODO: Get rid of this when we do variance shadow maps (helps with swimming... a bit)
-    const float step = 1024.0f; ///< shadow map resolution, hardcoded because this is temporary
-    min.x = ceil(min.x * step) / step;
-    max.x = (ceil((max.x - min.x) * step) / step) + min.x;
-    min.y = ceil(min.y * step) / step;
-    max.y = (ceil((max.y - min.y) * step) / step) + min.y;
 
     // TODO: TEMPORARY disabling shadow map frustum calculations
     min.x = -25; max.x = 18; min.y = -20; max.y = 27; min.z = -30; max.z = 100;
@@ -171,6 +171,16 @@ const TextureResource* Model::lightmap() const
     return light_texture_->texture();
 }
 
+const PixelData* Model::albedo_pixels() const
+{
+    return albedo_texture_->source_pixels();
+}
+
+const PixelData* Model::normal_pixels() const
+{
+    return normal_texture_->source_pixels();
+}
+
 Vector3 Model::pos() const
 {
     return pos_;
@@ -61,6 +61,7 @@ bool Deferred::Init()
     lighting_.reset(new stage::Lighting(perspective_));
     debug_output_.reset(new stage::debug::DebugOutput(perspective_));
     composite_.reset(new stage::Composite(perspective_));
+    relight_specular_ = true;
     log::Debug(" [%ims]\n", pipeline_setup.ms());
 
     // Shaders
@@ -126,6 +127,11 @@ bool Deferred::Render(const Scene& scene, Framebuffer* output_buffer)
     }
     performance::PopMarker();
 
+    // Progressive bakes are worked on a little every frame, while relighting uses the last finished bake
+    performance::PushMarker("Radiance transfer bake");
+    light_sector_->ContinueBake(scene);
+    performance::PopMarker();
+
     performance::PushMarker("Diffuse probe relight");
     if (!light_sector_->Relight(scene, *shadow_, light_vp_matrix))
     {
@@ -134,14 +140,21 @@ bool Deferred::Render(const Scene& scene, Framebuffer* output_buffer)
     }
     performance::PopMarker();
 
+    // The irradiance volume follows the camera, only filling in voxels that scroll in or sample relit probes
     performance::PushMarker("Irradiance volume relight");
-    if (!irradiance_volume_->Relight(*light_sector_))
+    if (!irradiance_volume_->Relight(*light_sector_, scene.view.pos()))
     {
         performance::PopMarker();
         return false;
     }
     performance::PopMarker();
 
+    // Specular probes are relit a few faces at a time, so they keep going until caught up
+    if (light_sector_->relit() || relight_specular_)
+    {
+        specular_local_->QueueRelight();
+        relight_specular_ = false;
+    }
     performance::PushMarker("Specular probe relight");
     if (!specular_local_->Relight(scene, *shadow_, *irradiance_volume_, light_vp_matrix))
     {
@@ -204,6 +217,20 @@ void Deferred::BakeRadianceTransfer(const Scene& scene)
     light_sector_->BakeRadianceTransfer(scene);
     specular_local_->BakeRadianceTransfer(scene);
     brdf_lookup_->BakeLookupTexture();
+    relight_specular_ = true;
+}
+
+void Deferred::RebakeRadianceTransfer(const Scene& scene)
+{
+    light_sector_->RebakeRadianceTransfer(scene);
+    // Specular probes have no incremental path yet, but the BRDF lookup doesn't depend on the scene
+    specular_local_->BakeRadianceTransfer(scene);
+    relight_specular_ = true;
+}
+
+float Deferred::bake_progress() const
+{
+    return light_sector_->bake_progress();
 }
 
 bool Deferred::RenderOutput()
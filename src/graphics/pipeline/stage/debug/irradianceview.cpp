@@ -69,7 +69,7 @@ bool IrradianceView::Render(Framebuffer* target, const TextureResource* depth, c
     // Mesh initialization is deferred because it's optional and adds significant startup time
     if (grid_mesh_ == nullptr || voxel_meshes_ == nullptr)
     {
-        InitMeshBuffers(irradiance);
+        InitMeshBuffers();
     }
 
     auto context = render::context();
@@ -107,6 +107,8 @@ bool IrradianceView::Render(Framebuffer* target, const TextureResource* depth, c
         !volume_shader_->SetInput("irradiance_volume_ny", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_NY), 3) ||
         !volume_shader_->SetInput("irradiance_volume_pz", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_PZ), 4) ||
         !volume_shader_->SetInput("irradiance_volume_nz", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_NZ), 5) ||
+        !volume_shader_->SetInput("irradiance_clipmap_origins", irradiance.clipmap_origins().data(), kIrradianceClipmapLevels) ||
+        !volume_shader_->SetInput("irradiance_voxel_size", irradiance.voxel_size()) ||
         !volume_shader_->SetInput("exposure", scene.view.exposure()))
     {
         target->BindDepthTexture(target->depth());
@@ -122,12 +124,14 @@ bool IrradianceView::Render(Framebuffer* target, const TextureResource* depth, c
     return true;
 }
 
-void IrradianceView::InitMeshBuffers(const IrradianceVolume& irradiance)
+void IrradianceView::InitMeshBuffers()
 {
-    // Grab the dimensions of the irradiance volume and construct a matching grid mesh
-    auto grid_data = render::context()->GetTextureData3D(irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_PX), 0);
+    // Construct a grid mesh matching the dimensions of the finest irradiance volume level
+    const int grid_width = kIrradianceVolumeWidth;
+    const int grid_height = kIrradianceVolumeHeight;
+    const int grid_depth = kIrradianceVolumeDepth;
     std::stringstream dimension_args;
-    dimension_args << (grid_data.width) << "," << (grid_data.height) << "," << (grid_data.depth);
+    dimension_args << (grid_width) << "," << (grid_height) << "," << (grid_depth);
     grid_mesh_.reset(new DrawBatcher(DrawMode::LINES));
     Mesh grid_mesh("blons:line-grid~" + dimension_args.str());
     grid_mesh_->Append(grid_mesh.mesh());
@@ -140,16 +144,16 @@ void IrradianceView::InitMeshBuffers(const IrradianceVolume& irradiance)
     MeshData cloud_mesh_data;
     cloud_mesh_data.draw_mode = DrawMode::TRIANGLES;
     // Pre-allocate for optimization (it helps! really!)
-    cloud_mesh_data.vertices.reserve(grid_data.width * grid_data.height * grid_data.depth * cube_mesh_data.vertices.size());
-    cloud_mesh_data.indices.reserve(grid_data.width * grid_data.height * grid_data.depth * cube_mesh_data.indices.size());
-    Vector3 grid_dimensions(static_cast<units::world>(grid_data.width),
-                            static_cast<units::world>(grid_data.height),
-                            static_cast<units::world>(grid_data.depth));
-    for (int x = 0; x < grid_data.width; x++)
+    cloud_mesh_data.vertices.reserve(grid_width * grid_height * grid_depth * cube_mesh_data.vertices.size());
+    cloud_mesh_data.indices.reserve(grid_width * grid_height * grid_depth * cube_mesh_data.indices.size());
+    Vector3 grid_dimensions(static_cast<units::world>(grid_width),
+                            static_cast<units::world>(grid_height),
+                            static_cast<units::world>(grid_depth));
+    for (int x = 0; x < grid_width; x++)
     {
-        for (int y = 0; y < grid_data.height; y++)
+        for (int y = 0; y < grid_height; y++)
         {
-            for (int z = 0; z < grid_data.depth; z++)
+            for (int z = 0; z < grid_depth; z++)
             {
                 for (auto& v : cube_mesh_data.vertices)
                 {
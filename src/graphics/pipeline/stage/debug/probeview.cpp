@@ -37,6 +37,7 @@ auto const cvar_debug_mode = console::RegisterVariable("dbg:probe-view", 0);
 } // namespace
 
 ProbeView::ProbeView()
+    : camera_cell_(LightSector::INVALID_ID)
 {
     // Shaders
     ShaderAttributeList probe_inputs = { { POS, "input_pos" },
@@ -77,7 +78,10 @@ bool ProbeView::Render(Framebuffer* target, const TextureResource* depth, const
     // Grab camera position from its view matrix. Hacky, lazy, sorry, but not that sorry
     auto inv_view_matrix = MatrixInverse(view_matrix);
     Vector3 camera_pos(inv_view_matrix.m[3][0], inv_view_matrix.m[3][1], inv_view_matrix.m[3][2]);
-    auto probe_weights = sector.FindProbeWeights(camera_pos);
+    LightSector::ProbeSearchResult camera_search;
+    sector.FindProbeWeights(&camera_pos, &camera_cell_, 1, &camera_search);
+    camera_cell_ = camera_search.cell_id;
+    const auto& probe_weights = camera_search.weights;
     // Bind the buffer to render the probes on top of
     target->Bind(false);
     target->BindDepthTexture(depth);
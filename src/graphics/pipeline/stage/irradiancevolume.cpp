@@ -23,7 +23,13 @@
 
 #include <blons/graphics/pipeline/stage/irradiancevolume.h>
 
+// Includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
 // Public Includes
+#include <blons/debug/performance.h>
 #include <blons/graphics/framebuffer.h>
 #include <blons/graphics/texture3d.h>
 #include <blons/graphics/render/shader.h>
@@ -34,36 +40,99 @@ namespace pipeline
 {
 namespace stage
 {
+namespace
+{
+// Stores the volume as 16-bit floats, halving its memory. Any change refills every level
+auto const cvar_half_precision = console::RegisterVariable("light:irradiance-half", 1);
+// Voxel edge length of the finest level in world units, doubling with each level after. Any change refills every level
+auto const cvar_voxel_size = console::RegisterVariable("light:irradiance-voxel-size", 1.0f);
+const units::world kMinVoxelSize = 0.05f;
+// Matches the local size of shaders/irradiance-volume.comp.glsl
+const int kWorkgroupSize = 4;
+const std::array<int, 3> kLevelSize = { kIrradianceVolumeWidth, kIrradianceVolumeHeight, kIrradianceVolumeDepth };
+
+units::world LevelVoxelSize(units::world voxel_size, int level)
+{
+    return voxel_size * static_cast<units::world>(1 << level);
+}
+} // namespace
+
 IrradianceVolume::IrradianceVolume()
 {
-    // Initialize 3D texture containing volume data
-    PixelData3D volume;
-    volume.width = kIrradianceVolumeWidth;
-    volume.height = kIrradianceVolumeHeight;
-    volume.depth = kIrradianceVolumeDepth;
-    volume.type = TextureType(TextureType::R32G32B32A32, TextureType::LINEAR, TextureType::REPEAT);
-    for (auto& volume_tex : irradiance_volume_)
+    voxel_size_ = std::max(cvar_voxel_size->to<float>(), kMinVoxelSize);
+    for (int level = 0; level < kIrradianceClipmapLevels; level++)
     {
-        volume_tex.reset(new Texture3D(volume));
+        origins_[level] = { 0, 0, 0 };
+        stats_[level] = { LevelVoxelSize(voxel_size_, level), 0, 0, 0 };
     }
+    InitTextures(cvar_half_precision->to<int>() != 0);
 
-    // World matrix sized to wrap sponza scene
-    static const units::world grid_width = 38.0f;
-    static const units::world grid_height = 19.0f;
-    static const units::world grid_depth = 18.0f;
-    static const units::world x_offset = -grid_width / 2.0f;
-    static const units::world y_offset = -2.0f;
-    static const units::world z_offset = -grid_depth / 2.0f;
-    world_matrix_ = MatrixScale(grid_width, grid_height, grid_depth) * MatrixTranslation(x_offset, y_offset, z_offset);
-
-    // Compute shader for updating irradiance volume each frame
+    // Compute shader for filling in voxels as they scroll into the volume
     irradiance_volume_shader_.reset(new ComputeShader({ { COMPUTE, "shaders/irradiance-volume.comp.glsl" } }));
 }
 
-bool IrradianceVolume::Relight(const LightSector& sector)
+bool IrradianceVolume::Relight(const LightSector& sector, const Vector3& camera_pos)
 {
-    if (!irradiance_volume_shader_->SetInput("world_matrix", world_matrix_) ||
-        !irradiance_volume_shader_->SetInput("probe_buffer", sector.probe_shader_data()) ||
+    for (auto& stats : stats_)
+    {
+        stats.updated_voxels = 0;
+        stats.updated_regions = 0;
+    }
+    // Nothing to sample until the first progressive bake is done
+    if (!sector.baked())
+    {
+        return true;
+    }
+
+    bool half_precision = cvar_half_precision->to<int>() != 0;
+    if (half_precision != half_precision_)
+    {
+        InitTextures(half_precision);
+    }
+    units::world voxel_size = std::max(cvar_voxel_size->to<float>(), kMinVoxelSize);
+    if (voxel_size != voxel_size_)
+    {
+        voxel_size_ = voxel_size;
+        filled_ = false;
+    }
+    // Voxels scrolling in always need filling, along with any sampling probes that were relit. Those can only be
+    // inside of the cells around the relit probes, lighting changes that never reach the probes don't show up here
+    bool update_all = !filled_;
+    Vector3 relit_min, relit_max;
+    bool probes_relit = sector.RelitProbeBounds(&relit_min, &relit_max);
+
+    // Levels that stayed put since last frame have nothing to update
+    std::array<std::vector<VoxelRegion>, kIrradianceClipmapLevels> level_regions;
+    bool needs_update = false;
+    for (int level = 0; level < kIrradianceClipmapLevels; level++)
+    {
+        stats_[level].voxel_size = LevelVoxelSize(voxel_size_, level);
+        auto origin = LevelOrigin(camera_pos, stats_[level].voxel_size);
+        if (update_all)
+        {
+            level_regions[level].push_back({ origin, kLevelSize });
+        }
+        else
+        {
+            level_regions[level] = ScrollRegions(origins_[level], origin);
+            // Might overlap voxels that scrolled in, which only costs a little extra work
+            VoxelRegion relit_region;
+            if (probes_relit && BoundsRegion(origin, relit_min, relit_max, stats_[level].voxel_size, &relit_region))
+            {
+                level_regions[level].push_back(relit_region);
+            }
+        }
+        origins_[level] = origin;
+        needs_update |= !level_regions[level].empty();
+    }
+    if (!needs_update)
+    {
+        return true;
+    }
+
+    // Stays unfilled if anything fails so that the next call starts over
+    filled_ = false;
+    if (!irradiance_volume_shader_->SetInput("probe_buffer", sector.probe_shader_data()) ||
         !irradiance_volume_shader_->SetInput("probe_network_buffer", sector.probe_network_shader_data()) ||
         !irradiance_volume_shader_->SetOutput("irradiance_volume_px_out", irradiance_volume_[POSITIVE_X]->mutable_texture().get(), 0, 0) ||
         !irradiance_volume_shader_->SetOutput("irradiance_volume_nx_out", irradiance_volume_[NEGATIVE_X]->mutable_texture().get(), 1, 0) ||
@@ -74,7 +143,25 @@ bool IrradianceVolume::Relight(const LightSector& sector)
     {
         return false;
     }
-    irradiance_volume_shader_->Run(kIrradianceVolumeWidth, kIrradianceVolumeHeight, kIrradianceVolumeDepth);
+    for (int level = 0; level < kIrradianceClipmapLevels; level++)
+    {
+        if (level_regions[level].empty())
+        {
+            continue;
+        }
+        // Marked separately so that the cost of each level shows up in the profiler
+        performance::PushMarker("Level " + std::to_string(level));
+        for (const auto& region : level_regions[level])
+        {
+            if (!UpdateRegion(level, region))
+            {
+                performance::PopMarker();
+                return false;
+            }
+        }
+        performance::PopMarker();
+    }
+    filled_ = true;
     return true;
 }
 
@@ -101,7 +188,151 @@ const TextureResource* IrradianceVolume::output(Output buffer) const
 
 Matrix IrradianceVolume::world_matrix() const
 {
-    return world_matrix_;
+    units::world voxel_size = stats_[0].voxel_size;
+    return MatrixScale(voxel_size * kLevelSize[0], voxel_size * kLevelSize[1], voxel_size * kLevelSize[2]) *
+           MatrixTranslation(voxel_size * origins_[0][0], voxel_size * origins_[0][1], voxel_size * origins_[0][2]);
+}
+
+std::array<Vector3, kIrradianceClipmapLevels> IrradianceVolume::clipmap_origins() const
+{
+    std::array<Vector3, kIrradianceClipmapLevels> origins;
+    for (int level = 0; level < kIrradianceClipmapLevels; level++)
+    {
+        origins[level] = Vector3(static_cast<units::world>(origins_[level][0]),
+                                 static_cast<units::world>(origins_[level][1]),
+                                 static_cast<units::world>(origins_[level][2]));
+    }
+    return origins;
+}
+
+units::world IrradianceVolume::voxel_size() const
+{
+    return stats_[0].voxel_size;
+}
+
+const std::array<IrradianceVolume::LevelStats, kIrradianceClipmapLevels>& IrradianceVolume::level_stats() const
+{
+    return stats_;
+}
+
+std::array<int, 3> IrradianceVolume::LevelOrigin(const Vector3& camera_pos, units::world voxel_size)
+{
+    // Snapped to whole voxels so that voxels keep their positions as the level scrolls
+    const units::world pos[3] = { camera_pos.x, camera_pos.y, camera_pos.z };
+    std::array<int, 3> origin;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        origin[axis] = static_cast<int>(std::floor(pos[axis] / voxel_size)) - kLevelSize[axis] / 2;
+    }
+    return origin;
+}
+
+std::vector<IrradianceVolume::VoxelRegion> IrradianceVolume::ScrollRegions(const std::array<int, 3>& old_origin, const std::array<int, 3>& new_origin)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (std::abs(new_origin[axis] - old_origin[axis]) >= kLevelSize[axis])
+        {
+            return { { new_origin, kLevelSize } };
+        }
+    }
+
+    // Each axis adds a slab of new voxels on the side the level moved towards. Slabs after the
+    // first only span voxels that were already in the level along earlier axes, so none overlap
+    std::vector<VoxelRegion> regions;
+    std::array<int, 3> kept_min = new_origin;
+    std::array<int, 3> kept_size = kLevelSize;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int shift = new_origin[axis] - old_origin[axis];
+        if (shift == 0)
+        {
+            continue;
+        }
+        VoxelRegion slab = { kept_min, kept_size };
+        slab.size[axis] = std::abs(shift);
+        slab.min[axis] = shift > 0 ? new_origin[axis] + kLevelSize[axis] - shift : new_origin[axis];
+        regions.push_back(slab);
+
+        kept_size[axis] -= std::abs(shift);
+        if (shift < 0)
+        {
+            kept_min[axis] -= shift;
+        }
+    }
+    return regions;
+}
+
+bool IrradianceVolume::BoundsRegion(const std::array<int, 3>& origin, const Vector3& bounds_min, const Vector3& bounds_max,
+                                    units::world voxel_size, VoxelRegion* region)
+{
+    // Worked out in floats so that infinite bounds clamp to the level instead of overflowing
+    const units::world lo[3] = { bounds_min.x, bounds_min.y, bounds_min.z };
+    const units::world hi[3] = { bounds_max.x, bounds_max.y, bounds_max.z };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // Voxels are sampled half a voxel in, see irradiance-volume.comp.glsl
+        float first = std::max(std::ceil(lo[axis] / voxel_size - 0.5f), static_cast<float>(origin[axis]));
+        float last = std::min(std::floor(hi[axis] / voxel_size - 0.5f), static_cast<float>(origin[axis] + kLevelSize[axis] - 1));
+        if (!(first <= last))
+        {
+            return false;
+        }
+        region->min[axis] = static_cast<int>(first);
+        region->size[axis] = static_cast<int>(last - first) + 1;
+    }
+    return true;
+}
+
+void IrradianceVolume::InitTextures(bool half_precision)
+{
+    // Initialize 3D textures containing every level of volume data
+    PixelData3D volume;
+    volume.width = kIrradianceVolumeWidth;
+    volume.height = kIrradianceVolumeHeight;
+    volume.depth = kIrradianceVolumeDepth * kIrradianceClipmapLevels;
+    volume.type = TextureType(half_precision ? TextureType::R16G16B16A16_FLOAT : TextureType::R32G32B32A32,
+                              TextureType::LINEAR, TextureType::REPEAT);
+    for (auto& volume_tex : irradiance_volume_)
+    {
+        volume_tex.reset(new Texture3D(volume));
+    }
+    half_precision_ = half_precision;
+    filled_ = false;
+
+    std::size_t level_memory = kIrradianceVolumeWidth * kIrradianceVolumeHeight * kIrradianceVolumeDepth *
+                               (volume.bits_per_pixel() / 8) * irradiance_volume_.size();
+    for (auto& stats : stats_)
+    {
+        stats.memory = level_memory;
+    }
+    log::Debug("Irradiance volume has %i levels of %ix%ix%i %s precision voxels, %.2fMB each\n",
+               kIrradianceClipmapLevels, kIrradianceVolumeWidth, kIrradianceVolumeHeight, kIrradianceVolumeDepth,
+               half_precision ? "half" : "full", static_cast<float>(level_memory) / (1024.0f * 1024.0f));
+}
+
+bool IrradianceVolume::UpdateRegion(int level, const VoxelRegion& region)
+{
+    if (!irradiance_volume_shader_->SetInput("update_min", Vector3(static_cast<units::world>(region.min[0]),
+                                                                   static_cast<units::world>(region.min[1]),
+                                                                   static_cast<units::world>(region.min[2]))) ||
+        !irradiance_volume_shader_->SetInput("update_size", Vector3(static_cast<units::world>(region.size[0]),
+                                                                    static_cast<units::world>(region.size[1]),
+                                                                    static_cast<units::world>(region.size[2]))) ||
+        !irradiance_volume_shader_->SetInput("voxel_size", stats_[level].voxel_size) ||
+        !irradiance_volume_shader_->SetInput("level", level))
+    {
+        return false;
+    }
+    if (!irradiance_volume_shader_->Run((region.size[0] + kWorkgroupSize - 1) / kWorkgroupSize,
+                                        (region.size[1] + kWorkgroupSize - 1) / kWorkgroupSize,
+                                        (region.size[2] + kWorkgroupSize - 1) / kWorkgroupSize))
+    {
+        return false;
+    }
+    stats_[level].updated_voxels += region.size[0] * region.size[1] * region.size[2];
+    stats_[level].updated_regions++;
+    return true;
 }
 } // namespace stage
 } // namespace pipeline
@@ -95,7 +95,8 @@ bool Lighting::Render(const Scene& scene, const Geometry& geometry, const Shadow
         !light_shader_->SetInput("sh_sky_colour.r", scene.sky_box.r.coeffs, 9) ||
         !light_shader_->SetInput("sh_sky_colour.g", scene.sky_box.g.coeffs, 9) ||
         !light_shader_->SetInput("sh_sky_colour.b", scene.sky_box.b.coeffs, 9) ||
-        !light_shader_->SetInput("inv_irradiance_matrix", MatrixInverse(irradiance.world_matrix())) ||
+        !light_shader_->SetInput("irradiance_clipmap_origins", irradiance.clipmap_origins().data(), kIrradianceClipmapLevels) ||
+        !light_shader_->SetInput("irradiance_voxel_size", irradiance.voxel_size()) ||
         !light_shader_->SetInput("irradiance_volume_px", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_PX), 4) ||
         !light_shader_->SetInput("irradiance_volume_nx", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_NX), 5) ||
         !light_shader_->SetInput("irradiance_volume_py", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_PY), 6) ||
@@ -0,0 +1,790 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "environmentmaprasterizer.h"
+
+// Includes
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+// Public Includes
+#include <blons/system/job.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+namespace
+{
+// Outcode bits of a clip space vertex lying outside each plane of the view volume
+enum ClipPlane
+{
+    CLIP_LEFT   = 1 << 0,
+    CLIP_RIGHT  = 1 << 1,
+    CLIP_BOTTOM = 1 << 2,
+    CLIP_TOP    = 1 << 3,
+    CLIP_NEAR   = 1 << 4,
+    CLIP_FAR    = 1 << 5
+};
+
+// Clip space vertex along with its barycentric coordinates in the unclipped triangle it came from
+struct ClipVertex
+{
+    Vector4 pos;
+    Vector3 weights;
+};
+
+Vector4 TransformPoint(const Vector3& p, const Matrix& mat)
+{
+    return Vector4(p.x * mat.m[0][0] + p.y * mat.m[1][0] + p.z * mat.m[2][0] + mat.m[3][0],
+                   p.x * mat.m[0][1] + p.y * mat.m[1][1] + p.z * mat.m[2][1] + mat.m[3][1],
+                   p.x * mat.m[0][2] + p.y * mat.m[1][2] + p.z * mat.m[2][2] + mat.m[3][2],
+                   p.x * mat.m[0][3] + p.y * mat.m[1][3] + p.z * mat.m[2][3] + mat.m[3][3]);
+}
+
+int Outcode(const Vector4& v, bool depth_zero_to_one)
+{
+    int code = 0;
+    code |= v.x < -v.w ? CLIP_LEFT : 0;
+    code |= v.x > v.w ? CLIP_RIGHT : 0;
+    code |= v.y < -v.w ? CLIP_BOTTOM : 0;
+    code |= v.y > v.w ? CLIP_TOP : 0;
+    code |= v.z < (depth_zero_to_one ? 0.0f : -v.w) ? CLIP_NEAR : 0;
+    code |= v.z > v.w ? CLIP_FAR : 0;
+    return code;
+}
+
+// Signed distance to the near plane, positive on the visible side
+float NearPlaneDistance(const Vector4& v, bool depth_zero_to_one)
+{
+    return depth_zero_to_one ? v.z : v.z + v.w;
+}
+
+float EdgeFunction(float ax, float ay, float bx, float by, float px, float py)
+{
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+// Vector4 arithmetic doesn't blend the W component, so it's done by hand here
+Vector4 Lerp(const Vector4& a, const Vector4& b, float t)
+{
+    return Vector4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+}
+
+unsigned char UnormToByte(float v)
+{
+    return static_cast<unsigned char>(std::floor(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f));
+}
+
+bool IsByteFormat(TextureType::Format format)
+{
+    switch (format)
+    {
+    case TextureType::A8:
+    case TextureType::R8G8_UINT:
+    case TextureType::R8G8B8:
+    case TextureType::R8G8B8A8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Decoded base level of a texture, always RGBA8 with the first row of the source first
+struct DecodedImage
+{
+    int width;
+    int height;
+    std::vector<unsigned char> texels;
+};
+
+// Expands every byte format to RGBA, filling in missing channels like the GPU does
+bool DecodeByteTexture(const PixelData& pixels, DecodedImage* image)
+{
+    std::size_t channels = pixels.bits_per_pixel() / 8;
+    std::size_t texel_count = static_cast<std::size_t>(pixels.width) * pixels.height;
+    if (pixels.pixels.size() < texel_count * channels)
+    {
+        return false;
+    }
+    image->width = pixels.width;
+    image->height = pixels.height;
+    image->texels.resize(texel_count * 4);
+    for (std::size_t i = 0; i < texel_count; i++)
+    {
+        for (std::size_t c = 0; c < 4; c++)
+        {
+            image->texels[i * 4 + c] = c < channels ? pixels.pixels[i * channels + c] : (c == 3 ? 255 : 0);
+        }
+    }
+    return true;
+}
+
+// Block compressed formats found in DDS files
+enum class DDSFormat
+{
+    BC1,
+    BC2,
+    BC3,
+    UNCOMPRESSED
+};
+
+uint32_t ReadUint32(const unsigned char* bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+uint32_t FourCC(char a, char b, char c, char d)
+{
+    return static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | (static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24);
+}
+
+// Scales a channel picked out by a bit mask up to 8 bits, or returns the fallback if the mask is empty
+unsigned char MaskedChannel(uint32_t texel, uint32_t mask, unsigned char fallback)
+{
+    if (mask == 0)
+    {
+        return fallback;
+    }
+    int shift = 0;
+    while (((mask >> shift) & 1) == 0)
+    {
+        shift++;
+    }
+    uint32_t max_value = mask >> shift;
+    return static_cast<unsigned char>((((texel & mask) >> shift) * 255 + max_value / 2) / max_value);
+}
+
+// 4x4 block of RGB565 endpoints and 2 bit indices shared by BC1, BC2, and BC3. Only BC1 uses the 3 colour mode
+// with transparent black, when the first endpoint isn't greater than the second
+void DecodeColourBlock(const unsigned char* block, bool allow_transparent, unsigned char texels[16][4])
+{
+    uint32_t endpoints[2] = { static_cast<uint32_t>(block[0] | (block[1] << 8)), static_cast<uint32_t>(block[2] | (block[3] << 8)) };
+    int palette[4][4];
+    for (int i = 0; i < 2; i++)
+    {
+        int r = (endpoints[i] >> 11) & 31;
+        int g = (endpoints[i] >> 5) & 63;
+        int b = endpoints[i] & 31;
+        palette[i][0] = (r << 3) | (r >> 2);
+        palette[i][1] = (g << 2) | (g >> 4);
+        palette[i][2] = (b << 3) | (b >> 2);
+        palette[i][3] = 255;
+    }
+    bool four_colours = endpoints[0] > endpoints[1] || !allow_transparent;
+    for (int c = 0; c < 4; c++)
+    {
+        if (four_colours)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    uint32_t indices = ReadUint32(block + 4);
+    for (int i = 0; i < 16; i++)
+    {
+        const int* colour = palette[(indices >> (i * 2)) & 3];
+        for (int c = 0; c < 4; c++)
+        {
+            texels[i][c] = static_cast<unsigned char>(colour[c]);
+        }
+    }
+}
+
+// BC2 stores alpha as 4 bits per texel
+void DecodeExplicitAlphaBlock(const unsigned char* block, unsigned char texels[16][4])
+{
+    for (int i = 0; i < 16; i++)
+    {
+        int alpha = (block[i / 2] >> ((i % 2) * 4)) & 15;
+        texels[i][3] = static_cast<unsigned char>(alpha * 17);
+    }
+}
+
+// BC3 stores alpha as two endpoints and 3 bit indices
+void DecodeInterpolatedAlphaBlock(const unsigned char* block, unsigned char texels[16][4])
+{
+    int palette[8];
+    palette[0] = block[0];
+    palette[1] = block[1];
+    if (palette[0] > palette[1])
+    {
+        for (int i = 1; i < 7; i++)
+        {
+            palette[i + 1] = ((7 - i) * palette[0] + i * palette[1] + 3) / 7;
+        }
+    }
+    else
+    {
+        for (int i = 1; i < 5; i++)
+        {
+            palette[i + 1] = ((5 - i) * palette[0] + i * palette[1] + 2) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        indices |= static_cast<uint64_t>(block[2 + i]) << (i * 8);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        texels[i][3] = static_cast<unsigned char>(palette[(indices >> (i * 3)) & 7]);
+    }
+}
+
+// Decodes the top mip level of a DDS file's contents. Handles the DXT1/3/5 (BC1/2/3) formats the renderer
+// can upload, through either the legacy or DX10 header, as well as uncompressed RGB(A) and luminance
+bool DecodeDDSTexture(const PixelData& pixels, DecodedImage* image)
+{
+    // Magic number, then a 124 byte header with the pixel format 72 bytes in
+    const std::size_t kHeaderSize = 128;
+    const std::size_t kDX10HeaderSize = 20;
+    const uint32_t kFlagAlphaPixels = 0x1;
+    const uint32_t kFlagFourCC = 0x4;
+    const uint32_t kFlagRGB = 0x40;
+    const uint32_t kFlagLuminance = 0x20000;
+
+    const auto& bytes = pixels.pixels;
+    if (bytes.size() < kHeaderSize || memcmp(bytes.data(), "DDS ", 4) != 0)
+    {
+        return false;
+    }
+    int height = static_cast<int>(ReadUint32(&bytes[12]));
+    int width = static_cast<int>(ReadUint32(&bytes[16]));
+    uint32_t format_flags = ReadUint32(&bytes[80]);
+    uint32_t four_cc = ReadUint32(&bytes[84]);
+    uint32_t bit_count = ReadUint32(&bytes[88]);
+    uint32_t masks[4] = { ReadUint32(&bytes[92]), ReadUint32(&bytes[96]), ReadUint32(&bytes[100]), ReadUint32(&bytes[104]) };
+    std::size_t data_offset = kHeaderSize;
+    if (width <= 0 || height <= 0)
+    {
+        return false;
+    }
+
+    DDSFormat format;
+    if (format_flags & kFlagFourCC)
+    {
+        if (four_cc == FourCC('D', 'X', 'T', '1'))
+        {
+            format = DDSFormat::BC1;
+        }
+        else if (four_cc == FourCC('D', 'X', 'T', '2') || four_cc == FourCC('D', 'X', 'T', '3'))
+        {
+            format = DDSFormat::BC2;
+        }
+        else if (four_cc == FourCC('D', 'X', 'T', '4') || four_cc == FourCC('D', 'X', 'T', '5'))
+        {
+            format = DDSFormat::BC3;
+        }
+        else if (four_cc == FourCC('D', 'X', '1', '0') && bytes.size() >= kHeaderSize + kDX10HeaderSize)
+        {
+            // DXGI_FORMAT values, including the typeless and sRGB variants
+            uint32_t dxgi_format = ReadUint32(&bytes[kHeaderSize]);
+            data_offset += kDX10HeaderSize;
+            if (dxgi_format >= 70 && dxgi_format <= 72)
+            {
+                format = DDSFormat::BC1;
+            }
+            else if (dxgi_format >= 73 && dxgi_format <= 75)
+            {
+                format = DDSFormat::BC2;
+            }
+            else if (dxgi_format >= 76 && dxgi_format <= 78)
+            {
+                format = DDSFormat::BC3;
+            }
+            else if (dxgi_format >= 27 && dxgi_format <= 29)
+            {
+                format = DDSFormat::UNCOMPRESSED;
+                bit_count = 32;
+                masks[0] = 0x000000FF;
+                masks[1] = 0x0000FF00;
+                masks[2] = 0x00FF0000;
+                masks[3] = 0xFF000000;
+            }
+            else if (dxgi_format == 87 || dxgi_format == 90 || dxgi_format == 91)
+            {
+                format = DDSFormat::UNCOMPRESSED;
+                bit_count = 32;
+                masks[0] = 0x00FF0000;
+                masks[1] = 0x0000FF00;
+                masks[2] = 0x000000FF;
+                masks[3] = 0xFF000000;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else if ((format_flags & (kFlagRGB | kFlagLuminance)) && bit_count >= 8 && bit_count <= 32 && bit_count % 8 == 0)
+    {
+        format = DDSFormat::UNCOMPRESSED;
+        if (format_flags & kFlagLuminance)
+        {
+            masks[1] = masks[2] = masks[0];
+        }
+        if (!(format_flags & kFlagAlphaPixels))
+        {
+            masks[3] = 0;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->texels.resize(static_cast<std::size_t>(width) * height * 4);
+    const unsigned char* data = bytes.data() + data_offset;
+    const std::size_t data_size = bytes.size() - data_offset;
+
+    if (format == DDSFormat::UNCOMPRESSED)
+    {
+        const std::size_t texel_size = bit_count / 8;
+        if (data_size < static_cast<std::size_t>(width) * height * texel_size)
+        {
+            return false;
+        }
+        for (std::size_t i = 0; i < static_cast<std::size_t>(width) * height; i++)
+        {
+            uint32_t texel = 0;
+            memcpy(&texel, data + i * texel_size, texel_size);
+            for (int c = 0; c < 4; c++)
+            {
+                image->texels[i * 4 + c] = MaskedChannel(texel, masks[c], c == 3 ? 255 : 0);
+            }
+        }
+        return true;
+    }
+
+    const int blocks_x = (width + 3) / 4;
+    const int blocks_y = (height + 3) / 4;
+    const std::size_t block_size = format == DDSFormat::BC1 ? 8 : 16;
+    if (data_size < static_cast<std::size_t>(blocks_x) * blocks_y * block_size)
+    {
+        return false;
+    }
+    for (int by = 0; by < blocks_y; by++)
+    {
+        for (int bx = 0; bx < blocks_x; bx++)
+        {
+            const unsigned char* block = data + (static_cast<std::size_t>(by) * blocks_x + bx) * block_size;
+            unsigned char texels[16][4];
+            switch (format)
+            {
+            case DDSFormat::BC1:
+                DecodeColourBlock(block, true, texels);
+                break;
+            case DDSFormat::BC2:
+                DecodeColourBlock(block + 8, false, texels);
+                DecodeExplicitAlphaBlock(block, texels);
+                break;
+            default:
+                DecodeColourBlock(block + 8, false, texels);
+                DecodeInterpolatedAlphaBlock(block, texels);
+                break;
+            }
+            // Blocks hang off the edge of textures that aren't a multiple of 4 in size
+            for (int y = 0; y < 4 && by * 4 + y < height; y++)
+            {
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                {
+                    memcpy(&image->texels[((static_cast<std::size_t>(by) * 4 + y) * width + bx * 4 + x) * 4], texels[y * 4 + x], 4);
+                }
+            }
+        }
+    }
+    return true;
+}
+} // namespace
+
+EnvironmentMapRasterizer::EnvironmentMapRasterizer(const Scene& scene, bool depth_zero_to_one)
+{
+    depth_zero_to_one_ = depth_zero_to_one;
+    for (const auto& model : scene.models)
+    {
+        const auto& mesh = model->mesh();
+        // Only triangles are rendered into environment maps in any meaningful way
+        if (mesh.draw_mode != TRIANGLES)
+        {
+            continue;
+        }
+        RasterModel raster_model;
+        // World matrices are only updated when models render, so build the transform by hand
+        Vector3 pos = model->pos();
+        Vector3 scale = model->scale();
+        Matrix world_matrix = MatrixScale(scale.x, scale.y, scale.z) * MatrixTranslation(pos.x, pos.y, pos.z);
+        raster_model.vertices.reserve(mesh.vertices.size());
+        for (const auto& v : mesh.vertices)
+        {
+            // Same as the env map vertex shader, where the normal matrix only scales directions
+            RasterVertex rv;
+            Vector4 world_pos = TransformPoint(v.pos, world_matrix);
+            rv.pos = Vector3(world_pos.x, world_pos.y, world_pos.z);
+            rv.uv = v.tex;
+            rv.tangent = VectorNormalize(v.tan / scale);
+            rv.bitangent = VectorNormalize(v.bitan / scale);
+            rv.normal = VectorNormalize(v.norm / scale);
+            raster_model.vertices.push_back(rv);
+        }
+        raster_model.indices = mesh.indices;
+        raster_model.albedo = AddTexture(model->albedo_pixels(), false);
+        raster_model.normal = AddTexture(model->normal_pixels(), true);
+        models_.push_back(std::move(raster_model));
+    }
+}
+
+void EnvironmentMapRasterizer::Render(const std::vector<Face>& faces, units::pixel map_width, units::pixel map_height,
+                                      PixelData* albedo, PixelData* normal, PixelData* depth) const
+{
+    // Same formats as the baker's framebuffer
+    albedo->width = normal->width = depth->width = map_width;
+    albedo->height = normal->height = depth->height = map_height;
+    albedo->type = TextureType(TextureType::R8G8B8A8, TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP);
+    normal->type = TextureType(TextureType::R8G8B8, TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP);
+    depth->type = TextureType(TextureType::DEPTH, TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP);
+    // Clear to the same values the framebuffer is bound with, where sky visibility is stored in albedo alpha
+    const std::size_t pixel_count = static_cast<std::size_t>(map_width) * static_cast<std::size_t>(map_height);
+    albedo->pixels.resize(pixel_count * 4);
+    normal->pixels.resize(pixel_count * 3);
+    depth->pixels.resize(pixel_count * sizeof(float));
+    for (std::size_t i = 0; i < pixel_count; i++)
+    {
+        albedo->pixels[i * 4 + 0] = 0;
+        albedo->pixels[i * 4 + 1] = 255;
+        albedo->pixels[i * 4 + 2] = 0;
+        albedo->pixels[i * 4 + 3] = 255;
+        normal->pixels[i * 3 + 0] = 0;
+        normal->pixels[i * 3 + 1] = 255;
+        normal->pixels[i * 3 + 2] = 0;
+    }
+    std::fill(reinterpret_cast<float*>(depth->pixels.data()), reinterpret_cast<float*>(depth->pixels.data()) + pixel_count, 1.0f);
+
+    // Every face writes to its own tile, so they can all be rendered at once
+    ParallelFor(0, faces.size(), 1, [&](std::size_t i)
+    {
+        RenderFace(faces[i], map_width, albedo, normal, depth);
+    });
+}
+
+void EnvironmentMapRasterizer::RenderFace(const Face& face, units::pixel map_width, PixelData* albedo, PixelData* normal, PixelData* depth) const
+{
+    const float tile_size = static_cast<float>(kProbeMapSize);
+    float* depth_pixels = reinterpret_cast<float*>(depth->pixels.data());
+    std::vector<Vector4> clip_positions;
+    std::vector<int> outcodes;
+
+    for (const auto& model : models_)
+    {
+        const auto& albedo_texture = textures_[model.albedo];
+        const auto& normal_texture = textures_[model.normal];
+        const float albedo_size = static_cast<float>(std::max(albedo_texture.levels[0].width, albedo_texture.levels[0].height));
+        const float normal_size = static_cast<float>(std::max(normal_texture.levels[0].width, normal_texture.levels[0].height));
+
+        clip_positions.resize(model.vertices.size());
+        outcodes.resize(model.vertices.size());
+        for (std::size_t i = 0; i < model.vertices.size(); i++)
+        {
+            clip_positions[i] = TransformPoint(model.vertices[i].pos, face.vp_matrix);
+            outcodes[i] = Outcode(clip_positions[i], depth_zero_to_one_);
+        }
+
+        for (std::size_t tri = 0; tri + 2 < model.indices.size(); tri += 3)
+        {
+            const unsigned int index[3] = { model.indices[tri], model.indices[tri + 1], model.indices[tri + 2] };
+            // Skip anything entirely outside of a single plane of the view volume
+            if ((outcodes[index[0]] & outcodes[index[1]] & outcodes[index[2]]) != 0)
+            {
+                continue;
+            }
+            // Clip against the near plane, which can turn the triangle into a quad
+            std::array<ClipVertex, 4> polygon;
+            int polygon_size = 0;
+            const ClipVertex triangle[3] = { { clip_positions[index[0]], Vector3(1.0f, 0.0f, 0.0f) },
+                                             { clip_positions[index[1]], Vector3(0.0f, 1.0f, 0.0f) },
+                                             { clip_positions[index[2]], Vector3(0.0f, 0.0f, 1.0f) } };
+            if (((outcodes[index[0]] | outcodes[index[1]] | outcodes[index[2]]) & CLIP_NEAR) == 0)
+            {
+                std::copy(std::begin(triangle), std::end(triangle), polygon.begin());
+                polygon_size = 3;
+            }
+            else
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    const auto& a = triangle[i];
+                    const auto& b = triangle[(i + 1) % 3];
+                    float da = NearPlaneDistance(a.pos, depth_zero_to_one_);
+                    float db = NearPlaneDistance(b.pos, depth_zero_to_one_);
+                    if (da >= 0.0f)
+                    {
+                        polygon[polygon_size++] = a;
+                    }
+                    if ((da >= 0.0f) != (db >= 0.0f))
+                    {
+                        float t = da / (da - db);
+                        ClipVertex v;
+                        v.pos = Vector4(a.pos.x + (b.pos.x - a.pos.x) * t, a.pos.y + (b.pos.y - a.pos.y) * t,
+                                        a.pos.z + (b.pos.z - a.pos.z) * t, a.pos.w + (b.pos.w - a.pos.w) * t);
+                        v.weights = a.weights + (b.weights - a.weights) * t;
+                        polygon[polygon_size++] = v;
+                    }
+                }
+            }
+
+            // Rasterize the polygon as a triangle fan
+            for (int fan = 1; fan + 1 < polygon_size; fan++)
+            {
+                const ClipVertex* verts[3] = { &polygon[0], &polygon[fan], &polygon[fan + 1] };
+                float sx[3], sy[3], sz[3], inv_w[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    inv_w[i] = 1.0f / verts[i]->pos.w;
+                    // Tile space position, with pixel centers on half coordinates
+                    sx[i] = (verts[i]->pos.x * inv_w[i] * 0.5f + 0.5f) * tile_size;
+                    sy[i] = (verts[i]->pos.y * inv_w[i] * 0.5f + 0.5f) * tile_size;
+                    float ndc_z = verts[i]->pos.z * inv_w[i];
+                    sz[i] = depth_zero_to_one_ ? ndc_z : ndc_z * 0.5f + 0.5f;
+                }
+                // Counter-clockwise triangles face forward, everything else is culled
+                float area = EdgeFunction(sx[0], sy[0], sx[1], sy[1], sx[2], sy[2]);
+                if (!(area > 0.0f))
+                {
+                    continue;
+                }
+                // Top-left fill rule for pixels lying exactly on an edge, edges are opposite the vertex they weight
+                bool top_left[3];
+                for (int i = 0; i < 3; i++)
+                {
+                    int a = (i + 1) % 3;
+                    int b = (i + 2) % 3;
+                    float dx = sx[b] - sx[a];
+                    float dy = sy[b] - sy[a];
+                    top_left[i] = dy < 0.0f || (dy == 0.0f && dx < 0.0f);
+                }
+                int min_x = std::max(static_cast<int>(std::floor(std::min({ sx[0], sx[1], sx[2] }))), 0);
+                int max_x = std::min(static_cast<int>(std::ceil(std::max({ sx[0], sx[1], sx[2] }))), kProbeMapSize - 1);
+                int min_y = std::max(static_cast<int>(std::floor(std::min({ sy[0], sy[1], sy[2] }))), 0);
+                int max_y = std::min(static_cast<int>(std::ceil(std::max({ sy[0], sy[1], sy[2] }))), kProbeMapSize - 1);
+
+                // Perspective correct barycentric coordinates of the unclipped triangle at any point on screen
+                auto triangle_weights = [&](float px, float py)
+                {
+                    float e[3] = { EdgeFunction(sx[1], sy[1], sx[2], sy[2], px, py),
+                                   EdgeFunction(sx[2], sy[2], sx[0], sy[0], px, py),
+                                   EdgeFunction(sx[0], sy[0], sx[1], sy[1], px, py) };
+                    float pw[3] = { e[0] * inv_w[0], e[1] * inv_w[1], e[2] * inv_w[2] };
+                    float pw_sum = pw[0] + pw[1] + pw[2];
+                    return (verts[0]->weights * pw[0] + verts[1]->weights * pw[1] + verts[2]->weights * pw[2]) / pw_sum;
+                };
+                auto interpolate_uv = [&](const Vector3& w)
+                {
+                    return model.vertices[index[0]].uv * w.x + model.vertices[index[1]].uv * w.y + model.vertices[index[2]].uv * w.z;
+                };
+
+                for (int y = min_y; y <= max_y; y++)
+                {
+                    for (int x = min_x; x <= max_x; x++)
+                    {
+                        float px = static_cast<float>(x) + 0.5f;
+                        float py = static_cast<float>(y) + 0.5f;
+                        float e[3] = { EdgeFunction(sx[1], sy[1], sx[2], sy[2], px, py),
+                                       EdgeFunction(sx[2], sy[2], sx[0], sy[0], px, py),
+                                       EdgeFunction(sx[0], sy[0], sx[1], sy[1], px, py) };
+                        bool inside = true;
+                        for (int i = 0; i < 3; i++)
+                        {
+                            inside &= e[i] > 0.0f || (e[i] == 0.0f && top_left[i]);
+                        }
+                        if (!inside)
+                        {
+                            continue;
+                        }
+                        // Window depth is linear in screen space, with a less than test against a buffer cleared to 1
+                        float z = (e[0] * sz[0] + e[1] * sz[1] + e[2] * sz[2]) / area;
+                        std::size_t pixel = static_cast<std::size_t>(face.tile_y + y) * map_width + face.tile_x + x;
+                        if (!(z < depth_pixels[pixel]) || z < 0.0f)
+                        {
+                            continue;
+                        }
+                        depth_pixels[pixel] = z;
+
+                        // Interpolate vertex attributes
+                        Vector3 w = triangle_weights(px, py);
+                        const auto& v0 = model.vertices[index[0]];
+                        const auto& v1 = model.vertices[index[1]];
+                        const auto& v2 = model.vertices[index[2]];
+                        Vector2 uv = interpolate_uv(w);
+                        Vector3 tangent = v0.tangent * w.x + v1.tangent * w.y + v2.tangent * w.z;
+                        Vector3 bitangent = v0.bitangent * w.x + v1.bitangent * w.y + v2.bitangent * w.z;
+                        Vector3 surface_normal = v0.normal * w.x + v1.normal * w.y + v2.normal * w.z;
+                        // Texture level of detail from screen space UV derivatives, like a GPU would find across a pixel quad
+                        Vector2 uv_dx = interpolate_uv(triangle_weights(px + 1.0f, py)) - uv;
+                        Vector2 uv_dy = interpolate_uv(triangle_weights(px, py + 1.0f)) - uv;
+                        float uv_rate = std::sqrt(std::max(uv_dx.x * uv_dx.x + uv_dx.y * uv_dx.y, uv_dy.x * uv_dy.x + uv_dy.y * uv_dy.y));
+
+                        // Albedo
+                        Vector4 albedo_sample = SampleTexture(albedo_texture, uv, std::log2(std::max(uv_rate * albedo_size, 1e-8f)));
+                        unsigned char* albedo_pixel = &albedo->pixels[pixel * 4];
+                        albedo_pixel[0] = UnormToByte(std::pow(albedo_sample.x, 2.2f));
+                        albedo_pixel[1] = UnormToByte(std::pow(albedo_sample.y, 2.2f));
+                        albedo_pixel[2] = UnormToByte(std::pow(albedo_sample.z, 2.2f));
+                        albedo_pixel[3] = 0;
+
+                        // Normal, where the Z component is reconstructed since some compression formats only store XY channels
+                        Vector4 normal_sample = SampleTexture(normal_texture, uv, std::log2(std::max(uv_rate * normal_size, 1e-8f)));
+                        Vector3 normal_map(normal_sample.x * 2.0f - 1.0f, normal_sample.y * 2.0f - 1.0f, 0.0f);
+                        normal_map.z = std::sqrt(std::max(1.0f - normal_map.x * normal_map.x - normal_map.y * normal_map.y, 0.0f));
+                        Vector3 world_normal = VectorNormalize(tangent * normal_map.x + bitangent * normal_map.y + surface_normal * normal_map.z);
+                        unsigned char* normal_pixel = &normal->pixels[pixel * 3];
+                        normal_pixel[0] = UnormToByte((world_normal.x + 1.0f) / 2.0f);
+                        normal_pixel[1] = UnormToByte((world_normal.y + 1.0f) / 2.0f);
+                        normal_pixel[2] = UnormToByte((world_normal.z + 1.0f) / 2.0f);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int EnvironmentMapRasterizer::AddTexture(const PixelData* pixels, bool is_normal_map)
+{
+    // Models tend to share textures, so they're only decoded once
+    auto existing = std::find(texture_sources_.begin(), texture_sources_.end(), pixels);
+    if (pixels != nullptr && existing != texture_sources_.end())
+    {
+        return static_cast<int>(existing - texture_sources_.begin());
+    }
+
+    DecodedImage base;
+    bool loaded = false;
+    if (pixels != nullptr)
+    {
+        if (pixels->type.compression == TextureType::DDS)
+        {
+            loaded = DecodeDDSTexture(*pixels, &base);
+        }
+        else if (IsByteFormat(pixels->type.format))
+        {
+            loaded = DecodeByteTexture(*pixels, &base);
+        }
+    }
+    // Fall back to something neutral for anything that can't be decoded
+    if (!loaded)
+    {
+        log::Warn("Couldn't decode texture for CPU environment maps, using a flat colour\n");
+        base.width = 1;
+        base.height = 1;
+        base.texels = is_normal_map ? std::vector<unsigned char>{ 128, 128, 255, 255 } : std::vector<unsigned char>{ 128, 128, 128, 255 };
+    }
+
+    // Box filter a mip chain down to 1x1
+    RasterTexture raster_texture;
+    raster_texture.levels.push_back({ base.width, base.height, std::move(base.texels) });
+    while (raster_texture.levels.back().width > 1 || raster_texture.levels.back().height > 1)
+    {
+        const auto& src = raster_texture.levels.back();
+        RasterTexture::Level level;
+        level.width = std::max(src.width / 2, 1);
+        level.height = std::max(src.height / 2, 1);
+        level.texels.resize(static_cast<std::size_t>(level.width) * level.height * 4);
+        for (int y = 0; y < level.height; y++)
+        {
+            for (int x = 0; x < level.width; x++)
+            {
+                int x0 = std::min(x * 2, src.width - 1);
+                int x1 = std::min(x * 2 + 1, src.width - 1);
+                int y0 = std::min(y * 2, src.height - 1);
+                int y1 = std::min(y * 2 + 1, src.height - 1);
+                for (int c = 0; c < 4; c++)
+                {
+                    int sum = src.texels[(y0 * src.width + x0) * 4 + c] + src.texels[(y0 * src.width + x1) * 4 + c] +
+                              src.texels[(y1 * src.width + x0) * 4 + c] + src.texels[(y1 * src.width + x1) * 4 + c];
+                    level.texels[(y * level.width + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+        raster_texture.levels.push_back(std::move(level));
+    }
+    textures_.push_back(std::move(raster_texture));
+    texture_sources_.push_back(pixels);
+    return static_cast<int>(textures_.size() - 1);
+}
+
+Vector4 EnvironmentMapRasterizer::SampleTexture(const RasterTexture& texture, Vector2 uv, float lod)
+{
+    // Bilinear sample of a single level with repeat wrapping
+    auto sample_level = [&](const RasterTexture::Level& level)
+    {
+        float tx = uv.x * static_cast<float>(level.width) - 0.5f;
+        float ty = uv.y * static_cast<float>(level.height) - 0.5f;
+        float fx = std::floor(tx);
+        float fy = std::floor(ty);
+        float ax = tx - fx;
+        float ay = ty - fy;
+        auto wrap = [](int i, int size) { return ((i % size) + size) % size; };
+        int x0 = wrap(static_cast<int>(fx), level.width);
+        int x1 = wrap(static_cast<int>(fx) + 1, level.width);
+        int y0 = wrap(static_cast<int>(fy), level.height);
+        int y1 = wrap(static_cast<int>(fy) + 1, level.height);
+        auto texel = [&](int x, int y)
+        {
+            const unsigned char* t = &level.texels[(static_cast<std::size_t>(y) * level.width + x) * 4];
+            return Vector4(t[0] / 255.0f, t[1] / 255.0f, t[2] / 255.0f, t[3] / 255.0f);
+        };
+        return Lerp(Lerp(texel(x0, y0), texel(x1, y0), ax), Lerp(texel(x0, y1), texel(x1, y1), ax), ay);
+    };
+    // Trilinear filtering between the two nearest mip levels
+    const int max_level = static_cast<int>(texture.levels.size()) - 1;
+    lod = std::min(std::max(lod, 0.0f), static_cast<float>(max_level));
+    int level = static_cast<int>(lod);
+    float blend = lod - static_cast<float>(level);
+    Vector4 result = sample_level(texture.levels[level]);
+    if (blend > 0.0f && level < max_level)
+    {
+        result = Lerp(result, sample_level(texture.levels[level + 1]), blend);
+    }
+    return result;
+}
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
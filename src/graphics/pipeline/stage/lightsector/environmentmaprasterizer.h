@@ -0,0 +1,104 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_ENVIRONMENTMAPRASTERIZER_H_
+#define BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_ENVIRONMENTMAPRASTERIZER_H_
+
+// Includes
+#include <vector>
+// Public Includes
+#include <blons/graphics/pipeline/scene.h>
+#include <blons/graphics/render/renderer.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+// CPU implementation of the probe-env-map shaders used by RadianceTransferBaker. Renders the same albedo + sky
+// visibility, normal, and depth maps without touching the GPU or render context, so bakes can be cross-checked
+// between the two and run on machines without a GPU
+class EnvironmentMapRasterizer
+{
+public:
+    // One face of a probe's environment map, and where it sits in the output maps
+    struct Face
+    {
+        Matrix vp_matrix;
+        int tile_x;
+        int tile_y;
+    };
+
+public:
+    // Captures the world space geometry and textures of every model in the scene. Textures are decoded from the
+    // pixel data they were loaded from. Depth follows the same convention as the projection matrices faces use
+    EnvironmentMapRasterizer(const Scene& scene, bool depth_zero_to_one);
+    ~EnvironmentMapRasterizer() {}
+
+    // Clears the maps and renders each face into its tile, with faces spread across all worker threads.
+    // Maps are laid out like the baker's framebuffer, with the bottom row of pixels first
+    void Render(const std::vector<Face>& faces, units::pixel map_width, units::pixel map_height,
+                PixelData* albedo, PixelData* normal, PixelData* depth) const;
+
+private:
+    struct RasterVertex
+    {
+        Vector3 pos;
+        Vector2 uv;
+        Vector3 tangent;
+        Vector3 bitangent;
+        Vector3 normal;
+    };
+    // RGBA8 mip chain sampled with trilinear filtering and repeat wrapping, like the GPU would
+    struct RasterTexture
+    {
+        struct Level
+        {
+            int width;
+            int height;
+            std::vector<unsigned char> texels;
+        };
+        std::vector<Level> levels;
+    };
+    struct RasterModel
+    {
+        std::vector<RasterVertex> vertices;
+        std::vector<unsigned int> indices;
+        int albedo;
+        int normal;
+    };
+
+    void RenderFace(const Face& face, units::pixel map_width, PixelData* albedo, PixelData* normal, PixelData* depth) const;
+    int AddTexture(const PixelData* pixels, bool is_normal_map);
+    static Vector4 SampleTexture(const RasterTexture& texture, Vector2 uv, float lod);
+
+    std::vector<RasterModel> models_;
+    std::vector<RasterTexture> textures_;
+    std::vector<const PixelData*> texture_sources_;
+    bool depth_zero_to_one_;
+};
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
+#endif // BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_ENVIRONMENTMAPRASTERIZER_H_
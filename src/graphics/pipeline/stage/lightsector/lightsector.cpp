@@ -24,9 +24,18 @@
 #include <blons/graphics/pipeline/stage/lightsector/lightsector.h>
 
 // Includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <random>
 // Local Includes
+#include "probenetworksearch.h"
+#include "probeplacer.h"
 #include "radiancetransferbaker.h"
+#include "radiancetransfercache.h"
+#include "radiancetransferrelighter.h"
+#include "relighttracker.h"
 
 namespace blons
 {
@@ -37,6 +46,191 @@ namespace stage
 namespace
 {
 auto cvar_gi_boost = console::RegisterVariable("light:gi-boost", 1.0f);
+auto cvar_bake_cache = console::RegisterVariable("light:bake-cache", 1);
+auto cvar_bake_incremental = console::RegisterVariable("light:bake-incremental", 1);
+auto cvar_rebake_validate = console::RegisterVariable("light:rebake-validate", 0);
+// Spreads bakes across frames instead of blocking until they're done
+auto cvar_bake_progressive = console::RegisterVariable("light:bake-progressive", 0);
+// Number of probes whose environment maps are rendered each frame during progressive bakes
+auto cvar_bake_slice_probes = console::RegisterVariable("light:bake-slice-probes", 16);
+// 0 bakes the built in probe layout, 1 places probes from the scene's geometry before every bake and rebake
+auto cvar_probe_placement = console::RegisterVariable("light:probe-placement", 0);
+// Distance between automatically placed probes away from geometry, halved by each subdivision near surfaces
+auto cvar_probe_spacing = console::RegisterVariable("light:probe-spacing", 4.0f);
+auto cvar_probe_subdivisions = console::RegisterVariable("light:probe-subdivisions", 1);
+// Most probes automatic placement can use, it trades detail for coverage to stay under this
+auto cvar_probe_budget = console::RegisterVariable("light:probe-budget", 1024);
+// 0 relights on the GPU, 1 relights on the CPU and uploads the results, 2 does both and warns if they differ
+auto cvar_relight_cpu = console::RegisterVariable("light:relight-cpu", 0);
+// Skips relighting when nothing it depends on has changed, and only relights what moving models affect
+auto cvar_relight_skip = console::RegisterVariable("light:relight-skip", 1);
+// Frames to keep relighting after a change, giving bounce lighting time to converge
+auto cvar_relight_settle_frames = console::RegisterVariable("light:relight-settle-frames", 16);
+
+const std::string kBakeCacheFilename = "radiancetransfer.cache";
+
+template <typename T>
+bool BakedArraysMatch(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+// Uploads only the range of elements that changed, or the whole array if it changed size
+template <typename T>
+void PatchShaderData(const std::vector<T>& previous, const std::vector<T>& current, std::unique_ptr<ShaderData<T>>* shader_data)
+{
+    if (*shader_data == nullptr || previous.size() != current.size())
+    {
+        shader_data->reset(new ShaderData<T>(current.data(), current.size()));
+        return;
+    }
+    auto element_changed = [&](std::size_t i) { return memcmp(&previous[i], &current[i], sizeof(T)) != 0; };
+    std::size_t first = 0;
+    while (first < current.size() && !element_changed(first))
+    {
+        first++;
+    }
+    if (first == current.size())
+    {
+        return;
+    }
+    std::size_t last = current.size() - 1;
+    while (!element_changed(last))
+    {
+        last--;
+    }
+    (*shader_data)->set_value(current.data() + first, first, last - first + 1);
+}
+
+RadianceTransferRelighter::Inputs MakeRelightInputs(const Scene& scene, Matrix light_vp_matrix)
+{
+    Light* sun = scene.lights[0];
+    RadianceTransferRelighter::Inputs inputs;
+    inputs.light_vp_matrix = light_vp_matrix;
+    // Only read back when relighting on the CPU
+    inputs.light_depth = nullptr;
+    inputs.sun_dir = sun->direction();
+    inputs.sun_colour = sun->colour();
+    inputs.sun_luminance = sun->luminance();
+    inputs.metalness = Vector3(console::var<float>("mtl:metalness"));
+    inputs.gi_boost = cvar_gi_boost->to<float>();
+    inputs.sky_box = scene.sky_box;
+    inputs.sky_luminance = scene.sky_luminance;
+    return inputs;
+}
+
+// Uploads the given ranges of an array
+template <typename T>
+void UploadShaderDataRanges(const std::vector<T>& values, const std::vector<RadianceTransferRelighter::Range>& ranges, ShaderData<T>* shader_data)
+{
+    for (const auto& range : ranges)
+    {
+        shader_data->set_value(values.data() + range.start, range.start, range.count);
+    }
+}
+
+// Box around every point that samples any of the given probes, found from the cells that have them as vertices. Outer
+// cells reach out from the hull forever, so the box is infinite on any side that their vertex normals point towards
+void FindRelitBounds(const std::vector<LightSector::Probe>& probes, const std::vector<LightSector::ProbeSearchCell>& network,
+                     const std::vector<RadianceTransferRelighter::Range>& probe_ranges, Vector3* bounds_min, Vector3* bounds_max)
+{
+    const float kInfinity = std::numeric_limits<float>::infinity();
+    // Searches accept points a little outside of their cell, see kMinBarycentricMargin in probes.lib.glsl
+    const float kCellMargin = 0.05f;
+    std::vector<char> relit(probes.size(), 0);
+    for (const auto& range : probe_ranges)
+    {
+        std::fill(relit.begin() + range.start, relit.begin() + range.start + range.count, 1);
+    }
+    float lo[3] = { kInfinity, kInfinity, kInfinity };
+    float hi[3] = { -kInfinity, -kInfinity, -kInfinity };
+    if (network.empty())
+    {
+        // No network to narrow it down with
+        *bounds_min = Vector3(-kInfinity);
+        *bounds_max = Vector3(kInfinity);
+        return;
+    }
+    auto valid_probe = [&](int probe_id) { return probe_id >= 0 && static_cast<std::size_t>(probe_id) < probes.size(); };
+    for (const auto& cell : network)
+    {
+        bool outer = LightSector::IsOuterProbeSearchCell(cell);
+        int vertex_count = outer ? 3 : 4;
+        bool cell_relit = false;
+        for (int i = 0; i < vertex_count; i++)
+        {
+            cell_relit |= valid_probe(cell.probe_vertices[i]) && relit[cell.probe_vertices[i]];
+        }
+        if (!cell_relit)
+        {
+            continue;
+        }
+        float cell_lo[3] = { kInfinity, kInfinity, kInfinity };
+        float cell_hi[3] = { -kInfinity, -kInfinity, -kInfinity };
+        for (int i = 0; i < vertex_count; i++)
+        {
+            if (!valid_probe(cell.probe_vertices[i]))
+            {
+                continue;
+            }
+            const auto& pos = probes[cell.probe_vertices[i]].pos;
+            const float p[3] = { pos.x, pos.y, pos.z };
+            for (int axis = 0; axis < 3; axis++)
+            {
+                cell_lo[axis] = std::min(cell_lo[axis], p[axis]);
+                cell_hi[axis] = std::max(cell_hi[axis], p[axis]);
+            }
+        }
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float margin = (cell_hi[axis] - cell_lo[axis]) * kCellMargin;
+            cell_lo[axis] -= margin;
+            cell_hi[axis] += margin;
+            // Outer cells hold each vertex's normal in their converter, the cell is extruded along them
+            for (int i = 0; outer && i < 3; i++)
+            {
+                float normal = cell.barycentric_converter.m[i][axis];
+                cell_lo[axis] = normal < 0.0f ? -kInfinity : cell_lo[axis];
+                cell_hi[axis] = normal > 0.0f ? kInfinity : cell_hi[axis];
+            }
+            lo[axis] = std::min(lo[axis], cell_lo[axis]);
+            hi[axis] = std::max(hi[axis], cell_hi[axis]);
+        }
+    }
+    *bounds_min = Vector3(lo[0], lo[1], lo[2]);
+    *bounds_max = Vector3(hi[0], hi[1], hi[2]);
+}
+
+// Relative difference between CPU and GPU lighting, ignoring anything too dim to see
+float RelightError(const Vector3& cpu, const Vector3& gpu)
+{
+    auto channel_error = [](float cpu, float gpu) { return std::abs(cpu - gpu) / std::max(std::abs(gpu), 0.001f); };
+    return std::max(std::max(channel_error(cpu.x, gpu.x), channel_error(cpu.y, gpu.y)), channel_error(cpu.z, gpu.z));
+}
+
+std::vector<LightSector::Probe> MakeProbes(const std::vector<Vector3>& positions)
+{
+    std::vector<LightSector::Probe> probes;
+    probes.reserve(positions.size());
+    for (const auto& pos : positions)
+    {
+        LightSector::Probe probe{ static_cast<int>(probes.size()), pos };
+        probe.brick_factor_range_start = 0;
+        probe.brick_factor_count = 0;
+        probes.push_back(probe);
+    }
+    return probes;
+}
+
+std::vector<Vector3> PlaceProbes(const Scene& scene)
+{
+    log::Debug("Placing probes... ");
+    Timer placement_stats;
+    ProbePlacer placer(scene);
+    auto positions = placer.Place(cvar_probe_spacing->to<float>(), cvar_probe_subdivisions->to<int>(), cvar_probe_budget->to<int>());
+    log::Debug("%i probes [%ims]\n", static_cast<int>(positions.size()), placement_stats.ms());
+    return positions;
+}
 } // namespace
 
 namespace temp
@@ -135,6 +329,7 @@ void GenerateRandomProbes(std::vector<LightSector::Probe>* probes, int num_probe
 } // namespace temp
 
 LightSector::LightSector()
+    : rebaking_(false), rebake_queued_(false), relight_mode_(0), relit_(false), probes_relit_(false)
 {
     temp::GenerateOldSponzaProbes(&probes_);
     // Initialize shader buffer to fit all probes in
@@ -143,23 +338,242 @@ LightSector::LightSector()
     // Relight compute shaders to be run every frame
     surfel_brick_relight_shader_.reset(new ComputeShader({ { COMPUTE, "shaders/surfelbrick-relight.comp.glsl" } }));
     probe_relight_shader_.reset(new ComputeShader({ { COMPUTE, "shaders/probe-relight.comp.glsl" } }));
+    relight_tracker_.reset(new RelightTracker());
+}
+
+LightSector::~LightSector()
+{
 }
 
 void LightSector::BakeRadianceTransfer(const Scene& scene)
 {
-    // Bake the scene and retrieve the data
-    RadianceTransferBaker bake(scene, probes_);
-    probes_ = std::vector<Probe>(bake.probes().begin(), bake.probes().end());
-    surfels_ = bake.surfels();
-    surfel_bricks_ = bake.surfel_bricks();
-    surfel_brick_factors_ = bake.surfel_brick_factors();
-    probe_network_ = bake.probe_network();
+    if (cvar_probe_placement->to<int>() != 0)
+    {
+        auto positions = PlaceProbes(scene);
+        if (!positions.empty())
+        {
+            BakeProbes(scene, MakeProbes(positions));
+            return;
+        }
+        log::Warn("No probes could be placed, keeping the current layout\n");
+    }
+    BakeProbes(scene, probes_);
+}
+
+void LightSector::RebakeRadianceTransfer(const Scene& scene)
+{
+    if (baker_ == nullptr)
+    {
+        BakeRadianceTransfer(scene);
+        return;
+    }
+    // Placement is deterministic, so probes away from whatever changed keep their positions and previous bake
+    if (cvar_probe_placement->to<int>() != 0)
+    {
+        auto positions = PlaceProbes(scene);
+        if (!positions.empty())
+        {
+            RebakeRadianceTransfer(scene, positions);
+            return;
+        }
+        log::Warn("No probes could be placed, keeping the current layout\n");
+    }
+    // Builds on whatever layout is being baked, so a queued rebake doesn't undo it
+    RebakeProbes(scene, baker_->baking() ? bake_probes_ : probes_);
+}
+
+void LightSector::RebakeRadianceTransfer(const Scene& scene, const std::vector<Vector3>& probe_positions)
+{
+    auto probes = MakeProbes(probe_positions);
+    // Without a previous bake to build from, everything must be baked regardless
+    if (baker_ == nullptr)
+    {
+        BakeProbes(scene, probes);
+        return;
+    }
+    RebakeProbes(scene, probes);
+}
+
+void LightSector::ContinueBake(const Scene& scene)
+{
+    if (baker_ == nullptr || !baker_->baking())
+    {
+        return;
+    }
+    if (!baker_->ContinueBake(scene, cvar_bake_slice_probes->to<int>()))
+    {
+        return;
+    }
+    // Everything is swapped in at once between frames, so relighting never sees a partial bake
+    if (rebaking_)
+    {
+        PatchRadianceTransfer(scene);
+    }
+    else
+    {
+        UpdateRadianceTransfer(scene);
+        UploadRadianceTransfer();
+    }
+    log::Debug("Progressively baked radiance transfer [%ims]\n", bake_stats_.ms());
+    if (rebake_queued_)
+    {
+        rebake_queued_ = false;
+        auto probes = std::move(queued_probes_);
+        if (baker_ == nullptr)
+        {
+            BakeProbes(scene, probes);
+        }
+        else
+        {
+            RebakeProbes(scene, probes);
+        }
+    }
+}
+
+void LightSector::BakeProbes(const Scene& scene, const std::vector<Probe>& probes)
+{
+    // Anything still waiting on an older bake is superseded by this one
+    rebake_queued_ = false;
+    rebaking_ = false;
+    // Skip the bake entirely if it's already been done for this exact scene
+    RadianceTransferCache cache(scene, probes, console::var<int>("light:bake-env-maps"));
+    bool use_cache = cvar_bake_cache->to<int>() != 0;
+    log::Debug("Loading radiance transfer cache... ");
+    Timer cache_load_stats;
+    // Loaded into copies of the new layout, so a miss leaves the results in use alone
+    std::vector<Probe> cached_probes(probes.begin(), probes.end());
+    std::vector<ProbeSearchCell> cached_probe_network;
+    std::vector<Surfel> cached_surfels;
+    std::vector<SurfelBrick> cached_surfel_bricks;
+    std::vector<SurfelBrickFactor> cached_surfel_brick_factors;
+    if (use_cache && cache.Load(kBakeCacheFilename, &cached_probes, &cached_probe_network, &cached_surfels, &cached_surfel_bricks, &cached_surfel_brick_factors))
+    {
+        log::Debug("[%ims]\n", cache_load_stats.ms());
+        probes_ = std::move(cached_probes);
+        probe_network_ = std::move(cached_probe_network);
+        surfels_ = std::move(cached_surfels);
+        surfel_bricks_ = std::move(cached_surfel_bricks);
+        surfel_brick_factors_ = std::move(cached_surfel_brick_factors);
+        baker_.reset();
+    }
+    else
+    {
+        log::Debug("miss\n");
+        if (cvar_bake_progressive->to<int>() != 0)
+        {
+            // The previous results stay in use until ContinueBake() finishes this
+            log::Debug("Baking radiance transfer progressively...\n");
+            bake_stats_.Start();
+            bake_probes_ = std::vector<Probe>(probes.begin(), probes.end());
+            baker_.reset(new RadianceTransferBaker(scene, bake_probes_, true));
+            return;
+        }
+        // Bake the scene and retrieve the data
+        baker_.reset(new RadianceTransferBaker(scene, probes));
+        UpdateRadianceTransfer(scene);
+    }
+    UploadRadianceTransfer();
+}
+
+void LightSector::RebakeProbes(const Scene& scene, const std::vector<Probe>& probes)
+{
+    // Only one bake runs at a time, so this waits for the current one to build on top of it
+    if (baker_->baking())
+    {
+        log::Debug("Queued radiance transfer rebake\n");
+        queued_probes_ = std::vector<Probe>(probes.begin(), probes.end());
+        rebake_queued_ = true;
+        return;
+    }
+    log::Debug("Rebaking radiance transfer...\n");
+    Timer rebake_stats;
+    bool progressive = cvar_bake_progressive->to<int>() != 0;
+    if (!baker_->Rebake(scene, probes, progressive))
+    {
+        log::Debug("Nothing to rebake [%ims]\n", rebake_stats.ms());
+        return;
+    }
+    bake_probes_ = std::vector<Probe>(probes.begin(), probes.end());
+    rebaking_ = true;
+    if (progressive)
+    {
+        bake_stats_.Start();
+        return;
+    }
+    PatchRadianceTransfer(scene);
+    log::Debug("Rebaked radiance transfer [%ims]\n", rebake_stats.ms());
+}
+
+void LightSector::UpdateRadianceTransfer(const Scene& scene)
+{
+    probes_ = std::vector<Probe>(baker_->probes().begin(), baker_->probes().end());
+    surfels_ = baker_->surfels();
+    surfel_bricks_ = baker_->surfel_bricks();
+    surfel_brick_factors_ = baker_->surfel_brick_factors();
+    probe_network_ = baker_->probe_network();
+    RadianceTransferCache cache(scene, probes_, baker_->env_map_mode());
+    if (cvar_bake_cache->to<int>() != 0 &&
+        !cache.Save(kBakeCacheFilename, probes_, probe_network_, surfels_, surfel_bricks_, surfel_brick_factors_))
+    {
+        log::Warn("Failed to save radiance transfer cache\n");
+    }
+}
+
+void LightSector::UploadRadianceTransfer()
+{
+    // Samples are only kept around for rebakes, and take up quite a bit of memory
+    if (cvar_bake_incremental->to<int>() == 0)
+    {
+        baker_.reset();
+    }
     // Update shader buffer with generated radiance data
     probe_shader_data_.reset(new ShaderData<LightSector::Probe>(probes_.data(), probes_.size()));
     probe_network_shader_data_.reset(new ShaderData<LightSector::ProbeSearchCell>(probe_network_.data(), probe_network_.size()));
     surfel_shader_data_.reset(new ShaderData<LightSector::Surfel>(surfels_.data(), surfels_.size()));
     surfel_brick_shader_data_.reset(new ShaderData<LightSector::SurfelBrick>(surfel_bricks_.data(), surfel_bricks_.size()));
     surfel_brick_factor_shader_data_.reset(new ShaderData<LightSector::SurfelBrickFactor>(surfel_brick_factors_.data(), surfel_brick_factors_.size()));
+    probe_search_.reset(new ProbeNetworkSearch(probes_, probe_network_));
+    relight_tracker_->Invalidate();
+}
+
+void LightSector::PatchRadianceTransfer(const Scene& scene)
+{
+    // Hold onto the old results so only what changed has to be sent to the GPU
+    auto previous_probes = std::move(probes_);
+    auto previous_probe_network = std::move(probe_network_);
+    auto previous_surfels = std::move(surfels_);
+    auto previous_surfel_bricks = std::move(surfel_bricks_);
+    auto previous_surfel_brick_factors = std::move(surfel_brick_factors_);
+    UpdateRadianceTransfer(scene);
+
+    PatchShaderData(previous_probes, probes_, &probe_shader_data_);
+    PatchShaderData(previous_probe_network, probe_network_, &probe_network_shader_data_);
+    PatchShaderData(previous_surfels, surfels_, &surfel_shader_data_);
+    PatchShaderData(previous_surfel_bricks, surfel_bricks_, &surfel_brick_shader_data_);
+    PatchShaderData(previous_surfel_brick_factors, surfel_brick_factors_, &surfel_brick_factor_shader_data_);
+    probe_search_.reset(new ProbeNetworkSearch(probes_, probe_network_));
+    relight_tracker_->Invalidate();
+
+    // Checks that rebaking gave the exact same results as baking everything from scratch
+    if (cvar_rebake_validate->to<int>() != 0)
+    {
+        log::Debug("Validating rebake against full bake...\n");
+        RadianceTransferBaker bake(scene, bake_probes_);
+        bool probes_match = BakedArraysMatch(bake.probes(), probes_);
+        bool probe_network_match = BakedArraysMatch(bake.probe_network(), probe_network_);
+        bool surfels_match = BakedArraysMatch(bake.surfels(), surfels_);
+        bool surfel_bricks_match = BakedArraysMatch(bake.surfel_bricks(), surfel_bricks_);
+        bool surfel_brick_factors_match = BakedArraysMatch(bake.surfel_brick_factors(), surfel_brick_factors_);
+        if (probes_match && probe_network_match && surfels_match && surfel_bricks_match && surfel_brick_factors_match)
+        {
+            log::Debug("Rebake matches full bake\n");
+        }
+        else
+        {
+            log::Warn("Rebake differs from full bake! probes:%i network:%i surfels:%i bricks:%i factors:%i\n",
+                      probes_match, probe_network_match, surfels_match, surfel_bricks_match, surfel_brick_factors_match);
+        }
+    }
 }
 
 bool LightSector::Relight(const Scene& scene, const Shadow& shadow, Matrix light_vp_matrix)
@@ -168,7 +582,46 @@ bool LightSector::Relight(const Scene& scene, const Shadow& shadow, Matrix light
     assert(scene.lights.size() == 1);
     Light* sun = scene.lights[0];
 
-    // Iterate over every brick, relighting their surfels and building a radiance term
+    // Switching backends starts lighting over, since the CPU and GPU copies aren't kept in sync
+    int relight_cpu = cvar_relight_cpu->to<int>();
+    if (cvar_relight_skip->to<int>() == 0 || relight_cpu != relight_mode_)
+    {
+        relight_tracker_->Invalidate();
+    }
+    relight_mode_ = relight_cpu;
+    relit_ = relight_tracker_->Update(scene, MakeRelightInputs(scene, light_vp_matrix), cvar_relight_settle_frames->to<int>(),
+                                      surfels_, surfel_bricks_, probes_, surfel_brick_factors_);
+    // Nothing to light until the first progressive bake is done, or if nothing has changed
+    probes_relit_ = false;
+    if (!baked() || !relit_)
+    {
+        return true;
+    }
+    const auto& brick_ranges = relight_tracker_->brick_ranges();
+    const auto& probe_ranges = relight_tracker_->probe_ranges();
+    probes_relit_ = !probe_ranges.empty();
+    if (probes_relit_)
+    {
+        FindRelitBounds(probes_, probe_network_, probe_ranges, &relit_min_, &relit_max_);
+    }
+
+    if (relight_cpu == 1)
+    {
+        RelightCPU(scene, shadow, light_vp_matrix);
+        UploadShaderDataRanges(surfels_, relight_tracker_->SurfelRanges(surfel_bricks_), surfel_shader_data_.get());
+        UploadShaderDataRanges(surfel_bricks_, brick_ranges, surfel_brick_shader_data_.get());
+        UploadShaderDataRanges(probes_, probe_ranges, probe_shader_data_.get());
+        return true;
+    }
+    else if (relight_cpu == 2)
+    {
+        // Starts from the same lighting as the GPU, since surfels are lit with the previous frame's probes
+        render::context()->GetShaderData(probe_shader_data_->data(), probes_.data());
+        render::context()->GetShaderData(surfel_shader_data_->data(), surfels_.data());
+        render::context()->GetShaderData(surfel_brick_shader_data_->data(), surfel_bricks_.data());
+    }
+
+    // Iterate over every dirty brick, relighting their surfels and building a radiance term
     if (!surfel_brick_relight_shader_->SetInput("light_vp_matrix", light_vp_matrix) ||
         !surfel_brick_relight_shader_->SetInput("light_depth", shadow.output(Shadow::LIGHT_DEPTH)) ||
         !surfel_brick_relight_shader_->SetInput("sun.dir", sun->direction()) ||
@@ -182,9 +635,16 @@ bool LightSector::Relight(const Scene& scene, const Shadow& shadow, Matrix light
     {
         return false;
     }
-    surfel_brick_relight_shader_->Run(static_cast<unsigned int>(surfel_bricks_.size()), 1, 1);
+    for (const auto& range : brick_ranges)
+    {
+        if (!surfel_brick_relight_shader_->SetInput("brick_offset", static_cast<int>(range.start)))
+        {
+            return false;
+        }
+        surfel_brick_relight_shader_->Run(static_cast<unsigned int>(range.count), 1, 1);
+    }
 
-    // Iterate over every probe, building an irradiance term from sky light and any visible surfel bricks
+    // Iterate over every dirty probe, building an irradiance term from sky light and any visible surfel bricks
     if (!probe_relight_shader_->SetInput("probe_buffer", probe_shader_data()) ||
         !probe_relight_shader_->SetInput("surfel_brick_buffer", surfel_brick_shader_data()) ||
         !probe_relight_shader_->SetInput("surfel_brick_factor_buffer", surfel_brick_factor_shader_data()) ||
@@ -195,7 +655,83 @@ bool LightSector::Relight(const Scene& scene, const Shadow& shadow, Matrix light
     {
         return false;
     }
-    probe_relight_shader_->Run(static_cast<unsigned int>(probes_.size()), 1, 1);
+    for (const auto& range : probe_ranges)
+    {
+        if (!probe_relight_shader_->SetInput("probe_offset", static_cast<int>(range.start)))
+        {
+            return false;
+        }
+        probe_relight_shader_->Run(static_cast<unsigned int>(range.count), 1, 1);
+    }
+
+    if (relight_cpu == 2)
+    {
+        RelightCPU(scene, shadow, light_vp_matrix);
+        ValidateRelight();
+    }
+    return true;
+}
+
+void LightSector::RelightCPU(const Scene& scene, const Shadow& shadow, Matrix light_vp_matrix)
+{
+    auto light_depth = render::context()->GetTextureData(shadow.output(Shadow::LIGHT_DEPTH), 0);
+    auto inputs = MakeRelightInputs(scene, light_vp_matrix);
+    inputs.light_depth = &light_depth;
+    RadianceTransferRelighter::Relight(inputs, surfel_brick_factors_, relight_tracker_->brick_ranges(), relight_tracker_->probe_ranges(),
+                                       &surfels_, &surfel_bricks_, &probes_);
+}
+
+void LightSector::ValidateRelight()
+{
+    // Copied to get arrays of the right size, the contents are overwritten by the GPU's
+    std::vector<Probe> gpu_probes(probes_);
+    std::vector<SurfelBrick> gpu_bricks(surfel_bricks_);
+    render::context()->GetShaderData(probe_shader_data_->data(), gpu_probes.data());
+    render::context()->GetShaderData(surfel_brick_shader_data_->data(), gpu_bricks.data());
+
+    float brick_error = 0.0f;
+    for (std::size_t i = 0; i < surfel_bricks_.size(); i++)
+    {
+        brick_error = std::max(brick_error, RelightError(surfel_bricks_[i].radiance, gpu_bricks[i].radiance));
+    }
+    float probe_error = 0.0f;
+    for (std::size_t i = 0; i < probes_.size(); i++)
+    {
+        for (int cube_face = 0; cube_face < 6; cube_face++)
+        {
+            probe_error = std::max(probe_error, RelightError(probes_[i].irradiance.coeffs[cube_face],
+                                                             gpu_probes[i].irradiance.coeffs[cube_face]));
+        }
+    }
+    // Texture filtering and fused multiply-adds on the GPU mean the results are never quite exact
+    if (brick_error > 0.01f || probe_error > 0.01f)
+    {
+        log::Warn("CPU relight differs from GPU! brick error:%.4f probe error:%.4f\n", brick_error, probe_error);
+    }
+    else
+    {
+        log::Debug("CPU relight matches GPU, brick error:%.4f probe error:%.4f\n", brick_error, probe_error);
+    }
+}
+
+bool LightSector::relit() const
+{
+    return relit_;
+}
+
+bool LightSector::probes_relit() const
+{
+    return probes_relit_;
+}
+
+bool LightSector::RelitProbeBounds(Vector3* bounds_min, Vector3* bounds_max) const
+{
+    if (!probes_relit_)
+    {
+        return false;
+    }
+    *bounds_min = relit_min_;
+    *bounds_max = relit_max_;
     return true;
 }
 
@@ -206,97 +742,40 @@ bool LightSector::IsOuterProbeSearchCell(const ProbeSearchCell& cell)
 
 LightSector::ProbeSearchWeights LightSector::FindProbeWeights(const Vector3& point) const
 {
-    ProbeSearchWeights weights = {};
-    const units::world kMinBarycentricMargin = -0.01f;
-    const units::world kMinPlaneDistance = abs(kMinBarycentricMargin) / 2.0f;
-    const std::size_t kMaxSteps = probe_network_.size();
-    int cell_id = 0;
-    for (int i = 0; i < kMaxSteps; i++)
-    {
-        const auto& cell = probe_network_[cell_id];
-        Vector4 barycentric_coords;
-        // Barycentric coordinates are calculated by different means for outer and inner cells
-        if (IsOuterProbeSearchCell(cell))
-        {
-            // Collect the positions of the 3 probes in this outer cell
-            std::array<Vector3, 3> pos = { probes_[cell.probe_vertices[0]].pos,
-                                           probes_[cell.probe_vertices[1]].pos,
-                                           probes_[cell.probe_vertices[2]].pos };
-            // Collect each vertex normal, pre-scaled during bake to have a distance from the hull plane equal to 1
-            const auto& m = cell.barycentric_converter.m;
-            std::array<Vector3, 3> normal = { Vector3(m[0][0], m[0][1], m[0][2]),
-                                              Vector3(m[1][0], m[1][1], m[1][2]),
-                                              Vector3(m[2][0], m[2][1], m[2][2]) };
-            Vector3 plane_normal = VectorNormalize(VectorCross(pos[1] - pos[0], pos[2] - pos[0]));
-            Vector3 ray = point - pos[0];
-            units::world distance_to_plane = VectorDot(plane_normal, ray);
-            if (distance_to_plane < kMinPlaneDistance)
-            {
-                cell_id = cell.neighbours[LightSector::FACE];
-                continue;
-            }
-            // Extrude the hull face to contain our world position
-            Triangle extruded_face = { { pos[0] + (normal[0] * distance_to_plane),
-                                         pos[1] + (normal[1] * distance_to_plane),
-                                         pos[2] + (normal[2] * distance_to_plane) } };
-            // Then calculate the barycentric coordinates from the extruded triangle
-            barycentric_coords = TriangleBarycentric(extruded_face, point);
-            // There are only 3 probes for an outer cell, the last weight will always be 0
-            barycentric_coords.w = 0.0f;
-            if (barycentric_coords.x < kMinBarycentricMargin)
-            {
-                cell_id = cell.neighbours[LightSector::EDGE_12];
-                continue;
-            }
-            if (barycentric_coords.y < kMinBarycentricMargin)
-            {
-                cell_id = cell.neighbours[LightSector::EDGE_02];
-                continue;
-            }
-            if (barycentric_coords.z < kMinBarycentricMargin)
-            {
-                cell_id = cell.neighbours[LightSector::EDGE_01];
-                continue;
-            }
-        }
-        else
+    ProbeSearchResult result = {};
+    if (probe_search_ == nullptr || !probe_search_->Find(point, INVALID_ID, &result))
+    {
+        log::Warn("Failed to find probe lighting cell\n");
+    }
+    return result.weights;
+}
+
+void LightSector::FindProbeWeights(const Vector3* points, const int* hint_cells, std::size_t count, ProbeSearchResult* results) const
+{
+    if (probe_search_ == nullptr)
+    {
+        for (std::size_t i = 0; i < count; i++)
         {
-            Vector4 barycentric_pos(point - probes_[cell.probe_vertices[0]].pos);
-            barycentric_coords = barycentric_pos * cell.barycentric_converter;
-            barycentric_coords = Vector4(1.0f - barycentric_coords.x - barycentric_coords.y - barycentric_coords.z, barycentric_coords.x, barycentric_coords.y, barycentric_coords.z);
-            if (barycentric_coords.x < kMinBarycentricMargin)
-            {
-                cell_id = cell.neighbours[LightSector::FACE_123];
-                continue;
-            }
-            if (barycentric_coords.y < kMinBarycentricMargin)
-            {
-                cell_id = cell.neighbours[LightSector::FACE_023];
-                continue;
-            }
-            if (barycentric_coords.z < kMinBarycentricMargin)
-            {
-                cell_id = cell.neighbours[LightSector::FACE_013];
-                continue;
-            }
-            if (barycentric_coords.w < kMinBarycentricMargin)
-            {
-                cell_id = cell.neighbours[LightSector::FACE_012];
-                continue;
-            }
+            results[i] = {};
+            results[i].cell_id = INVALID_ID;
         }
-        weights[0].id = cell.probe_vertices[0];
-        weights[0].weight = std::max(barycentric_coords.x, 0.0f);
-        weights[1].id = cell.probe_vertices[1];
-        weights[1].weight = std::max(barycentric_coords.y, 0.0f);
-        weights[2].id = cell.probe_vertices[2];
-        weights[2].weight = std::max(barycentric_coords.z, 0.0f);
-        weights[3].id = IsOuterProbeSearchCell(cell) ? 0 : cell.probe_vertices[3];
-        weights[3].weight = std::max(barycentric_coords.w, 0.0f);
-        return weights;
-    }
-    log::Warn("Failed to find probe lighting cell\n");
-    return weights;
+        return;
+    }
+    probe_search_->Find(points, hint_cells, count, results);
+}
+
+bool LightSector::baked() const
+{
+    return surfel_brick_factor_shader_data_ != nullptr;
+}
+
+float LightSector::bake_progress() const
+{
+    if (baker_ == nullptr || !baker_->baking())
+    {
+        return 1.0f;
+    }
+    return baker_->progress();
 }
 
 const std::vector<LightSector::Probe>& LightSector::probes() const
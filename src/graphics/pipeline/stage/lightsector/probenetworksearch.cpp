@@ -0,0 +1,254 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "probenetworksearch.h"
+
+// Includes
+#include <algorithm>
+#include <array>
+#include <cmath>
+// Public Includes
+#include <blons/system/job.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+namespace
+{
+const units::world kMinBarycentricMargin = -0.01f;
+const units::world kMinPlaneDistance = std::abs(kMinBarycentricMargin) / 2.0f;
+// Grid resolution is picked to have about this many voxels per probe, up to a limit on each axis
+const units::world kGridVoxelsPerProbe = 1.0f;
+const int kMaxGridDim = 128;
+// Queries are cheap, so each job needs plenty of them to be worth it
+const std::size_t kQueriesPerJob = 256;
+} // namespace
+
+ProbeNetworkSearch::ProbeNetworkSearch(const std::vector<LightSector::Probe>& probes, const std::vector<LightSector::ProbeSearchCell>& network)
+    : network_(network), grid_dims_{ 0, 0, 0 }, grid_min_(0.0f), grid_voxel_size_(1.0f)
+{
+    probe_positions_.reserve(probes.size());
+    for (const auto& probe : probes)
+    {
+        probe_positions_.push_back(probe.pos);
+    }
+    plane_normals_.resize(network_.size());
+    for (std::size_t i = 0; i < network_.size(); i++)
+    {
+        const auto& cell = network_[i];
+        if (LightSector::IsOuterProbeSearchCell(cell))
+        {
+            const auto& p0 = probe_positions_[cell.probe_vertices[0]];
+            const auto& p1 = probe_positions_[cell.probe_vertices[1]];
+            const auto& p2 = probe_positions_[cell.probe_vertices[2]];
+            plane_normals_[i] = VectorNormalize(VectorCross(p1 - p0, p2 - p0));
+        }
+    }
+    if (network_.empty() || probe_positions_.empty())
+    {
+        return;
+    }
+
+    // Size voxels to the probe bounds, padded so every probe is strictly inside
+    Vector3 bounds_min = probe_positions_[0];
+    Vector3 bounds_max = probe_positions_[0];
+    for (const auto& pos : probe_positions_)
+    {
+        bounds_min = Vector3(std::min(bounds_min.x, pos.x), std::min(bounds_min.y, pos.y), std::min(bounds_min.z, pos.z));
+        bounds_max = Vector3(std::max(bounds_max.x, pos.x), std::max(bounds_max.y, pos.y), std::max(bounds_max.z, pos.z));
+    }
+    Vector3 extent = bounds_max - bounds_min + Vector3(1e-3f);
+    units::world volume = extent.x * extent.y * extent.z;
+    grid_voxel_size_ = std::cbrt(volume / (static_cast<units::world>(probe_positions_.size()) * kGridVoxelsPerProbe));
+    // Flat networks have no volume, so fall back on their longest side
+    grid_voxel_size_ = std::max(grid_voxel_size_, std::max(extent.x, std::max(extent.y, extent.z)) / static_cast<units::world>(kMaxGridDim));
+    const units::world axis_extents[3] = { extent.x, extent.y, extent.z };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        grid_dims_[axis] = std::min(std::max(static_cast<int>(std::ceil(axis_extents[axis] / grid_voxel_size_)), 1), kMaxGridDim);
+    }
+    grid_min_ = bounds_min - Vector3(5e-4f);
+
+    // Each row of voxels walks along from where the last voxel was found
+    grid_cells_.resize(static_cast<std::size_t>(grid_dims_[0]) * grid_dims_[1] * grid_dims_[2], 0);
+    ParallelFor(0, static_cast<std::size_t>(grid_dims_[1]) * grid_dims_[2], 1, [&](std::size_t row)
+    {
+        int cell_id = 0;
+        for (int x = 0; x < grid_dims_[0]; x++)
+        {
+            Vector3 center = grid_min_ + Vector3(static_cast<units::world>(x) + 0.5f,
+                                                 static_cast<units::world>(row % grid_dims_[1]) + 0.5f,
+                                                 static_cast<units::world>(row / grid_dims_[1]) + 0.5f) * grid_voxel_size_;
+            LightSector::ProbeSearchResult result;
+            if (Walk(center, cell_id, &result))
+            {
+                cell_id = result.cell_id;
+            }
+            grid_cells_[row * grid_dims_[0] + x] = cell_id;
+        }
+    });
+}
+
+bool ProbeNetworkSearch::Find(const Vector3& point, int start_cell, LightSector::ProbeSearchResult* result) const
+{
+    if (start_cell == LightSector::INVALID_ID)
+    {
+        start_cell = GridCell(point);
+    }
+    if (Walk(point, start_cell, result))
+    {
+        return true;
+    }
+    *result = {};
+    result->cell_id = LightSector::INVALID_ID;
+    return false;
+}
+
+void ProbeNetworkSearch::Find(const Vector3* points, const int* hint_cells, std::size_t count, LightSector::ProbeSearchResult* results) const
+{
+    const int cell_count = static_cast<int>(network_.size());
+    ParallelFor(0, count, kQueriesPerJob, [&](std::size_t i)
+    {
+        int hint = hint_cells != nullptr ? hint_cells[i] : LightSector::INVALID_ID;
+        if (hint >= 0 && hint < cell_count && Walk(points[i], hint, &results[i]))
+        {
+            return;
+        }
+        Find(points[i], LightSector::INVALID_ID, &results[i]);
+    });
+}
+
+int ProbeNetworkSearch::GridCell(const Vector3& point) const
+{
+    if (grid_cells_.empty())
+    {
+        return 0;
+    }
+    // Points outside of the grid start from the closest voxel on its edge
+    Vector3 voxel_pos = (point - grid_min_) / grid_voxel_size_;
+    const units::world coords[3] = { voxel_pos.x, voxel_pos.y, voxel_pos.z };
+    int voxel[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        units::world clamped = std::min(std::max(coords[axis], 0.0f), static_cast<units::world>(grid_dims_[axis] - 1));
+        voxel[axis] = static_cast<int>(clamped);
+    }
+    return grid_cells_[(static_cast<std::size_t>(voxel[2]) * grid_dims_[1] + voxel[1]) * grid_dims_[0] + voxel[0]];
+}
+
+bool ProbeNetworkSearch::Walk(const Vector3& point, int cell_id, LightSector::ProbeSearchResult* result) const
+{
+    const std::size_t kMaxSteps = network_.size();
+    for (std::size_t i = 0; i < kMaxSteps; i++)
+    {
+        const auto& cell = network_[cell_id];
+        Vector4 barycentric_coords;
+        // Barycentric coordinates are calculated by different means for outer and inner cells
+        if (LightSector::IsOuterProbeSearchCell(cell))
+        {
+            // Collect the positions of the 3 probes in this outer cell
+            std::array<Vector3, 3> pos = { probe_positions_[cell.probe_vertices[0]],
+                                           probe_positions_[cell.probe_vertices[1]],
+                                           probe_positions_[cell.probe_vertices[2]] };
+            // Collect each vertex normal, pre-scaled during bake to have a distance from the hull plane equal to 1
+            const auto& m = cell.barycentric_converter.m;
+            std::array<Vector3, 3> normal = { Vector3(m[0][0], m[0][1], m[0][2]),
+                                              Vector3(m[1][0], m[1][1], m[1][2]),
+                                              Vector3(m[2][0], m[2][1], m[2][2]) };
+            Vector3 ray = point - pos[0];
+            units::world distance_to_plane = VectorDot(plane_normals_[cell_id], ray);
+            if (distance_to_plane < kMinPlaneDistance)
+            {
+                cell_id = cell.neighbours[LightSector::FACE];
+                continue;
+            }
+            // Extrude the hull face to contain our world position
+            Triangle extruded_face = { { pos[0] + (normal[0] * distance_to_plane),
+                                         pos[1] + (normal[1] * distance_to_plane),
+                                         pos[2] + (normal[2] * distance_to_plane) } };
+            // Then calculate the barycentric coordinates from the extruded triangle
+            barycentric_coords = TriangleBarycentric(extruded_face, point);
+            // There are only 3 probes for an outer cell, the last weight will always be 0
+            barycentric_coords.w = 0.0f;
+            if (barycentric_coords.x < kMinBarycentricMargin)
+            {
+                cell_id = cell.neighbours[LightSector::EDGE_12];
+                continue;
+            }
+            if (barycentric_coords.y < kMinBarycentricMargin)
+            {
+                cell_id = cell.neighbours[LightSector::EDGE_02];
+                continue;
+            }
+            if (barycentric_coords.z < kMinBarycentricMargin)
+            {
+                cell_id = cell.neighbours[LightSector::EDGE_01];
+                continue;
+            }
+        }
+        else
+        {
+            Vector4 barycentric_pos(point - probe_positions_[cell.probe_vertices[0]]);
+            barycentric_coords = barycentric_pos * cell.barycentric_converter;
+            barycentric_coords = Vector4(1.0f - barycentric_coords.x - barycentric_coords.y - barycentric_coords.z, barycentric_coords.x, barycentric_coords.y, barycentric_coords.z);
+            if (barycentric_coords.x < kMinBarycentricMargin)
+            {
+                cell_id = cell.neighbours[LightSector::FACE_123];
+                continue;
+            }
+            if (barycentric_coords.y < kMinBarycentricMargin)
+            {
+                cell_id = cell.neighbours[LightSector::FACE_023];
+                continue;
+            }
+            if (barycentric_coords.z < kMinBarycentricMargin)
+            {
+                cell_id = cell.neighbours[LightSector::FACE_013];
+                continue;
+            }
+            if (barycentric_coords.w < kMinBarycentricMargin)
+            {
+                cell_id = cell.neighbours[LightSector::FACE_012];
+                continue;
+            }
+        }
+        auto& weights = result->weights;
+        weights[0].id = cell.probe_vertices[0];
+        weights[0].weight = std::max(barycentric_coords.x, 0.0f);
+        weights[1].id = cell.probe_vertices[1];
+        weights[1].weight = std::max(barycentric_coords.y, 0.0f);
+        weights[2].id = cell.probe_vertices[2];
+        weights[2].weight = std::max(barycentric_coords.z, 0.0f);
+        weights[3].id = LightSector::IsOuterProbeSearchCell(cell) ? 0 : cell.probe_vertices[3];
+        weights[3].weight = std::max(barycentric_coords.w, 0.0f);
+        result->cell_id = cell_id;
+        return true;
+    }
+    return false;
+}
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
@@ -0,0 +1,73 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_PROBENETWORKSEARCH_H_
+#define BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_PROBENETWORKSEARCH_H_
+
+// Includes
+#include <vector>
+// Public Includes
+#include <blons/graphics/pipeline/stage/lightsector/lightsector.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+// Finds the cell of a probe network containing a point by walking from cell to cell towards it. Walks start from
+// a hint cell, like where the point was last frame, or from a uniform grid of cells covering the network, so they
+// rarely take more than a few steps. The hull plane of each outer cell is computed once up front
+class ProbeNetworkSearch
+{
+public:
+    // Copies what it needs from the probes and network, which can change afterwards without affecting the search
+    ProbeNetworkSearch(const std::vector<LightSector::Probe>& probes, const std::vector<LightSector::ProbeSearchCell>& network);
+    ~ProbeNetworkSearch() {}
+
+    // Searches from start_cell, or from the grid if it's INVALID_ID. Returns false if no cell was found
+    bool Find(const Vector3& point, int start_cell, LightSector::ProbeSearchResult* result) const;
+    // Searches for every point across the worker threads, starting from each hint cell where given. Hints that
+    // are out of range or lead nowhere fall back on the grid. Cells that can't be found are set to INVALID_ID
+    void Find(const Vector3* points, const int* hint_cells, std::size_t count, LightSector::ProbeSearchResult* results) const;
+
+    // Cell that searches for a point start from when there's no hint
+    int GridCell(const Vector3& point) const;
+
+private:
+    bool Walk(const Vector3& point, int cell_id, LightSector::ProbeSearchResult* result) const;
+
+    std::vector<Vector3> probe_positions_;
+    std::vector<LightSector::ProbeSearchCell> network_;
+    // Unit normal of each outer cell's hull face, unused for inner cells
+    std::vector<Vector3> plane_normals_;
+    // Cell containing the center of each voxel of a grid over the probes, ordered by x, then y, then z
+    std::vector<int> grid_cells_;
+    int grid_dims_[3];
+    Vector3 grid_min_;
+    units::world grid_voxel_size_;
+};
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
+#endif // BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_PROBENETWORKSEARCH_H_
@@ -0,0 +1,279 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "probeplacer.h"
+
+// Includes
+#include <algorithm>
+#include <cmath>
+// Public Includes
+#include <blons/system/job.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+namespace
+{
+// Deepest a root cell can be split, so keys fit the root index in the remaining bits
+const int kMaxSubdivisions = 8;
+// Distance from the center of a cell to its corners, relative to its size
+const units::world kCellHalfDiagonal = 0.8660254f;
+// Closest a probe can be to a surface, relative to the size of its cell
+const units::world kSurfaceOffset = 0.25f;
+const int kSurfacePushes = 4;
+// How much wider the spacing grows each time a layout doesn't fit the probe budget
+const units::world kSpacingGrowth = 1.25f;
+const int kInsideTestRays = 16;
+
+// Rays cast to tell whether a point is inside of solid geometry, spread evenly over the sphere
+const std::vector<Vector3>& InsideTestDirections()
+{
+    static const std::vector<Vector3> directions = []()
+    {
+        // Fibonacci sphere, which avoids lining rays up with axis aligned walls
+        const float kGoldenAngle = kPi * (3.0f - sqrt(5.0f));
+        std::vector<Vector3> dirs;
+        for (int i = 0; i < kInsideTestRays; i++)
+        {
+            float y = 1.0f - (static_cast<float>(i) + 0.5f) / static_cast<float>(kInsideTestRays) * 2.0f;
+            float radius = sqrt(1.0f - y * y);
+            float theta = kGoldenAngle * static_cast<float>(i);
+            dirs.push_back(Vector3(cos(theta) * radius, y, sin(theta) * radius));
+        }
+        return dirs;
+    }();
+    return directions;
+}
+} // namespace
+
+ProbePlacer::ProbePlacer(const Scene& scene)
+    : bounds_min_(0.0f), bounds_max_(0.0f)
+{
+    std::vector<BVH::Instance> instances;
+    bool has_bounds = false;
+    for (const auto& model : scene.models)
+    {
+        const auto& mesh = model->mesh();
+        Vector3 pos = model->pos();
+        Vector3 scale = model->scale();
+        instances.push_back({ &mesh, MatrixScale(scale.x, scale.y, scale.z) * MatrixTranslation(pos.x, pos.y, pos.z) });
+        meshes_.push_back(&mesh);
+        scales_.push_back(scale);
+        if (mesh.draw_mode != TRIANGLES)
+        {
+            continue;
+        }
+        for (const auto& v : mesh.vertices)
+        {
+            Vector3 world_pos = v.pos * scale + pos;
+            if (!has_bounds)
+            {
+                bounds_min_ = world_pos;
+                bounds_max_ = world_pos;
+                has_bounds = true;
+            }
+            bounds_min_ = Vector3(std::min(bounds_min_.x, world_pos.x), std::min(bounds_min_.y, world_pos.y), std::min(bounds_min_.z, world_pos.z));
+            bounds_max_ = Vector3(std::max(bounds_max_.x, world_pos.x), std::max(bounds_max_.y, world_pos.y), std::max(bounds_max_.z, world_pos.z));
+        }
+    }
+    bvh_.reset(new BVH(instances));
+}
+
+std::vector<Vector3> ProbePlacer::Place(units::world spacing, int subdivisions, int max_probes) const
+{
+    if (!(spacing > 0.0f))
+    {
+        throw "Probe spacing must be positive";
+    }
+    if (bvh_->triangle_count() == 0 || max_probes <= 0)
+    {
+        return {};
+    }
+    subdivisions = std::min(std::max(subdivisions, 0), kMaxSubdivisions);
+
+    // Even if every root cell kept its probe there'd be too many, so skip straight to a spacing that could fit
+    Vector3 extent = bounds_max_ - bounds_min_;
+    auto root_cell_count = [&](units::world s)
+    {
+        return std::max(std::ceil(extent.x / s), 1.0f) * std::max(std::ceil(extent.y / s), 1.0f) * std::max(std::ceil(extent.z / s), 1.0f);
+    };
+    while (root_cell_count(spacing) > static_cast<float>(max_probes))
+    {
+        spacing *= kSpacingGrowth;
+    }
+    for (;;)
+    {
+        auto probes = PlaceOnGrid(spacing, subdivisions);
+        if (probes.size() <= static_cast<std::size_t>(max_probes))
+        {
+            return probes;
+        }
+        // Give up detail near surfaces before giving up coverage
+        if (subdivisions > 0)
+        {
+            subdivisions--;
+        }
+        else
+        {
+            spacing *= kSpacingGrowth;
+        }
+        log::Debug("Over probe budget with %i probes, trying %i subdivisions at %.2f spacing\n",
+                   static_cast<int>(probes.size()), subdivisions, spacing);
+    }
+}
+
+std::vector<Vector3> ProbePlacer::PlaceOnGrid(units::world spacing, int subdivisions) const
+{
+    // Root cells cover the bounds, centered on them
+    Vector3 extent = bounds_max_ - bounds_min_;
+    const int dims[3] = { std::max(static_cast<int>(std::ceil(extent.x / spacing)), 1),
+                          std::max(static_cast<int>(std::ceil(extent.y / spacing)), 1),
+                          std::max(static_cast<int>(std::ceil(extent.z / spacing)), 1) };
+    Vector3 origin = (bounds_min_ + bounds_max_) * 0.5f -
+                     Vector3(static_cast<units::world>(dims[0]), static_cast<units::world>(dims[1]), static_cast<units::world>(dims[2])) * (spacing * 0.5f);
+    std::vector<Cell> cells;
+    cells.reserve(static_cast<std::size_t>(dims[0]) * dims[1] * dims[2]);
+    for (int x = 0; x < dims[0]; x++)
+    {
+        for (int y = 0; y < dims[1]; y++)
+        {
+            for (int z = 0; z < dims[2]; z++)
+            {
+                Vector3 center = origin + Vector3(static_cast<units::world>(x) + 0.5f, static_cast<units::world>(y) + 0.5f, static_cast<units::world>(z) + 0.5f) * spacing;
+                cells.push_back({ center, spacing, static_cast<uint64_t>(cells.size()), 0 });
+            }
+        }
+    }
+
+    // Split any cell that geometry could pass through, one level at a time
+    std::vector<Cell> leaves;
+    for (int level = 0; !cells.empty(); level++)
+    {
+        std::vector<char> split(cells.size(), 0);
+        if (level < subdivisions)
+        {
+            ParallelFor(0, cells.size(), 16, [&](std::size_t i)
+            {
+                split[i] = bvh_->NearestPoint(cells[i].center, cells[i].size * kCellHalfDiagonal, nullptr) ? 1 : 0;
+            });
+        }
+        std::vector<Cell> children;
+        for (std::size_t i = 0; i < cells.size(); i++)
+        {
+            const auto& cell = cells[i];
+            if (!split[i])
+            {
+                leaves.push_back(cell);
+                continue;
+            }
+            for (int octant = 0; octant < 8; octant++)
+            {
+                Vector3 offset((octant & 1) ? 0.25f : -0.25f, (octant & 2) ? 0.25f : -0.25f, (octant & 4) ? 0.25f : -0.25f);
+                children.push_back({ cell.center + offset * cell.size, cell.size * 0.5f, (cell.key << 3) | static_cast<uint64_t>(octant), level + 1 });
+            }
+        }
+        cells.swap(children);
+    }
+    // Depth first order keeps probes that are close in space close in the list
+    auto padded_key = [&](const Cell& cell) { return cell.key << (3 * (subdivisions - cell.level)); };
+    std::sort(leaves.begin(), leaves.end(), [&](const Cell& a, const Cell& b) { return padded_key(a) < padded_key(b); });
+
+    // Push probes off of nearby surfaces, then drop any that are left inside of solid geometry
+    std::vector<Vector3> positions(leaves.size());
+    std::vector<char> keep(leaves.size(), 0);
+    ParallelFor(0, leaves.size(), 16, [&](std::size_t i)
+    {
+        Vector3 pos = leaves[i].center;
+        units::world min_distance = leaves[i].size * kSurfaceOffset;
+        // Probes in corners can be pushed from one surface into another, so it takes a few tries
+        BVH::Hit hit;
+        for (int push = 0; push < kSurfacePushes && bvh_->NearestPoint(pos, min_distance * 0.99f, &hit); push++)
+        {
+            Vector3 away = pos - hit.pos;
+            units::world length = VectorLength(away);
+            away = length > 1e-5f ? away / length : SurfaceNormal(hit);
+            pos = hit.pos + away * min_distance;
+        }
+        positions[i] = pos;
+        keep[i] = IsInsideGeometry(pos) ? 0 : 1;
+    });
+    std::vector<Vector3> probes;
+    for (std::size_t i = 0; i < leaves.size(); i++)
+    {
+        if (keep[i])
+        {
+            probes.push_back(positions[i]);
+        }
+    }
+    return probes;
+}
+
+bool ProbePlacer::IsInsideGeometry(const Vector3& point) const
+{
+    // Rays from inside of solid geometry mostly see the back of its surfaces. Rays that escape don't count either
+    // way, so probes over open ground or under a lone roof aren't mistaken for being inside
+    const units::world max_distance = VectorDistance(bounds_min_, bounds_max_) * 2.0f;
+    int front_hits = 0;
+    int back_hits = 0;
+    for (const auto& dir : InsideTestDirections())
+    {
+        BVH::Hit hit;
+        if (!bvh_->Raycast(point, dir, max_distance, &hit))
+        {
+            continue;
+        }
+        if (VectorDot(SurfaceNormal(hit), dir) > 0.0f)
+        {
+            back_hits++;
+        }
+        else
+        {
+            front_hits++;
+        }
+    }
+    return back_hits > front_hits;
+}
+
+Vector3 ProbePlacer::SurfaceNormal(const BVH::Hit& hit) const
+{
+    // Interpolated vertex normals say which side is the front far more reliably than winding order
+    const auto& mesh = *meshes_[hit.instance];
+    const auto* indices = &mesh.indices[hit.triangle * 3];
+    Vector3 normal = mesh.vertices[indices[0]].norm * (1.0f - hit.barycentric.x - hit.barycentric.y) +
+                     mesh.vertices[indices[1]].norm * hit.barycentric.x +
+                     mesh.vertices[indices[2]].norm * hit.barycentric.y;
+    // Normals are transformed by the inverse of the model's scale
+    normal = normal / scales_[hit.instance];
+    units::world length = VectorLength(normal);
+    if (!(length > 1e-6f))
+    {
+        return hit.normal;
+    }
+    return normal / length;
+}
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_PROBEPLACER_H_
+#define BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_PROBEPLACER_H_
+
+// Includes
+#include <cstdint>
+#include <memory>
+#include <vector>
+// Public Includes
+#include <blons/graphics/bvh.h>
+#include <blons/graphics/pipeline/scene.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+// Places light probes from the geometry of a scene. Probes start on a grid over the scene's bounds, cells near
+// surfaces are split into octants to place them more densely where lighting changes the most, probes inside solid
+// geometry are dropped, and probes too close to a surface are pushed away from it
+class ProbePlacer
+{
+public:
+    // Builds a BVH over every model in the scene. Models are placed by position and scale, since their world
+    // matrices only update when they're rendered
+    ProbePlacer(const Scene& scene);
+    ~ProbePlacer() {}
+
+    // Places probes spacing apart, splitting cells that touch geometry up to subdivisions times. If that gives
+    // more than max_probes probes, fewer subdivisions and then wider spacing are used until they fit. Cells are
+    // checked across all worker threads, and the same scene always gives the same probes in the same order
+    std::vector<Vector3> Place(units::world spacing, int subdivisions, int max_probes) const;
+
+private:
+    struct Cell
+    {
+        Vector3 center;
+        units::world size;
+        // Index of the root cell followed by the octant taken at each level, so sorting leaves by key (padded
+        // out to the deepest level) walks the tree depth first
+        uint64_t key;
+        int level;
+    };
+
+    std::vector<Vector3> PlaceOnGrid(units::world spacing, int subdivisions) const;
+    bool IsInsideGeometry(const Vector3& point) const;
+    Vector3 SurfaceNormal(const BVH::Hit& hit) const;
+
+    std::unique_ptr<BVH> bvh_;
+    // Meshes and scales of each BVH instance, for looking up the shading normals of hits
+    std::vector<const MeshData*> meshes_;
+    std::vector<Vector3> scales_;
+    Vector3 bounds_min_;
+    Vector3 bounds_max_;
+};
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
+#endif // BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_PROBEPLACER_H_
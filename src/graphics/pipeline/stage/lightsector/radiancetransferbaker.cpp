@@ -26,7 +26,15 @@
 // Includes
 #include <algorithm>
 #include <array>
+#include <cmath>
+#include <iterator>
+#include <limits>
 #include <numeric>
+#include <random>
+#include <tuple>
+#include <unordered_map>
+// Public Includes
+#include <blons/system/job.h>
 
 namespace blons
 {
@@ -36,9 +44,16 @@ namespace stage
 {
 namespace
 {
+// 0 renders environment maps on the GPU, 1 on the CPU, and 2 renders both and logs how far apart they are
+auto cvar_bake_env_maps = console::RegisterVariable("light:bake-env-maps", 0);
+// Number of probes whose environment maps and samples are held in memory at once while baking
+auto cvar_bake_chunk_probes = console::RegisterVariable("light:bake-chunk-probes", 256);
+
 const std::vector<AxisAlignedNormal> kFaceOrder = { NEGATIVE_Z, POSITIVE_X, POSITIVE_Z, NEGATIVE_X, POSITIVE_Y, NEGATIVE_Y };
 const int kProbeNetworkFaces = 4;
 const int kProbeNetworkEdges = 3;
+// Bits used by each probe ID when packing the 3 probes of a face into a key
+const int kFaceKeyProbeBits = 21;
 // When weighting the function f(theta,phi) = 1 over
 // a sphere with UV-spaced inputs this will result
 // in a final sum of 4*pi*N where N is the number of
@@ -53,51 +68,866 @@ float EnvironmentMapTexelWeight(const Vector2& uv)
     // 6 = Number of faces to integrate
     return 24.0f / (sqrt(texel_weight_intermediate) * texel_weight_intermediate);
 }
+
+const int kTexelsPerProbe = kProbeMapSize * kProbeMapSize * 6;
+
+// Index of a texel within a probe's environment map, in the order samples are gathered
+int EnvironmentMapTexelIndex(int face_index, int x, int y)
+{
+    return (face_index * kProbeMapSize + x) * kProbeMapSize + y;
+}
+
+// World space direction from the probe through the center of each environment map texel
+const std::vector<Vector3>& EnvironmentMapTexelDirections()
+{
+    static const std::vector<Vector3> directions = []()
+    {
+        std::vector<Vector3> dirs(kTexelsPerProbe);
+        int face_index = 0;
+        for (const auto& face : kFaceOrder)
+        {
+            // Since a view matrix rotates things in the opposite of the direction given
+            // We use the inverse for determining the normal of the sphere at a given texel
+            Vector3 rot = AxisRotationPitchYawRoll(face);
+            Camera cube_view;
+            cube_view.set_pos(0, 0, 0);
+            cube_view.set_rot(rot.x, rot.y, rot.z);
+            Matrix sphere_rotation_matrix = MatrixInverse(cube_view.view_matrix());
+            for (int x = 0; x < kProbeMapSize; x++)
+            {
+                for (int y = 0; y < kProbeMapSize; y++)
+                {
+                    // Normalized Device Coordinates of texel
+                    Vector2 uv;
+                    uv.x = (static_cast<units::world>(x) + 0.5f) / static_cast<units::world>(kProbeMapSize) * 2.0f - 1.0f;
+                    uv.y = (static_cast<units::world>(y) + 0.5f) / static_cast<units::world>(kProbeMapSize) * 2.0f - 1.0f;
+                    Vector3 sphere_normal(uv.x, uv.y, -1.0f);
+                    sphere_normal *= sphere_rotation_matrix;
+                    dirs[EnvironmentMapTexelIndex(face_index, x, y)] = VectorNormalize(sphere_normal);
+                }
+            }
+            face_index++;
+        }
+        return dirs;
+    }();
+    return directions;
+}
+
+// Solid angle weight of each environment map texel, see EnvironmentMapTexelWeight
+const std::vector<float>& EnvironmentMapTexelWeights()
+{
+    static const std::vector<float> weights = []()
+    {
+        std::vector<float> texel_weights(kTexelsPerProbe);
+        for (int face_index = 0; face_index < static_cast<int>(kFaceOrder.size()); face_index++)
+        {
+            for (int x = 0; x < kProbeMapSize; x++)
+            {
+                for (int y = 0; y < kProbeMapSize; y++)
+                {
+                    // Normalized Device Coordinates of texel
+                    Vector2 uv;
+                    uv.x = (static_cast<units::world>(x) + 0.5f) / static_cast<units::world>(kProbeMapSize) * 2.0f - 1.0f;
+                    uv.y = (static_cast<units::world>(y) + 0.5f) / static_cast<units::world>(kProbeMapSize) * 2.0f - 1.0f;
+                    texel_weights[EnvironmentMapTexelIndex(face_index, x, y)] = EnvironmentMapTexelWeight(uv);
+                }
+            }
+        }
+        return texel_weights;
+    }();
+    return weights;
+}
+
+// Sum of every texel weight in an environment map, used to normalize integrals over the sphere
+float EnvironmentMapTotalTexelWeight()
+{
+    static const float total_weight = []()
+    {
+        float total = 0.0f;
+        for (const auto& weight : EnvironmentMapTexelWeights())
+        {
+            total += weight;
+        }
+        return total;
+    }();
+    return total_weight;
+}
+
+// Slab test for a ray hitting a box somewhere between its origin and a max distance
+bool RayIntersectsBox(const Vector3& origin, const Vector3& dir, units::world max_distance, const Vector3& box_min, const Vector3& box_max)
+{
+    const units::world o[3] = { origin.x, origin.y, origin.z };
+    const units::world d[3] = { dir.x, dir.y, dir.z };
+    const units::world lo[3] = { box_min.x, box_min.y, box_min.z };
+    const units::world hi[3] = { box_max.x, box_max.y, box_max.z };
+    units::world t_enter = 0.0f;
+    units::world t_exit = max_distance;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (std::abs(d[axis]) < 1e-8f)
+        {
+            // Parallel to this slab, so it either always or never overlaps
+            if (o[axis] < lo[axis] || o[axis] > hi[axis])
+            {
+                return false;
+            }
+            continue;
+        }
+        units::world t0 = (lo[axis] - o[axis]) / d[axis];
+        units::world t1 = (hi[axis] - o[axis]) / d[axis];
+        t_enter = std::max(t_enter, std::min(t0, t1));
+        t_exit = std::min(t_exit, std::max(t0, t1));
+        if (t_enter > t_exit)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Surfel keys pack a brick index, direction, and surfel index within the brick from the most to least
+// significant bits. Sorting samples by key then groups them by brick, and by surfel within each brick
+const int kKeyBrickAxisBits = 17;
+const int kKeyDirectionBits = 3;
+const int kKeySurfelAxisBits = 2;
+const int kKeySurfelBits = kKeySurfelAxisBits * 3;
+static_assert(kSurfelsPerBrick <= (1 << kKeySurfelAxisBits), "Surfel keys can't index every surfel in a brick");
+
+// Index of the surfel containing a world position along one axis
+int SurfelCoordinate(units::world pos)
+{
+    // Offset negative values by a whole step to deal with naive truncations resulting
+    // in too many surfels located at index 0
+    return static_cast<int>(pos / kSurfelSize) + (pos >= 0.0 ? 0 : -1);
+}
+
+// Index of the brick containing a surfel along one axis
+int BrickCoordinate(int surfel_coordinate)
+{
+    // Offset negative values by a whole step and 1 to deal with naive truncations resulting
+    // in too many bricks located at index 0
+    return (surfel_coordinate + (surfel_coordinate >= 0 ? 0 : -kSurfelsPerBrick + 1)) / kSurfelsPerBrick;
+}
+
+uint64_t SurfelKey(const LightSector::Surfel& surfel)
+{
+    const int surfel_coordinates[3] = { SurfelCoordinate(surfel.pos.x), SurfelCoordinate(surfel.pos.y), SurfelCoordinate(surfel.pos.z) };
+    uint64_t brick_key = 0;
+    uint64_t surfel_key = 0;
+    for (const auto& surfel_coordinate : surfel_coordinates)
+    {
+        int brick_coordinate = BrickCoordinate(surfel_coordinate);
+        // Bias so negative coordinates sort below positive ones
+        int64_t biased_brick_coordinate = static_cast<int64_t>(brick_coordinate) + (1LL << (kKeyBrickAxisBits - 1));
+        if (biased_brick_coordinate < 0 || biased_brick_coordinate >= (1LL << kKeyBrickAxisBits))
+        {
+            throw "Surfel is too far from the origin to be clustered";
+        }
+        brick_key = (brick_key << kKeyBrickAxisBits) | static_cast<uint64_t>(biased_brick_coordinate);
+        surfel_key = (surfel_key << kKeySurfelAxisBits) | static_cast<uint64_t>(surfel_coordinate - brick_coordinate * kSurfelsPerBrick);
+    }
+    brick_key = (brick_key << kKeyDirectionBits) | static_cast<uint64_t>(FindGreatestAxis(surfel.normal));
+    return (brick_key << kKeySurfelBits) | surfel_key;
+}
+
+uint64_t SurfelKeyBrick(uint64_t key)
+{
+    return key >> kKeySurfelBits;
+}
+
+// Stable LSD radix sort of keys, carrying ids along with them. Each pass counts digits and scatters
+// keys in parallel over fixed chunks, with chunk offsets laid out in order so equal keys never swap
+void RadixSort(std::vector<uint64_t>* keys, std::vector<uint32_t>* ids)
+{
+    const int kRadixBits = 8;
+    const std::size_t kBucketCount = 1 << kRadixBits;
+    const std::size_t kChunkSize = 1 << 16;
+    const std::size_t count = keys->size();
+    const std::size_t chunk_count = (count + kChunkSize - 1) / kChunkSize;
+    // Digits that every key shares don't need a pass
+    uint64_t key_or = ParallelReduce(0, count, kChunkSize, static_cast<uint64_t>(0),
+                                     [&](std::size_t i) { return (*keys)[i]; },
+                                     [](uint64_t a, uint64_t b) { return a | b; });
+    uint64_t key_and = ParallelReduce(0, count, kChunkSize, ~static_cast<uint64_t>(0),
+                                      [&](std::size_t i) { return (*keys)[i]; },
+                                      [](uint64_t a, uint64_t b) { return a & b; });
+    const uint64_t varying_bits = key_or ^ key_and;
+
+    std::vector<uint64_t> sorted_keys(count);
+    std::vector<uint32_t> sorted_ids(count);
+    std::vector<std::size_t> offsets(chunk_count * kBucketCount);
+    for (int shift = 0; shift < 64; shift += kRadixBits)
+    {
+        if (((varying_bits >> shift) & (kBucketCount - 1)) == 0)
+        {
+            continue;
+        }
+        // Count digits in each chunk
+        ParallelFor(0, chunk_count, 1, [&](std::size_t chunk)
+        {
+            auto histogram = &offsets[chunk * kBucketCount];
+            std::fill(histogram, histogram + kBucketCount, 0);
+            auto end = std::min((chunk + 1) * kChunkSize, count);
+            for (auto i = chunk * kChunkSize; i < end; i++)
+            {
+                histogram[((*keys)[i] >> shift) & (kBucketCount - 1)]++;
+            }
+        });
+        // Turn counts into output offsets, ordered by digit and then by chunk
+        std::size_t offset = 0;
+        for (std::size_t digit = 0; digit < kBucketCount; digit++)
+        {
+            for (std::size_t chunk = 0; chunk < chunk_count; chunk++)
+            {
+                auto digit_count = offsets[chunk * kBucketCount + digit];
+                offsets[chunk * kBucketCount + digit] = offset;
+                offset += digit_count;
+            }
+        }
+        // Scatter
+        ParallelFor(0, chunk_count, 1, [&](std::size_t chunk)
+        {
+            auto chunk_offsets = &offsets[chunk * kBucketCount];
+            auto end = std::min((chunk + 1) * kChunkSize, count);
+            for (auto i = chunk * kChunkSize; i < end; i++)
+            {
+                auto& destination = chunk_offsets[((*keys)[i] >> shift) & (kBucketCount - 1)];
+                sorted_keys[destination] = (*keys)[i];
+                sorted_ids[destination] = (*ids)[i];
+                destination++;
+            }
+        });
+        keys->swap(sorted_keys);
+        ids->swap(sorted_ids);
+    }
+}
+
+// Position along a 3D Hilbert curve of a point quantized to kHilbertBits per axis, using Skilling's
+// transpose algorithm. Points close along the curve are close in space
+uint64_t HilbertIndex(std::array<uint32_t, 3> axes)
+{
+    const int kHilbertBits = 16;
+    // Inverse undo excess work
+    for (uint32_t q = 1 << (kHilbertBits - 1); q > 1; q >>= 1)
+    {
+        uint32_t p = q - 1;
+        for (auto& axis : axes)
+        {
+            if (axis & q)
+            {
+                axes[0] ^= p;
+            }
+            else
+            {
+                uint32_t t = (axes[0] ^ axis) & p;
+                axes[0] ^= t;
+                axis ^= t;
+            }
+        }
+    }
+    // Gray encode
+    axes[1] ^= axes[0];
+    axes[2] ^= axes[1];
+    uint32_t t = 0;
+    for (uint32_t q = 1 << (kHilbertBits - 1); q > 1; q >>= 1)
+    {
+        if (axes[2] & q)
+        {
+            t ^= q - 1;
+        }
+    }
+    // Interleave the transposed bits into a single index
+    uint64_t index = 0;
+    for (int bit = kHilbertBits - 1; bit >= 0; bit--)
+    {
+        for (const auto& axis : axes)
+        {
+            index = (index << 1) | (((axis ^ t) >> bit) & 1);
+        }
+    }
+    return index;
+}
+
+// Incremental Delaunay tetrahedralization using the Bowyer-Watson algorithm. Cells keep track of their
+// neighbours, so points are located by walking towards them and cavities are grown by flood filling.
+// Predicates run in double precision on the float inputs
+class DelaunayTetrahedralization
+{
+public:
+    // Builds the 5 cells of a box from min to max, which must encase every point later inserted
+    DelaunayTetrahedralization(const std::vector<Vector3>& points, const Vector3& min, const Vector3& max);
+
+    void Insert(int point_id);
+    // Every cell that doesn't touch the bounding box, as point ids
+    std::vector<std::array<int, 4>> Cells() const;
+
+private:
+    struct Point
+    {
+        double x, y, z;
+    };
+    struct Cell
+    {
+        // Neighbour i is across the face opposite of vertex i. Dead cells have a vertex of -1
+        std::array<int, 4> vertices;
+        std::array<int, 4> neighbours;
+        // Insertion that last visited this cell, to avoid clearing flags between insertions
+        unsigned int visited;
+    };
+    struct CavityFace
+    {
+        // Vertices of the cell to be built from this face, with the inserted point at face_index
+        std::array<int, 4> vertices;
+        int face_index;
+        // Cell across this face outside of the cavity and the index of its face pointing back in
+        int outer_cell;
+        int outer_face_index;
+    };
+    struct CavityEdge
+    {
+        uint64_t key;
+        int cell;
+        int face_index;
+        // Entries from older insertions count as empty
+        unsigned int insertion;
+    };
+
+    // Positive for cells that follow the winding of the bounding cells
+    double Orientation(const std::array<int, 4>& vertices) const;
+    // Positive when the point lies inside of the cell's circumsphere
+    double InSphere(const Cell& cell, int point_id) const;
+    int LocatePoint(int point_id);
+    int AllocateCell();
+
+    std::vector<Point> points_;
+    std::vector<Cell> cells_;
+    std::vector<int> free_cells_;
+    int first_box_vertex_;
+    int last_cell_;
+    unsigned int insertion_;
+    double orientation_epsilon_;
+    std::mt19937 walk_random_;
+    // Per insertion scratch data, kept around to reuse allocations
+    std::vector<int> cavity_;
+    std::vector<CavityFace> cavity_faces_;
+    std::vector<unsigned int> vertex_visited_;
+    // Open addressed hash table of boundary edges, sized to a power of 2
+    std::vector<CavityEdge> cavity_edges_;
+};
+
+DelaunayTetrahedralization::DelaunayTetrahedralization(const std::vector<Vector3>& points, const Vector3& min, const Vector3& max)
+    : first_box_vertex_(static_cast<int>(points.size())), last_cell_(0), insertion_(0)
+{
+    walk_random_.seed(1);
+    points_.reserve(points.size() + 8);
+    for (const auto& p : points)
+    {
+        points_.push_back({ p.x, p.y, p.z });
+    }
+    // Box corners, with bit 0, 1, and 2 of the index selecting max over min for x, y, and z
+    for (int corner = 0; corner < 8; corner++)
+    {
+        points_.push_back({ corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z });
+    }
+    vertex_visited_.resize(points_.size(), 0);
+    // Volumes below this are treated as flat, scaled to the size of the box
+    double extent = std::max({ max.x - min.x, max.y - min.y, max.z - min.z });
+    orientation_epsilon_ = extent * extent * extent * 1e-12;
+
+    // Build a bounding box volume out of 5 tetrahedrons
+    const std::array<std::array<int, 4>, 5> kBoxCells = { { { 1, 2, 4, 0 }, { 2, 1, 3, 7 }, { 2, 4, 6, 7 }, { 4, 1, 5, 7 }, { 2, 1, 4, 7 } } };
+    for (const auto& box_cell : kBoxCells)
+    {
+        Cell cell;
+        for (int i = 0; i < 4; i++)
+        {
+            cell.vertices[i] = first_box_vertex_ + box_cell[i];
+        }
+        if (Orientation(cell.vertices) < 0.0)
+        {
+            std::swap(cell.vertices[0], cell.vertices[1]);
+        }
+        cell.neighbours = { -1, -1, -1, -1 };
+        cell.visited = 0;
+        cells_.push_back(cell);
+    }
+    // Link up the faces the box cells share with each other
+    for (auto& cell : cells_)
+    {
+        for (int face = 0; face < 4; face++)
+        {
+            for (std::size_t other_id = 0; other_id < cells_.size(); other_id++)
+            {
+                const auto& other = cells_[other_id];
+                int shared = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    if (i != face && std::find(other.vertices.begin(), other.vertices.end(), cell.vertices[i]) != other.vertices.end())
+                    {
+                        shared++;
+                    }
+                }
+                if (&other != &cell && shared == 3)
+                {
+                    cell.neighbours[face] = static_cast<int>(other_id);
+                }
+            }
+        }
+    }
+}
+
+void DelaunayTetrahedralization::Insert(int point_id)
+{
+    insertion_++;
+    int start_cell = LocatePoint(point_id);
+
+    // Flood fill every cell whose circumsphere contains the point, starting from the one containing it
+    cavity_.clear();
+    cavity_.push_back(start_cell);
+    cells_[start_cell].visited = insertion_;
+    for (std::size_t i = 0; i < cavity_.size(); i++)
+    {
+        for (const auto& neighbour : cells_[cavity_[i]].neighbours)
+        {
+            if (neighbour != -1 && cells_[neighbour].visited != insertion_ && InSphere(cells_[neighbour], point_id) > 0.0)
+            {
+                cells_[neighbour].visited = insertion_;
+                cavity_.push_back(neighbour);
+            }
+        }
+    }
+
+    // Collect the faces on the cavity boundary. Rounding errors can leave faces that the point can't see,
+    // which would build flat or inverted cells, so the cavity is grown past those until none are left
+    bool cavity_grown = true;
+    while (cavity_grown)
+    {
+        cavity_grown = false;
+        cavity_faces_.clear();
+        for (std::size_t i = 0; i < cavity_.size(); i++)
+        {
+            const auto& cell = cells_[cavity_[i]];
+            for (int face = 0; face < 4; face++)
+            {
+                int neighbour = cell.neighbours[face];
+                if (neighbour != -1 && cells_[neighbour].visited == insertion_)
+                {
+                    continue;
+                }
+                CavityFace cavity_face;
+                cavity_face.vertices = cell.vertices;
+                cavity_face.vertices[face] = point_id;
+                if (Orientation(cavity_face.vertices) <= orientation_epsilon_)
+                {
+                    if (neighbour == -1)
+                    {
+                        throw "Probe lies outside of the probe network bounds";
+                    }
+                    cells_[neighbour].visited = insertion_;
+                    cavity_.push_back(neighbour);
+                    cavity_grown = true;
+                    continue;
+                }
+                cavity_face.face_index = face;
+                cavity_face.outer_cell = neighbour;
+                cavity_face.outer_face_index = -1;
+                if (neighbour != -1)
+                {
+                    const auto& outer_neighbours = cells_[neighbour].neighbours;
+                    cavity_face.outer_face_index = static_cast<int>(std::find(outer_neighbours.begin(), outer_neighbours.end(), cavity_[i]) - outer_neighbours.begin());
+                }
+                cavity_faces_.push_back(cavity_face);
+            }
+        }
+    }
+
+    // Every vertex of the cavity must still be on its boundary, or it would be lost from the triangulation
+    for (const auto& cavity_face : cavity_faces_)
+    {
+        for (const auto& vertex : cavity_face.vertices)
+        {
+            vertex_visited_[vertex] = insertion_;
+        }
+    }
+    for (const auto& cell_id : cavity_)
+    {
+        for (const auto& vertex : cells_[cell_id].vertices)
+        {
+            if (vertex_visited_[vertex] != insertion_)
+            {
+                // Only heavily degenerate point sets should make it here
+                throw "It is time, John Codeman, to gaze upon the abyss once more";
+            }
+        }
+        cells_[cell_id].vertices[0] = -1;
+        free_cells_.push_back(cell_id);
+    }
+
+    // Connect the point to every boundary face. New cells share the faces built on boundary edges, so they're
+    // matched up through a hash of the edge. Each boundary face has 3 edges shared by 2 faces, so the table is
+    // kept at least 4 times larger than the number of edges
+    std::size_t edge_table_size = std::max<std::size_t>(cavity_edges_.size(), 64);
+    while (edge_table_size < cavity_faces_.size() * 6)
+    {
+        edge_table_size *= 2;
+    }
+    if (edge_table_size != cavity_edges_.size())
+    {
+        CavityEdge empty_edge = { 0, -1, -1, 0 };
+        cavity_edges_.assign(edge_table_size, empty_edge);
+    }
+    for (const auto& cavity_face : cavity_faces_)
+    {
+        int cell_id = AllocateCell();
+        auto& cell = cells_[cell_id];
+        cell.vertices = cavity_face.vertices;
+        cell.neighbours = { -1, -1, -1, -1 };
+        cell.neighbours[cavity_face.face_index] = cavity_face.outer_cell;
+        if (cavity_face.outer_cell != -1)
+        {
+            cells_[cavity_face.outer_cell].neighbours[cavity_face.outer_face_index] = cell_id;
+        }
+        for (int face = 0; face < 4; face++)
+        {
+            if (face == cavity_face.face_index)
+            {
+                continue;
+            }
+            // The face opposite vertex "face" contains the point and the boundary edge made of the other 2 vertices
+            std::array<int, 2> edge;
+            int edge_vertex = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                if (i != face && i != cavity_face.face_index)
+                {
+                    edge[edge_vertex++] = cell.vertices[i];
+                }
+            }
+            uint64_t key = (static_cast<uint64_t>(std::min(edge[0], edge[1])) << 32) | static_cast<uint64_t>(std::max(edge[0], edge[1]));
+            // Linear probe from a Fibonacci hash of the key
+            std::size_t slot = static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & (cavity_edges_.size() - 1);
+            while (cavity_edges_[slot].insertion == insertion_ && cavity_edges_[slot].key != key)
+            {
+                slot = (slot + 1) & (cavity_edges_.size() - 1);
+            }
+            auto& cavity_edge = cavity_edges_[slot];
+            if (cavity_edge.insertion == insertion_)
+            {
+                cell.neighbours[face] = cavity_edge.cell;
+                cells_[cavity_edge.cell].neighbours[cavity_edge.face_index] = cell_id;
+            }
+            else
+            {
+                cavity_edge = { key, cell_id, face, insertion_ };
+            }
+        }
+        last_cell_ = cell_id;
+    }
+}
+
+std::vector<std::array<int, 4>> DelaunayTetrahedralization::Cells() const
+{
+    std::vector<std::array<int, 4>> cells;
+    for (const auto& cell : cells_)
+    {
+        if (cell.vertices[0] != -1 && std::all_of(cell.vertices.begin(), cell.vertices.end(), [&](int v) { return v < first_box_vertex_; }))
+        {
+            cells.push_back(cell.vertices);
+        }
+    }
+    return cells;
+}
+
+double DelaunayTetrahedralization::Orientation(const std::array<int, 4>& vertices) const
+{
+    const auto& a = points_[vertices[0]];
+    const auto& b = points_[vertices[1]];
+    const auto& c = points_[vertices[2]];
+    const auto& d = points_[vertices[3]];
+    double bx = b.x - a.x, by = b.y - a.y, bz = b.z - a.z;
+    double cx = c.x - a.x, cy = c.y - a.y, cz = c.z - a.z;
+    double dx = d.x - a.x, dy = d.y - a.y, dz = d.z - a.z;
+    return bx * (cy * dz - cz * dy) - by * (cx * dz - cz * dx) + bz * (cx * dy - cy * dx);
+}
+
+double DelaunayTetrahedralization::InSphere(const Cell& cell, int point_id) const
+{
+    const auto& p = points_[point_id];
+    // Lift each vertex relative to the point onto a paraboloid, the sign of the resulting determinant
+    // tells which side of the circumsphere the point is on
+    double m[4][4];
+    for (int i = 0; i < 4; i++)
+    {
+        const auto& v = points_[cell.vertices[i]];
+        m[i][0] = v.x - p.x;
+        m[i][1] = v.y - p.y;
+        m[i][2] = v.z - p.z;
+        m[i][3] = m[i][0] * m[i][0] + m[i][1] * m[i][1] + m[i][2] * m[i][2];
+    }
+    auto minor = [&](int r0, int r1, int r2)
+    {
+        return m[r0][0] * (m[r1][1] * m[r2][2] - m[r1][2] * m[r2][1]) -
+               m[r0][1] * (m[r1][0] * m[r2][2] - m[r1][2] * m[r2][0]) +
+               m[r0][2] * (m[r1][0] * m[r2][1] - m[r1][1] * m[r2][0]);
+    };
+    return m[0][3] * minor(1, 2, 3) - m[1][3] * minor(0, 2, 3) + m[2][3] * minor(0, 1, 3) - m[3][3] * minor(0, 1, 2);
+}
+
+int DelaunayTetrahedralization::LocatePoint(int point_id)
+{
+    // Walk from the last built cell towards the point, crossing any face the point lies beyond. Faces
+    // are tested from a random start so the walk can't get caught in a loop
+    int cell_id = last_cell_;
+    for (std::size_t step = 0; step < cells_.size(); step++)
+    {
+        const auto& cell = cells_[cell_id];
+        int next_cell = cell_id;
+        int first_face = walk_random_() & 3;
+        for (int i = 0; i < 4 && next_cell == cell_id; i++)
+        {
+            int face = (first_face + i) & 3;
+            auto vertices = cell.vertices;
+            vertices[face] = point_id;
+            if (Orientation(vertices) < 0.0)
+            {
+                next_cell = cell.neighbours[face];
+            }
+        }
+        if (next_cell == cell_id)
+        {
+            return cell_id;
+        }
+        if (next_cell == -1)
+        {
+            throw "Probe lies outside of the probe network bounds";
+        }
+        cell_id = next_cell;
+    }
+    // Rounding errors kept the walk from settling, so fall back to searching every cell
+    double best_orientation = -std::numeric_limits<double>::max();
+    for (std::size_t i = 0; i < cells_.size(); i++)
+    {
+        if (cells_[i].vertices[0] == -1)
+        {
+            continue;
+        }
+        double min_orientation = std::numeric_limits<double>::max();
+        for (int face = 0; face < 4; face++)
+        {
+            auto vertices = cells_[i].vertices;
+            vertices[face] = point_id;
+            min_orientation = std::min(min_orientation, Orientation(vertices));
+        }
+        if (min_orientation > best_orientation)
+        {
+            best_orientation = min_orientation;
+            cell_id = static_cast<int>(i);
+        }
+    }
+    return cell_id;
+}
+
+int DelaunayTetrahedralization::AllocateCell()
+{
+    if (!free_cells_.empty())
+    {
+        int cell_id = free_cells_.back();
+        free_cells_.pop_back();
+        return cell_id;
+    }
+    cells_.emplace_back();
+    cells_.back().visited = 0;
+    return static_cast<int>(cells_.size() - 1);
+}
+
+// Copies a band of full width rows read back from a map into the same rows of a full size copy
+void CopyMapRows(const PixelData& band, units::pixel y, PixelData* map)
+{
+    const std::size_t row_size = static_cast<std::size_t>(map->width) * (map->bits_per_pixel() / 8);
+    std::copy(band.pixels.begin(), band.pixels.end(), map->pixels.begin() + static_cast<std::size_t>(y) * row_size);
+}
+
+// Logs how closely two sets of environment maps agree within bands of pixel rows, used to cross-check the CPU and
+// GPU renderers
+void CompareEnvironmentMaps(const PixelData& albedo_a, const PixelData& normal_a, const PixelData& depth_a,
+                            const PixelData& albedo_b, const PixelData& normal_b, const PixelData& depth_b,
+                            const std::vector<std::pair<units::pixel, units::pixel>>& pixel_rows)
+{
+    if (albedo_a.pixels.size() != albedo_b.pixels.size() || normal_a.pixels.size() != normal_b.pixels.size() ||
+        depth_a.pixels.size() != depth_b.pixels.size())
+    {
+        log::Warn("Environment maps differ in size\n");
+        return;
+    }
+    const std::size_t map_width = static_cast<std::size_t>(albedo_a.width);
+    const std::size_t albedo_pixel_size = albedo_a.bits_per_pixel() / 8;
+    const std::size_t normal_pixel_size = normal_a.bits_per_pixel() / 8;
+    const float* depth_pixels_a = reinterpret_cast<const float*>(depth_a.pixels.data());
+    const float* depth_pixels_b = reinterpret_cast<const float*>(depth_b.pixels.data());
+    std::size_t sky_mismatches = 0;
+    std::size_t geometry_texels = 0;
+    double albedo_error = 0.0;
+    double normal_error = 0.0;
+    double depth_error = 0.0;
+    std::size_t pixel_count = 0;
+    for (const auto& band : pixel_rows)
+    {
+        pixel_count += (band.second - band.first) * map_width;
+        for (std::size_t i = band.first * map_width; i < band.second * map_width; i++)
+        {
+            bool sky_a = albedo_a.pixels[i * albedo_pixel_size + 3] >= 128;
+            bool sky_b = albedo_b.pixels[i * albedo_pixel_size + 3] >= 128;
+            if (sky_a != sky_b)
+            {
+                sky_mismatches++;
+                continue;
+            }
+            if (sky_a)
+            {
+                continue;
+            }
+            geometry_texels++;
+            for (std::size_t c = 0; c < 3; c++)
+            {
+                albedo_error += std::abs(albedo_a.pixels[i * albedo_pixel_size + c] - albedo_b.pixels[i * albedo_pixel_size + c]) / 255.0;
+                normal_error += std::abs(normal_a.pixels[i * normal_pixel_size + c] - normal_b.pixels[i * normal_pixel_size + c]) / 255.0;
+            }
+            depth_error += std::abs(depth_pixels_a[i] - depth_pixels_b[i]);
+        }
+    }
+    double texels = static_cast<double>(std::max(geometry_texels, std::size_t(1)));
+    log::Debug("Environment map comparison: %i/%i sky mismatches, mean error albedo %.4f normal %.4f depth %.6f\n",
+               static_cast<int>(sky_mismatches), static_cast<int>(pixel_count),
+               albedo_error / (texels * 3.0), normal_error / (texels * 3.0), depth_error / texels);
+}
 } // namespace
 
-RadianceTransferBaker::RadianceTransferBaker(const Scene& scene, const std::vector<LightSector::Probe>& probes)
-    : probes_(probes)
-{
-    // Setup shader for generating environment maps to build surfel and sky visibility data
-    ShaderAttributeList env_map_inputs = { { POS, "input_pos" },
-                                           { TEX, "input_uv" },
-                                           { ShaderAttributeIndex::NORMAL, "input_norm" },
-                                           { TANGENT, "input_tan" },
-                                           { BITANGENT, "input_bitan" } };
-    environment_map_shader_.reset(new Shader({ { VERTEX, "shaders/probe-env-map.vert.glsl" }, { PIXEL, "shaders/probe-env-map.frag.glsl" } }, env_map_inputs));
-    // Setup framebuffer for storing environment maps
-    environment_maps_.reset(new Framebuffer(kProbeMapSize * 6, kProbeMapSize * static_cast<units::pixel>(probes_.size()),
-                                            { { TextureType::R8G8B8A8, TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP },   // albedo + sky vis
-                                              { TextureType::R8G8B8,   TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP } }, // normal
-                                            true));
-
-    // G-Buffer env map generation
-    log::Debug("Baking environment maps... ");
-    Timer env_bake_stats;
-    BakeEnvironmentMaps(scene);
-    log::Debug("[%ims]\n", env_bake_stats.ms());
-    // Gather surfel and sky visibility samples from probes
-    log::Debug("Gathering probe samples... ");
-    Timer sample_gather_stats;
-    std::vector<SurfelSample> surfel_samples;
-    std::vector<SkyVisSample> sky_samples;
-    GatherProbeSamples(&surfel_samples, &sky_samples);
-    log::Debug("[%ims]\n", sample_gather_stats.ms());
-    // Compute surfel clusters
-    log::Debug("Baking surfel clusters... ");
-    Timer surfel_bake_stats;
-    BakeSurfelClusters(surfel_samples);
-    log::Debug("[%ims]\n", surfel_bake_stats.ms());
-    // Compute SH coefficients for sky visibility
-    log::Debug("Baking sky visibility... ");
-    Timer sky_bake_stats;
-    BakeSkyCoefficients(sky_samples);
-    log::Debug("[%ims]\n", sky_bake_stats.ms());
-    // Create a Delaunay Triangulation for probe interpolation
-    log::Debug("Baking probe network...");
-    Timer bake_network_stats;
-    BakeProbeNetwork();
-    log::Debug("[%ims]\n", bake_network_stats.ms());
+namespace // Stop gap platform isolation
+{
+// Quarantine this sucker
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+// Largest the process's working set has been, in bytes
+std::size_t PeakMemoryUsage()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+}
+} // namespace
+
+RadianceTransferBaker::RadianceTransferBaker(const Scene& scene, const std::vector<LightSector::Probe>& probes, bool progressive)
+    : probes_(probes), baking_(false), bake_task_done_(true)
+{
+    // Every probe is baked from scratch
+    std::vector<int> probe_ids(probes_.size());
+    std::iota(probe_ids.begin(), probe_ids.end(), 0);
+    texel_depths_.resize(probes_.size() * kTexelsPerProbe);
+    BeginBake(scene, probe_ids, std::vector<int>(probes_.size(), -1), {}, {}, true);
+    bake_models_ = BuildBakeModels(scene);
+    if (!progressive)
+    {
+        while (!BakeSlice(scene, std::numeric_limits<int>::max(), false)) {}
+    }
+}
+
+RadianceTransferBaker::RadianceTransferBaker(const std::vector<LightSector::Probe>& probes)
+    : probes_(probes), baking_(false), bake_task_done_(true)
+{
+}
+
+bool RadianceTransferBaker::Rebake(const Scene& scene, const std::vector<LightSector::Probe>& probes, bool progressive)
+{
+    if (baking_)
+    {
+        throw "Can't rebake while a bake is still in progress";
+    }
+    auto models = BuildBakeModels(scene);
+    auto changed_models = FindChangedModels(models);
+    auto previous_ids = FindPreviousProbes(probes);
+    bool probes_changed = probes.size() != probes_.size();
+    for (std::size_t i = 0; i < probes.size(); i++)
+    {
+        probes_changed |= previous_ids[i] != static_cast<int>(i);
+    }
+    // New probes always need environment maps, old ones only if they could see what changed
+    std::vector<char> dirty(probes.size(), 0);
+    ParallelFor(0, probes.size(), 16, [&](std::size_t i)
+    {
+        dirty[i] = previous_ids[i] < 0 || ProbeSeesModels(previous_ids[i], changed_models);
+    });
+    std::vector<int> probe_ids;
+    for (std::size_t i = 0; i < probes.size(); i++)
+    {
+        if (dirty[i])
+        {
+            probe_ids.push_back(static_cast<int>(i));
+        }
+    }
+    bake_models_ = std::move(models);
+    if (probe_ids.empty() && !probes_changed)
+    {
+        return false;
+    }
+    log::Debug("Rebaking %i of %i probes\n", static_cast<int>(probe_ids.size()), static_cast<int>(probes.size()));
+
+    // Carry results of the previous bake over to the new probe layout
+    auto previous_probes = std::move(probes_);
+    auto previous_clusters = std::move(probe_clusters_);
+    auto previous_texel_depths = std::move(texel_depths_);
+    probes_ = std::vector<LightSector::Probe>(probes.begin(), probes.end());
+    texel_depths_.resize(probes_.size() * kTexelsPerProbe);
+    for (std::size_t i = 0; i < probes_.size(); i++)
+    {
+        if (!dirty[i])
+        {
+            auto previous_depths = previous_texel_depths.begin() + static_cast<std::size_t>(previous_ids[i]) * kTexelsPerProbe;
+            std::copy(previous_depths, previous_depths + kTexelsPerProbe, texel_depths_.begin() + i * kTexelsPerProbe);
+        }
+    }
+    // The triangulation only depends on probe positions, so it can be left alone unless they changed. It's rebuilt
+    // in full rather than patched locally, since it takes milliseconds and keeps ties between cospherical probes
+    // resolved exactly the same as in a full bake
+    BeginBake(scene, probe_ids, previous_ids, previous_probes, std::move(previous_clusters), probes_changed);
+    if (!progressive)
+    {
+        while (!BakeSlice(scene, std::numeric_limits<int>::max(), false)) {}
+    }
+    return true;
+}
+
+bool RadianceTransferBaker::ContinueBake(const Scene& scene, int max_probes)
+{
+    if (!baking_)
+    {
+        return true;
+    }
+    return BakeSlice(scene, std::max(max_probes, 1), true);
+}
+
+bool RadianceTransferBaker::baking() const
+{
+    return baking_;
+}
+
+float RadianceTransferBaker::progress() const
+{
+    if (!baking_)
+    {
+        return 1.0f;
+    }
+    // Finishing the bake counts as one more probe
+    return static_cast<float>(bake_.next_probe) / static_cast<float>(bake_.probe_ids.size() + 1);
+}
+
+int RadianceTransferBaker::env_map_mode() const
+{
+    return bake_.env_map_mode;
 }
 
 const std::vector<LightSector::Probe>& RadianceTransferBaker::probes() const
@@ -115,17 +945,211 @@ const std::vector<LightSector::Surfel>& RadianceTransferBaker::surfels() const
     return surfels_;
 }
 
-const std::vector<LightSector::SurfelBrick>& RadianceTransferBaker::surfel_bricks() const
+const std::vector<LightSector::SurfelBrick>& RadianceTransferBaker::surfel_bricks() const
+{
+    return surfel_bricks_;
+}
+
+const std::vector<LightSector::SurfelBrickFactor>& RadianceTransferBaker::surfel_brick_factors() const
+{
+    return surfel_brick_factors_;
+}
+
+void RadianceTransferBaker::BeginBake(const Scene& scene, const std::vector<int>& probe_ids, const std::vector<int>& previous_ids, const std::vector<LightSector::Probe>& previous_probes,
+                                      std::vector<ProbeClusters> previous_clusters, bool rebuild_network)
+{
+    // Take surfel clusters and sky visibility from the previous bake for probes that won't be gathered
+    std::vector<char> gathered(probes_.size(), 0);
+    for (const auto& probe_id : probe_ids)
+    {
+        gathered[probe_id] = 1;
+    }
+    probe_clusters_.clear();
+    probe_clusters_.resize(probes_.size());
+    for (std::size_t i = 0; i < probes_.size(); i++)
+    {
+        if (!gathered[i])
+        {
+            probe_clusters_[i] = std::move(previous_clusters[previous_ids[i]]);
+            probes_[i].sh_sky_visibility = previous_probes[previous_ids[i]].sh_sky_visibility;
+        }
+    }
+    std::vector<ProbeClusters>().swap(previous_clusters);
+
+    // Probes are baked a chunk at a time, reducing their samples as soon as they're gathered, so only one chunk of
+    // environment maps and samples is held in memory at once. Each probe always takes the same row of the maps, and
+    // chunks are made of probes sharing a block of rows, so a probe rasterizes the same no matter what else is baked.
+    // Slices are pieces of a chunk, and rasterize the same for the same reason
+    const std::size_t chunk_probes = std::max(cvar_bake_chunk_probes->to<int>(), 1);
+    bake_.probe_ids = probe_ids;
+    bake_.next_probe = 0;
+    bake_.slice_ids.clear();
+    bake_.map_rows = static_cast<int>(std::min(chunk_probes, std::max<std::size_t>(probes_.size(), 1)));
+    bake_.env_map_mode = cvar_bake_env_maps->to<int>();
+    bake_.rebuild_network = rebuild_network;
+    bake_.finishing = false;
+    bake_.slice_count = 0;
+    bake_.render_time = 0;
+    bake_.gather_time = 0;
+    bake_.timer.Start();
+
+    // Every slice renders into the same maps, so they're only made once per bake
+    const units::pixel map_width = kProbeMapSize * 6;
+    const units::pixel map_height = kProbeMapSize * static_cast<units::pixel>(bake_.map_rows);
+    environment_maps_.reset();
+    environment_rasterizer_.reset();
+    if (bake_.env_map_mode != 1)
+    {
+        // Only created when needed so CPU bakes don't have to compile it
+        if (environment_map_shader_ == nullptr)
+        {
+            ShaderAttributeList env_map_inputs = { { POS, "input_pos" },
+                                                   { TEX, "input_uv" },
+                                                   { ShaderAttributeIndex::NORMAL, "input_norm" },
+                                                   { TANGENT, "input_tan" },
+                                                   { BITANGENT, "input_bitan" } };
+            environment_map_shader_.reset(new Shader({ { VERTEX, "shaders/probe-env-map.vert.glsl" }, { PIXEL, "shaders/probe-env-map.frag.glsl" } }, env_map_inputs));
+        }
+        environment_maps_.reset(new Framebuffer(map_width, map_height,
+                                                { { TextureType::R8G8B8A8, TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP },   // albedo + sky vis
+                                                  { TextureType::R8G8B8,   TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP } }, // normal
+                                                true));
+    }
+    if (bake_.env_map_mode != 0)
+    {
+        environment_rasterizer_.reset(new EnvironmentMapRasterizer(scene, render::context()->IsDepthBufferRangeZeroToOne()));
+    }
+    // Read back maps are laid out like the framebuffer, slices only fill in the rows they rendered
+    environment_albedo_.reset(new PixelData());
+    environment_normal_.reset(new PixelData());
+    environment_depth_.reset(new PixelData());
+    environment_albedo_->type = TextureType(TextureType::R8G8B8A8, TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP);
+    environment_normal_->type = TextureType(TextureType::R8G8B8, TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP);
+    environment_depth_->type = TextureType(TextureType::DEPTH, TextureType::RAW, TextureType::NEAREST, TextureType::CLAMP);
+    for (auto map : { environment_albedo_.get(), environment_normal_.get(), environment_depth_.get() })
+    {
+        map->width = map_width;
+        map->height = map_height;
+        map->pixels.resize(static_cast<std::size_t>(map_width) * map_height * (map->bits_per_pixel() / 8));
+    }
+
+    baking_ = true;
+    log::Debug("Baking environment maps and gathering probe samples...\n");
+}
+
+bool RadianceTransferBaker::BakeSlice(const Scene& scene, int max_probes, bool background)
+{
+    // Nothing the last slice uses can be touched until it's done
+    if (bake_task_ != nullptr)
+    {
+        if (!bake_task_done_.load())
+        {
+            return false;
+        }
+        std::unique_ptr<Job> task(std::move(bake_task_));
+        try
+        {
+            task->Wait();
+        }
+        catch (...)
+        {
+            baking_ = false;
+            throw;
+        }
+    }
+    if (bake_.finishing)
+    {
+        baking_ = false;
+        log::Debug("Finished baking %i probes [%ims]\n", static_cast<int>(bake_.probe_ids.size()), static_cast<int>(bake_.timer.ms()));
+        return true;
+    }
+
+    if (bake_.next_probe < bake_.probe_ids.size())
+    {
+        // Slices stop at the end of a chunk
+        const auto& probe_ids = bake_.probe_ids;
+        auto slice_begin = bake_.next_probe;
+        auto slice_end = slice_begin + 1;
+        while (slice_end < probe_ids.size() && slice_end - slice_begin < static_cast<std::size_t>(max_probes) &&
+               probe_ids[slice_end] / bake_.map_rows == probe_ids[slice_begin] / bake_.map_rows)
+        {
+            slice_end++;
+        }
+        bake_.slice_ids.assign(probe_ids.begin() + slice_begin, probe_ids.begin() + slice_end);
+        bake_.next_probe = slice_end;
+        bake_.slice_count++;
+        // G-Buffer env map generation, which needs the render context and so stays on this thread
+        Timer env_bake_stats;
+        BakeEnvironmentMaps(scene, bake_.slice_ids);
+        bake_.render_time += env_bake_stats.ms();
+        // Reduce surfel samples and sky visibility from probes
+        RunBakeTask(&RadianceTransferBaker::GatherSlice, background);
+        return false;
+    }
+
+    // GPU resources have to be released on this thread
+    environment_albedo_.reset();
+    environment_normal_.reset();
+    environment_depth_.reset();
+    environment_maps_.reset();
+    environment_rasterizer_.reset();
+    log::Debug("%i probes in %i slices, %ims rendering and %ims gathering\n", static_cast<int>(bake_.probe_ids.size()), bake_.slice_count,
+               static_cast<int>(bake_.render_time), static_cast<int>(bake_.gather_time));
+    bake_.finishing = true;
+    RunBakeTask(&RadianceTransferBaker::FinishBake, background);
+    return false;
+}
+
+void RadianceTransferBaker::RunBakeTask(void (RadianceTransferBaker::*task)(), bool background)
+{
+    if (!background)
+    {
+        (this->*task)();
+        return;
+    }
+    bake_task_done_ = false;
+    bake_task_.reset(new Job([this, task]()
+    {
+        try
+        {
+            (this->*task)();
+        }
+        catch (...)
+        {
+            bake_task_done_ = true;
+            throw;
+        }
+        bake_task_done_ = true;
+    }, Job::BACKGROUND));
+    bake_task_->Enqueue();
+}
+
+void RadianceTransferBaker::GatherSlice()
 {
-    return surfel_bricks_;
+    Timer sample_gather_stats;
+    GatherProbeSamples(bake_.slice_ids);
+    bake_.gather_time += sample_gather_stats.ms();
 }
 
-const std::vector<LightSector::SurfelBrickFactor>& RadianceTransferBaker::surfel_brick_factors() const
+void RadianceTransferBaker::FinishBake()
 {
-    return surfel_brick_factors_;
+    // Compute surfel clusters
+    log::Debug("Baking surfel clusters... ");
+    Timer surfel_bake_stats;
+    BakeSurfelClusters();
+    log::Debug("[%ims]\n", surfel_bake_stats.ms());
+    // Create a Delaunay Triangulation for probe interpolation
+    if (bake_.rebuild_network)
+    {
+        log::Debug("Baking probe network...");
+        Timer bake_network_stats;
+        BakeProbeNetwork();
+        log::Debug("[%ims]\n", bake_network_stats.ms());
+    }
+    log::Debug("Peak memory usage: %iMB\n", static_cast<int>(PeakMemoryUsage() / (1024 * 1024)));
 }
 
-void RadianceTransferBaker::BakeEnvironmentMaps(const Scene& scene)
+void RadianceTransferBaker::BakeEnvironmentMaps(const Scene& scene, const std::vector<int>& probe_ids)
 {
     // Shader data delivery struct
     struct PerFaceData
@@ -136,17 +1160,20 @@ void RadianceTransferBaker::BakeEnvironmentMaps(const Scene& scene)
     };
     std::vector<PerFaceData> per_face_data;
 
-    auto context = render::context();
-    environment_maps_->Bind(Vector4(0, 1, 0, 1));
-    context->SetDepthTesting(true);
-    context->SetBlendMode(BlendMode::OVERWRITE);
+    // Each probe keeps the same place in the maps no matter which probes are rendered,
+    // so rebaking a probe rasterizes exactly like a full bake would
+    const int map_rows = bake_.map_rows;
+    const units::pixel map_width = kProbeMapSize * 6;
+    const units::pixel map_height = kProbeMapSize * static_cast<units::pixel>(map_rows);
 
     Camera cube_view;
     const Matrix cube_projection = MatrixPerspective(kPi / 2.0f, 1.0f, kBakeScreenNear, kBakeScreenFar, render::context()->IsDepthBufferRangeZeroToOne());
 
     // Build up a buffer of unique face data used for instanced rendering
-    for (const auto& probe : probes_)
+    std::vector<int> rows;
+    for (const auto& probe_id : probe_ids)
     {
+        const auto& probe = probes_[probe_id];
         cube_view.set_pos(probe.pos.x, probe.pos.y, probe.pos.z);
         int face_index = 0;
         for (const auto& face : kFaceOrder)
@@ -156,61 +1183,115 @@ void RadianceTransferBaker::BakeEnvironmentMaps(const Scene& scene)
             cube_view.set_rot(rot.x, rot.y, rot.z);
             face_data.vp_matrix = cube_view.view_matrix() * cube_projection;
             face_data.scissor_x = face_index * kProbeMapSize;
-            face_data.scissor_y = static_cast<units::pixel>(probe.id) * kProbeMapSize;
+            face_data.scissor_y = static_cast<units::pixel>(probe.id % map_rows) * kProbeMapSize;
             per_face_data.push_back(face_data);
             face_index++;
         }
+        rows.push_back(probe.id % map_rows);
     }
-    // Setup any non-varying shader inputs
-    ShaderData<PerFaceData> per_face_shaderdata(per_face_data.data(), per_face_data.size());
-    environment_map_shader_->SetInput("per_face_data_buffer", per_face_shaderdata.data());
-    environment_map_shader_->SetInput("scissor_w", kProbeMapSize);
-    environment_map_shader_->SetInput("scissor_h", kProbeMapSize);
-    environment_map_shader_->SetInput("map_width", kProbeMapSize * 6);
-    environment_map_shader_->SetInput("map_height", kProbeMapSize * static_cast<units::pixel>(probes_.size()));
-    // Render each model a total of (number of probes) * (6 faces) times
-    for (const auto& m : scene.models)
+    // Runs of neighbouring rows rendered by this slice, in pixels, so each can be read back in one go
+    std::sort(rows.begin(), rows.end());
+    std::vector<std::pair<units::pixel, units::pixel>> pixel_rows;
+    for (const auto& row : rows)
     {
-        m->Render();
-        environment_map_shader_->SetInput("m_matrix", m->world_matrix());
-        environment_map_shader_->SetInput("normal_matrix", MatrixTranspose(MatrixInverse(m->world_matrix())));
-        environment_map_shader_->SetInput("albedo", m->albedo(), 0);
-        environment_map_shader_->SetInput("normal", m->normal(), 1);
-        environment_map_shader_->RenderInstanced(m->index_count(), static_cast<unsigned int>(per_face_data.size()));
+        units::pixel row_begin = static_cast<units::pixel>(row) * kProbeMapSize;
+        if (!pixel_rows.empty() && pixel_rows.back().second >= row_begin)
+        {
+            pixel_rows.back().second = row_begin + kProbeMapSize;
+        }
+        else
+        {
+            pixel_rows.push_back({ row_begin, row_begin + kProbeMapSize });
+        }
     }
 
-    environment_maps_->Unbind();
+    if (bake_.env_map_mode != 1)
+    {
+        auto context = render::context();
+        environment_maps_->Bind(Vector4(0, 1, 0, 1));
+        context->SetDepthTesting(true);
+        context->SetBlendMode(BlendMode::OVERWRITE);
+
+        // Setup any non-varying shader inputs
+        ShaderData<PerFaceData> per_face_shaderdata(per_face_data.data(), per_face_data.size());
+        environment_map_shader_->SetInput("per_face_data_buffer", per_face_shaderdata.data());
+        environment_map_shader_->SetInput("scissor_w", kProbeMapSize);
+        environment_map_shader_->SetInput("scissor_h", kProbeMapSize);
+        environment_map_shader_->SetInput("map_width", map_width);
+        environment_map_shader_->SetInput("map_height", map_height);
+        // Render each model a total of (number of probes) * (6 faces) times
+        for (const auto& m : scene.models)
+        {
+            m->Render();
+            environment_map_shader_->SetInput("m_matrix", m->world_matrix());
+            environment_map_shader_->SetInput("normal_matrix", MatrixTranspose(MatrixInverse(m->world_matrix())));
+            environment_map_shader_->SetInput("albedo", m->albedo(), 0);
+            environment_map_shader_->SetInput("normal", m->normal(), 1);
+            environment_map_shader_->RenderInstanced(m->index_count(), static_cast<unsigned int>(per_face_data.size()));
+        }
+
+        environment_maps_->Unbind();
+
+        // Retrieve rendered rows for sample gathering
+        for (const auto& band : pixel_rows)
+        {
+            const units::pixel band_height = band.second - band.first;
+            CopyMapRows(context->GetTextureData(environment_maps_->textures()[0], 0, 0, band.first, map_width, band_height), band.first, environment_albedo_.get());
+            CopyMapRows(context->GetTextureData(environment_maps_->textures()[1], 0, 0, band.first, map_width, band_height), band.first, environment_normal_.get());
+            CopyMapRows(context->GetTextureData(environment_maps_->depth(), 0, 0, band.first, map_width, band_height), band.first, environment_depth_.get());
+        }
+    }
+    if (bake_.env_map_mode != 0)
+    {
+        std::vector<EnvironmentMapRasterizer::Face> faces;
+        faces.reserve(per_face_data.size());
+        for (const auto& face_data : per_face_data)
+        {
+            faces.push_back({ face_data.vp_matrix, face_data.scissor_x, face_data.scissor_y });
+        }
+        if (bake_.env_map_mode == 1)
+        {
+            environment_rasterizer_->Render(faces, map_width, map_height, environment_albedo_.get(), environment_normal_.get(), environment_depth_.get());
+        }
+        else
+        {
+            // Bake with the GPU maps, the CPU ones are only for checking against
+            PixelData albedo, normal, depth;
+            environment_rasterizer_->Render(faces, map_width, map_height, &albedo, &normal, &depth);
+            CompareEnvironmentMaps(*environment_albedo_, *environment_normal_, *environment_depth_, albedo, normal, depth, pixel_rows);
+        }
+    }
 }
 
-void RadianceTransferBaker::GatherProbeSamples(std::vector<SurfelSample>* surfel_samples, std::vector<SkyVisSample>* sky_samples)
+void RadianceTransferBaker::GatherProbeSamples(const std::vector<int>& probe_ids)
 {
-    // Pre-allocate sample containers
-    surfel_samples->reserve(kProbeMapSize * kProbeMapSize * 6 * probes_.size());
-    sky_samples->reserve(kProbeMapSize * kProbeMapSize * 6 * probes_.size());
-
-    // Retrieve textures and pixel spacing in memory
-    auto albedo_tex = render::context()->GetTextureData(environment_maps_->textures()[0], 0);
-    auto normal_tex = render::context()->GetTextureData(environment_maps_->textures()[1], 0);
-    auto depth_tex = render::context()->GetTextureData(environment_maps_->depth(), 0);
+    // Pixel spacing in memory
+    const auto& albedo_tex = *environment_albedo_;
+    const auto& normal_tex = *environment_normal_;
+    const auto& depth_tex = *environment_depth_;
     std::size_t albedo_pixel_size = albedo_tex.bits_per_pixel() / 8;
     std::size_t normal_pixel_size = normal_tex.bits_per_pixel() / 8;
     std::size_t depth_pixel_size = depth_tex.bits_per_pixel() / 8;
+    const int map_rows = static_cast<int>(albedo_tex.height) / kProbeMapSize;
     const Matrix cube_projection = MatrixPerspective(kPi / 2.0f, 1.0f, kBakeScreenNear, kBakeScreenFar, render::context()->IsDepthBufferRangeZeroToOne());
 
-    // Iterate over each face of each probe and generate samples
-    for (const auto& probe : probes_)
+    // Iterate over each face of each probe and generate samples, with probes spread across all worker threads.
+    // Each probe reduces its own samples before moving on, so the output is the same no matter how many threads are used
+    ParallelFor(0, probe_ids.size(), 1, [&](std::size_t probe_slot)
     {
+        const auto& probe = probes_[probe_ids[probe_slot]];
+        // Surfel samples are only produced by texels that hit geometry, while every texel has a sky sample
+        std::vector<SurfelSample> probe_surfels;
+        probe_surfels.reserve(kTexelsPerProbe);
+        std::vector<float> probe_sky_visibility(kTexelsPerProbe);
+        units::world* probe_texel_depths = texel_depths_.data() + kTexelsPerProbe * probe.id;
         int face_index = 0;
         for (const auto& face : kFaceOrder)
         {
             // Reconstruct camera rotation that was used to render scene for this face
             Vector3 rot = AxisRotationPitchYawRoll(face);
             Camera cube_view;
-            cube_view.set_pos(0, 0, 0);
             cube_view.set_rot(rot.x, rot.y, rot.z);
-            // Since a view matrix rotates things in the opposite of the direction given
-            // We use the inverse for determining the normal of the sphere at a given texel
-            Matrix sphere_rotation_matrix = MatrixInverse(cube_view.view_matrix());
             // Reconstruct full camera rotation and position that was used to render scene for this face
             // Used for reconstructing the world space position at a given texel, same as in deferred rendering
             cube_view.set_pos(probe.pos.x, probe.pos.y, probe.pos.z);
@@ -227,7 +1308,7 @@ void RadianceTransferBaker::GatherProbeSamples(std::vector<SurfelSample>* surfel
                     uv.y = (static_cast<units::world>(y) + 0.5f) / static_cast<units::world>(kProbeMapSize) * 2.0f - 1.0f;
                     // Texel coordinates
                     int px = x + face_index * kProbeMapSize;
-                    int py = y + probe.id * kProbeMapSize;
+                    int py = y + (probe.id % map_rows) * kProbeMapSize;
 
                     // Extract and translate sample data from environment maps
                     auto albedo = Vector3(static_cast<float>(albedo_tex.pixels.data()[(px + py * albedo_tex.width) * albedo_pixel_size + 0]) / 255.0f,
@@ -241,16 +1322,14 @@ void RadianceTransferBaker::GatherProbeSamples(std::vector<SurfelSample>* surfel
                                                   static_cast<float>(normal_tex.pixels.data()[(px + py * normal_tex.width) * normal_pixel_size + 2]) / 255.0f);
                     surface_normal = VectorNormalize(surface_normal * 2.0f - 1.0f);
                     // Depth value is stored as a float across 4 unsigned chars so we cast to a pointer and then dereference
-                    auto depth = *reinterpret_cast<units::world*>(&depth_tex.pixels.data()[(px + py * depth_tex.width) * depth_pixel_size]);
+                    auto depth = *reinterpret_cast<const units::world*>(&depth_tex.pixels.data()[(px + py * depth_tex.width) * depth_pixel_size]);
                     // Translate to normalized device coordinates
                     depth = depth * 2.0f - 1.0f;
 
-                    // View direction from probe to sample
-                    Vector3 sphere_normal(uv.x, uv.y, -1.0f);
-                    sphere_normal *= sphere_rotation_matrix;
-                    sphere_normal = VectorNormalize(sphere_normal);
+                    int texel_index = EnvironmentMapTexelIndex(face_index, x, y);
 
                     // Finally build and store each sample
+                    probe_texel_depths[texel_index] = std::numeric_limits<units::world>::infinity();
                     if (sky_visibility < 0.5f)
                     {
                         // World space position of given sample
@@ -264,6 +1343,7 @@ void RadianceTransferBaker::GatherProbeSamples(std::vector<SurfelSample>* surfel
                         surfel.pos = Vector3(world_pos.x, world_pos.y, world_pos.z);
                         surfel.normal = surface_normal;
                         surfel.albedo = albedo;
+                        probe_texel_depths[texel_index] = VectorLength(surfel.pos - probe.pos);
                         surfel_sample.surfel = surfel;
                         surfel_sample.parent_probe = probe.id;
                         // Generate 6 weights for this sample based on the cosine to each axis
@@ -296,210 +1376,266 @@ void RadianceTransferBaker::GatherProbeSamples(std::vector<SurfelSample>* surfel
                             // Weight by texel solid angle since we are approximating a hemispherical function
                             surfel_sample.parent_probe_weights[weight_face] *= EnvironmentMapTexelWeight(uv);
                         }
-                        surfel_samples->push_back(surfel_sample);
+                        probe_surfels.push_back(surfel_sample);
                     }
-                    SkyVisSample sky_sample;
-                    sky_sample.uv = uv;
-                    sky_sample.normal = sphere_normal;
-                    sky_sample.visibility = sky_visibility;
-                    sky_sample.parent_probe = probe.id;
-                    sky_samples->push_back(sky_sample);
+                    probe_sky_visibility[texel_index] = sky_visibility;
                 }
             }
             face_index++;
         }
-    }
+        probes_[probe.id].sh_sky_visibility = BakeSkyCoefficients(probe_sky_visibility);
+        probe_clusters_[probe.id] = ReduceProbeSamples(probe_surfels);
+    });
 }
 
-void RadianceTransferBaker::BakeSurfelClusters(const std::vector<SurfelSample>& samples)
+RadianceTransferBaker::ProbeClusters RadianceTransferBaker::ReduceProbeSamples(const std::vector<SurfelSample>& samples)
 {
-    // Turn surfel samples into spatially indexed clusters
-    auto surfel_data = ClusterSurfelData(samples);
-    auto brick_data = ClusterBrickData(&surfel_data);
-    // Transfer clustered surfel and brick data to contiguous memory
-    // BakeBrick data still needed for weight factor generation
-    std::vector<BakeBrick> contiguous_bricks;
-    contiguous_bricks.reserve(brick_data.size());
-    for (auto& brick : brick_data)
+    // Spatially index each sample, breaking ties by gather order so samples are summed in the order they were taken
+    std::vector<std::pair<uint64_t, uint32_t>> sorted_samples(samples.size());
+    for (std::size_t i = 0; i < samples.size(); i++)
+    {
+        sorted_samples[i] = std::make_pair(SurfelKey(samples[i].surfel), static_cast<uint32_t>(i));
+    }
+    std::sort(sorted_samples.begin(), sorted_samples.end());
+
+    ProbeClusters clusters;
+    for (std::size_t i = 0; i < sorted_samples.size(); i++)
     {
-        // Calculate the final index references
-        brick.second.brick.surfel_range_start = static_cast<int>(surfels_.size());
-        brick.second.brick.surfel_count = static_cast<int>(brick.second.surfels.size());
-        // Transfer to contiguous memory
-        contiguous_bricks.push_back(brick.second);
-        surfel_bricks_.push_back(brick.second.brick);
-        // Cluster final surfels by brick
-        for (const auto& bake_surfel : brick.second.surfels)
+        const auto& key = sorted_samples[i].first;
+        const auto& sample = samples[sorted_samples[i].second];
+        // Sum surfel data
+        if (i == 0 || key != sorted_samples[i - 1].first)
+        {
+            SurfelCluster surfel;
+            surfel.key = key;
+            surfel.pos = sample.surfel.pos;
+            surfel.normal = sample.surfel.normal;
+            surfel.albedo = sample.surfel.albedo;
+            surfel.sample_count = 1;
+            clusters.surfels.push_back(surfel);
+        }
+        else
+        {
+            auto& surfel = clusters.surfels.back();
+            surfel.pos += sample.surfel.pos;
+            surfel.normal += sample.surfel.normal;
+            surfel.albedo += sample.surfel.albedo;
+            surfel.sample_count++;
+        }
+        // Note the sampling probe face that sampled and add to its weight
+        if (i == 0 || SurfelKeyBrick(key) != SurfelKeyBrick(sorted_samples[i - 1].first))
+        {
+            BrickCluster brick;
+            brick.brick_key = SurfelKeyBrick(key);
+            // Copy basis weights
+            std::copy(std::begin(sample.parent_probe_weights), std::end(sample.parent_probe_weights), std::begin(brick.brick_weights));
+            clusters.bricks.push_back(brick);
+        }
+        else
         {
-            surfels_.push_back(bake_surfel.surfel);
+            auto& brick = clusters.bricks.back();
+            for (const auto& face : kFaceOrder)
+            {
+                brick.brick_weights[face] += sample.parent_probe_weights[face];
+            }
         }
     }
-    // Turn use BakeBrick data to build brick weights for each probe
-    GenerateBrickWeights(contiguous_bricks);
+    return clusters;
+}
+
+SHCoeffs3 RadianceTransferBaker::BakeSkyCoefficients(const std::vector<float>& texel_visibility)
+{
+    const auto& texel_directions = EnvironmentMapTexelDirections();
+    const auto& texel_weights = EnvironmentMapTexelWeights();
+    // Weight texels contribution by its solid angle on the sphere
+    std::vector<float> sample_weights(kTexelsPerProbe);
+    for (int texel_index = 0; texel_index < kTexelsPerProbe; texel_index++)
+    {
+        sample_weights[texel_index] = texel_visibility[texel_index] * texel_weights[texel_index];
+    }
+    // Sum up sky coefficients of every texel at once
+    SHCoeffs3 sh_sky_visibility;
+    SHProjectDirections3(texel_directions.data(), sample_weights.data(), kTexelsPerProbe, &sh_sky_visibility);
+    // Normalize sky coefficients to surface area of unit sphere
+    sh_sky_visibility *= 4.0f * kPi / EnvironmentMapTotalTexelWeight();
+    return sh_sky_visibility;
+}
+
+void RadianceTransferBaker::BakeSurfelClusters()
+{
+    // Turn every probe's surfel clusters into spatially sorted surfels, along with the brick weights of each probe
+    FoldProbeClusters(probe_clusters_, &probes_, &surfels_, &surfel_bricks_, &surfel_brick_factors_);
     // Normalize weights to PI
     NormalizeBrickWeights();
 }
 
-RadianceTransferBaker::SurfelCluster RadianceTransferBaker::ClusterSurfelData(const std::vector<SurfelSample>& samples)
+void RadianceTransferBaker::ClusterSurfelSamples(const std::vector<SurfelSample>& samples, std::vector<LightSector::Probe>* probes,
+                                                 std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks,
+                                                 std::vector<LightSector::SurfelBrickFactor>* brick_factors)
 {
-    // Build a spatial, clustered hash grid of all surfels
-    SurfelCluster surfel_data;
-    // The max possible number of surfels we'll store (likely much less)
-    surfel_data.reserve(samples.size());
-    // Spatially index each sample, summing surfel data in overlapping indices
-    // These are averaged later in the bake process during ClusterBrickData (sloppier code, but more efficient sorry)
+    // Split samples up by the probe that gathered them, keeping them in order
+    std::vector<std::vector<SurfelSample>> probe_samples(probes->size());
     for (const auto& sample : samples)
     {
-        SurfelIndex search_index;
-        // Offset negative values by a whole step to deal with naive truncations resulting
-        // in too many surfels located at index 0
-        search_index.x = static_cast<int>(sample.surfel.pos.x / kSurfelSize) + (sample.surfel.pos.x >= 0.0 ? 0 : -1);
-        search_index.y = static_cast<int>(sample.surfel.pos.y / kSurfelSize) + (sample.surfel.pos.y >= 0.0 ? 0 : -1);
-        search_index.z = static_cast<int>(sample.surfel.pos.z / kSurfelSize) + (sample.surfel.pos.z >= 0.0 ? 0 : -1);
-        search_index.direction = FindGreatestAxis(sample.surfel.normal);
-        // Copy parent probe id and basis weights
-        BakeSurfel::ParentProbeData parent_data;
-        parent_data.id = sample.parent_probe;
-        std::copy(std::begin(sample.parent_probe_weights), std::end(sample.parent_probe_weights), std::begin(parent_data.weights));
-        // Check if surfel exists already
-        auto it = surfel_data.find(search_index);
-        // Add to surfel at index
-        if (it != surfel_data.end())
-        {
-            it->second.surfel.pos += sample.surfel.pos;
-            it->second.surfel.normal += sample.surfel.normal;
-            it->second.surfel.albedo += sample.surfel.albedo;
-            it->second.parent_probes.push_back(parent_data);
-            it->second.sample_count++;
-        }
-        // Generate new surfel at index
-        else
-        {
-            BakeSurfel surfel;
-            surfel.surfel = sample.surfel;
-            surfel.parent_probes = { parent_data };
-            surfel.sample_count = 1;
-            surfel_data[search_index] = surfel;
-        }
+        probe_samples[sample.parent_probe].push_back(sample);
     }
-    return surfel_data;
+    std::vector<ProbeClusters> probe_clusters(probes->size());
+    ParallelFor(0, probes->size(), 1, [&](std::size_t probe_id)
+    {
+        probe_clusters[probe_id] = ReduceProbeSamples(probe_samples[probe_id]);
+    });
+    FoldProbeClusters(probe_clusters, probes, surfels, bricks, brick_factors);
 }
 
-RadianceTransferBaker::BrickCluster RadianceTransferBaker::ClusterBrickData(SurfelCluster* surfel_data)
+void RadianceTransferBaker::FoldProbeClusters(const std::vector<ProbeClusters>& probe_clusters, std::vector<LightSector::Probe>* probes,
+                                              std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks,
+                                              std::vector<LightSector::SurfelBrickFactor>* brick_factors)
 {
-    // Build a spatial, clustered hash grid of all bricks
-    BrickCluster brick_data;
-    // The max possible number of bricks we'll store (likely much less)
-    brick_data.reserve(surfel_data->size());
-    // Cluster surfels into bricks
-    for (auto& surfel_it : *surfel_data)
+    auto sorted = SortSurfelClusters(probe_clusters);
+    ReduceSurfels(sorted, *probes, surfels);
+    ReduceBricks(sorted, bricks);
+    GenerateBrickWeights(probe_clusters, sorted, probes, brick_factors);
+}
+
+RadianceTransferBaker::SortedSurfelClusters RadianceTransferBaker::SortSurfelClusters(const std::vector<ProbeClusters>& probe_clusters)
+{
+    std::size_t cluster_count = 0;
+    for (const auto& clusters : probe_clusters)
     {
-        auto& s = surfel_it.second;
-        // Average surfel values among given samples
-        s.surfel.pos    /= static_cast<units::world>(s.sample_count);
-        s.surfel.normal /= static_cast<units::world>(s.sample_count);
-        s.surfel.normal = VectorNormalize(s.surfel.normal);
-        s.surfel.albedo /= static_cast<units::world>(s.sample_count);
-        s.sample_count = 1;
-        // Also an efficient time to solve for nearest probe
-        for (const auto& parent_probe : s.parent_probes)
+        cluster_count += clusters.surfels.size();
+    }
+    if (cluster_count > std::numeric_limits<uint32_t>::max())
+    {
+        throw "Too many surfel clusters to sort";
+    }
+    SortedSurfelClusters sorted;
+    sorted.clusters.reserve(cluster_count);
+    sorted.cluster_probes.reserve(cluster_count);
+    sorted.keys.reserve(cluster_count);
+    sorted.cluster_ids.reserve(cluster_count);
+    for (std::size_t probe_id = 0; probe_id < probe_clusters.size(); probe_id++)
+    {
+        for (const auto& cluster : probe_clusters[probe_id].surfels)
         {
-            if (s.surfel.nearest_probe_id != parent_probe.id)
-            {
-                auto dist_old = VectorLength(probes_[s.surfel.nearest_probe_id].pos - s.surfel.pos);
-                auto dist_new = VectorLength(probes_[parent_probe.id].pos - s.surfel.pos);
-                if (dist_new < dist_old)
-                {
-                    s.surfel.nearest_probe_id = parent_probe.id;
-                }
-            }
+            sorted.cluster_ids.push_back(static_cast<uint32_t>(sorted.clusters.size()));
+            sorted.clusters.push_back(&cluster);
+            sorted.cluster_probes.push_back(static_cast<int>(probe_id));
+            sorted.keys.push_back(cluster.key);
         }
+    }
+    // The sort is stable, so clusters within a surfel stay in probe order
+    RadixSort(&sorted.keys, &sorted.cluster_ids);
 
-        SurfelIndex search_index;
-        // Offset negative values by a whole step and 1 to deal with naive truncations resulting
-        // in too many bricks located at index 0
-        search_index.x = (surfel_it.first.x + (surfel_it.first.x >= 0 ? 0 : -kSurfelsPerBrick + 1)) / kSurfelsPerBrick;
-        search_index.y = (surfel_it.first.y + (surfel_it.first.y >= 0 ? 0 : -kSurfelsPerBrick + 1)) / kSurfelsPerBrick;
-        search_index.z = (surfel_it.first.z + (surfel_it.first.z >= 0 ? 0 : -kSurfelsPerBrick + 1)) / kSurfelsPerBrick;
-        search_index.direction = surfel_it.first.direction;
-
-        auto brick_it = brick_data.find(search_index);
-        if (brick_it != brick_data.end())
-        {
-            brick_it->second.surfels.push_back(s);
-        }
-        else
+    // Find where each surfel and brick begins
+    for (std::size_t i = 0; i < sorted.keys.size(); i++)
+    {
+        bool new_brick = (i == 0 || SurfelKeyBrick(sorted.keys[i]) != SurfelKeyBrick(sorted.keys[i - 1]));
+        if (new_brick || sorted.keys[i] != sorted.keys[i - 1])
         {
-            BakeBrick brick;
-            brick.surfels = { s };
-            brick_data[search_index] = brick;
+            if (new_brick)
+            {
+                sorted.brick_starts.push_back(sorted.surfel_starts.size());
+            }
+            sorted.surfel_starts.push_back(i);
         }
     }
-    return brick_data;
+    sorted.brick_starts.push_back(sorted.surfel_starts.size());
+    sorted.surfel_starts.push_back(sorted.keys.size());
+    return sorted;
 }
 
-void RadianceTransferBaker::GenerateBrickWeights(const std::vector<BakeBrick>& bricks)
+void RadianceTransferBaker::ReduceSurfels(const SortedSurfelClusters& sorted, const std::vector<LightSector::Probe>& probes,
+                                          std::vector<LightSector::Surfel>* surfels)
 {
-    // Generate brick factors
-    std::vector<BakeBrickFactor> brick_factor_data;
-    for (int i = 0; i < bricks.size(); i++)
+    const std::size_t surfel_count = sorted.surfel_starts.size() - 1;
+    surfels->resize(surfel_count);
+    ParallelFor(0, surfel_count, 256, [&](std::size_t surfel_id)
     {
-        // Stores number of samples each probe face saw in this brick
-        std::unordered_map<int, float[6]> probe_counts;
-        for (const auto& surfel : bricks[i].surfels)
+        auto cluster_begin = sorted.surfel_starts[surfel_id];
+        auto cluster_end = sorted.surfel_starts[surfel_id + 1];
+        // Sum surfel data in probe order, with the first probe to see the surfel being the nearest until shown otherwise
+        const auto& first_cluster = *sorted.clusters[sorted.cluster_ids[cluster_begin]];
+        LightSector::Surfel surfel;
+        surfel.nearest_probe_id = sorted.cluster_probes[sorted.cluster_ids[cluster_begin]];
+        surfel.pos = first_cluster.pos;
+        surfel.normal = first_cluster.normal;
+        surfel.albedo = first_cluster.albedo;
+        surfel.radiance = Vector3(0.0f);
+        int sample_count = first_cluster.sample_count;
+        for (auto i = cluster_begin + 1; i < cluster_end; i++)
         {
-            // Iterate through every sample that was gathered from this surfel
-            // Note the sampling probe face that sampled and add to its weight
-            for (const auto& probe : surfel.parent_probes)
-            {
-                auto probe_it = probe_counts.find(probe.id);
-                // Add to sample count
-                if (probe_it != probe_counts.end())
-                {
-                    for (const auto& face : kFaceOrder)
-                    {
-                        probe_it->second[face] += probe.weights[face];
-                    }
-                }
-                // Generate new sample count array
-                else
-                {
-                    for (const auto& face : kFaceOrder)
-                    {
-                        probe_counts[probe.id][face] = probe.weights[face];
-                    }
-                }
-            }
+            const auto& cluster = *sorted.clusters[sorted.cluster_ids[i]];
+            surfel.pos += cluster.pos;
+            surfel.normal += cluster.normal;
+            surfel.albedo += cluster.albedo;
+            sample_count += cluster.sample_count;
         }
-        // Build a BakeBrickFactor for each probe that samples this brick using
-        // the weights we just generated
-        for (const auto& probe : probe_counts)
+        // Average surfel values among given samples
+        auto sample_weight = static_cast<units::world>(sample_count);
+        surfel.pos    /= sample_weight;
+        surfel.normal /= sample_weight;
+        surfel.normal = VectorNormalize(surfel.normal);
+        surfel.albedo /= sample_weight;
+        // Also an efficient time to solve for nearest probe
+        for (auto i = cluster_begin + 1; i < cluster_end; i++)
         {
-            BakeBrickFactor f;
-            f.factor.brick_id = i;
-            // Copy basis weights
-            std::copy(std::begin(probe.second), std::end(probe.second), std::begin(f.factor.brick_weights));
-            f.parent_probe = probe.first;
-            brick_factor_data.push_back(f);
+            int parent_probe = sorted.cluster_probes[sorted.cluster_ids[i]];
+            auto dist_old = VectorLength(probes[surfel.nearest_probe_id].pos - surfel.pos);
+            auto dist_new = VectorLength(probes[parent_probe].pos - surfel.pos);
+            if (dist_new < dist_old)
+            {
+                surfel.nearest_probe_id = parent_probe;
+            }
         }
+        (*surfels)[surfel_id] = surfel;
+    });
+}
+
+void RadianceTransferBaker::ReduceBricks(const SortedSurfelClusters& sorted, std::vector<LightSector::SurfelBrick>* bricks)
+{
+    const std::size_t brick_count = sorted.brick_starts.size() - 1;
+    bricks->resize(brick_count);
+    // Surfels are already grouped by brick, so bricks just reference a range of them
+    for (std::size_t i = 0; i < brick_count; i++)
+    {
+        auto& brick = (*bricks)[i];
+        brick.surfel_range_start = static_cast<int>(sorted.brick_starts[i]);
+        brick.surfel_count = static_cast<int>(sorted.brick_starts[i + 1] - sorted.brick_starts[i]);
+        brick.radiance = Vector3(0.0f);
     }
-    // Group by parent probe
-    std::sort(brick_factor_data.begin(), brick_factor_data.end(),
-              [](const auto& a, const auto& b){ return a.parent_probe < b.parent_probe; });
-    // Fill in brick factor indices for parent probes
-    // Transfer bake brick factors to final container in the same pass
-    for (int i = 0; i < brick_factor_data.size(); i++)
+}
+
+void RadianceTransferBaker::GenerateBrickWeights(const std::vector<ProbeClusters>& probe_clusters, const SortedSurfelClusters& sorted,
+                                                 std::vector<LightSector::Probe>* probes, std::vector<LightSector::SurfelBrickFactor>* brick_factors)
+{
+    const std::size_t brick_count = sorted.brick_starts.size() - 1;
+    std::vector<uint64_t> brick_keys(brick_count);
+    for (std::size_t i = 0; i < brick_count; i++)
+    {
+        brick_keys[i] = SurfelKeyBrick(sorted.keys[sorted.surfel_starts[sorted.brick_starts[i]]]);
+    }
+    // Each probe already summed its own brick weights in brick order, so they only need to be laid out one after another
+    int factor_count = 0;
+    for (std::size_t i = 0; i < probes->size(); i++)
+    {
+        auto& probe = (*probes)[i];
+        int probe_factor_count = static_cast<int>(probe_clusters[i].bricks.size());
+        // Fill in brick factor indices for parent probes
+        probe.brick_factor_range_start = probe_factor_count > 0 ? factor_count : 0;
+        probe.brick_factor_count = probe_factor_count;
+        factor_count += probe_factor_count;
+    }
+    brick_factors->resize(factor_count);
+    ParallelFor(0, probes->size(), 16, [&](std::size_t probe_id)
     {
-        const auto& factor = brick_factor_data[i];
-        auto& probe = probes_[factor.parent_probe];
-        if (probe.brick_factor_count == 0)
+        auto factor = brick_factors->begin() + (*probes)[probe_id].brick_factor_range_start;
+        for (const auto& brick : probe_clusters[probe_id].bricks)
         {
-            probe.brick_factor_range_start = i;
+            factor->brick_id = static_cast<int>(std::lower_bound(brick_keys.begin(), brick_keys.end(), brick.brick_key) - brick_keys.begin());
+            std::copy(std::begin(brick.brick_weights), std::end(brick.brick_weights), std::begin(factor->brick_weights));
+            factor++;
         }
-        probe.brick_factor_count++;
-        // Transfer to contiguous memory
-        surfel_brick_factors_.push_back(factor.factor);
-    }
+    });
 }
 
 void RadianceTransferBaker::NormalizeBrickWeights()
@@ -517,8 +1653,9 @@ void RadianceTransferBaker::NormalizeBrickWeights()
     // both use cases is simply N, or 6*kProbeMapSize^2
     const float normalization_factor = static_cast<float>(kProbeMapSize * kProbeMapSize * 6);
     // Normalize brick weights to pi
-    for (const auto& probe : probes_)
+    ParallelFor(0, probes_.size(), 16, [&](std::size_t probe_id)
     {
+        const auto& probe = probes_[probe_id];
         auto start = surfel_brick_factors_.begin() + probe.brick_factor_range_start;
         auto end = start + probe.brick_factor_count;
         // Apply normalization factor
@@ -531,35 +1668,17 @@ void RadianceTransferBaker::NormalizeBrickWeights()
             }
             return bf;
         });
-    }
-}
-
-void RadianceTransferBaker::BakeSkyCoefficients(const std::vector<SkyVisSample>& samples)
-{
-    // Holds normalization factor for each probe as samples are summed
-    std::vector<float> probe_weights(probes_.size(), 0.0f);
-    // Iterate over all samples and sum up sky coefficients
-    for (const auto& sample : samples)
-    {
-        // Weight texels contribution by its solid angle on the sphere
-        float sh_texel_weight = EnvironmentMapTexelWeight(sample.uv);
-        // Add sample to SH coefficients
-        probes_[sample.parent_probe].sh_sky_visibility += SHProjectDirection3(sample.normal) * sample.visibility * sh_texel_weight;
-        // Build up normalization sums
-        probe_weights[sample.parent_probe] += sh_texel_weight;
-    }
-    // Normalize sky coefficients to surface area of unit sphere
-    for (auto& probe : probes_)
-    {
-        probe.sh_sky_visibility *= 4.0f * kPi / probe_weights[probe.id];
-    }
+    });
 }
 
 void RadianceTransferBaker::BakeProbeNetwork()
 {
     // Probe lookup acceleration and interpolation structure based on:
     // http://www.gdcvault.com/play/1015312/Light-Probe-Interpolation-Using-Tetrahedral
-    auto triangulation = TriangulateProbeNetwork();
+    // Rebakes build over the previous network, so start from nothing like a full bake would
+    probe_network_.clear();
+    hull_normals_.assign(probes_.size(), Vector3(0.0f));
+    auto triangulation = TriangulateProbeNetwork(probes_);
     BakeProbeNetworkInnerCells(triangulation);
     BakeProbeNetworkInnerNeighbours();
     BakeProbeNetworkOuterCells();
@@ -568,15 +1687,22 @@ void RadianceTransferBaker::BakeProbeNetwork()
     BakeProbeNetworkConvererters();
 }
 
-std::vector<Tetrahedron> RadianceTransferBaker::TriangulateProbeNetwork()
+std::vector<LightSector::ProbeSearchCell> RadianceTransferBaker::BuildProbeNetwork(const std::vector<LightSector::Probe>& probes)
+{
+    RadianceTransferBaker baker(probes);
+    baker.BakeProbeNetwork();
+    return std::move(baker.probe_network_);
+}
+
+std::vector<std::array<int, 4>> RadianceTransferBaker::TriangulateProbeNetwork(const std::vector<LightSector::Probe>& probes)
 {
     // Bowyer-Watson algorithm for calculating Delaunay triangulations
-    std::vector<Tetrahedron> tetrahedrons;
-    // Create 5 bounding tetrahedrons that encase all probe positions
-    // Start by making an AABB
+    // Start by making an AABB that encases all probe positions
     Vector3 min(std::numeric_limits<units::world>::max());
     Vector3 max(-std::numeric_limits<units::world>::max());
-    for (const auto& probe : probes_)
+    std::vector<Vector3> points;
+    points.reserve(probes.size());
+    for (const auto& probe : probes)
     {
         min.x = std::min(min.x, probe.pos.x);
         max.x = std::max(max.x, probe.pos.x);
@@ -584,158 +1710,66 @@ std::vector<Tetrahedron> RadianceTransferBaker::TriangulateProbeNetwork()
         max.y = std::max(max.y, probe.pos.y);
         min.z = std::min(min.z, probe.pos.z);
         max.z = std::max(max.z, probe.pos.z);
+        points.push_back(probe.pos);
     }
     // Add a margin because of floating point precision
     min -= 5.0f;
     max += 5.0f;
-    // Build a bounding box volume out of 5 tetrahedrons
-    const std::vector<Tetrahedron> kBoundingTetrahedrons = {
-        { Vector3(max.x, min.y, min.z), Vector3(min.x, max.y, min.z), Vector3(min.x, min.y, max.z), min },
-        { Vector3(min.x, max.y, min.z), Vector3(max.x, min.y, min.z), Vector3(max.x, max.y, min.z), max },
-        { Vector3(min.x, max.y, min.z), Vector3(min.x, min.y, max.z), Vector3(min.x, max.y, max.z), max },
-        { Vector3(min.x, min.y, max.z), Vector3(max.x, min.y, min.z), Vector3(max.x, min.y, max.z), max },
-        { Vector3(min.x, max.y, min.z), Vector3(max.x, min.y, min.z), Vector3(min.x, min.y, max.z), max }
-    };
-    // Inject them into our solver as a starting point
-    tetrahedrons.insert(tetrahedrons.begin(), kBoundingTetrahedrons.begin(), kBoundingTetrahedrons.end());
-    for (const auto& probe : probes_)
-    {
-        Vector3 point = probe.pos;
-        // Partition the tetrahedrons so that circumspheres containing point are in the latter half (returns false)
-        auto partition_point = std::partition(tetrahedrons.begin(), tetrahedrons.end(), [&](const auto& tetrahedron)
-        {
-            Sphere circumsphere = TetrahedronCircumsphere(tetrahedron);
-            // 1e-3 is a magic number. I hope you never have to deal with it.
-            // This implementation gets messed up on heavily co-planar point sets.
-            // I have spent a lot of time messing with this and I'm not sure why. I even had
-            // an infinite precision float library hooked up at one point to make sure it wasn't
-            // caused by rounding errors (didn't seem to be). I found 1e-3 just by exasperatedly
-            // tweaking numbers. Making this number smaller or larger seems to ruin its mysterious
-            // properties. There is a throwable exception lying in wait should this ever run into
-            // a dataset that causes it to fail.
-            return !(VectorDistance(circumsphere.center, point) <= circumsphere.radius - 1e-3);
-        });
-        // Move the marked tetrahedrons to a new list
-        std::vector<Tetrahedron> subdividable_tetrahedrons(std::make_move_iterator(partition_point),
-                                                           std::make_move_iterator(tetrahedrons.end()));
-        // And remove them from the old one
-        tetrahedrons.erase(partition_point, tetrahedrons.end());
+    DelaunayTetrahedralization triangulation(points, min, max);
 
-        // Define a triangle type as 3 points
-        using Triangle = std::array<Vector3, 3>;
+    // Insert in biased randomized rounds (BRIO), each one twice as large as the last and sorted along a
+    // Hilbert curve. Randomness keeps the expected cavity size constant while the curve keeps consecutive
+    // points close together, so locating each point only needs a short walk
+    std::vector<int> insertion_order(probes.size());
+    std::iota(insertion_order.begin(), insertion_order.end(), 0);
+    std::mt19937 random_algorithm;
+    random_algorithm.seed(1);
+    std::shuffle(insertion_order.begin(), insertion_order.end(), random_algorithm);
+    std::vector<uint64_t> hilbert_indices(probes.size());
+    Vector3 extent = max - min;
+    for (std::size_t i = 0; i < probes.size(); i++)
+    {
+        Vector3 normalized = (probes[i].pos - min) / extent;
+        hilbert_indices[i] = HilbertIndex({ static_cast<uint32_t>(normalized.x * 65535.0f),
+                                            static_cast<uint32_t>(normalized.y * 65535.0f),
+                                            static_cast<uint32_t>(normalized.z * 65535.0f) });
+    }
+    std::size_t round_end = insertion_order.size();
+    while (round_end > 0)
+    {
+        std::size_t round_start = round_end > 64 ? round_end / 2 : 0;
+        std::sort(insertion_order.begin() + round_start, insertion_order.begin() + round_end,
+                  [&](int a, int b) { return hilbert_indices[a] < hilbert_indices[b]; });
+        round_end = round_start;
+    }
 
-        // Build a list of every face within the list of subdividable tetrahedrons
-        std::vector<Triangle> triangle_list;
-        for (const auto& tetrahedron : subdividable_tetrahedrons)
-        {
-            triangle_list.push_back({ tetrahedron.vertices[0], tetrahedron.vertices[1], tetrahedron.vertices[2] }); // Skip 3
-            triangle_list.push_back({ tetrahedron.vertices[0], tetrahedron.vertices[1], tetrahedron.vertices[3] }); // Skip 2
-            triangle_list.push_back({ tetrahedron.vertices[0], tetrahedron.vertices[2], tetrahedron.vertices[3] }); // Skip 1
-            triangle_list.push_back({ tetrahedron.vertices[1], tetrahedron.vertices[2], tetrahedron.vertices[3] }); // Skip 0
-        }
-        // Sort every triangle so they can be compared
-        for (auto& triangle : triangle_list)
-        {
-            std::stable_sort(triangle.begin(), triangle.end(), [](const auto& a, const auto& b) { return a.x < b.x; });
-            std::stable_sort(triangle.begin(), triangle.end(), [](const auto& a, const auto& b) { return a.y < b.y; });
-            std::stable_sort(triangle.begin(), triangle.end(), [](const auto& a, const auto& b) { return a.z < b.z; });
-        }
-        // Remove both instances (yes, both) of every duplicate triangle face
-        std::vector<Triangle> unique_triangle_list;
-        std::copy_if(triangle_list.begin(), triangle_list.end(), std::back_inserter(unique_triangle_list), [&](const auto& triangle)
-        {
-            int match_count = 0;
-            for (const auto& other_triangle : triangle_list)
-            {
-                // If I read the standard right this should be fine since we never did any floating point math with these.
-                // While risky, doing this properly is preferrable over an epsilon since that's a whole can of worms that
-                // could quietly bite you down the road
-                if (triangle[0] == other_triangle[0] && triangle[1] == other_triangle[1] && triangle[2] == other_triangle[2])
-                {
-                    match_count++;
-                }
-            }
-            // This can only be caused by degenerate tetrahedrons
-            if (match_count != 2 && match_count != 1)
-            {
-                // If we're getting this again and have the time to do a full overhaul of the triangulation
-                // here's a method that I think will work better with floating point precision:
-                // Create any triangulation (simple barycentric tests with inclusive error margin to create
-                // cavity, insert point and connect). Then iterate by checking a tetrahedron with all neighbours,
-                // calculate and add the solid angle of their unique vertex and compare with the summed
-                // solid angle of all possible edge flips, take the minimum, if the difference between the
-                // current orientation and minimum is larger than some error margin.
-                // Continue iterating until no flips are made.
-                throw "It is time, John Codeman, to gaze upon the abyss once more";
-            }
-            // This naive test should always come out positive once when comparing to itself
-            // So we only return true for 1 or less
-            return match_count < 2;
-        });
-        // Finally, for every unique triangle construct a tetrahedron
-        // where one vertex lies on the subdividable point
-        for (const auto& triangle : unique_triangle_list)
-        {
-            tetrahedrons.push_back({ { point, triangle[0], triangle[1], triangle[2] } });
-        }
+    for (const auto& probe_id : insertion_order)
+    {
+        triangulation.Insert(probe_id);
     }
-    // Prune any tetrahedrons that are attached to the original bounding box
-    // A 4 level deep nested loop looks scary, but it seems to run fine
-    for (int i = 0; i < tetrahedrons.size(); i++)
+
+    // Skip any tetrahedrons that are attached to the original bounding box
+    std::vector<std::array<int, 4>> tetrahedrons = triangulation.Cells();
+    // Translate point indices to probe IDs
+    for (auto& tetrahedron : tetrahedrons)
     {
-        bool vertex_match = false;
-        for (const auto& vertex : tetrahedrons[i].vertices)
-        {
-            for (const auto& bounding_tetrahedron : kBoundingTetrahedrons)
-            {
-                for (const auto& bounding_vertex : bounding_tetrahedron.vertices)
-                {
-                    if (vertex == bounding_vertex)
-                    {
-                        vertex_match = true;
-                    }
-                }
-            }
-        }
-        if (vertex_match)
+        for (auto& vertex : tetrahedron)
         {
-            tetrahedrons.erase(tetrahedrons.begin() + i);
-            // We just erased, so the next element is actually at i
-            i--;
+            vertex = probes[vertex].id;
         }
     }
-
     return tetrahedrons;
 }
 
-void RadianceTransferBaker::BakeProbeNetworkInnerCells(const std::vector<Tetrahedron>& tetrahedrons)
+void RadianceTransferBaker::BakeProbeNetworkInnerCells(const std::vector<std::array<int, 4>>& tetrahedrons)
 {
     // Create a probe search cell for each tetrahedron
+    probe_network_.reserve(tetrahedrons.size());
     for (const auto& tetrahedron : tetrahedrons)
     {
         LightSector::ProbeSearchCell cell;
-        cell.probe_vertices = { LightSector::INVALID_ID, LightSector::INVALID_ID, LightSector::INVALID_ID, LightSector::INVALID_ID };
+        cell.probe_vertices = tetrahedron;
         cell.neighbours = { LightSector::INVALID_ID, LightSector::INVALID_ID, LightSector::INVALID_ID, LightSector::INVALID_ID };
-        // Translate vertex positions to matching probe positions by ID
-        for (int i = 0; i < tetrahedron.vertices.size(); i++)
-        {
-            for (const auto& probe : probes_)
-            {
-                if (probe.pos == tetrahedron.vertices[i])
-                {
-                    cell.probe_vertices[i] = probe.id;
-                    break;
-                }
-            }
-        }
-        // Check to ensure all vertices found their matching probe
-        for (const auto& probe_id : cell.probe_vertices)
-        {
-            if (probe_id == LightSector::INVALID_ID)
-            {
-                throw "Could not find probe matching triangulated vertex";
-            }
-        }
         // Sort by ID to make face comparisons easier during neighbour search
         std::sort(cell.probe_vertices.begin(), cell.probe_vertices.end());
         probe_network_.push_back(cell);
@@ -744,7 +1778,14 @@ void RadianceTransferBaker::BakeProbeNetworkInnerCells(const std::vector<Tetrahe
 
 void RadianceTransferBaker::BakeProbeNetworkInnerNeighbours()
 {
-    // Find neighbouring indices
+    // Every inner face is shared by exactly 2 cells, so cells are paired up through a table of faces
+    // that have only been seen once so far. Keyed by the sorted probe IDs of the face
+    if (probes_.size() > (static_cast<std::size_t>(1) << kFaceKeyProbeBits))
+    {
+        throw "Too many probes to build probe network neighbours";
+    }
+    std::unordered_map<uint64_t, std::pair<int, int>> open_faces;
+    open_faces.reserve(probe_network_.size() * 2);
     // For each cell
     for (int self_id = 0; self_id < probe_network_.size(); self_id++)
     {
@@ -752,11 +1793,6 @@ void RadianceTransferBaker::BakeProbeNetworkInnerNeighbours()
         // For each face
         for (int self_face = 0; self_face < kProbeNetworkFaces; self_face++)
         {
-            // This was already calculated while being determined as an "other" face, skip
-            if (self.neighbours[self_face] != LightSector::INVALID_ID)
-            {
-                continue;
-            }
             std::array<int, 3> self_probes;
             switch (self_face)
             {
@@ -775,42 +1811,20 @@ void RadianceTransferBaker::BakeProbeNetworkInnerNeighbours()
             default:
                 throw "Hit impossible face statement";
             }
-            // Check against every other cell & face
-            for (int other_id = 0; other_id < probe_network_.size(); other_id++)
+            // Inner cells have sorted probe vertices so the key is the same from either side
+            uint64_t key = (static_cast<uint64_t>(self_probes[0]) << (kFaceKeyProbeBits * 2)) |
+                           (static_cast<uint64_t>(self_probes[1]) << kFaceKeyProbeBits) |
+                            static_cast<uint64_t>(self_probes[2]);
+            auto face_it = open_faces.find(key);
+            if (face_it != open_faces.end())
             {
-                // Don't compare with self, skip
-                if (self_id == other_id)
-                {
-                    continue;
-                }
-                auto& other = probe_network_[other_id];
-                for (int other_face = 0; other_face < kProbeNetworkFaces; other_face++)
-                {
-                    std::array<int, 3> other_probes;
-                    switch (other_face)
-                    {
-                    case LightSector::FACE_012:
-                        other_probes = { other.probe_vertices[0], other.probe_vertices[1], other.probe_vertices[2] };
-                        break;
-                    case LightSector::FACE_023:
-                        other_probes = { other.probe_vertices[0], other.probe_vertices[2], other.probe_vertices[3] };
-                        break;
-                    case LightSector::FACE_013:
-                        other_probes = { other.probe_vertices[0], other.probe_vertices[1], other.probe_vertices[3] };
-                        break;
-                    case LightSector::FACE_123:
-                        other_probes = { other.probe_vertices[1], other.probe_vertices[2], other.probe_vertices[3] };
-                        break;
-                    default:
-                        throw "Hit impossible face statement";
-                    }
-                    // Inner cells have sorted probe vertices so a straight comparison works fine
-                    if (self_probes == other_probes)
-                    {
-                        self.neighbours[self_face] = other_id;
-                        other.neighbours[other_face] = self_id;
-                    }
-                }
+                self.neighbours[self_face] = face_it->second.first;
+                probe_network_[face_it->second.first].neighbours[face_it->second.second] = self_id;
+                open_faces.erase(face_it);
+            }
+            else
+            {
+                open_faces[key] = { self_id, self_face };
             }
         }
     }
@@ -823,7 +1837,8 @@ void RadianceTransferBaker::BakeProbeNetworkOuterCells()
     // Use an interator since we are modifying the list as we go
     for (int i = 0; i < outer_cell_start; i++)
     {
-        auto& cell = probe_network_[i];
+        // Copied since pushing outer cells can reallocate the network
+        const auto cell = probe_network_[i];
         for (const auto& face : { LightSector::FACE_123, LightSector::FACE_023, LightSector::FACE_013, LightSector::FACE_012 })
         {
             // Neighbour is an outer cell
@@ -870,7 +1885,7 @@ void RadianceTransferBaker::BakeProbeNetworkOuterCells()
                     std::iter_swap(outer_cell.probe_vertices.begin() + 1, outer_cell.probe_vertices.begin() + 2);
                 }
                 // Link the inner cell to the new outer cell
-                cell.neighbours[face] = static_cast<int>(probe_network_.size());
+                probe_network_[i].neighbours[face] = static_cast<int>(probe_network_.size());
                 // Push the outer cell onto the network
                 probe_network_.push_back(outer_cell);
             }
@@ -880,7 +1895,9 @@ void RadianceTransferBaker::BakeProbeNetworkOuterCells()
 
 void RadianceTransferBaker::BakeProbeNetworkOuterNeighbours()
 {
-    // Find neighbouring indices
+    // Pair up outer cells sharing an edge of the hull through a table of edges that have only been
+    // seen once so far. Keyed by the probe IDs of the edge, smallest first
+    std::unordered_map<uint64_t, std::pair<int, int>> open_edges;
     // For each cell
     for (int self_id = 0; self_id < probe_network_.size(); self_id++)
     {
@@ -892,11 +1909,6 @@ void RadianceTransferBaker::BakeProbeNetworkOuterNeighbours()
         // For each edge
         for (int self_edge = 0; self_edge < kProbeNetworkEdges; self_edge++)
         {
-            // This was already calculated while being determined as an "other" edge, skip
-            if (self.neighbours[self_edge] != LightSector::INVALID_ID)
-            {
-                continue;
-            }
             std::array<int, 2> self_probes;
             switch (self_edge)
             {
@@ -912,40 +1924,19 @@ void RadianceTransferBaker::BakeProbeNetworkOuterNeighbours()
             default:
                 throw "Hit impossible face statement";
             }
-            // Check against every other cell & edge
-            for (int other_id = 0; other_id < probe_network_.size(); other_id++)
+            // Outer cell vertices cannot be sorted so we order them like this
+            uint64_t key = (static_cast<uint64_t>(std::min(self_probes[0], self_probes[1])) << 32) |
+                            static_cast<uint64_t>(std::max(self_probes[0], self_probes[1]));
+            auto edge_it = open_edges.find(key);
+            if (edge_it != open_edges.end())
             {
-                auto& other = probe_network_[other_id];
-                // Don't compare with self and don't use inner cells, skip
-                if (self_id == other_id || !LightSector::IsOuterProbeSearchCell(other))
-                {
-                    continue;
-                }
-                for (int other_edge = 0; other_edge < kProbeNetworkEdges; other_edge++)
-                {
-                    std::array<int, 2> other_probes;
-                    switch (other_edge)
-                    {
-                    case LightSector::EDGE_12:
-                        other_probes = { other.probe_vertices[1], other.probe_vertices[2] };
-                        break;
-                    case LightSector::EDGE_02:
-                        other_probes = { other.probe_vertices[0], other.probe_vertices[2] };
-                        break;
-                    case LightSector::EDGE_01:
-                        other_probes = { other.probe_vertices[0], other.probe_vertices[1] };
-                        break;
-                    default:
-                        throw "Hit impossible face statement";
-                    }
-                    // Outer cell vertices cannot be sorted so we compare them like this
-                    if (std::min(self_probes[0], self_probes[1]) == std::min(other_probes[0], other_probes[1]) &&
-                        std::max(self_probes[0], self_probes[1]) == std::max(other_probes[0], other_probes[1]))
-                    {
-                        self.neighbours[self_edge] = other_id;
-                        other.neighbours[other_edge] = self_id;
-                    }
-                }
+                self.neighbours[self_edge] = edge_it->second.first;
+                probe_network_[edge_it->second.first].neighbours[edge_it->second.second] = self_id;
+                open_edges.erase(edge_it);
+            }
+            else
+            {
+                open_edges[key] = { self_id, self_edge };
             }
         }
     }
@@ -955,8 +1946,7 @@ void RadianceTransferBaker::BakeProbeNetworkHullNormals()
 {
     // We only need to store normals for probes that exist on the network hull.
     // Meaning this will have many empty values, but it's worth the instant
-    // lookup for the temporary cost of some memory
-    hull_normals_.resize(probes_.size());
+    // lookup for the temporary cost of some memory. Sized and zeroed in BakeProbeNetwork
 
     // This is implemented in a way that should hopefully never create a hull_normal
     // that has an angle between any of its connected face_normals greater than pi/2
@@ -1013,8 +2003,9 @@ void RadianceTransferBaker::BakeProbeNetworkHullNormals()
 void RadianceTransferBaker::BakeProbeNetworkConvererters()
 {
     // Build barycentric conversion matrices
-    for (auto& cell : probe_network_)
+    ParallelFor(0, probe_network_.size(), 64, [&](std::size_t cell_id)
     {
+        auto& cell = probe_network_[cell_id];
         // For inner cells we can build a matrix that takes as input
         // the world position to test subtracted by the 0th vertex (world_pos - vertices[0].pos)
         // and outputs a Vector3 of the barycentric coordinates for the tetrahedron
@@ -1078,7 +2069,134 @@ void RadianceTransferBaker::BakeProbeNetworkConvererters()
             }
             cell.barycentric_converter = matrix;
         }
+    });
+}
+
+std::vector<int> RadianceTransferBaker::FindPreviousProbes(const std::vector<LightSector::Probe>& probes) const
+{
+    auto position_less = [](const Vector3& a, const Vector3& b)
+    {
+        return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
+    };
+    // Sort previous probes by position so each new probe can binary search for its match
+    std::vector<int> sorted_ids(probes_.size());
+    std::iota(sorted_ids.begin(), sorted_ids.end(), 0);
+    std::stable_sort(sorted_ids.begin(), sorted_ids.end(), [&](int a, int b) { return position_less(probes_[a].pos, probes_[b].pos); });
+
+    std::vector<char> matched(probes_.size(), 0);
+    std::vector<int> previous_ids(probes.size(), -1);
+    for (std::size_t i = 0; i < probes.size(); i++)
+    {
+        const auto& pos = probes[i].pos;
+        auto it = std::lower_bound(sorted_ids.begin(), sorted_ids.end(), pos, [&](int id, const Vector3& p) { return position_less(probes_[id].pos, p); });
+        // Probes sharing a position are matched up in order
+        for (; it != sorted_ids.end() && !position_less(pos, probes_[*it].pos); it++)
+        {
+            if (!matched[*it])
+            {
+                matched[*it] = 1;
+                previous_ids[i] = *it;
+                break;
+            }
+        }
+    }
+    return previous_ids;
+}
+
+std::vector<RadianceTransferBaker::BakeModel> RadianceTransferBaker::FindChangedModels(const std::vector<BakeModel>& models) const
+{
+    std::unordered_map<const Model*, const BakeModel*> previous_models;
+    for (const auto& previous : bake_models_)
+    {
+        previous_models[previous.model] = &previous;
+    }
+    // Any model that moved has to be checked against probes in both its old and new position
+    std::vector<BakeModel> changed_models;
+    for (const auto& model : models)
+    {
+        auto previous_it = previous_models.find(model.model);
+        if (previous_it == previous_models.end())
+        {
+            changed_models.push_back(model);
+            continue;
+        }
+        const auto& previous = *previous_it->second;
+        if (previous.vertex_count != model.vertex_count || previous.pos != model.pos || previous.scale != model.scale)
+        {
+            changed_models.push_back(model);
+            changed_models.push_back(previous);
+        }
+        previous_models.erase(previous_it);
+    }
+    // Whatever is left over was removed from the scene
+    for (const auto& previous : bake_models_)
+    {
+        if (previous_models.find(previous.model) != previous_models.end())
+        {
+            changed_models.push_back(previous);
+        }
+    }
+    return changed_models;
+}
+
+bool RadianceTransferBaker::ProbeSeesModels(int probe_id, const std::vector<BakeModel>& models) const
+{
+    const auto& probe_pos = probes_[probe_id].pos;
+    const auto& texel_directions = EnvironmentMapTexelDirections();
+    const units::world* probe_texel_depths = texel_depths_.data() + kTexelsPerProbe * probe_id;
+    // Any texel whose view ray enters a model's bounds before reaching the geometry it saw last time could
+    // have seen the model, whether the model is arriving or leaving. Same goes for texels that saw the sky
+    for (const auto& model : models)
+    {
+        if (model.vertex_count == 0)
+        {
+            continue;
+        }
+        for (int texel = 0; texel < kTexelsPerProbe; texel++)
+        {
+            // Small bias so geometry lying right on the box boundary still counts
+            units::world max_distance = std::min(probe_texel_depths[texel] * 1.001f + 0.01f, kBakeScreenFar);
+            if (RayIntersectsBox(probe_pos, texel_directions[texel], max_distance, model.bounds_min, model.bounds_max))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::vector<RadianceTransferBaker::BakeModel> RadianceTransferBaker::BuildBakeModels(const Scene& scene)
+{
+    std::vector<BakeModel> models;
+    models.reserve(scene.models.size());
+    for (const auto& model : scene.models)
+    {
+        const auto& vertices = model->mesh().vertices;
+        BakeModel bake_model;
+        bake_model.model = model;
+        bake_model.vertex_count = vertices.size();
+        bake_model.pos = model->pos();
+        bake_model.scale = model->scale();
+        bake_model.bounds_min = Vector3(0.0f);
+        bake_model.bounds_max = Vector3(0.0f);
+        if (!vertices.empty())
+        {
+            Vector3 local_min = vertices[0].pos;
+            Vector3 local_max = vertices[0].pos;
+            for (const auto& v : vertices)
+            {
+                local_min = Vector3(std::min(local_min.x, v.pos.x), std::min(local_min.y, v.pos.y), std::min(local_min.z, v.pos.z));
+                local_max = Vector3(std::max(local_max.x, v.pos.x), std::max(local_max.y, v.pos.y), std::max(local_max.z, v.pos.z));
+            }
+            // World matrices are only updated when models render, so transform the bounds by hand. Negative scales flip them
+            Vector3 a = local_min * bake_model.scale + bake_model.pos;
+            Vector3 b = local_max * bake_model.scale + bake_model.pos;
+            bake_model.bounds_min = Vector3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+            bake_model.bounds_max = Vector3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+        }
+        models.push_back(bake_model);
     }
+    return models;
 }
 } // namespace stage
 } // namespace pipeline
@@ -25,12 +25,19 @@
 #define BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RADIANCETRANSFERBAKER_H_
 
 // Includes
-#include <unordered_map>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
 // Public Includes
 #include <blons/graphics/pipeline/scene.h>
 #include <blons/graphics/pipeline/stage/lightsector/lightsector.h>
 #include <blons/graphics/framebuffer.h>
 #include <blons/graphics/render/shader.h>
+#include <blons/system/job.h>
+#include <blons/system/timer.h>
+// Local Includes
+#include "environmentmaprasterizer.h"
 
 namespace blons
 {
@@ -41,87 +48,188 @@ namespace stage
 class RadianceTransferBaker
 {
 public:
-    RadianceTransferBaker(const Scene& scene, const std::vector<LightSector::Probe>& probes);
+    // Used in PRT baking
+    struct SurfelSample
+    {
+        LightSector::Surfel surfel;
+        int parent_probe;
+        float parent_probe_weights[6];
+    };
+
+public:
+    // Bakes every probe before returning, or only sets the bake up when progressive so that it can be carried out
+    // over several frames with ContinueBake()
+    RadianceTransferBaker(const Scene& scene, const std::vector<LightSector::Probe>& probes, bool progressive = false);
     ~RadianceTransferBaker() {}
 
+    // Updates the bake for a new set of probes and any models that have moved, been added, or been removed since
+    // the last bake. Only probes that are new or whose environment maps could see the changed geometry are
+    // rendered again, everything else reuses its previous surfel clusters. Gives the same results as a full bake.
+    // When progressive the update is only set up, same as the constructor. Returns false if nothing needed to change
+    bool Rebake(const Scene& scene, const std::vector<LightSector::Probe>& probes, bool progressive = false);
+    // Carries a progressive bake forward by one slice without blocking. Renders environment maps for up to max_probes
+    // probes and hands their sample gathering to a background job, or returns straight away if the last slice's job
+    // is still running. Once every probe is gathered, surfels and the probe network are finished in the background
+    // too. Slices give the same results as baking all at once. Returns true when the bake is complete, and the
+    // results must not be read until then
+    bool ContinueBake(const Scene& scene, int max_probes);
+    // Whether a bake has been set up and not yet completed
+    bool baking() const;
+    // Share of the current bake that's done, from 0 to 1
+    float progress() const;
+    // Value of light:bake-env-maps the current or most recent bake was started with
+    int env_map_mode() const;
+
     const std::vector<LightSector::Probe>& probes() const;
     const std::vector<LightSector::ProbeSearchCell>& probe_network() const;
     const std::vector<LightSector::Surfel>& surfels() const;
     const std::vector<LightSector::SurfelBrick>& surfel_bricks() const;
     const std::vector<LightSector::SurfelBrickFactor>& surfel_brick_factors() const;
 
+    // Clusters samples into surfels, surfels into bricks, and builds the brick weights of each probe. Samples are
+    // reduced per probe and then folded together in probe order, the same way a bake does it.
+    // Output is sorted by brick and then by surfel position. Exposed on its own for benchmarking
+    static void ClusterSurfelSamples(const std::vector<SurfelSample>& samples, std::vector<LightSector::Probe>* probes,
+                                     std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks,
+                                     std::vector<LightSector::SurfelBrickFactor>* brick_factors);
+    // Builds a Delaunay tetrahedralization of every probe position, as the IDs of the 4 probes in each
+    // tetrahedron. Exposed on its own for benchmarking
+    static std::vector<std::array<int, 4>> TriangulateProbeNetwork(const std::vector<LightSector::Probe>& probes);
+    // Builds the probe network a bake would, without baking anything else. Exposed on its own for benchmarking
+    static std::vector<LightSector::ProbeSearchCell> BuildProbeNetwork(const std::vector<LightSector::Probe>& probes);
+
 private:
-    // Used in PRT baking
-    struct SurfelSample
+    // Samples of a single surfel reduced to their sums, as gathered by one probe
+    struct SurfelCluster
     {
-        LightSector::Surfel surfel;
-        int parent_probe;
-        float parent_probe_weights[6];
+        uint64_t key;
+        Vector3 pos;
+        Vector3 normal;
+        Vector3 albedo;
+        int sample_count;
     };
-    struct SkyVisSample
+    // Summed weights of a single brick, as gathered by one probe
+    struct BrickCluster
     {
-        Vector2 uv;
-        Vector3 normal;
-        float visibility;
-        int parent_probe;
+        uint64_t brick_key;
+        float brick_weights[6];
     };
-    struct BakeSurfel
+    // Everything a probe contributes to the surfel clusters, sorted by key. Much smaller than the samples it's
+    // reduced from, so these are kept between bakes in place of the samples themselves
+    struct ProbeClusters
     {
-        LightSector::Surfel surfel;
-        int sample_count;
-        struct ParentProbeData
-        {
-            int id;
-            float weights[6];
-        };
-        std::vector<ParentProbeData> parent_probes;
+        std::vector<SurfelCluster> surfels;
+        std::vector<BrickCluster> bricks;
     };
-    struct BakeBrick
+    // Transform and world space bounds of a model as it was baked, used to find what changed between bakes
+    struct BakeModel
     {
-        LightSector::SurfelBrick brick;
-        std::vector<BakeSurfel> surfels;
+        const Model* model;
+        std::size_t vertex_count;
+        Vector3 pos;
+        Vector3 scale;
+        Vector3 bounds_min;
+        Vector3 bounds_max;
     };
-    struct BakeBrickFactor
+    // Sorted view of every probe's surfel clusters. Clusters are ordered by a key packing their brick
+    // index, direction, and surfel index within the brick, so each surfel and brick is a contiguous run
+    struct SortedSurfelClusters
     {
-        LightSector::SurfelBrickFactor factor;
-        int parent_probe;
+        // Every probe's clusters in probe order, along with the probe that gathered them
+        std::vector<const SurfelCluster*> clusters;
+        std::vector<int> cluster_probes;
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> cluster_ids;
+        // Index of the first sorted cluster in each surfel, plus one past the end
+        std::vector<std::size_t> surfel_starts;
+        // Index of the first surfel in each brick, plus one past the end
+        std::vector<std::size_t> brick_starts;
     };
-    struct SurfelIndex
+
+    // Where a bake is up to between slices
+    struct BakeState
     {
-        int x, y, z;
-        AxisAlignedNormal direction;
-        struct HashFunc { unsigned int operator()(const SurfelIndex& s) const { return FastHash(&s, sizeof(SurfelIndex)); } };
-        struct CompFunc { bool operator()(const SurfelIndex& a, const SurfelIndex& b) const { return std::tie(a.x, a.y, a.z, a.direction) == std::tie(b.x, b.y, b.z, b.direction); } };
+        // Probes that need their environment maps rendered and samples gathered
+        std::vector<int> probe_ids;
+        // First of probe_ids that hasn't been rendered yet
+        std::size_t next_probe;
+        // Probes whose samples are being gathered by the current slice
+        std::vector<int> slice_ids;
+        int map_rows;
+        // Value of light:bake-env-maps when the bake began, so every slice renders its maps the same way
+        int env_map_mode;
+        bool rebuild_network;
+        // Every probe has been gathered and the results are being finished
+        bool finishing;
+        int slice_count;
+        units::time::ms render_time;
+        units::time::ms gather_time;
+        Timer timer;
     };
-    using SurfelCluster = std::unordered_map<SurfelIndex, BakeSurfel, SurfelIndex::HashFunc, SurfelIndex::CompFunc>;
-    using BrickCluster = std::unordered_map<SurfelIndex, BakeBrick, SurfelIndex::HashFunc, SurfelIndex::CompFunc>;
+
+    // Holds onto the probes without baking them, for building the probe network alone
+    explicit RadianceTransferBaker(const std::vector<LightSector::Probe>& probes);
 
     // These functions only exists to help compartmentalize the long process of PRT baking
-    void BakeEnvironmentMaps(const Scene& scene);
-    void GatherProbeSamples(std::vector<SurfelSample>* surfel_samples, std::vector<SkyVisSample>* sky_samples);
-    void BakeSurfelClusters(const std::vector<SurfelSample>& samples);
-        SurfelCluster ClusterSurfelData(const std::vector<SurfelSample>& samples);
-        BrickCluster ClusterBrickData(SurfelCluster* surfel_data);
-        void GenerateBrickWeights(const std::vector<BakeBrick>& bricks);
+    void BeginBake(const Scene& scene, const std::vector<int>& probe_ids, const std::vector<int>& previous_ids, const std::vector<LightSector::Probe>& previous_probes,
+                   std::vector<ProbeClusters> previous_clusters, bool rebuild_network);
+    bool BakeSlice(const Scene& scene, int max_probes, bool background);
+        void RunBakeTask(void (RadianceTransferBaker::*task)(), bool background);
+        void GatherSlice();
+        void FinishBake();
+    void BakeEnvironmentMaps(const Scene& scene, const std::vector<int>& probe_ids);
+    void GatherProbeSamples(const std::vector<int>& probe_ids);
+        static ProbeClusters ReduceProbeSamples(const std::vector<SurfelSample>& samples);
+        static SHCoeffs3 BakeSkyCoefficients(const std::vector<float>& texel_visibility);
+    void BakeSurfelClusters();
+        static void FoldProbeClusters(const std::vector<ProbeClusters>& probe_clusters, std::vector<LightSector::Probe>* probes,
+                                      std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks,
+                                      std::vector<LightSector::SurfelBrickFactor>* brick_factors);
+        static SortedSurfelClusters SortSurfelClusters(const std::vector<ProbeClusters>& probe_clusters);
+        static void ReduceSurfels(const SortedSurfelClusters& sorted, const std::vector<LightSector::Probe>& probes,
+                                  std::vector<LightSector::Surfel>* surfels);
+        static void ReduceBricks(const SortedSurfelClusters& sorted, std::vector<LightSector::SurfelBrick>* bricks);
+        static void GenerateBrickWeights(const std::vector<ProbeClusters>& probe_clusters, const SortedSurfelClusters& sorted,
+                                         std::vector<LightSector::Probe>* probes, std::vector<LightSector::SurfelBrickFactor>* brick_factors);
         void NormalizeBrickWeights();
-    void BakeSkyCoefficients(const std::vector<SkyVisSample>& samples);
     void BakeProbeNetwork();
-        std::vector<Tetrahedron> TriangulateProbeNetwork();
-        void BakeProbeNetworkInnerCells(const std::vector<Tetrahedron>& tetrahedrons);
+        void BakeProbeNetworkInnerCells(const std::vector<std::array<int, 4>>& tetrahedrons);
         void BakeProbeNetworkInnerNeighbours();
         void BakeProbeNetworkOuterCells();
         void BakeProbeNetworkOuterNeighbours();
         void BakeProbeNetworkHullNormals();
         void BakeProbeNetworkConvererters();
+    std::vector<int> FindPreviousProbes(const std::vector<LightSector::Probe>& probes) const;
+    std::vector<BakeModel> FindChangedModels(const std::vector<BakeModel>& models) const;
+    bool ProbeSeesModels(int probe_id, const std::vector<BakeModel>& models) const;
+    static std::vector<BakeModel> BuildBakeModels(const Scene& scene);
 
     std::vector<LightSector::Probe> probes_;
     std::vector<LightSector::ProbeSearchCell> probe_network_;
     std::vector<LightSector::Surfel> surfels_;
     std::vector<LightSector::SurfelBrick> surfel_bricks_;
     std::vector<LightSector::SurfelBrickFactor> surfel_brick_factors_;
+    // Every probe's surfel clusters, kept around so that rebakes only need to gather them from changed probes
+    std::vector<ProbeClusters> probe_clusters_;
+    // Distance to the geometry behind each texel of every probe's environment map, infinite for sky texels
+    std::vector<units::world> texel_depths_;
+    std::vector<BakeModel> bake_models_;
+    // Environment map targets of the bake in progress, made once in BeginBake and reused by every slice
     std::unique_ptr<Framebuffer> environment_maps_;
+    std::unique_ptr<EnvironmentMapRasterizer> environment_rasterizer_;
+    // Environment maps of the chunk being baked, with only the rows of the latest slice read back from the
+    // framebuffer or rendered on the CPU
+    std::unique_ptr<PixelData> environment_albedo_;
+    std::unique_ptr<PixelData> environment_normal_;
+    std::unique_ptr<PixelData> environment_depth_;
     std::unique_ptr<Shader> environment_map_shader_;
     std::vector<Vector3> hull_normals_;
+    bool baking_;
+    BakeState bake_;
+    // Jobs can't be checked on without blocking, so the background task flags when it's done. The job is declared
+    // last so that it's waited on before anything it uses is destroyed
+    std::atomic<bool> bake_task_done_;
+    std::unique_ptr<Job> bake_task_;
 };
 } // namespace stage
 } // namespace pipeline
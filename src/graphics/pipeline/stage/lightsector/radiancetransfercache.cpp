@@ -0,0 +1,293 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "radiancetransfercache.h"
+
+// Includes
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+namespace
+{
+const char kCacheMagic[4] = { 'B', 'P', 'R', 'T' };
+// Bump whenever the bake produces different results in a way the cache key can't see
+const uint32_t kCacheVersion = 1;
+
+struct CacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint64_t probe_count;
+    uint64_t probe_network_count;
+    uint64_t surfel_count;
+    uint64_t surfel_brick_count;
+    uint64_t surfel_brick_factor_count;
+};
+
+// 64-bit FNV-1a, like FastHash but wide enough that unrelated scenes won't collide
+class ContentHash
+{
+public:
+    ContentHash() : hash_(14695981039346656037ULL) {}
+
+    void Add(const void* data, std::size_t size)
+    {
+        auto bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            hash_ = (hash_ ^ bytes[i]) * 1099511628211ULL;
+        }
+    }
+    template <typename T>
+    void Add(const T& value)
+    {
+        Add(&value, sizeof(T));
+    }
+
+    uint64_t hash() const { return hash_; }
+
+private:
+    uint64_t hash_;
+};
+
+// Same layout as LightSector::Probe without the const ID, so probes can be read from disk and assigned field by field
+struct CachedProbe
+{
+    int id;
+    Vector3 pos;
+    AmbientCube irradiance;
+    SHCoeffs3 sh_sky_visibility;
+    int brick_factor_range_start;
+    int brick_factor_count;
+};
+static_assert(sizeof(CachedProbe) == sizeof(LightSector::Probe), "CachedProbe must match the layout of LightSector::Probe");
+
+// Textures are often shared between models, so each one's contents are only hashed the first time it's seen
+void HashTexture(const PixelData* pixels, std::unordered_map<const PixelData*, std::size_t>* seen, ContentHash* hash)
+{
+    if (pixels == nullptr)
+    {
+        hash->Add(false);
+        return;
+    }
+    hash->Add(true);
+    auto existing = seen->find(pixels);
+    if (existing != seen->end())
+    {
+        hash->Add(existing->second);
+        return;
+    }
+    std::size_t index = seen->size();
+    seen->emplace(pixels, index);
+    hash->Add(index);
+    hash->Add(pixels->width);
+    hash->Add(pixels->height);
+    hash->Add(pixels->type.format);
+    hash->Add(pixels->type.compression);
+    hash->Add(pixels->pixels.size());
+    hash->Add(pixels->pixels.data(), pixels->pixels.size());
+}
+
+using File = std::unique_ptr<FILE, decltype(&fclose)>;
+
+File OpenFile(const std::string& filename, const char* mode)
+{
+    FILE* file;
+    if (fopen_s(&file, filename.c_str(), mode) != 0)
+    {
+        file = nullptr;
+    }
+    return File(file, &fclose);
+}
+
+template <typename T>
+bool ReadArray(FILE* file, uint64_t count, std::vector<T>* data)
+{
+    data->resize(static_cast<std::size_t>(count));
+    return fread(data->data(), sizeof(T), data->size(), file) == data->size();
+}
+
+template <typename T>
+bool WriteArray(FILE* file, const std::vector<T>& data)
+{
+    return fwrite(data.data(), sizeof(T), data.size(), file) == data.size();
+}
+} // namespace
+
+RadianceTransferCache::RadianceTransferCache(const Scene& scene, const std::vector<LightSector::Probe>& probes, int env_map_mode)
+    : probe_count_(probes.size())
+{
+    ContentHash hash;
+    // Format and bake constants
+    hash.Add(kCacheVersion);
+    hash.Add(sizeof(LightSector::Probe));
+    hash.Add(sizeof(LightSector::ProbeSearchCell));
+    hash.Add(sizeof(LightSector::Surfel));
+    hash.Add(sizeof(LightSector::SurfelBrick));
+    hash.Add(sizeof(LightSector::SurfelBrickFactor));
+    hash.Add(kProbeMapSize);
+    hash.Add(kSurfelSize);
+    hash.Add(kSurfelsPerBrick);
+    hash.Add(kBakeScreenNear);
+    hash.Add(kBakeScreenFar);
+    // Environment maps rendered on the CPU can differ slightly from the GPU's. Mode 2 renders both but bakes
+    // with the GPU's maps, so it shares its results with mode 0
+    hash.Add(env_map_mode == 1);
+    // Probe layout
+    hash.Add(probes.size());
+    for (const auto& probe : probes)
+    {
+        hash.Add(probe.id);
+        hash.Add(probe.pos);
+    }
+    // Scene geometry and surface textures. World matrices are only updated when models render, so use the
+    // transform they're built from
+    std::unordered_map<const PixelData*, std::size_t> seen_textures;
+    hash.Add(scene.models.size());
+    for (const auto& model : scene.models)
+    {
+        const auto& mesh = model->mesh();
+        hash.Add(mesh.vertices.size());
+        hash.Add(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        hash.Add(mesh.indices.size());
+        hash.Add(mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+        hash.Add(mesh.draw_mode);
+        hash.Add(model->pos());
+        hash.Add(model->scale());
+        HashTexture(model->albedo_pixels(), &seen_textures, &hash);
+        HashTexture(model->normal_pixels(), &seen_textures, &hash);
+    }
+    key_ = hash.hash();
+}
+
+bool RadianceTransferCache::Load(const std::string& filename,
+                                 std::vector<LightSector::Probe>* probes,
+                                 std::vector<LightSector::ProbeSearchCell>* probe_network,
+                                 std::vector<LightSector::Surfel>* surfels,
+                                 std::vector<LightSector::SurfelBrick>* surfel_bricks,
+                                 std::vector<LightSector::SurfelBrickFactor>* surfel_brick_factors) const
+{
+    auto file = OpenFile(filename, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    CacheHeader header;
+    if (fread(&header, sizeof(header), 1, file.get()) != 1 ||
+        memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+        header.version != kCacheVersion ||
+        header.key != key_ ||
+        header.probe_count != probe_count_ ||
+        probes->size() != probe_count_)
+    {
+        return false;
+    }
+    // Make sure the file holds exactly what the header says before allocating anything
+    uint64_t expected_size = sizeof(header) +
+                             header.probe_count * sizeof(LightSector::Probe) +
+                             header.probe_network_count * sizeof(LightSector::ProbeSearchCell) +
+                             header.surfel_count * sizeof(LightSector::Surfel) +
+                             header.surfel_brick_count * sizeof(LightSector::SurfelBrick) +
+                             header.surfel_brick_factor_count * sizeof(LightSector::SurfelBrickFactor);
+    _fseeki64(file.get(), 0, SEEK_END);
+    uint64_t file_size = static_cast<uint64_t>(_ftelli64(file.get()));
+    _fseeki64(file.get(), sizeof(header), SEEK_SET);
+    if (file_size != expected_size)
+    {
+        return false;
+    }
+
+    // Probes have a const ID and can't be read into directly, so they're staged and assigned once everything
+    // else has loaded. IDs are part of the key, but are checked anyway as they're never overwritten
+    std::vector<CachedProbe> cached_probes;
+    if (!ReadArray(file.get(), header.probe_count, &cached_probes) ||
+        !ReadArray(file.get(), header.probe_network_count, probe_network) ||
+        !ReadArray(file.get(), header.surfel_count, surfels) ||
+        !ReadArray(file.get(), header.surfel_brick_count, surfel_bricks) ||
+        !ReadArray(file.get(), header.surfel_brick_factor_count, surfel_brick_factors))
+    {
+        return false;
+    }
+    for (std::size_t i = 0; i < cached_probes.size(); i++)
+    {
+        auto& probe = (*probes)[i];
+        const auto& cached = cached_probes[i];
+        if (cached.id != probe.id)
+        {
+            return false;
+        }
+        probe.pos = cached.pos;
+        probe.irradiance = cached.irradiance;
+        probe.sh_sky_visibility = cached.sh_sky_visibility;
+        probe.brick_factor_range_start = cached.brick_factor_range_start;
+        probe.brick_factor_count = cached.brick_factor_count;
+    }
+    return true;
+}
+
+bool RadianceTransferCache::Save(const std::string& filename,
+                                 const std::vector<LightSector::Probe>& probes,
+                                 const std::vector<LightSector::ProbeSearchCell>& probe_network,
+                                 const std::vector<LightSector::Surfel>& surfels,
+                                 const std::vector<LightSector::SurfelBrick>& surfel_bricks,
+                                 const std::vector<LightSector::SurfelBrickFactor>& surfel_brick_factors) const
+{
+    auto file = OpenFile(filename, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    CacheHeader header;
+    memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+    header.version = kCacheVersion;
+    header.key = key_;
+    header.probe_count = probes.size();
+    header.probe_network_count = probe_network.size();
+    header.surfel_count = surfels.size();
+    header.surfel_brick_count = surfel_bricks.size();
+    header.surfel_brick_factor_count = surfel_brick_factors.size();
+    return fwrite(&header, sizeof(header), 1, file.get()) == 1 &&
+           WriteArray(file.get(), probes) &&
+           WriteArray(file.get(), probe_network) &&
+           WriteArray(file.get(), surfels) &&
+           WriteArray(file.get(), surfel_bricks) &&
+           WriteArray(file.get(), surfel_brick_factors);
+}
+
+uint64_t RadianceTransferCache::key() const
+{
+    return key_;
+}
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RADIANCETRANSFERCACHE_H_
+#define BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RADIANCETRANSFERCACHE_H_
+
+// Includes
+#include <cstdint>
+#include <string>
+#include <vector>
+// Public Includes
+#include <blons/graphics/pipeline/scene.h>
+#include <blons/graphics/pipeline/stage/lightsector/lightsector.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+// Stores the results of a RadianceTransferBaker on disk, keyed by a hash of everything that went into the bake
+class RadianceTransferCache
+{
+public:
+    // Keyed on the scene's geometry and textures, the probe layout, and how environment maps were rendered, which
+    // should be the light:bake-env-maps mode the bake was started with
+    RadianceTransferCache(const Scene& scene, const std::vector<LightSector::Probe>& probes, int env_map_mode);
+    ~RadianceTransferCache() {}
+
+    // Reads every baked array straight from disk into the given vectors, where probes must be the layout the cache
+    // was made for. Returns false if there's no cache matching this scene and layout, in which case any of the
+    // vectors may have been clobbered, so callers should load into copies
+    bool Load(const std::string& filename,
+              std::vector<LightSector::Probe>* probes,
+              std::vector<LightSector::ProbeSearchCell>* probe_network,
+              std::vector<LightSector::Surfel>* surfels,
+              std::vector<LightSector::SurfelBrick>* surfel_bricks,
+              std::vector<LightSector::SurfelBrickFactor>* surfel_brick_factors) const;
+    bool Save(const std::string& filename,
+              const std::vector<LightSector::Probe>& probes,
+              const std::vector<LightSector::ProbeSearchCell>& probe_network,
+              const std::vector<LightSector::Surfel>& surfels,
+              const std::vector<LightSector::SurfelBrick>& surfel_bricks,
+              const std::vector<LightSector::SurfelBrickFactor>& surfel_brick_factors) const;
+
+    uint64_t key() const;
+
+private:
+    uint64_t key_;
+    // Size of the probe layout the key was made from
+    std::size_t probe_count_;
+};
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
+#endif // BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RADIANCETRANSFERCACHE_H_
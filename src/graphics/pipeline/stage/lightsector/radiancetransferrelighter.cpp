@@ -0,0 +1,381 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "radiancetransferrelighter.h"
+
+// Includes
+#include <algorithm>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define BLONS_RELIGHT_SSE
+#endif
+// Public Includes
+#include <blons/system/job.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+namespace
+{
+// Bricks only hold a handful of surfels each, so jobs need plenty of them to be worth it
+const std::size_t kBricksPerJob = 64;
+const std::size_t kProbesPerJob = 16;
+// Matches kBasisDirections in math.lib.glsl, which is ordered like AxisAlignedNormal
+const Vector3 kBasisDirections[6] = { Vector3(1.0f, 0.0f, 0.0f), Vector3(-1.0f, 0.0f, 0.0f),
+                                      Vector3(0.0f, 1.0f, 0.0f), Vector3(0.0f, -1.0f, 0.0f),
+                                      Vector3(0.0f, 0.0f, 1.0f), Vector3(0.0f, 0.0f, -1.0f) };
+// Convolution of each SH band with a cosine lobe, matching _kSHCosineLobe in math.lib.glsl
+const units::world kSHCosineLobe[3] = { kPi, 2.0f * kPi / 3.0f, kPi / 4.0f };
+const int kSHCoeffBands[9] = { 0, 1, 1, 1, 2, 2, 2, 2, 2 };
+// Constants from ShadowTest in shadow.lib.glsl
+const float kShadowVarianceBias = 0.00001f;
+const float kShadowDepthFadeStart = 0.005f;
+const float kShadowDepthFadeEnd = 0.0025f;
+const float kShadowBleedCutoff = 0.4f;
+
+struct ShadowMap
+{
+    const float* moments;
+    int width;
+    int height;
+};
+
+ShadowMap ReadShadowMap(const PixelData* light_depth)
+{
+    if (light_depth == nullptr || light_depth->type.compression == TextureType::DDS || light_depth->bits_per_pixel() != 64 ||
+        light_depth->pixels.size() < static_cast<std::size_t>(light_depth->width) * light_depth->height * 2 * sizeof(float))
+    {
+        throw "Shadow map must have 2 float channels for CPU relighting";
+    }
+    return { reinterpret_cast<const float*>(light_depth->pixels.data()), light_depth->width, light_depth->height };
+}
+
+// Bilinear sample with repeat wrapping, like the shadow map's sampler
+void SampleShadowMap(const ShadowMap& shadow, float u, float v, float* m1, float* m2)
+{
+    float tx = u * static_cast<float>(shadow.width) - 0.5f;
+    float ty = v * static_cast<float>(shadow.height) - 0.5f;
+    float fx = std::floor(tx);
+    float fy = std::floor(ty);
+    float ax = tx - fx;
+    float ay = ty - fy;
+    int x0 = static_cast<int>(fx) % shadow.width;
+    int y0 = static_cast<int>(fy) % shadow.height;
+    x0 = x0 < 0 ? x0 + shadow.width : x0;
+    y0 = y0 < 0 ? y0 + shadow.height : y0;
+    int x1 = x0 + 1 < shadow.width ? x0 + 1 : 0;
+    int y1 = y0 + 1 < shadow.height ? y0 + 1 : 0;
+    const float* t00 = &shadow.moments[(static_cast<std::size_t>(y0) * shadow.width + x0) * 2];
+    const float* t10 = &shadow.moments[(static_cast<std::size_t>(y0) * shadow.width + x1) * 2];
+    const float* t01 = &shadow.moments[(static_cast<std::size_t>(y1) * shadow.width + x0) * 2];
+    const float* t11 = &shadow.moments[(static_cast<std::size_t>(y1) * shadow.width + x1) * 2];
+    for (int c = 0; c < 2; c++)
+    {
+        float bottom = t00[c] + (t10[c] - t00[c]) * ax;
+        float top = t01[c] + (t11[c] - t01[c]) * ax;
+        (c == 0 ? *m1 : *m2) = bottom + (top - bottom) * ay;
+    }
+}
+
+float Smoothstep(float edge0, float edge1, float x)
+{
+    float t = std::min(std::max((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Variance shadow map test, see ShadowTest in shadow.lib.glsl
+float ShadowVisibility(float depth, float m1, float m2)
+{
+    float local_delta = depth - m1;
+    float variance = std::max(m2 - (m1 * m1), kShadowVarianceBias);
+    float p_max = variance / (variance + (local_delta * local_delta));
+    float p = Smoothstep(depth - kShadowDepthFadeStart, depth - kShadowDepthFadeEnd, m1);
+    p_max = Smoothstep(kShadowBleedCutoff, 1.0f, p_max);
+    return std::max(p, p_max);
+}
+
+// Shadowed and cosine weighted sunlight reaching a surfel. Returns false if the surfel is outside of the shadow map
+// and should keep its previous lighting
+bool SurfelSunlight(const RadianceTransferRelighter::Inputs& inputs, const ShadowMap& shadow, const LightSector::Surfel& surfel, float* sunlight)
+{
+    const auto& m = inputs.light_vp_matrix.m;
+    const auto& p = surfel.pos;
+    float w = p.x * m[0][3] + p.y * m[1][3] + p.z * m[2][3] + m[3][3];
+    float x = (p.x * m[0][0] + p.y * m[1][0] + p.z * m[2][0] + m[3][0]) / w;
+    float y = (p.x * m[0][1] + p.y * m[1][1] + p.z * m[2][1] + m[3][1]) / w;
+    float z = (p.x * m[0][2] + p.y * m[1][2] + p.z * m[2][2] + m[3][2]) / w;
+    if (x < -1.0f || x > 1.0f || y < -1.0f || y > 1.0f)
+    {
+        return false;
+    }
+    float depth = (z + 1.0f) * 0.5f;
+    float m1, m2;
+    SampleShadowMap(shadow, (x + 1.0f) * 0.5f, (y + 1.0f) * 0.5f, &m1, &m2);
+    float n_dot_l = std::max(-VectorDot(surfel.normal, inputs.sun_dir), 0.0f);
+    *sunlight = ShadowVisibility(depth, m1, m2) * n_dot_l;
+    return true;
+}
+
+#ifdef BLONS_RELIGHT_SSE
+__m128 Smoothstep4(__m128 edge0, __m128 edge1, __m128 x)
+{
+    __m128 t = _mm_div_ps(_mm_sub_ps(x, edge0), _mm_sub_ps(edge1, edge0));
+    t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    return _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_add_ps(t, t)));
+}
+
+// SurfelSunlight for 4 consecutive surfels at once, only the shadow map reads are done one at a time.
+// Returns a bit mask of the surfels inside of the shadow map
+int SurfelSunlight4(const RadianceTransferRelighter::Inputs& inputs, const ShadowMap& shadow, const LightSector::Surfel* surfels, float sunlight[4])
+{
+    const auto& m = inputs.light_vp_matrix.m;
+    __m128 px = _mm_set_ps(surfels[3].pos.x, surfels[2].pos.x, surfels[1].pos.x, surfels[0].pos.x);
+    __m128 py = _mm_set_ps(surfels[3].pos.y, surfels[2].pos.y, surfels[1].pos.y, surfels[0].pos.y);
+    __m128 pz = _mm_set_ps(surfels[3].pos.z, surfels[2].pos.z, surfels[1].pos.z, surfels[0].pos.z);
+    auto transform = [&](int column)
+    {
+        __m128 r = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(m[0][column])), _mm_mul_ps(py, _mm_set1_ps(m[1][column])));
+        return _mm_add_ps(_mm_add_ps(r, _mm_mul_ps(pz, _mm_set1_ps(m[2][column]))), _mm_set1_ps(m[3][column]));
+    };
+    __m128 w = transform(3);
+    __m128 x = _mm_div_ps(transform(0), w);
+    __m128 y = _mm_div_ps(transform(1), w);
+    __m128 z = _mm_div_ps(transform(2), w);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 neg_one = _mm_set1_ps(-1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    // Written as not-less/not-greater so that NaNs count as inside, the same as the shader's test
+    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpnlt_ps(x, neg_one), _mm_cmpngt_ps(x, one)),
+                               _mm_and_ps(_mm_cmpnlt_ps(y, neg_one), _mm_cmpngt_ps(y, one)));
+    int inside_mask = _mm_movemask_ps(inside);
+    if (inside_mask == 0)
+    {
+        return 0;
+    }
+
+    float u[4], v[4], m1[4] = {}, m2[4] = {};
+    _mm_storeu_ps(u, _mm_mul_ps(_mm_add_ps(x, one), half));
+    _mm_storeu_ps(v, _mm_mul_ps(_mm_add_ps(y, one), half));
+    for (int i = 0; i < 4; i++)
+    {
+        if (inside_mask & (1 << i))
+        {
+            SampleShadowMap(shadow, u[i], v[i], &m1[i], &m2[i]);
+        }
+    }
+    __m128 depth = _mm_mul_ps(_mm_add_ps(z, one), half);
+    __m128 moment1 = _mm_loadu_ps(m1);
+    __m128 moment2 = _mm_loadu_ps(m2);
+    __m128 local_delta = _mm_sub_ps(depth, moment1);
+    __m128 variance = _mm_max_ps(_mm_sub_ps(moment2, _mm_mul_ps(moment1, moment1)), _mm_set1_ps(kShadowVarianceBias));
+    __m128 p_max = _mm_div_ps(variance, _mm_add_ps(variance, _mm_mul_ps(local_delta, local_delta)));
+    __m128 p = Smoothstep4(_mm_sub_ps(depth, _mm_set1_ps(kShadowDepthFadeStart)), _mm_sub_ps(depth, _mm_set1_ps(kShadowDepthFadeEnd)), moment1);
+    p_max = Smoothstep4(_mm_set1_ps(kShadowBleedCutoff), one, p_max);
+    __m128 visibility = _mm_max_ps(p, p_max);
+
+    __m128 nx = _mm_set_ps(surfels[3].normal.x, surfels[2].normal.x, surfels[1].normal.x, surfels[0].normal.x);
+    __m128 ny = _mm_set_ps(surfels[3].normal.y, surfels[2].normal.y, surfels[1].normal.y, surfels[0].normal.y);
+    __m128 nz = _mm_set_ps(surfels[3].normal.z, surfels[2].normal.z, surfels[1].normal.z, surfels[0].normal.z);
+    __m128 n_dot_sun = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(inputs.sun_dir.x)), _mm_mul_ps(ny, _mm_set1_ps(inputs.sun_dir.y))),
+                                  _mm_mul_ps(nz, _mm_set1_ps(inputs.sun_dir.z)));
+    __m128 n_dot_l = _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), n_dot_sun), _mm_setzero_ps());
+    _mm_storeu_ps(sunlight, _mm_mul_ps(visibility, n_dot_l));
+    return inside_mask;
+}
+#endif
+
+// Rest of ComputeSurfelLighting in surfelbrick-relight.comp.glsl, once sunlight is known
+void LightSurfel(const RadianceTransferRelighter::Inputs& inputs, const std::vector<LightSector::Probe>& probes, float sunlight,
+                 LightSector::Surfel* surfel)
+{
+    Vector3 radiance = inputs.sun_colour * (sunlight * inputs.sun_luminance * inputs.gi_boost);
+    // Use previous frame's ambient term of nearest probe to approximate infinite bounce lighting
+    radiance += SampleAmbientCube(probes[surfel->nearest_probe_id].irradiance, surfel->normal);
+    radiance *= surfel->albedo;
+    radiance *= Vector3(1.0f) - inputs.metalness;
+    surfel->radiance = radiance / kPi;
+}
+
+units::world SHDot3(const SHCoeffs3& a, const SHCoeffs3& b)
+{
+    units::world sh_dot = 0.0f;
+    for (int i = 0; i < 9; i++)
+    {
+        sh_dot += a.coeffs[i] * b.coeffs[i];
+    }
+    return sh_dot;
+}
+} // namespace
+
+void RadianceTransferRelighter::Relight(const Inputs& inputs, const std::vector<LightSector::SurfelBrickFactor>& brick_factors,
+                                        std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks,
+                                        std::vector<LightSector::Probe>* probes)
+{
+    Relight(inputs, brick_factors, { { 0, bricks->size() } }, { { 0, probes->size() } }, surfels, bricks, probes);
+}
+
+void RadianceTransferRelighter::Relight(const Inputs& inputs, const std::vector<LightSector::SurfelBrickFactor>& brick_factors,
+                                        const std::vector<Range>& brick_ranges, const std::vector<Range>& probe_ranges,
+                                        std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks,
+                                        std::vector<LightSector::Probe>* probes)
+{
+    RelightSurfelBricks(inputs, *probes, brick_ranges, surfels, bricks);
+    RelightProbes(inputs, *bricks, brick_factors, probe_ranges, probes);
+}
+
+void RadianceTransferRelighter::RelightSurfelBricks(const Inputs& inputs, const std::vector<LightSector::Probe>& probes, const std::vector<Range>& brick_ranges,
+                                                    std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks)
+{
+    const ShadowMap shadow = ReadShadowMap(inputs.light_depth);
+    auto& surfel_data = *surfels;
+    // Each surfel belongs to a single brick, so bricks can be lit independently
+    for (const auto& range : brick_ranges)
+    {
+        ParallelFor(range.start, range.start + range.count, kBricksPerJob, [&](std::size_t brick_id)
+        {
+            auto& brick = (*bricks)[brick_id];
+            Vector3 radiance(0.0f);
+            int surfel_id = brick.surfel_range_start;
+            const int surfel_end = brick.surfel_range_start + brick.surfel_count;
+#ifdef BLONS_RELIGHT_SSE
+            for (; surfel_id + 4 <= surfel_end; surfel_id += 4)
+            {
+                float sunlight[4];
+                int inside_mask = SurfelSunlight4(inputs, shadow, &surfel_data[surfel_id], sunlight);
+                for (int i = 0; i < 4; i++)
+                {
+                    auto& surfel = surfel_data[surfel_id + i];
+                    if (inside_mask & (1 << i))
+                    {
+                        LightSurfel(inputs, probes, sunlight[i], &surfel);
+                    }
+                    radiance += surfel.radiance;
+                }
+            }
+#endif
+            // Whatever didn't fill a whole register, or everything if there's no SIMD
+            for (; surfel_id < surfel_end; surfel_id++)
+            {
+                auto& surfel = surfel_data[surfel_id];
+                float sunlight;
+                if (SurfelSunlight(inputs, shadow, surfel, &sunlight))
+                {
+                    LightSurfel(inputs, probes, sunlight, &surfel);
+                }
+                radiance += surfel.radiance;
+            }
+            brick.radiance = radiance / static_cast<float>(brick.surfel_count);
+        });
+    }
+}
+
+void RadianceTransferRelighter::RelightProbes(const Inputs& inputs, const std::vector<LightSector::SurfelBrick>& bricks,
+                                              const std::vector<LightSector::SurfelBrickFactor>& brick_factors, const std::vector<Range>& probe_ranges,
+                                              std::vector<LightSector::Probe>* probes)
+{
+    // Sky light and cosine lobe of each basis direction are the same for every probe
+    SHCoeffs3 direction_coeffs[6];
+    Vector3 sky_light[6];
+    for (int cube_face = 0; cube_face < 6; cube_face++)
+    {
+        direction_coeffs[cube_face] = SHProjectDirection3(kBasisDirections[cube_face]);
+        for (int i = 0; i < 9; i++)
+        {
+            direction_coeffs[cube_face].coeffs[i] *= kSHCosineLobe[kSHCoeffBands[i]];
+        }
+        sky_light[cube_face] = Vector3(SHDot3(direction_coeffs[cube_face], inputs.sky_box.r),
+                                       SHDot3(direction_coeffs[cube_face], inputs.sky_box.g),
+                                       SHDot3(direction_coeffs[cube_face], inputs.sky_box.b));
+    }
+
+    for (const auto& range : probe_ranges)
+    {
+        ParallelFor(range.start, range.start + range.count, kProbesPerJob, [&](std::size_t probe_id)
+        {
+            auto& probe = (*probes)[probe_id];
+            auto& cube = probe.irradiance.coeffs;
+            for (int cube_face = 0; cube_face < 6; cube_face++)
+            {
+                // Divide by pi because sky_vis is merely a visibility function and is not meant to be scaled for irradiance
+                float sky_vis = std::max(SHDot3(probe.sh_sky_visibility, direction_coeffs[cube_face]), 0.0f) / kPi;
+                cube[cube_face] = sky_light[cube_face] * sky_vis * inputs.sky_luminance;
+            }
+
+            // Brick weights sum up to pi over the set of factors
+            const auto* factor = brick_factors.data() + probe.brick_factor_range_start;
+            const auto* factor_end = factor + probe.brick_factor_count;
+#ifdef BLONS_RELIGHT_SSE
+            // Faces 0-3 in one register and 2-5 in another, so every weight is loaded without reading past a factor
+            __m128 r_lo = _mm_set_ps(cube[3].x, cube[2].x, cube[1].x, cube[0].x);
+            __m128 g_lo = _mm_set_ps(cube[3].y, cube[2].y, cube[1].y, cube[0].y);
+            __m128 b_lo = _mm_set_ps(cube[3].z, cube[2].z, cube[1].z, cube[0].z);
+            __m128 r_hi = _mm_set_ps(cube[5].x, cube[4].x, cube[3].x, cube[2].x);
+            __m128 g_hi = _mm_set_ps(cube[5].y, cube[4].y, cube[3].y, cube[2].y);
+            __m128 b_hi = _mm_set_ps(cube[5].z, cube[4].z, cube[3].z, cube[2].z);
+            for (; factor != factor_end; factor++)
+            {
+                const auto& radiance = bricks[factor->brick_id].radiance;
+                __m128 weights_lo = _mm_loadu_ps(factor->brick_weights);
+                __m128 weights_hi = _mm_loadu_ps(factor->brick_weights + 2);
+                __m128 r = _mm_set1_ps(radiance.x);
+                __m128 g = _mm_set1_ps(radiance.y);
+                __m128 b = _mm_set1_ps(radiance.z);
+                r_lo = _mm_add_ps(r_lo, _mm_mul_ps(r, weights_lo));
+                g_lo = _mm_add_ps(g_lo, _mm_mul_ps(g, weights_lo));
+                b_lo = _mm_add_ps(b_lo, _mm_mul_ps(b, weights_lo));
+                r_hi = _mm_add_ps(r_hi, _mm_mul_ps(r, weights_hi));
+                g_hi = _mm_add_ps(g_hi, _mm_mul_ps(g, weights_hi));
+                b_hi = _mm_add_ps(b_hi, _mm_mul_ps(b, weights_hi));
+            }
+            float lanes[3][8];
+            _mm_storeu_ps(lanes[0], r_lo);
+            _mm_storeu_ps(lanes[0] + 4, r_hi);
+            _mm_storeu_ps(lanes[1], g_lo);
+            _mm_storeu_ps(lanes[1] + 4, g_hi);
+            _mm_storeu_ps(lanes[2], b_lo);
+            _mm_storeu_ps(lanes[2] + 4, b_hi);
+            for (int cube_face = 0; cube_face < 6; cube_face++)
+            {
+                // Faces 4 and 5 come from the upper half of the second register
+                int lane = cube_face < 4 ? cube_face : cube_face + 2;
+                cube[cube_face] = Vector3(lanes[0][lane], lanes[1][lane], lanes[2][lane]);
+            }
+#else
+            for (; factor != factor_end; factor++)
+            {
+                const auto& radiance = bricks[factor->brick_id].radiance;
+                for (int cube_face = 0; cube_face < 6; cube_face++)
+                {
+                    cube[cube_face] += radiance * factor->brick_weights[cube_face];
+                }
+            }
+#endif
+        });
+    }
+}
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
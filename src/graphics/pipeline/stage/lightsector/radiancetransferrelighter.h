@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RADIANCETRANSFERRELIGHTER_H_
+#define BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RADIANCETRANSFERRELIGHTER_H_
+
+// Includes
+#include <vector>
+// Public Includes
+#include <blons/graphics/pipeline/stage/lightsector/lightsector.h>
+#include <blons/graphics/render/renderer.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+// CPU implementation of the surfelbrick-relight and probe-relight shaders used by LightSector. Computes the same brick
+// radiance and probe irradiance from the same inputs without touching the GPU, so GI can be lit headless or checked
+// against the shaders. Surfels are lit 4 at a time and brick factors summed 6 faces at a time with SSE where available
+class RadianceTransferRelighter
+{
+public:
+    // Everything the relight shaders take as uniforms
+    struct Inputs
+    {
+        Matrix light_vp_matrix;
+        // Variance shadow map as read back from Shadow::LIGHT_DEPTH, 2 float moments per texel with the bottom row first
+        const PixelData* light_depth;
+        Vector3 sun_dir;
+        Vector3 sun_colour;
+        units::luminance sun_luminance;
+        Vector3 metalness;
+        float gi_boost;
+        SHColourCoeffs3 sky_box;
+        units::luminance sky_luminance;
+    };
+    // Contiguous run of bricks or probes to relight
+    struct Range
+    {
+        std::size_t start;
+        std::size_t count;
+    };
+
+public:
+    // Relights every brick and then every probe, spread across all worker threads. Bricks read the probes' irradiance
+    // from before the relight, the same as the shaders which are dispatched one after the other
+    static void Relight(const Inputs& inputs, const std::vector<LightSector::SurfelBrickFactor>& brick_factors,
+                        std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks,
+                        std::vector<LightSector::Probe>* probes);
+    // Same as above, but only relights the given ranges of bricks and probes. Everything else is left as is
+    static void Relight(const Inputs& inputs, const std::vector<LightSector::SurfelBrickFactor>& brick_factors,
+                        const std::vector<Range>& brick_ranges, const std::vector<Range>& probe_ranges,
+                        std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks,
+                        std::vector<LightSector::Probe>* probes);
+    // Lights every surfel in the given bricks from the sun and its nearest probe, then averages them into their
+    // brick's radiance. Surfels outside of the shadow map keep their previous radiance
+    static void RelightSurfelBricks(const Inputs& inputs, const std::vector<LightSector::Probe>& probes, const std::vector<Range>& brick_ranges,
+                                    std::vector<LightSector::Surfel>* surfels, std::vector<LightSector::SurfelBrick>* bricks);
+    // Builds the given probes' irradiance from sky light and the radiance of the bricks they can see
+    static void RelightProbes(const Inputs& inputs, const std::vector<LightSector::SurfelBrick>& bricks,
+                              const std::vector<LightSector::SurfelBrickFactor>& brick_factors, const std::vector<Range>& probe_ranges,
+                              std::vector<LightSector::Probe>* probes);
+};
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
+#endif // BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RADIANCETRANSFERRELIGHTER_H_
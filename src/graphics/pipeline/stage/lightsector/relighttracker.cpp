@@ -0,0 +1,433 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#include "relighttracker.h"
+
+// Includes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+// Public Includes
+#include <blons/system/job.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+namespace
+{
+const std::size_t kBricksPerJob = 64;
+const std::size_t kProbesPerJob = 16;
+// Clean elements between dirty ones are relit anyway when the gap is this small, to save on dispatches
+const std::size_t kRangeMergeGap = 32;
+// Covers the blur of the variance shadow map's soft edges, in world units
+const units::world kShadowBoundsMargin = 1.0f;
+// Covers the shadow map's blur and bilinear filtering, see shadow-blur.frag.glsl
+const float kShadowEdgeTexels = 8.0f;
+// How far from a whole number of texels the shadow map can slide before it's considered resampled
+const float kShadowTexelTolerance = 0.01f;
+
+// Whether a point is inside of the bounds or has them between itself and the light
+bool ShadowedBy(const Vector3& pos, const Vector3& to_light, const Vector3& bounds_min, const Vector3& bounds_max)
+{
+    const float p[3] = { pos.x, pos.y, pos.z };
+    const float d[3] = { to_light.x, to_light.y, to_light.z };
+    const float lo[3] = { bounds_min.x - kShadowBoundsMargin, bounds_min.y - kShadowBoundsMargin, bounds_min.z - kShadowBoundsMargin };
+    const float hi[3] = { bounds_max.x + kShadowBoundsMargin, bounds_max.y + kShadowBoundsMargin, bounds_max.z + kShadowBoundsMargin };
+    float t_min = 0.0f;
+    float t_max = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (d[axis] == 0.0f)
+        {
+            if (p[axis] < lo[axis] || p[axis] > hi[axis])
+            {
+                return false;
+            }
+            continue;
+        }
+        float t0 = (lo[axis] - p[axis]) / d[axis];
+        float t1 = (hi[axis] - p[axis]) / d[axis];
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1));
+        if (t_min > t_max)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether a point lands on the shadow map, at least the given number of texels in from its edges. Surfels closer to the
+// edges than kShadowEdgeTexels are sampled from texels that wrap around or were blurred with what's off the map
+bool InShadowMap(const Vector3& p, const Matrix& light_vp_matrix, float edge_texels = 0.0f)
+{
+    const auto& m = light_vp_matrix.m;
+    float w = p.x * m[0][3] + p.y * m[1][3] + p.z * m[2][3] + m[3][3];
+    float x = (p.x * m[0][0] + p.y * m[1][0] + p.z * m[2][0] + m[3][0]) / w;
+    float y = (p.x * m[0][1] + p.y * m[1][1] + p.z * m[2][1] + m[3][1]) / w;
+    float edge = 1.0f - edge_texels * 2.0f / kShadowMapResolution;
+    return !(x < -edge || x > edge || y < -edge || y > edge);
+}
+
+// Whether the shadow map was only slid along by whole texels, which leaves everything well inside of both the old and
+// new maps sampling the same shadows. Any other change to the light's matrix changes them everywhere
+bool ShadowMapSlid(const Matrix& previous_light_vp_matrix, const Matrix& light_vp_matrix)
+{
+    const auto& a = previous_light_vp_matrix.m;
+    const auto& b = light_vp_matrix.m;
+    for (int row = 0; row < 4; row++)
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            bool translation = row == 3 && column < 2;
+            if (!translation && a[row][column] != b[row][column])
+            {
+                return false;
+            }
+        }
+    }
+    for (int column = 0; column < 2; column++)
+    {
+        float texels = (b[3][column] - a[3][column]) * kShadowMapResolution * 0.5f;
+        if (std::abs(texels - std::round(texels)) > kShadowTexelTolerance)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+RelightTracker::RelightTracker()
+    : previous_inputs_(), all_dirty_(true), tracking_(false), settle_frames_left_(0)
+{
+}
+
+void RelightTracker::Invalidate()
+{
+    // Treated like every input changed on the next update
+    tracking_ = false;
+    brick_dirty_.clear();
+    probe_dirty_.clear();
+}
+
+bool RelightTracker::Update(const Scene& scene, const RadianceTransferRelighter::Inputs& inputs, int settle_frames,
+                            const std::vector<LightSector::Surfel>& surfels, const std::vector<LightSector::SurfelBrick>& bricks,
+                            const std::vector<LightSector::Probe>& probes, const std::vector<LightSector::SurfelBrickFactor>& brick_factors)
+{
+    // Always checked so that models are up to date for the next frame
+    auto changed_models = FindChangedModels(scene);
+    bool inputs_changed = !tracking_ || InputsChanged(inputs);
+    brick_dirty_.resize(bricks.size(), 0);
+    probe_dirty_.resize(probes.size(), 0);
+    // The light's matrix follows the camera rather than the lighting, so sliding it only matters to surfels it newly
+    // covers. Anything else it does changes every surfel's shadows, and is caught by InputsChanged
+    bool newly_covered = !inputs_changed &&
+                         memcmp(&previous_inputs_.light_vp_matrix, &inputs.light_vp_matrix, sizeof(Matrix)) != 0 &&
+                         DirtyNewlyCoveredBricks(previous_inputs_.light_vp_matrix, inputs.light_vp_matrix, surfels, bricks);
+    previous_inputs_ = inputs;
+    tracking_ = true;
+    settle_frames = std::max(settle_frames, 0);
+
+    if (inputs_changed)
+    {
+        all_dirty_ = true;
+        settle_frames_left_ = settle_frames;
+    }
+    else if (!changed_models.empty() || newly_covered)
+    {
+        if (!all_dirty_)
+        {
+            if (!changed_models.empty())
+            {
+                DirtyShadowedBricks(changed_models, inputs.sun_dir, surfels, bricks);
+            }
+            // Last frame's changes still need to bounce out, even while new ones keep coming in
+            SpreadToBricks(surfels, bricks);
+            SpreadToProbes(probes, brick_factors);
+        }
+        settle_frames_left_ = settle_frames;
+    }
+    else if (settle_frames_left_ > 0)
+    {
+        settle_frames_left_--;
+        // Each frame of settling carries the changes one more bounce out
+        if (!all_dirty_)
+        {
+            SpreadToBricks(surfels, bricks);
+            SpreadToProbes(probes, brick_factors);
+        }
+    }
+    else
+    {
+        // Everything has settled
+        all_dirty_ = false;
+        std::fill(brick_dirty_.begin(), brick_dirty_.end(), 0);
+        std::fill(probe_dirty_.begin(), probe_dirty_.end(), 0);
+        brick_ranges_.clear();
+        probe_ranges_.clear();
+        return false;
+    }
+
+    if (all_dirty_)
+    {
+        brick_ranges_.clear();
+        probe_ranges_.clear();
+        if (!bricks.empty())
+        {
+            brick_ranges_.push_back({ 0, bricks.size() });
+        }
+        if (!probes.empty())
+        {
+            probe_ranges_.push_back({ 0, probes.size() });
+        }
+    }
+    else
+    {
+        brick_ranges_ = BuildRanges(brick_dirty_);
+        probe_ranges_ = BuildRanges(probe_dirty_);
+    }
+    return true;
+}
+
+const std::vector<RadianceTransferRelighter::Range>& RelightTracker::brick_ranges() const
+{
+    return brick_ranges_;
+}
+
+const std::vector<RadianceTransferRelighter::Range>& RelightTracker::probe_ranges() const
+{
+    return probe_ranges_;
+}
+
+std::vector<RadianceTransferRelighter::Range> RelightTracker::SurfelRanges(const std::vector<LightSector::SurfelBrick>& bricks) const
+{
+    // Bakes sort surfels by brick, so a run of bricks always owns a run of surfels
+    std::vector<RadianceTransferRelighter::Range> surfel_ranges;
+    for (const auto& range : brick_ranges_)
+    {
+        const auto& first = bricks[range.start];
+        const auto& last = bricks[range.start + range.count - 1];
+        std::size_t start = first.surfel_range_start;
+        std::size_t end = last.surfel_range_start + last.surfel_count;
+        surfel_ranges.push_back({ start, end - start });
+    }
+    return surfel_ranges;
+}
+
+bool RelightTracker::InputsChanged(const RadianceTransferRelighter::Inputs& inputs) const
+{
+    const auto& previous = previous_inputs_;
+    return previous.sun_dir != inputs.sun_dir ||
+           previous.sun_colour != inputs.sun_colour ||
+           previous.sun_luminance != inputs.sun_luminance ||
+           previous.metalness != inputs.metalness ||
+           previous.gi_boost != inputs.gi_boost ||
+           memcmp(&previous.sky_box, &inputs.sky_box, sizeof(SHColourCoeffs3)) != 0 ||
+           previous.sky_luminance != inputs.sky_luminance ||
+           !ShadowMapSlid(previous.light_vp_matrix, inputs.light_vp_matrix);
+}
+
+std::vector<RelightTracker::Bounds> RelightTracker::FindChangedModels(const Scene& scene)
+{
+    // Any model that moved affects lighting in both its old and new position
+    std::vector<Bounds> changed;
+    std::unordered_map<const Model*, ModelState> current;
+    for (const auto& model : scene.models)
+    {
+        auto previous_it = models_.find(model);
+        if (previous_it == models_.end())
+        {
+            auto state = CaptureModel(model);
+            if (state.vertex_count > 0)
+            {
+                changed.push_back(WorldBounds(state));
+            }
+            current[model] = state;
+            continue;
+        }
+        auto state = previous_it->second;
+        if (state.vertex_count != model->mesh().vertices.size() || state.pos != model->pos() || state.scale != model->scale())
+        {
+            if (state.vertex_count > 0)
+            {
+                changed.push_back(WorldBounds(state));
+            }
+            state = CaptureModel(model);
+            if (state.vertex_count > 0)
+            {
+                changed.push_back(WorldBounds(state));
+            }
+        }
+        current[model] = state;
+        models_.erase(previous_it);
+    }
+    // Whatever is left over was removed from the scene
+    for (const auto& previous : models_)
+    {
+        if (previous.second.vertex_count > 0)
+        {
+            changed.push_back(WorldBounds(previous.second));
+        }
+    }
+    models_ = std::move(current);
+    return changed;
+}
+
+void RelightTracker::DirtyShadowedBricks(const std::vector<Bounds>& changed, const Vector3& sun_dir,
+                                         const std::vector<LightSector::Surfel>& surfels, const std::vector<LightSector::SurfelBrick>& bricks)
+{
+    Vector3 to_light = sun_dir * -1.0f;
+    ParallelFor(0, bricks.size(), kBricksPerJob, [&](std::size_t brick_id)
+    {
+        if (brick_dirty_[brick_id])
+        {
+            return;
+        }
+        const auto& brick = bricks[brick_id];
+        for (int i = 0; i < brick.surfel_count && !brick_dirty_[brick_id]; i++)
+        {
+            const auto& surfel = surfels[brick.surfel_range_start + i];
+            for (const auto& bounds : changed)
+            {
+                if (ShadowedBy(surfel.pos, to_light, bounds.min, bounds.max))
+                {
+                    brick_dirty_[brick_id] = 1;
+                    break;
+                }
+            }
+        }
+    });
+}
+
+bool RelightTracker::DirtyNewlyCoveredBricks(const Matrix& previous_light_vp_matrix, const Matrix& light_vp_matrix,
+                                             const std::vector<LightSector::Surfel>& surfels, const std::vector<LightSector::SurfelBrick>& bricks)
+{
+    // Surfels off the shadow map keep their last lighting, and the ones that stay well inside of it see the same
+    // shadows, so only those coming onto it or near its edges light differently. Checked even when everything is
+    // dirty, since they still need to settle
+    std::atomic<bool> any_covered(false);
+    ParallelFor(0, bricks.size(), kBricksPerJob, [&](std::size_t brick_id)
+    {
+        const auto& brick = bricks[brick_id];
+        for (int i = 0; i < brick.surfel_count; i++)
+        {
+            const auto& pos = surfels[brick.surfel_range_start + i].pos;
+            bool covered = InShadowMap(pos, light_vp_matrix);
+            bool unchanged = InShadowMap(pos, light_vp_matrix, kShadowEdgeTexels) &&
+                             InShadowMap(pos, previous_light_vp_matrix, kShadowEdgeTexels);
+            if (covered && !unchanged)
+            {
+                brick_dirty_[brick_id] = 1;
+                any_covered = true;
+                break;
+            }
+        }
+    });
+    return any_covered;
+}
+
+void RelightTracker::SpreadToProbes(const std::vector<LightSector::Probe>& probes, const std::vector<LightSector::SurfelBrickFactor>& brick_factors)
+{
+    ParallelFor(0, probes.size(), kProbesPerJob, [&](std::size_t probe_id)
+    {
+        const auto& probe = probes[probe_id];
+        for (int i = 0; i < probe.brick_factor_count && !probe_dirty_[probe_id]; i++)
+        {
+            probe_dirty_[probe_id] = brick_dirty_[brick_factors[probe.brick_factor_range_start + i].brick_id];
+        }
+    });
+}
+
+void RelightTracker::SpreadToBricks(const std::vector<LightSector::Surfel>& surfels, const std::vector<LightSector::SurfelBrick>& bricks)
+{
+    // Surfels pick up bounce lighting from their nearest probe
+    ParallelFor(0, bricks.size(), kBricksPerJob, [&](std::size_t brick_id)
+    {
+        const auto& brick = bricks[brick_id];
+        for (int i = 0; i < brick.surfel_count && !brick_dirty_[brick_id]; i++)
+        {
+            brick_dirty_[brick_id] = probe_dirty_[surfels[brick.surfel_range_start + i].nearest_probe_id];
+        }
+    });
+}
+
+std::vector<RadianceTransferRelighter::Range> RelightTracker::BuildRanges(const std::vector<char>& dirty)
+{
+    std::vector<RadianceTransferRelighter::Range> ranges;
+    for (std::size_t i = 0; i < dirty.size(); i++)
+    {
+        if (!dirty[i])
+        {
+            continue;
+        }
+        if (!ranges.empty() && i - (ranges.back().start + ranges.back().count) <= kRangeMergeGap)
+        {
+            ranges.back().count = i - ranges.back().start + 1;
+        }
+        else
+        {
+            ranges.push_back({ i, 1 });
+        }
+    }
+    return ranges;
+}
+
+RelightTracker::ModelState RelightTracker::CaptureModel(const Model* model)
+{
+    const auto& vertices = model->mesh().vertices;
+    ModelState state;
+    state.pos = model->pos();
+    state.scale = model->scale();
+    state.vertex_count = vertices.size();
+    state.local_min = Vector3(0.0f);
+    state.local_max = Vector3(0.0f);
+    if (!vertices.empty())
+    {
+        state.local_min = vertices[0].pos;
+        state.local_max = vertices[0].pos;
+        for (const auto& v : vertices)
+        {
+            state.local_min = Vector3(std::min(state.local_min.x, v.pos.x), std::min(state.local_min.y, v.pos.y), std::min(state.local_min.z, v.pos.z));
+            state.local_max = Vector3(std::max(state.local_max.x, v.pos.x), std::max(state.local_max.y, v.pos.y), std::max(state.local_max.z, v.pos.z));
+        }
+    }
+    return state;
+}
+
+RelightTracker::Bounds RelightTracker::WorldBounds(const ModelState& model)
+{
+    // World matrices are only updated when models render, so transform the bounds by hand. Negative scales flip them
+    Vector3 a = model.local_min * model.scale + model.pos;
+    Vector3 b = model.local_max * model.scale + model.pos;
+    return { Vector3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)),
+             Vector3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)) };
+}
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
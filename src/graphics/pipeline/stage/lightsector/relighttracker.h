@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RELIGHTTRACKER_H_
+#define BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RELIGHTTRACKER_H_
+
+// Includes
+#include <unordered_map>
+#include <vector>
+// Public Includes
+#include <blons/graphics/pipeline/scene.h>
+#include <blons/graphics/pipeline/stage/lightsector/lightsector.h>
+// Local Includes
+#include "radiancetransferrelighter.h"
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+// Works out which bricks and probes need relighting each frame. Nothing does when the sun, sky, and models are the
+// same as last frame. Moving models only dirty the bricks in or shadowed by them, along with the probes that see
+// those bricks. The shadow map is fit to the camera, and surfels it doesn't cover keep their old lighting, so sliding
+// it by whole texels only dirties the bricks with surfels it has newly covered or that are near its edges. Any other
+// change to it relights everything. Since surfels are lit with last frame's probes, bounce lighting takes a few
+// frames to settle after any change, so dirty bricks and probes keep relighting (and spreading to their neighbours)
+// for a while before going clean
+class RelightTracker
+{
+public:
+    RelightTracker();
+    ~RelightTracker() {}
+
+    // Marks everything dirty, for when the radiance transfer data has been replaced
+    void Invalidate();
+    // Compares this frame's lighting against the last one and builds the ranges to relight. The shadow map's
+    // contents are considered unchanged as long as the sun and the models are, and it only slides by whole texels.
+    // Returns false if nothing needs relighting, in which case anything lit from the sector can skip relighting too
+    bool Update(const Scene& scene, const RadianceTransferRelighter::Inputs& inputs, int settle_frames,
+                const std::vector<LightSector::Surfel>& surfels, const std::vector<LightSector::SurfelBrick>& bricks,
+                const std::vector<LightSector::Probe>& probes, const std::vector<LightSector::SurfelBrickFactor>& brick_factors);
+
+    // Dirty bricks and probes from the last update, merged into as few ranges as is reasonable
+    const std::vector<RadianceTransferRelighter::Range>& brick_ranges() const;
+    const std::vector<RadianceTransferRelighter::Range>& probe_ranges() const;
+    // Surfels belonging to the dirty bricks
+    std::vector<RadianceTransferRelighter::Range> SurfelRanges(const std::vector<LightSector::SurfelBrick>& bricks) const;
+
+private:
+    // Where a model was last frame, with local bounds kept around so vertices are only scanned once
+    struct ModelState
+    {
+        Vector3 pos;
+        Vector3 scale;
+        std::size_t vertex_count;
+        Vector3 local_min;
+        Vector3 local_max;
+    };
+    struct Bounds
+    {
+        Vector3 min;
+        Vector3 max;
+    };
+
+    bool InputsChanged(const RadianceTransferRelighter::Inputs& inputs) const;
+    std::vector<Bounds> FindChangedModels(const Scene& scene);
+    void DirtyShadowedBricks(const std::vector<Bounds>& changed, const Vector3& sun_dir,
+                             const std::vector<LightSector::Surfel>& surfels, const std::vector<LightSector::SurfelBrick>& bricks);
+    bool DirtyNewlyCoveredBricks(const Matrix& previous_light_vp_matrix, const Matrix& light_vp_matrix,
+                                 const std::vector<LightSector::Surfel>& surfels, const std::vector<LightSector::SurfelBrick>& bricks);
+    void SpreadToProbes(const std::vector<LightSector::Probe>& probes, const std::vector<LightSector::SurfelBrickFactor>& brick_factors);
+    void SpreadToBricks(const std::vector<LightSector::Surfel>& surfels, const std::vector<LightSector::SurfelBrick>& bricks);
+    static std::vector<RadianceTransferRelighter::Range> BuildRanges(const std::vector<char>& dirty);
+    static ModelState CaptureModel(const Model* model);
+    static Bounds WorldBounds(const ModelState& model);
+
+    RadianceTransferRelighter::Inputs previous_inputs_;
+    std::unordered_map<const Model*, ModelState> models_;
+    bool all_dirty_;
+    bool tracking_;
+    int settle_frames_left_;
+    std::vector<char> brick_dirty_;
+    std::vector<char> probe_dirty_;
+    std::vector<RadianceTransferRelighter::Range> brick_ranges_;
+    std::vector<RadianceTransferRelighter::Range> probe_ranges_;
+};
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
+#endif // BLONSTECH_GRAPHICS_PIPELINE_STAGE_LIGHTSECTOR_RELIGHTTRACKER_H_
@@ -23,6 +23,10 @@
 
 #include <blons/graphics/pipeline/stage/specularlocal.h>
 
+// Includes
+#include <algorithm>
+#include <limits>
+
 namespace blons
 {
 namespace pipeline
@@ -38,6 +42,14 @@ std::vector<Vector3> GenerateOldSponzaProbePositions()
 } // namespace temp
 namespace
 {
+// Most faces and mip levels to relight per frame, 0 to relight every probe fully each time
+auto cvar_specular_relight_budget = console::RegisterVariable("light:specular-relight-budget", 6);
+
+// Each of the 6 faces of the base level, followed by every filtered mip level
+const int kCubemapFaces = 6;
+const int kSpecularRelightSteps = kCubemapFaces + kSpecularProbeMipLevels;
+const int kAllCubemapFaces = (1 << kCubemapFaces) - 1;
+
 std::array<Matrix, 6> GenerateViewProjMatrices(Vector3 position, bool depth_buffer_zero_to_one)
 {
     std::array<Matrix, 6> matrices;
@@ -55,6 +67,7 @@ std::array<Matrix, 6> GenerateViewProjMatrices(Vector3 position, bool depth_buff
 } // namespace
 
 SpecularLocal::SpecularLocal()
+    : relighting_probe_(-1)
 {
     const auto probe_positions = temp::GenerateOldSponzaProbePositions();
     for (const auto& pos : probe_positions)
@@ -77,12 +90,20 @@ SpecularLocal::SpecularLocal()
         buffer.type.format = TextureType::R16G16B16A16_FLOAT;
         buffer.type.compression = TextureType::AUTO;
         probe.environment.reset(new TextureCubemap(buffer));
+        probe.back_environment.reset(new TextureCubemap(buffer));
         // HDR LD term for ambient specular, with mipmaps for varying roughness
         buffer.type.format = TextureType::R16G16B16A16_FLOAT;
         buffer.type.compression = TextureType::RAW;
         probe.ld_term.reset(new TextureCubemap(buffer));
-        render::context()->SetTextureMipmapRange(probe.ld_term->mutable_texture().get(), 0, kSpecularProbeMipLevels);
-        render::context()->MakeTextureMipmaps(probe.ld_term->mutable_texture().get());
+        probe.back_ld_term.reset(new TextureCubemap(buffer));
+        for (auto ld_term : { probe.ld_term.get(), probe.back_ld_term.get() })
+        {
+            render::context()->SetTextureMipmapRange(ld_term->mutable_texture().get(), 0, kSpecularProbeMipLevels);
+            render::context()->MakeTextureMipmaps(ld_term->mutable_texture().get());
+        }
+        probe.stale_count = 1;
+        probe.next_step = 0;
+        probe.lit = false;
         // Add it to the list
         probes_.push_back(std::move(probe));
     }
@@ -170,8 +191,20 @@ void SpecularLocal::BakeRadianceTransfer(const Scene& scene)
     // or make a separate 2 channel dfg texture owned by light sector might be more sensible. but thats an extra texture fetch wauhg
 }
 
+void SpecularLocal::QueueRelight()
+{
+    for (auto& probe : probes_)
+    {
+        probe.stale_count++;
+    }
+}
+
 bool SpecularLocal::Relight(const Scene& scene, const Shadow& shadow, const IrradianceVolume& irradiance, Matrix light_vp_matrix)
 {
+    if (relighting_probe_ < 0 && NextProbe(scene.view.pos()) < 0)
+    {
+        return true;
+    }
     auto context = render::context();
     context->SetDepthTesting(false);
     context->SetBlendMode(BlendMode::OVERWRITE);
@@ -188,7 +221,8 @@ bool SpecularLocal::Relight(const Scene& scene, const Shadow& shadow, const Irra
         !relight_shader_->SetInput("sh_sky_colour.r", scene.sky_box.r.coeffs, 9) ||
         !relight_shader_->SetInput("sh_sky_colour.g", scene.sky_box.g.coeffs, 9) ||
         !relight_shader_->SetInput("sh_sky_colour.b", scene.sky_box.b.coeffs, 9) ||
-        !relight_shader_->SetInput("inv_irradiance_matrix", MatrixInverse(irradiance.world_matrix())) ||
+        !relight_shader_->SetInput("irradiance_clipmap_origins", irradiance.clipmap_origins().data(), kIrradianceClipmapLevels) ||
+        !relight_shader_->SetInput("irradiance_voxel_size", irradiance.voxel_size()) ||
         !relight_shader_->SetInput("irradiance_volume_px", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_PX), 4) ||
         !relight_shader_->SetInput("irradiance_volume_nx", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_NX), 5) ||
         !relight_shader_->SetInput("irradiance_volume_py", irradiance.output(IrradianceVolume::IRRADIANCE_VOLUME_PY), 6) ||
@@ -199,56 +233,127 @@ bool SpecularLocal::Relight(const Scene& scene, const Shadow& shadow, const Irra
         return false;
     }
 
-    // Relight the base mip level of all lit environment maps
+    int budget = cvar_specular_relight_budget->to<int>();
+    if (budget <= 0)
+    {
+        budget = kSpecularRelightSteps * static_cast<int>(probes_.size());
+    }
     relight_buffer_->Bind();
-    for (const auto& probe : probes_)
+    while (budget > 0)
+    {
+        if (relighting_probe_ < 0)
+        {
+            relighting_probe_ = NextProbe(scene.view.pos());
+            if (relighting_probe_ < 0)
+            {
+                break;
+            }
+            // Changes queued after this point need another relight
+            probes_[relighting_probe_].stale_count = 0;
+        }
+        auto& probe = probes_[relighting_probe_];
+        // Probes that have never been lit would have nothing to show until they were done, so they skip the budget
+        int steps = probe.lit ? std::min(budget, kSpecularRelightSteps - probe.next_step) : kSpecularRelightSteps - probe.next_step;
+        if (!RelightSteps(&probe, steps))
+        {
+            relight_buffer_->Unbind();
+            return false;
+        }
+        budget -= steps;
+        if (probe.next_step == kSpecularRelightSteps)
+        {
+            std::swap(probe.environment, probe.back_environment);
+            std::swap(probe.ld_term, probe.back_ld_term);
+            probe.next_step = 0;
+            probe.lit = true;
+            relighting_probe_ = -1;
+        }
+    }
+    relight_buffer_->Unbind();
+    return true;
+}
+
+int SpecularLocal::NextProbe(const Vector3& camera_pos) const
+{
+    // Unlit probes come first, then whichever has missed the most lighting changes for how close it is
+    int next_probe = -1;
+    float best_priority = 0.0f;
+    for (std::size_t i = 0; i < probes_.size(); i++)
+    {
+        const auto& probe = probes_[i];
+        if (probe.stale_count == 0)
+        {
+            continue;
+        }
+        float priority = std::numeric_limits<float>::max();
+        if (probe.lit)
+        {
+            units::world distance = VectorLength(probe.pos - camera_pos);
+            priority = static_cast<float>(probe.stale_count) / std::max(distance, 1.0f);
+        }
+        if (next_probe < 0 || priority > best_priority)
+        {
+            next_probe = static_cast<int>(i);
+            best_priority = priority;
+        }
+    }
+    return next_probe;
+}
+
+bool SpecularLocal::RelightSteps(SpecularProbe* probe, int max_steps)
+{
+    auto context = render::context();
+    const int last_step = std::min(probe->next_step + max_steps, kSpecularRelightSteps);
+
+    // Relight the faces of the base mip level in a single pass
+    if (probe->next_step < kCubemapFaces)
     {
+        int face_mask = 0;
+        for (int face = probe->next_step; face < std::min(last_step, kCubemapFaces); face++)
+        {
+            face_mask |= 1 << face;
+        }
         // Inverted view-proj matrices to find world space positions from G-buffer
-        std::array<Matrix, 6> inv_vp_matrices = GenerateViewProjMatrices(probe.pos, context->IsDepthBufferRangeZeroToOne());
+        std::array<Matrix, 6> inv_vp_matrices = GenerateViewProjMatrices(probe->pos, context->IsDepthBufferRangeZeroToOne());
         std::transform(inv_vp_matrices.begin(), inv_vp_matrices.end(), inv_vp_matrices.begin(), [](const auto& mat) { return MatrixInverse(mat); });
         if (!relight_shader_->SetInput("inv_vp_matrices", inv_vp_matrices.data(), 6) ||
-            !relight_shader_->SetInput("albedo", probe.g_buffer.albedo->texture(), 0) ||
-            !relight_shader_->SetInput("normal", probe.g_buffer.normal->texture(), 1) ||
-            !relight_shader_->SetInput("depth", probe.g_buffer.depth->texture(), 2))
+            !relight_shader_->SetInput("face_mask", face_mask) ||
+            !relight_shader_->SetInput("albedo", probe->g_buffer.albedo->texture(), 0) ||
+            !relight_shader_->SetInput("normal", probe->g_buffer.normal->texture(), 1) ||
+            !relight_shader_->SetInput("depth", probe->g_buffer.depth->texture(), 2))
         {
-            relight_buffer_->Unbind();
             return false;
         }
-        relight_buffer_->BindColourTextures({ probe.environment->texture(), probe.ld_term->texture() });
+        context->SetViewport(0, 0, kSpecularProbeMapSize, kSpecularProbeMapSize);
+        relight_buffer_->BindColourTextures({ probe->back_environment->texture(), probe->back_ld_term->texture() });
         relight_buffer_->Render();
         relight_shader_->Render(relight_buffer_->index_count());
+        probe->next_step = std::min(last_step, kCubemapFaces);
     }
-    // Propogate the relighting to the lower mip levels for pre-filtered importance sampling
-    // Done in a separate loop to mitigate state changes in the rendering context
-    for (const auto& probe : probes_)
-    {
-        context->MakeTextureMipmaps(probe.environment->mutable_texture().get());
-    }
+
     // Approximate the specular lighting distribution for each mipmaps roughness level
-    for (const auto& probe : probes_)
+    for (; probe->next_step < last_step; probe->next_step++)
     {
-        if (!relight_distribution_shader_->SetInput("environment_map", probe.environment->texture(), 0) ||
-            !relight_distribution_shader_->SetInput("max_mip_level", kSpecularProbeMipLevels) ||
-            !relight_distribution_shader_->SetInput("base_texture_size", kSpecularProbeMapSize))
+        int mip_level = probe->next_step - kCubemapFaces + 1;
+        // Propogate the relighting to the lower mip levels for pre-filtered importance sampling
+        if (mip_level == 1)
         {
-            relight_buffer_->Unbind();
-            return false;
+            context->MakeTextureMipmaps(probe->back_environment->mutable_texture().get());
         }
-        for (int mip_level = 1; mip_level <= kSpecularProbeMipLevels; mip_level++)
+        units::pixel resolution = kSpecularProbeMapSize >> mip_level;
+        if (!relight_distribution_shader_->SetInput("environment_map", probe->back_environment->texture(), 0) ||
+            !relight_distribution_shader_->SetInput("max_mip_level", kSpecularProbeMipLevels) ||
+            !relight_distribution_shader_->SetInput("base_texture_size", kSpecularProbeMapSize) ||
+            !relight_distribution_shader_->SetInput("face_mask", kAllCubemapFaces) ||
+            !relight_distribution_shader_->SetInput("mip_level", mip_level))
         {
-            units::pixel resolution = kSpecularProbeMapSize >> mip_level;
-            if (!relight_distribution_shader_->SetInput("mip_level", mip_level))
-            {
-                relight_buffer_->Unbind();
-                return false;
-            }
-            context->SetViewport(0, 0, resolution, resolution);
-            relight_buffer_->BindColourTextures({ probe.ld_term->texture() }, mip_level);
-            relight_buffer_->Render();
-            relight_distribution_shader_->Render(relight_buffer_->index_count());
+            return false;
         }
+        context->SetViewport(0, 0, resolution, resolution);
+        relight_buffer_->BindColourTextures({ probe->back_ld_term->texture() }, mip_level);
+        relight_buffer_->Render();
+        relight_distribution_shader_->Render(relight_buffer_->index_count());
     }
-    relight_buffer_->Unbind();
     return true;
 }
 
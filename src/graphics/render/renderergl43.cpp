@@ -1364,6 +1364,59 @@ PixelData RendererGL43::GetTextureData(const TextureResource* texture, unsigned
     return pixels;
 }
 
+PixelData RendererGL43::GetTextureData(const TextureResource* texture, unsigned int mip_level,
+                                       units::pixel x, units::pixel y, units::pixel width, units::pixel height)
+{
+    auto tex = resource_cast<const TextureResourceGL43*>(texture, id());
+    if (tex->type_ != TranslatePixelDataType<PixelData>())
+    {
+        throw "Attemped to retrieve mismatched texture type";
+    }
+    if (tex->options_.compression == TextureType::DDS)
+    {
+        throw "Attemped to retrieve compressed texture type";
+    }
+    if (mip_level != 0 && tex->has_mipmaps_ == false)
+    {
+        throw "Attempted to retrieve mipmap of single level texture";
+    }
+    GLint tex_width, tex_height;
+    GLint internal_format, input_format;
+    GLenum input_type;
+    glBindTexture(tex->type_, tex->texture_);
+    glGetTexLevelParameteriv(tex->type_, mip_level, GL_TEXTURE_WIDTH, &tex_width);
+    glGetTexLevelParameteriv(tex->type_, mip_level, GL_TEXTURE_HEIGHT, &tex_height);
+    if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > tex_width || y + height > tex_height)
+    {
+        throw "Attempted to retrieve pixels outside of texture";
+    }
+    TranslateTextureFormat(tex->options_.format, &internal_format, &input_format, &input_type);
+
+    PixelData pixels;
+    pixels.width = width;
+    pixels.height = height;
+    pixels.type = tex->options_;
+    pixels.pixels.resize(width * height * (pixels.bits_per_pixel() / 8));
+
+    // GL 4.3 can only read part of a texture through a framebuffer, so attach it to a temporary one
+    GLuint read_framebuffer;
+    glGenFramebuffers(1, &read_framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+    if (tex->options_.format == TextureType::DEPTH)
+    {
+        glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tex->texture_, mip_level);
+    }
+    else
+    {
+        glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex->texture_, mip_level);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+    }
+    glReadPixels(x, y, width, height, input_format, input_type, pixels.pixels.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, active_framebuffer_);
+    glDeleteFramebuffers(1, &read_framebuffer);
+    return pixels;
+}
+
 PixelData3D RendererGL43::GetTextureData3D(const TextureResource* texture, unsigned int mip_level)
 {
     auto tex = resource_cast<const TextureResourceGL43*>(texture, id());
@@ -80,6 +80,8 @@ public:
     void SetTextureData(TextureResource* texture, PixelData3D* pixels, unsigned int mip_level) override;
     void SetTextureData(TextureResource* texture, PixelDataCubemap* pixels, unsigned int mip_level) override;
     PixelData GetTextureData(const TextureResource* texture, unsigned int mip_level) override;
+    PixelData GetTextureData(const TextureResource* texture, unsigned int mip_level,
+                             units::pixel x, units::pixel y, units::pixel width, units::pixel height) override;
     PixelData3D GetTextureData3D(const TextureResource* texture, unsigned int mip_level) override;
     PixelDataCubemap GetTextureDataCubemap(const TextureResource* texture, unsigned int mip_level) override;
     void MakeTextureMipmaps(TextureResource* texture) override;
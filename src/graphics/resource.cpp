@@ -170,6 +170,16 @@ TextureBuffer LoadTexture(const std::string& filename, TextureType::Options opti
     return buffer;
 }
 
+const PixelData* TexturePixels(const std::string& filename)
+{
+    auto tex = g_texture_cache.find(filename);
+    if (tex == g_texture_cache.end())
+    {
+        return nullptr;
+    }
+    return tex->second.pixels.get();
+}
+
 void ClearBufferCache()
 {
     for (auto& m : g_mesh_cache)
@@ -89,6 +89,14 @@ MeshBuffer LoadMesh(const std::string& filename);
 /// nullptr on failure, as well as texture information
 ////////////////////////////////////////////////////////////////////////////////
 TextureBuffer LoadTexture(const std::string& filename, TextureType::Options options);
+////////////////////////////////////////////////////////////////////////////////
+/// \brief Retrieves the pixel data a texture was loaded from, without reading
+/// anything back from the GPU. DDS files are kept exactly as they are on disk
+///
+/// \param filename Filename the texture was loaded with
+/// \return Cached pixel data, or nullptr if the texture isn't in the data cache
+////////////////////////////////////////////////////////////////////////////////
+const PixelData* TexturePixels(const std::string& filename);
 
 ////////////////////////////////////////////////////////////////////////////////
 /// \brief Clears all cached resource buffers, but not cached resource data
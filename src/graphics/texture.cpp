@@ -97,6 +97,16 @@ const PixelData* Texture::pixels(bool force_gpu_sync)
     return pixel_data_.get();
 }
 
+const PixelData* Texture::source_pixels() const
+{
+    // Files keep their pixels in the resource cache rather than on every texture
+    if (filename_.length() > 0)
+    {
+        return resource::TexturePixels(filename_);
+    }
+    return pixel_data_.get();
+}
+
 const TextureResource* Texture::texture() const
 {
     return texture_.get();
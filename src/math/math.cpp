@@ -25,6 +25,14 @@
 
 // Includes
 #include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BLONS_SH_AVX2
+#endif
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define BLONS_SH_SSE
+#endif
 
 namespace blons
 {
@@ -496,6 +504,138 @@ SHCoeffs3 SHProjectDirection3(Vector3 direction)
     return result;
 }
 
+#ifdef BLONS_SH_SSE
+namespace
+{
+static_assert(sizeof(Vector3) == sizeof(units::world) * 3, "Directions must be tightly packed to be loaded 4 at a time");
+
+// Loads 4 packed directions, transposed into one register per axis
+inline void LoadDirections4(const Vector3* directions, __m128* x, __m128* y, __m128* z)
+{
+    const float* p = reinterpret_cast<const float*>(directions);
+    __m128 a = _mm_loadu_ps(p);     // x0 y0 z0 x1
+    __m128 b = _mm_loadu_ps(p + 4); // y1 z1 x2 y2
+    __m128 c = _mm_loadu_ps(p + 8); // z2 x3 y3 z3
+    *x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+    *y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    *z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+} // namespace
+#endif
+
+void SHProjectDirections3(const Vector3* directions, const units::world* weights, std::size_t count, SHCoeffs3* out)
+{
+    // Band constants of the sh_* functions above, which are applied to the sums once at the end rather than to
+    // every direction. {l=2,m=0} is the exception, as its constant part would otherwise cancel out most of the sum
+    const units::world kL1 = 0.48860251190291992158638462283835f;
+    const units::world kL2 = 1.0925484305920790705433857058027f;
+    const units::world kL2M0 = 0.94617469575756001809268107088713f;
+    const units::world kL2M0Offset = 0.31539156525252000603089369029571f;
+    const units::world kL2M2 = 0.54627421529603953527169285290134f;
+
+    // Sums of w, w*y, w*z, w*x, w*y*x, w*y*z, w*{l=2,m=0}, w*x*z, and w*(x*x - y*y), in coefficient order
+    units::world sums[9] = {};
+    std::size_t i = 0;
+#if defined(BLONS_SH_AVX2)
+    const __m256 wide_l2m0 = _mm256_set1_ps(kL2M0);
+    const __m256 wide_l2m0_offset = _mm256_set1_ps(kL2M0Offset);
+    __m256 wide_sums[9];
+    for (auto& sum : wide_sums)
+    {
+        sum = _mm256_setzero_ps();
+    }
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 x_lo, y_lo, z_lo, x_hi, y_hi, z_hi;
+        LoadDirections4(directions + i, &x_lo, &y_lo, &z_lo);
+        LoadDirections4(directions + i + 4, &x_hi, &y_hi, &z_hi);
+        __m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(x_lo), x_hi, 1);
+        __m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(y_lo), y_hi, 1);
+        __m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(z_lo), z_hi, 1);
+        __m256 w = _mm256_loadu_ps(weights + i);
+        __m256 wx = _mm256_mul_ps(w, x);
+        __m256 wy = _mm256_mul_ps(w, y);
+        __m256 wz = _mm256_mul_ps(w, z);
+        wide_sums[0] = _mm256_add_ps(wide_sums[0], w);
+        wide_sums[1] = _mm256_add_ps(wide_sums[1], wy);
+        wide_sums[2] = _mm256_add_ps(wide_sums[2], wz);
+        wide_sums[3] = _mm256_add_ps(wide_sums[3], wx);
+        wide_sums[4] = _mm256_fmadd_ps(wy, x, wide_sums[4]);
+        wide_sums[5] = _mm256_fmadd_ps(wy, z, wide_sums[5]);
+        wide_sums[6] = _mm256_fmadd_ps(w, _mm256_fmsub_ps(wide_l2m0, _mm256_mul_ps(z, z), wide_l2m0_offset), wide_sums[6]);
+        wide_sums[7] = _mm256_fmadd_ps(wx, z, wide_sums[7]);
+        wide_sums[8] = _mm256_fmadd_ps(wx, x, wide_sums[8]);
+        wide_sums[8] = _mm256_fnmadd_ps(wy, y, wide_sums[8]);
+    }
+    for (int c = 0; c < 9; c++)
+    {
+        alignas(32) float lanes[8];
+        _mm256_store_ps(lanes, wide_sums[c]);
+        for (const auto& lane : lanes)
+        {
+            sums[c] += lane;
+        }
+    }
+#elif defined(BLONS_SH_SSE)
+    const __m128 wide_l2m0 = _mm_set1_ps(kL2M0);
+    const __m128 wide_l2m0_offset = _mm_set1_ps(kL2M0Offset);
+    __m128 wide_sums[9];
+    for (auto& sum : wide_sums)
+    {
+        sum = _mm_setzero_ps();
+    }
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x, y, z;
+        LoadDirections4(directions + i, &x, &y, &z);
+        __m128 w = _mm_loadu_ps(weights + i);
+        __m128 wx = _mm_mul_ps(w, x);
+        __m128 wy = _mm_mul_ps(w, y);
+        __m128 wz = _mm_mul_ps(w, z);
+        wide_sums[0] = _mm_add_ps(wide_sums[0], w);
+        wide_sums[1] = _mm_add_ps(wide_sums[1], wy);
+        wide_sums[2] = _mm_add_ps(wide_sums[2], wz);
+        wide_sums[3] = _mm_add_ps(wide_sums[3], wx);
+        wide_sums[4] = _mm_add_ps(wide_sums[4], _mm_mul_ps(wy, x));
+        wide_sums[5] = _mm_add_ps(wide_sums[5], _mm_mul_ps(wy, z));
+        wide_sums[6] = _mm_add_ps(wide_sums[6], _mm_mul_ps(w, _mm_sub_ps(_mm_mul_ps(wide_l2m0, _mm_mul_ps(z, z)), wide_l2m0_offset)));
+        wide_sums[7] = _mm_add_ps(wide_sums[7], _mm_mul_ps(wx, z));
+        wide_sums[8] = _mm_add_ps(wide_sums[8], _mm_sub_ps(_mm_mul_ps(wx, x), _mm_mul_ps(wy, y)));
+    }
+    for (int c = 0; c < 9; c++)
+    {
+        float lanes[4];
+        _mm_storeu_ps(lanes, wide_sums[c]);
+        sums[c] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+#endif
+    // Whatever didn't fill a whole register, or everything if there's no SIMD
+    for (; i < count; i++)
+    {
+        const auto& d = directions[i];
+        const auto& w = weights[i];
+        sums[0] += w;
+        sums[1] += w * d.y;
+        sums[2] += w * d.z;
+        sums[3] += w * d.x;
+        sums[4] += w * d.y * d.x;
+        sums[5] += w * d.y * d.z;
+        sums[6] += w * (kL2M0 * d.z * d.z - kL2M0Offset);
+        sums[7] += w * d.x * d.z;
+        sums[8] += w * (d.x * d.x - d.y * d.y);
+    }
+
+    out->coeffs[0] += sh_l0m0() * sums[0];
+    out->coeffs[1] += -kL1 * sums[1];
+    out->coeffs[2] += kL1 * sums[2];
+    out->coeffs[3] += -kL1 * sums[3];
+    out->coeffs[4] += kL2 * sums[4];
+    out->coeffs[5] += -kL2 * sums[5];
+    out->coeffs[6] += sums[6];
+    out->coeffs[7] += -kL2 * sums[7];
+    out->coeffs[8] += kL2M2 * sums[8];
+}
+
 Vector3 TriangleBarycentric(const Triangle& triangle, const Vector3& point)
 {
     // Get barycentric coordinates through use of a modified Moller-Trumbore triangle intersection test:
@@ -26,34 +26,21 @@
 // Includes
 #include <shaders/lib/colour.lib.glsl>
 #include <shaders/lib/math.lib.glsl>
+#include <shaders/lib/irradiance.lib.glsl>
 
 // Ins n outs
 in vec3 norm;
-in vec3 sample_pos;
+in vec3 world_pos;
 
 out vec4 frag_colour;
 
 // Globals
-uniform sampler3D irradiance_volume_px;
-uniform sampler3D irradiance_volume_nx;
-uniform sampler3D irradiance_volume_py;
-uniform sampler3D irradiance_volume_ny;
-uniform sampler3D irradiance_volume_pz;
-uniform sampler3D irradiance_volume_nz;
 uniform float exposure;
 
 void main(void)
 {
     // Irradiance volume stored as ambient cube, reconstruct indirect lighting from data
-    vec3 ambient_cube[6] = vec3[6](
-        vec3(texture(irradiance_volume_px, sample_pos).rgb),
-        vec3(texture(irradiance_volume_nx, sample_pos).rgb),
-        vec3(texture(irradiance_volume_py, sample_pos).rgb),
-        vec3(texture(irradiance_volume_ny, sample_pos).rgb),
-        vec3(texture(irradiance_volume_pz, sample_pos).rgb),
-        vec3(texture(irradiance_volume_nz, sample_pos).rgb)
-    );
-    vec3 ambient_light = SampleAmbientCube(ambient_cube, norm);
+    vec3 ambient_light = SampleIrradianceVolume(world_pos, norm);
     // Visualize as exit irradiance, divide by pi
     ambient_light /= kPi;
     ambient_light = GammaEncode(FilmicTonemap(ambient_light * exposure));
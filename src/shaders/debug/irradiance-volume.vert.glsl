@@ -29,7 +29,7 @@ in vec3 input_norm;
 in vec3 input_grid_pos;
 
 out vec3 norm;
-out vec3 sample_pos;
+out vec3 world_pos;
 
 // Globals
 uniform mat4 world_matrix;
@@ -37,9 +37,9 @@ uniform mat4 vp_matrix;
 
 void main(void)
 {
-    gl_Position = (world_matrix * vec4(input_grid_pos, 1.0)) + vec4(input_pos, 0.0);
-    gl_Position = vp_matrix * gl_Position;
+    vec4 voxel_pos = world_matrix * vec4(input_grid_pos, 1.0);
+    gl_Position = vp_matrix * (voxel_pos + vec4(input_pos, 0.0));
 
     norm = input_norm;
-    sample_pos = input_grid_pos;
+    world_pos = voxel_pos.xyz;
 }
@@ -29,26 +29,41 @@
 #include <shaders/lib/probes.lib.glsl>
 
 // Workgroup size
-layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
 
 // Globals
-layout(rgba16f, binding = 0) writeonly uniform image3D irradiance_volume_px_out;
-layout(rgba16f, binding = 1) writeonly uniform image3D irradiance_volume_nx_out;
-layout(rgba16f, binding = 2) writeonly uniform image3D irradiance_volume_py_out;
-layout(rgba16f, binding = 3) writeonly uniform image3D irradiance_volume_ny_out;
-layout(rgba16f, binding = 4) writeonly uniform image3D irradiance_volume_pz_out;
-layout(rgba16f, binding = 5) writeonly uniform image3D irradiance_volume_nz_out;
-uniform mat4 world_matrix;
+// Formats are left to the textures so that they can be stored at full or half precision
+layout(binding = 0) writeonly uniform image3D irradiance_volume_px_out;
+layout(binding = 1) writeonly uniform image3D irradiance_volume_nx_out;
+layout(binding = 2) writeonly uniform image3D irradiance_volume_py_out;
+layout(binding = 3) writeonly uniform image3D irradiance_volume_ny_out;
+layout(binding = 4) writeonly uniform image3D irradiance_volume_pz_out;
+layout(binding = 5) writeonly uniform image3D irradiance_volume_nz_out;
+// Region of voxels being updated, in units of this level's voxels
+uniform vec3 update_min;
+uniform vec3 update_size;
+uniform float voxel_size;
+uniform int level;
+
+// Sizes copied from blons::pipeline
+const ivec3 kIrradianceVolumeSize = ivec3(32, 16, 32);
 
 void main(void)
 {
+    // Dispatches are rounded up to whole workgroups
+    if (any(greaterThanEqual(vec3(gl_GlobalInvocationID), update_size)))
+    {
+        return;
+    }
     // Figure out the world space coordinates of this irradiance sample
-    vec3 texels = vec3(gl_NumWorkGroups * gl_WorkGroupSize);
+    vec3 voxel = update_min + vec3(gl_GlobalInvocationID);
     // Offset by half a texel so our samples represent the same area they are stored at
-    vec3 sample_pos = (vec3(gl_GlobalInvocationID) + vec3(0.5f)) / texels;
-    vec4 world_pos = world_matrix * vec4(sample_pos, 1.0);
+    vec3 world_pos = (voxel + vec3(0.5f)) * voxel_size;
+    // Levels wrap around on themselves as the camera scrolls, and are stacked along the depth of the volume
+    ivec3 texel = ivec3(mod(voxel, vec3(kIrradianceVolumeSize)));
+    texel.z += level * kIrradianceVolumeSize.z;
 
-    ProbeWeight weights[4] = FindProbeWeights(world_pos.xyz);
+    ProbeWeight weights[4] = FindProbeWeights(world_pos);
     Probe probes[4] = { FindProbe(weights[0].id), FindProbe(weights[1].id), FindProbe(weights[2].id), FindProbe(weights[3].id) };
     float cube_coeffs[6][3];
     for (int face = 0; face < 6; face++)
@@ -62,28 +77,28 @@ void main(void)
         }
     }
 
-    imageStore(irradiance_volume_px_out, ivec3(gl_GlobalInvocationID), vec4(cube_coeffs[kPositiveX][0],
-                                                                            cube_coeffs[kPositiveX][1],
-                                                                            cube_coeffs[kPositiveX][2],
-                                                                            0.0));
-    imageStore(irradiance_volume_nx_out, ivec3(gl_GlobalInvocationID), vec4(cube_coeffs[kNegativeX][0],
-                                                                            cube_coeffs[kNegativeX][1],
-                                                                            cube_coeffs[kNegativeX][2],
-                                                                            0.0));
-    imageStore(irradiance_volume_py_out, ivec3(gl_GlobalInvocationID), vec4(cube_coeffs[kPositiveY][0],
-                                                                            cube_coeffs[kPositiveY][1],
-                                                                            cube_coeffs[kPositiveY][2],
-                                                                            0.0));
-    imageStore(irradiance_volume_ny_out, ivec3(gl_GlobalInvocationID), vec4(cube_coeffs[kNegativeY][0],
-                                                                            cube_coeffs[kNegativeY][1],
-                                                                            cube_coeffs[kNegativeY][2],
-                                                                            0.0));
-    imageStore(irradiance_volume_pz_out, ivec3(gl_GlobalInvocationID), vec4(cube_coeffs[kPositiveZ][0],
-                                                                            cube_coeffs[kPositiveZ][1],
-                                                                            cube_coeffs[kPositiveZ][2],
-                                                                            0.0));
-    imageStore(irradiance_volume_nz_out, ivec3(gl_GlobalInvocationID), vec4(cube_coeffs[kNegativeZ][0],
-                                                                            cube_coeffs[kNegativeZ][1],
-                                                                            cube_coeffs[kNegativeZ][2],
-                                                                            0.0));
+    imageStore(irradiance_volume_px_out, texel, vec4(cube_coeffs[kPositiveX][0],
+                                                     cube_coeffs[kPositiveX][1],
+                                                     cube_coeffs[kPositiveX][2],
+                                                     0.0));
+    imageStore(irradiance_volume_nx_out, texel, vec4(cube_coeffs[kNegativeX][0],
+                                                     cube_coeffs[kNegativeX][1],
+                                                     cube_coeffs[kNegativeX][2],
+                                                     0.0));
+    imageStore(irradiance_volume_py_out, texel, vec4(cube_coeffs[kPositiveY][0],
+                                                     cube_coeffs[kPositiveY][1],
+                                                     cube_coeffs[kPositiveY][2],
+                                                     0.0));
+    imageStore(irradiance_volume_ny_out, texel, vec4(cube_coeffs[kNegativeY][0],
+                                                     cube_coeffs[kNegativeY][1],
+                                                     cube_coeffs[kNegativeY][2],
+                                                     0.0));
+    imageStore(irradiance_volume_pz_out, texel, vec4(cube_coeffs[kPositiveZ][0],
+                                                     cube_coeffs[kPositiveZ][1],
+                                                     cube_coeffs[kPositiveZ][2],
+                                                     0.0));
+    imageStore(irradiance_volume_nz_out, texel, vec4(cube_coeffs[kNegativeZ][0],
+                                                     cube_coeffs[kNegativeZ][1],
+                                                     cube_coeffs[kNegativeZ][2],
+                                                     0.0));
 }
\ No newline at end of file
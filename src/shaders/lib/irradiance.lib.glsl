@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+
+// Sizes copied from blons::pipeline, each clipmap level is stacked along the depth of the textures
+const ivec3 kIrradianceVolumeSize = ivec3(32, 16, 32);
+const int kIrradianceClipmapLevels = 3;
+// Voxels at the edge of a level that are blended into the next level out, to hide the seam
+const float kIrradianceBlendVoxels = 2.0;
+
+// Globals
+uniform sampler3D irradiance_volume_px;
+uniform sampler3D irradiance_volume_nx;
+uniform sampler3D irradiance_volume_py;
+uniform sampler3D irradiance_volume_ny;
+uniform sampler3D irradiance_volume_pz;
+uniform sampler3D irradiance_volume_nz;
+// First voxel of each level, in units of that level's voxels
+uniform vec3 irradiance_clipmap_origins[kIrradianceClipmapLevels];
+// Voxel edge length of the finest level, doubling with each level after
+uniform float irradiance_voxel_size;
+
+// Position in voxels relative to the level's first voxel, with voxel centres on whole numbers.
+// Clamped so that it can always be filtered without reading from voxels outside of the level
+vec3 IrradianceLevelPos(vec3 world_pos, int level)
+{
+    vec3 voxel_pos = world_pos / (irradiance_voxel_size * exp2(float(level))) - 0.5;
+    return clamp(voxel_pos - irradiance_clipmap_origins[level], vec3(0.0), vec3(kIrradianceVolumeSize - 1));
+}
+
+// Each level wraps around on itself as the camera scrolls through it. Width and height are wrapped by
+// the sampler, but depth is shared between levels and has to be wrapped and filtered by hand
+vec3 SampleIrradianceFace(sampler3D volume, vec3 level_pos, int level)
+{
+    vec3 voxel_pos = level_pos + irradiance_clipmap_origins[level];
+    vec3 texels = vec3(kIrradianceVolumeSize.xy, kIrradianceVolumeSize.z * kIrradianceClipmapLevels);
+    float depth = float(kIrradianceVolumeSize.z);
+    float slice = floor(voxel_pos.z);
+    float level_start = float(level) * depth + 0.5;
+    vec2 uv = (voxel_pos.xy + 0.5) / texels.xy;
+    vec3 near_slice = texture(volume, vec3(uv, (mod(slice, depth) + level_start) / texels.z)).rgb;
+    vec3 far_slice = texture(volume, vec3(uv, (mod(slice + 1.0, depth) + level_start) / texels.z)).rgb;
+    return mix(near_slice, far_slice, voxel_pos.z - slice);
+}
+
+// Only fetches the 3 faces of the ambient cube that the normal can see
+vec3 SampleIrradianceLevel(vec3 level_pos, vec3 normal, int level)
+{
+    vec3 ambient_cube[6];
+    bvec3 is_positive = bvec3(normal.x > 0.0, normal.y > 0.0, normal.z > 0.0);
+    ivec3 cube_indices = ivec3(is_positive.x ? kPositiveX : kNegativeX,
+                               is_positive.y ? kPositiveY : kNegativeY,
+                               is_positive.z ? kPositiveZ : kNegativeZ);
+    ambient_cube[cube_indices.x] = is_positive.x ?
+                                       SampleIrradianceFace(irradiance_volume_px, level_pos, level) :
+                                       SampleIrradianceFace(irradiance_volume_nx, level_pos, level);
+    ambient_cube[cube_indices.y] = is_positive.y ?
+                                       SampleIrradianceFace(irradiance_volume_py, level_pos, level) :
+                                       SampleIrradianceFace(irradiance_volume_ny, level_pos, level);
+    ambient_cube[cube_indices.z] = is_positive.z ?
+                                       SampleIrradianceFace(irradiance_volume_pz, level_pos, level) :
+                                       SampleIrradianceFace(irradiance_volume_nz, level_pos, level);
+    return SampleAmbientCube(ambient_cube, normal);
+}
+
+// Irradiance arriving at a world space position from the hemisphere around a normal. Taken from the finest
+// clipmap level that contains the position, or the coarsest level clamped to its edge if none do
+vec3 SampleIrradianceVolume(vec3 world_pos, vec3 normal)
+{
+    for (int level = 0; level < kIrradianceClipmapLevels - 1; level++)
+    {
+        vec3 voxel_pos = world_pos / (irradiance_voxel_size * exp2(float(level))) - 0.5;
+        vec3 level_pos = voxel_pos - irradiance_clipmap_origins[level];
+        // Voxels to the nearest edge of the level that can still be filtered
+        vec3 edge = min(level_pos, vec3(kIrradianceVolumeSize - 1) - level_pos);
+        float edge_distance = min(edge.x, min(edge.y, edge.z));
+        if (edge_distance >= 0.0)
+        {
+            vec3 irradiance = SampleIrradianceLevel(level_pos, normal, level);
+            float blend = edge_distance / kIrradianceBlendVoxels;
+            if (blend < 1.0)
+            {
+                vec3 outer_irradiance = SampleIrradianceLevel(IrradianceLevelPos(world_pos, level + 1), normal, level + 1);
+                irradiance = mix(outer_irradiance, irradiance, blend);
+            }
+            return irradiance;
+        }
+    }
+    int last_level = kIrradianceClipmapLevels - 1;
+    return SampleIrradianceLevel(IrradianceLevelPos(world_pos, last_level), normal, last_level);
+}
\ No newline at end of file
@@ -28,6 +28,7 @@
 #include <shaders/lib/types.lib.glsl>
 #include <shaders/lib/math.lib.glsl>
 #include <shaders/lib/pbr.lib.glsl>
+#include <shaders/lib/irradiance.lib.glsl>
 #include <shaders/lib/sky.lib.glsl>
 
 // Ins n outs
@@ -37,7 +38,6 @@ out vec4 frag_colour;
 
 // Globals
 uniform mat4 inv_vp_matrix;
-uniform mat4 inv_irradiance_matrix;
 uniform sampler2D albedo;
 uniform sampler2D normal;
 uniform sampler2D depth;
@@ -46,12 +46,6 @@ uniform DirectionalLight sun;
 uniform SHColourCoeffs sh_sky_colour;
 uniform float sky_luminance;
 uniform float exposure;
-uniform sampler3D irradiance_volume_px;
-uniform sampler3D irradiance_volume_nx;
-uniform sampler3D irradiance_volume_py;
-uniform sampler3D irradiance_volume_ny;
-uniform sampler3D irradiance_volume_pz;
-uniform sampler3D irradiance_volume_nz;
 uniform sampler2D brdf_lut;
 uniform samplerCube local_specular_probe;
 uniform int max_mip_level;
@@ -64,26 +58,9 @@ uniform vec3 metalness;
 vec3 AmbientDiffuse(vec4 pos, vec3 normal, vec3 albedo, vec2 diffuse_brdf)
 {
     // Irradiance volume stored as ambient cube, reconstruct indirect lighting from data
-    vec4 irradiance_sample_pos = inv_irradiance_matrix * pos;
-    irradiance_sample_pos /= irradiance_sample_pos.w;
-    vec3 ambient_cube[6];
-    // We do a lot of ugly busywork to cut texture fetches down in half because these are dependent texture fetches and wow those are expensive!!!
     // TODO: Shove indirect lighting computation into a half-res bilaterally-upsampled buffer? Or possibly
-    // do this step during G-buffer creation as that would make for independent fetches. This currently adds 0.6ms
-    bvec3 is_positive = bvec3(normal.x > 0.0, normal.y > 0.0, normal.z > 0.0);
-    ivec3 cube_indices = ivec3(is_positive.x ? kPositiveX : kNegativeX,
-                               is_positive.y ? kPositiveY : kNegativeY,
-                               is_positive.z ? kPositiveZ : kNegativeZ);
-    ambient_cube[cube_indices.x] = is_positive.x ?
-                                       vec3(texture(irradiance_volume_px, irradiance_sample_pos.xyz).rgb) :
-                                       vec3(texture(irradiance_volume_nx, irradiance_sample_pos.xyz).rgb);
-    ambient_cube[cube_indices.y] = is_positive.y ?
-                                       vec3(texture(irradiance_volume_py, irradiance_sample_pos.xyz).rgb) :
-                                       vec3(texture(irradiance_volume_ny, irradiance_sample_pos.xyz).rgb);
-    ambient_cube[cube_indices.z] = is_positive.z ?
-                                       vec3(texture(irradiance_volume_pz, irradiance_sample_pos.xyz).rgb) :
-                                       vec3(texture(irradiance_volume_nz, irradiance_sample_pos.xyz).rgb);
-    vec3 ambient = SampleAmbientCube(ambient_cube, normal);
+    // do this step during G-buffer creation as that would make for independent fetches
+    vec3 ambient = SampleIrradianceVolume(pos.xyz / pos.w, normal);
     // Modulate by surface colour and diffuse term
     return ambient * albedo * (diffuse_brdf.x + albedo * diffuse_brdf.y);
 }
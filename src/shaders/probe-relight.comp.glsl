@@ -34,6 +34,8 @@ layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
 // Globals
 uniform SHColourCoeffs sh_sky_colour;
 uniform float sky_luminance;
+// First probe of the range being relit
+uniform int probe_offset;
 
 void ComputeAmbientCube(const uint probe_id)
 {
@@ -88,7 +90,7 @@ void ComputeAmbientCube(const uint probe_id)
 
 void main(void)
 {
-    uint probe_id = gl_GlobalInvocationID.x;
+    uint probe_id = gl_GlobalInvocationID.x + uint(probe_offset);
 
     // Sample the probe's sky vis coefficients
     // Sample brick radiance
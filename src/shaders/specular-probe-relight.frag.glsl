@@ -27,6 +27,7 @@
 #include <shaders/lib/types.lib.glsl>
 #include <shaders/lib/math.lib.glsl>
 #include <shaders/lib/shadow.lib.glsl>
+#include <shaders/lib/irradiance.lib.glsl>
 #include <shaders/lib/sky.lib.glsl>
 
 // Ins n outs
@@ -39,17 +40,10 @@ out vec4 ld_term_colour;
 uniform mat4 inv_direction_matrices[6];
 uniform mat4 inv_vp_matrices[6];
 uniform mat4 light_vp_matrix;
-uniform mat4 inv_irradiance_matrix;
 uniform samplerCube albedo;
 uniform samplerCube normal;
 uniform samplerCube depth;
 uniform sampler2D light_depth;
-uniform sampler3D irradiance_volume_px;
-uniform sampler3D irradiance_volume_nx;
-uniform sampler3D irradiance_volume_py;
-uniform sampler3D irradiance_volume_ny;
-uniform sampler3D irradiance_volume_pz;
-uniform sampler3D irradiance_volume_nz;
 uniform DirectionalLight sun;
 uniform SHColourCoeffs sh_sky_colour;
 uniform float sky_luminance;
@@ -61,24 +55,7 @@ uniform float sky_luminance;
 vec3 AmbientDiffuse(vec4 pos, vec3 normal)
 {
     // Irradiance volume stored as ambient cube, reconstruct indirect lighting from data
-    vec4 irradiance_sample_pos = inv_irradiance_matrix * pos;
-    irradiance_sample_pos /= irradiance_sample_pos.w;
-    vec3 ambient_cube[6];
-    // We do a lot of ugly busywork to cut texture fetches down in half because these are dependent texture fetches and wow those are expensive!!!
-    bvec3 is_positive = bvec3(normal.x > 0.0, normal.y > 0.0, normal.z > 0.0);
-    ivec3 cube_indices = ivec3(is_positive.x ? kPositiveX : kNegativeX,
-                               is_positive.y ? kPositiveY : kNegativeY,
-                               is_positive.z ? kPositiveZ : kNegativeZ);
-    ambient_cube[cube_indices.x] = is_positive.x ?
-                                       vec3(texture(irradiance_volume_px, irradiance_sample_pos.xyz).rgb) :
-                                       vec3(texture(irradiance_volume_nx, irradiance_sample_pos.xyz).rgb);
-    ambient_cube[cube_indices.y] = is_positive.y ?
-                                       vec3(texture(irradiance_volume_py, irradiance_sample_pos.xyz).rgb) :
-                                       vec3(texture(irradiance_volume_ny, irradiance_sample_pos.xyz).rgb);
-    ambient_cube[cube_indices.z] = is_positive.z ?
-                                       vec3(texture(irradiance_volume_pz, irradiance_sample_pos.xyz).rgb) :
-                                       vec3(texture(irradiance_volume_nz, irradiance_sample_pos.xyz).rgb);
-    return SampleAmbientCube(ambient_cube, normal);
+    return SampleIrradianceVolume(pos.xyz / pos.w, normal);
 }
 
 void main(void)
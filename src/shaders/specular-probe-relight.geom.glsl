@@ -34,8 +34,16 @@ in vec2 vertex_tex_coord[];
 
 out vec2 tex_coord;
 
+// Globals
+// Bit for each cubemap face to render, so faces can be relit a few at a time
+uniform int face_mask;
+
 void main(void)
 {
+    if ((face_mask & (1 << gl_InvocationID)) == 0)
+    {
+        return;
+    }
     gl_Layer = gl_InvocationID;
     for (int i = 0; i < gl_in.length(); i++)
     {
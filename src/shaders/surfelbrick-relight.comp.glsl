@@ -38,6 +38,8 @@ uniform sampler2D light_depth;
 uniform DirectionalLight sun;
 uniform vec3 metalness;
 uniform float gi_boost;
+// First brick of the range being relit
+uniform int brick_offset;
 
 vec3 ComputeSurfelLighting(inout Surfel surfel)
 {
@@ -87,7 +89,7 @@ vec3 ComputeSurfelLighting(inout Surfel surfel)
 void main(void)
 {
     // Read the entire brick from SSBO
-    uint brick_id = gl_GlobalInvocationID.x;
+    uint brick_id = gl_GlobalInvocationID.x + uint(brick_offset);
     SurfelBrick brick = FindProbeSurfelBrick(brick_id);
 
     vec3 radiance = vec3(0);
@@ -24,151 +24,991 @@
 #include <blons/system/job.h>
 
 // Includes
+#include <algorithm>
 #include <array>
 #include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <random>
 #include <thread>
+#include <vector>
 // Public Includes
+#include <blons/debug/console.h>
 #include <blons/debug/log.h>
 #include <blons/system/timer.h>
 
 namespace blons
 {
+namespace
+{
+// Worker threads are only created when the first Job is queued, so these can be set beforehand
+// 0 sizes the thread pool to the number of hardware threads
+auto const cvar_worker_threads = console::RegisterVariable("sys:worker-threads", 0);
+auto const cvar_worker_affinity = console::RegisterVariable("sys:worker-affinity", 0);
+// Maximum number of workers running background jobs at once, 0 leaves one worker free for everything else
+auto const cvar_background_workers = console::RegisterVariable("sys:background-workers", 0);
+} // namespace
+
+namespace // Stop gap platform isolation
+{
+// Quarantine this sucker
+#include <Windows.h>
+
+void PinThreadToCore(std::thread* thread, unsigned int core)
+{
+    // Affinity masks are limited to the first 64 logical processors
+    DWORD_PTR mask = static_cast<DWORD_PTR>(1) << (core % (sizeof(DWORD_PTR) * 8));
+    if (SetThreadAffinityMask(thread->native_handle(), mask) == 0)
+    {
+        log::Warn("Failed to pin worker thread to core %u\n", core);
+    }
+}
+} // namespace
+
 namespace internal
 {
-class ThreadedQueue
+// Lock-free work stealing deque based on:
+// Correct and Efficient Work-Stealing for Weak Memory Models (Le, Pop, Cohen, Nardelli 2013)
+// The owning thread pushes and pops from the bottom while any other thread can steal from the top
+class WorkStealingDeque
 {
 public:
-    ThreadedQueue() {}
-    ~ThreadedQueue() {}
+    WorkStealingDeque(std::size_t capacity) : top_(0), bottom_(0)
+    {
+        buffers_.emplace_back(new Buffer(capacity));
+        buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+    }
+    ~WorkStealingDeque() {}
 
+    // Only to be called by owning thread
     void push(Job* job)
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        jobs_.push(job);
-        // Unlock before notification because the transfer is
-        // instant and the waiting variable would just instantly
-        // relock otherwise
-        lock.unlock();
-        condition_variable_.notify_one();
+        auto bottom = bottom_.load(std::memory_order_relaxed);
+        auto top = top_.load(std::memory_order_acquire);
+        auto buffer = buffer_.load(std::memory_order_relaxed);
+        if (bottom - top > static_cast<int64_t>(buffer->capacity) - 1)
+        {
+            buffer = Grow(buffer, top, bottom);
+        }
+        buffer->set(bottom, job);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
     }
 
-    // pop blocks until there is a Job to return or nullptr
-    // if timeout is reached. A timeout of 0 blocks indefinitely
-    Job* pop(units::time::ms timeout)
+    // Only to be called by owning thread, returns nullptr when empty
+    Job* pop()
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        while (jobs_.empty())
+        auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        auto buffer = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto top = top_.load(std::memory_order_relaxed);
+
+        Job* job = nullptr;
+        if (top <= bottom)
         {
-            auto timed_out = condition_variable_.wait_for(lock, std::chrono::milliseconds(timeout));
-            if (timed_out == std::cv_status::timeout)
+            job = buffer->get(bottom);
+            // Last job in the deque, race against any stealing threads for it
+            if (top == bottom)
             {
-                return nullptr;
+                if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    job = nullptr;
+                }
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
             }
         }
-        auto job = jobs_.front();
-        jobs_.pop();
+        else
+        {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
         return job;
     }
 
+    // Safe to call from any thread, returns nullptr when empty or when losing a race to another thread
+    Job* steal()
+    {
+        auto top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto bottom = bottom_.load(std::memory_order_acquire);
+        if (top < bottom)
+        {
+            auto buffer = buffer_.load(std::memory_order_acquire);
+            Job* job = buffer->get(top);
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
+            return job;
+        }
+        return nullptr;
+    }
+
+    bool empty() const
+    {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Circular array of jobs, capacity must be a power of 2
+    struct Buffer
+    {
+        Buffer(std::size_t c) : capacity(c), jobs(new std::atomic<Job*>[c]) {}
+        Job* get(int64_t i) const { return jobs[static_cast<std::size_t>(i) & (capacity - 1)].load(std::memory_order_relaxed); }
+        void set(int64_t i, Job* job) { jobs[static_cast<std::size_t>(i) & (capacity - 1)].store(job, std::memory_order_relaxed); }
+
+        const std::size_t capacity;
+        std::unique_ptr<std::atomic<Job*>[]> jobs;
+    };
+
+    Buffer* Grow(Buffer* old_buffer, int64_t top, int64_t bottom)
+    {
+        buffers_.emplace_back(new Buffer(old_buffer->capacity * 2));
+        auto buffer = buffers_.back().get();
+        for (auto i = top; i < bottom; i++)
+        {
+            buffer->set(i, old_buffer->get(i));
+        }
+        buffer_.store(buffer, std::memory_order_release);
+        return buffer;
+    }
+
+    std::atomic<int64_t> top_;
+    std::atomic<int64_t> bottom_;
+    std::atomic<Buffer*> buffer_;
+    // Old buffers are kept alive until destruction since stealing threads may still be reading them
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+// Used by threads outside of the ThreadPool to submit jobs
+// Backed by a ring buffer that only grows, so pushing doesn't allocate once it has warmed up
+class ThreadedQueue
+{
+public:
+    ThreadedQueue(std::size_t capacity) : jobs_(capacity), head_(0), size_(0) {}
+    ~ThreadedQueue() {}
+
+    void push(Job* job)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size_ == jobs_.size())
+        {
+            std::vector<Job*> jobs(jobs_.size() * 2);
+            for (std::size_t i = 0; i < size_; i++)
+            {
+                jobs[i] = jobs_[(head_ + i) & (jobs_.size() - 1)];
+            }
+            jobs_.swap(jobs);
+            head_ = 0;
+        }
+        jobs_[(head_ + size_) & (jobs_.size() - 1)] = job;
+        size_++;
+    }
+
     // pop immediately returns a Job or nullptr if none are available
     Job* pop()
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (jobs_.empty())
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size_ == 0)
         {
             return nullptr;
         }
-        auto job = jobs_.front();
-        jobs_.pop();
+        auto job = jobs_[head_];
+        head_ = (head_ + 1) & (jobs_.size() - 1);
+        size_--;
         return job;
     }
 
+    // Removes the newest job matching the predicate, only looking through the last few jobs queued.
+    // Queued jobs can't be run or destroyed while the lock is held, so the predicate can safely inspect them
+    template <typename Predicate>
+    Job* pop_if(Predicate predicate, std::size_t search_limit)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const std::size_t mask = jobs_.size() - 1;
+        for (std::size_t i = 0; i < std::min(size_, search_limit); i++)
+        {
+            std::size_t index = size_ - 1 - i;
+            auto job = jobs_[(head_ + index) & mask];
+            if (predicate(job))
+            {
+                // Close the gap left behind
+                for (; index + 1 < size_; index++)
+                {
+                    jobs_[(head_ + index) & mask] = jobs_[(head_ + index + 1) & mask];
+                }
+                size_--;
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
 private:
-    std::queue<Job*> jobs_;
+    // Capacity must be a power of 2
+    std::vector<Job*> jobs_;
+    std::size_t head_;
+    std::size_t size_;
     std::mutex mutex_;
-    std::condition_variable condition_variable_;
 };
 
-static ThreadedQueue g_JobQueue;
+// Job record recycled by JobGroup
+struct PooledJob
+{
+    PooledJob() : job(nullptr), next(nullptr) {}
+
+    Job job;
+    PooledJob* next;
+};
+
+// Each thread keeps its own list of unused job records so they can be reused without locking
+class PooledJobList
+{
+public:
+    PooledJobList() : head_(nullptr) {}
+    ~PooledJobList()
+    {
+        while (head_ != nullptr)
+        {
+            auto next = head_->next;
+            delete head_;
+            head_ = next;
+        }
+    }
+
+    PooledJob* pop()
+    {
+        if (head_ == nullptr)
+        {
+            return new PooledJob();
+        }
+        auto record = head_;
+        head_ = record->next;
+        record->next = nullptr;
+        return record;
+    }
+
+    // Takes ownership of a whole linked list of records
+    void push(PooledJob* records)
+    {
+        while (records != nullptr)
+        {
+            auto next = records->next;
+            records->next = head_;
+            head_ = records;
+            records = next;
+        }
+    }
+
+private:
+    PooledJob* head_;
+};
+
+thread_local PooledJobList t_free_jobs;
 
 class ThreadPool
 {
 public:
-    static const int kWorkerThreads = 3;
+    static const std::size_t kDequeCapacity = 1024;
 
-    ThreadPool()
+    static const std::size_t kRelatedJobSearchLimit = 64;
+
+    ThreadPool(int worker_threads, bool pin_affinity, int background_workers)
+        : running_background_(0), outstanding_jobs_(0), work_epoch_(0), sleeping_workers_(0)
     {
+        unsigned int hardware_threads = std::thread::hardware_concurrency();
+        // Leave a hardware thread free for the main thread since it helps out while waiting on jobs
+        if (worker_threads <= 0)
+        {
+            worker_threads = std::max<int>(static_cast<int>(hardware_threads) - 1, 1);
+        }
+        // Keep a worker free of background work so high priority jobs can start right away
+        if (background_workers <= 0)
+        {
+            background_workers = std::max<int>(worker_threads - 1, 1);
+        }
+        background_workers_ = std::min<int>(background_workers, worker_threads);
+        for (auto& queue : injection_queues_)
+        {
+            queue.reset(new ThreadedQueue(kDequeCapacity));
+        }
+        worker_queues_.resize(worker_threads);
+        for (auto& queues : worker_queues_)
+        {
+            for (auto& queue : queues)
+            {
+                queue.reset(new WorkStealingDeque(kDequeCapacity));
+            }
+        }
         // Set running state to true
         run_.store(true);
         // Launch all worker threads
-        for (auto& worker : workers_)
+        workers_.resize(worker_threads);
+        for (int i = 0; i < worker_threads; i++)
         {
-            worker = std::thread([&]()
+            workers_[i] = std::thread([this, i]()
             {
-                // Query for jobs while ThreadPool is running
-                while (run_.load())
+                t_worker_pool = this;
+                t_worker_queues = &worker_queues_[i];
+                std::minstd_rand random(i + 1);
+                // Query for jobs while ThreadPool is running, and finish every job queued on it before exiting
+                while (true)
                 {
-                    // Use a timeout so we can query run_ every once in a while
-                    auto job = g_JobQueue.pop(100);
+                    // Read before searching so any job pushed after the search is guaranteed to wake us up
+                    auto epoch = work_epoch_.load();
+                    auto job = FindJob(&random);
                     if (job != nullptr)
                     {
-                        job->Run();
+                        RunJob(job, job->priority_ == Job::BACKGROUND);
+                    }
+                    else if (run_.load() || outstanding_jobs_.load() > 0)
+                    {
+                        WaitForWork(epoch);
+                    }
+                    else
+                    {
+                        break;
                     }
                 }
+                t_worker_queues = nullptr;
+                t_worker_pool = nullptr;
             });
+            if (pin_affinity && hardware_threads > 0)
+            {
+                // Offset by 1 so the main thread keeps core 0 to itself
+                PinThreadToCore(&workers_[i], (i + 1) % hardware_threads);
+            }
         }
+        log::Debug("Started %i worker threads (%i for background jobs)\n", worker_threads, background_workers_);
     }
+    // Workers only exit once every job queued on the pool has finished, including background jobs and
+    // anything those jobs queue on their own deques while shutting down, so nothing is left behind
     ~ThreadPool()
     {
-        run_.store(false);
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            run_.store(false);
+            // Also wakes workers that skipped background jobs while every slot was taken
+            work_epoch_++;
+            sleep_condition_.notify_all();
+        }
         for (auto& worker : workers_)
         {
             worker.join();
         }
     }
 
+    void push(Job* job)
+    {
+        outstanding_jobs_++;
+        // Worker threads own their queues and can push without contention
+        if (t_worker_queues != nullptr)
+        {
+            (*t_worker_queues)[job->priority_]->push(job);
+        }
+        else
+        {
+            injection_queues_[job->priority_]->push(job);
+        }
+        NotifyWork();
+    }
+
+    // Immediately returns a Job or nullptr if none are available. Every queue of a higher priority
+    // is checked before a lower one, so background work can only delay a high priority job by as
+    // long as it takes the worker to finish the job it was already running
+    Job* FindJob(std::minstd_rand* random)
+    {
+        for (int priority = Job::HIGH; priority <= Job::NORMAL; priority++)
+        {
+            auto job = FindJobOfPriority(random, static_cast<Job::Priority>(priority));
+            if (job != nullptr)
+            {
+                return job;
+            }
+        }
+        // Reserve a background slot before looking, so only a limited number of workers are ever tied up.
+        // The limit is lifted while shutting down so the remaining background jobs can be drained
+        if (running_background_.fetch_add(1) >= background_workers_ && run_.load())
+        {
+            running_background_--;
+            return nullptr;
+        }
+        auto job = FindJobOfPriority(random, Job::BACKGROUND);
+        if (job == nullptr)
+        {
+            running_background_--;
+        }
+        return job;
+    }
+
+    // Runs a job taken from this pool and gives back its background slot if it had one
+    void RunJob(Job* job, bool background_slot)
+    {
+        job->Run();
+        if (background_slot)
+        {
+            running_background_--;
+            // Sleeping workers may have skipped background jobs while every slot was taken
+            NotifyWork();
+        }
+        // Workers waiting to shut down can leave once the last queued job has finished
+        if (outstanding_jobs_.fetch_sub(1) == 1 && !run_.load())
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            sleep_condition_.notify_all();
+        }
+    }
+
+    // Immediately returns a job that helps finish the wanted job, or nullptr if none are available.
+    // Unrelated jobs are left alone so a waiting thread never gets stuck running something that takes
+    // longer than what it waits on. Background jobs are included, since nothing else may be free to
+    // run them while every background slot is taken
+    Job* FindRelatedJob(const Job* wanted)
+    {
+        for (int priority = Job::HIGH; priority < Job::kPriorityCount; priority++)
+        {
+            Job* job = nullptr;
+            if (t_worker_queues != nullptr)
+            {
+                job = PopRelatedJob((*t_worker_queues)[priority].get(), wanted);
+                if (job != nullptr)
+                {
+                    return job;
+                }
+            }
+            job = injection_queues_[priority]->pop_if([wanted](const Job* queued)
+            {
+                return IsRelatedJob(queued, wanted, 0);
+            }, kRelatedJobSearchLimit);
+            if (job != nullptr)
+            {
+                return job;
+            }
+            // Jobs in another worker's deque can only be inspected once stolen, as they may be run and
+            // destroyed at any moment. Unrelated ones are handed to the injection queue instead of being
+            // run, where they stay in reach of every worker
+            for (auto& queues : worker_queues_)
+            {
+                if (&queues == t_worker_queues)
+                {
+                    continue;
+                }
+                job = queues[priority]->steal();
+                if (job != nullptr)
+                {
+                    if (IsRelatedJob(job, wanted, 0))
+                    {
+                        return job;
+                    }
+                    injection_queues_[priority]->push(job);
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    int worker_count() const
+    {
+        return static_cast<int>(workers_.size());
+    }
+
+    using WorkerQueues = std::array<std::unique_ptr<WorkStealingDeque>, Job::kPriorityCount>;
+    // Pool and queues owned by the calling thread, if it's a worker
+    static thread_local ThreadPool* t_worker_pool;
+    static thread_local WorkerQueues* t_worker_queues;
+
 private:
+    // A job helps finish the wanted one if it is the wanted job, was queued while the wanted job was
+    // running, or has to finish before the wanted job can start. Must only be called on jobs that
+    // can't be run by another thread in the meantime
+    static bool IsRelatedJob(const Job* job, const Job* wanted, int depth)
+    {
+        if (job == wanted)
+        {
+            return true;
+        }
+        for (const auto& ancestor : job->ancestors_)
+        {
+            auto ancestor_job = ancestor.load(std::memory_order_relaxed);
+            if (ancestor_job == wanted)
+            {
+                return true;
+            }
+            if (ancestor_job == nullptr)
+            {
+                break;
+            }
+        }
+        // Dependents are kept alive by their pending dependencies, so they can be followed safely
+        if (depth < Job::kAncestorCount)
+        {
+            for (const auto& dependent : job->dependents_)
+            {
+                if (IsRelatedJob(dependent, wanted, depth + 1))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Only the owning thread can reach past the newest job in its deque. Unrelated jobs popped along
+    // the way are pushed back afterwards in their original order
+    Job* PopRelatedJob(WorkStealingDeque* deque, const Job* wanted)
+    {
+        std::array<Job*, kRelatedJobSearchLimit> skipped;
+        std::size_t skipped_count = 0;
+        Job* related = nullptr;
+        while (related == nullptr && skipped_count < skipped.size())
+        {
+            auto job = deque->pop();
+            if (job == nullptr)
+            {
+                break;
+            }
+            if (IsRelatedJob(job, wanted, 0))
+            {
+                related = job;
+            }
+            else
+            {
+                skipped[skipped_count++] = job;
+            }
+        }
+        while (skipped_count > 0)
+        {
+            deque->push(skipped[--skipped_count]);
+        }
+        return related;
+    }
+
+    Job* FindJobOfPriority(std::minstd_rand* random, Job::Priority priority)
+    {
+        Job* job = nullptr;
+        // Newest local jobs first as their data is likely still in cache
+        if (t_worker_queues != nullptr)
+        {
+            job = (*t_worker_queues)[priority]->pop();
+            if (job != nullptr)
+            {
+                return job;
+            }
+        }
+        // Then oldest jobs from outside the pool
+        job = injection_queues_[priority]->pop();
+        if (job != nullptr)
+        {
+            return job;
+        }
+        // Finally try stealing from other workers, starting at a random victim to spread contention
+        const std::size_t worker_count = worker_queues_.size();
+        auto start = (*random)();
+        for (std::size_t i = 0; i < worker_count; i++)
+        {
+            auto& victim = worker_queues_[(start + i) % worker_count];
+            if (&victim == t_worker_queues)
+            {
+                continue;
+            }
+            job = victim[priority]->steal();
+            if (job != nullptr)
+            {
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    // Workers sleep until the work epoch moves past the one they last searched in, which makes
+    // it impossible to miss a job pushed in between searching the queues and going to sleep
+    void WaitForWork(uint64_t epoch)
+    {
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        sleeping_workers_++;
+        sleep_condition_.wait(lock, [&]() { return work_epoch_.load() != epoch || (!run_.load() && outstanding_jobs_.load() == 0); });
+        sleeping_workers_--;
+    }
+
+    void NotifyWork()
+    {
+        work_epoch_++;
+        if (sleeping_workers_.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            sleep_condition_.notify_one();
+        }
+    }
+
     std::atomic<bool> run_;
-    std::array<std::thread, kWorkerThreads> workers_;
+    std::vector<std::thread> workers_;
+    std::vector<WorkerQueues> worker_queues_;
+    std::array<std::unique_ptr<ThreadedQueue>, Job::kPriorityCount> injection_queues_;
+    int background_workers_;
+    std::atomic<int> running_background_;
+    // Jobs pushed to the pool that haven't finished running yet
+    std::atomic<int> outstanding_jobs_;
+    std::atomic<uint64_t> work_epoch_;
+    std::atomic<int> sleeping_workers_;
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_condition_;
 };
 
-static ThreadPool g_ThreadPool;
+thread_local ThreadPool* ThreadPool::t_worker_pool = nullptr;
+thread_local ThreadPool::WorkerQueues* ThreadPool::t_worker_queues = nullptr;
+
+// Job currently being run by this thread, if any
+thread_local Job* t_current_job = nullptr;
+
+// Threads waiting on a job sleep on one of a fixed set of condition variables, picked by the job's
+// address, so jobs don't each need their own. Unrelated jobs sharing a spot only cause spurious wakeups
+struct ParkingSpot
+{
+    ParkingSpot() : waiters(0) {}
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<int> waiters;
+};
+const std::size_t kParkingSpotCount = 64;
+ParkingSpot g_parking_lot[kParkingSpotCount];
+
+ParkingSpot* parking_spot(const Job* job)
+{
+    return &g_parking_lot[(reinterpret_cast<std::uintptr_t>(job) / alignof(Job)) % kParkingSpotCount];
+}
+
+namespace
+{
+std::mutex g_thread_pool_mutex;
+std::unique_ptr<ThreadPool> g_thread_pool_storage;
+std::atomic<ThreadPool*> g_thread_pool(nullptr);
+} // namespace
+
+// Lazily builds the thread pool so it can be configured after static initialization. Worker threads
+// always get the pool they belong to, so their jobs are queued and waited on where they will be run
+ThreadPool* thread_pool()
+{
+    if (ThreadPool::t_worker_pool != nullptr)
+    {
+        return ThreadPool::t_worker_pool;
+    }
+    auto pool = g_thread_pool.load(std::memory_order_acquire);
+    if (pool == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(g_thread_pool_mutex);
+        if (g_thread_pool_storage == nullptr)
+        {
+            g_thread_pool_storage.reset(new ThreadPool(cvar_worker_threads->to<int>(), cvar_worker_affinity->to<int>() != 0,
+                                                       cvar_background_workers->to<int>()));
+        }
+        pool = g_thread_pool_storage.get();
+        g_thread_pool.store(pool, std::memory_order_release);
+    }
+    return pool;
+}
+
+void ParallelForRange(std::size_t begin, std::size_t end, std::size_t grain, const InlineFunction<void(std::size_t, std::size_t), Job::kFunctionCapacity>& func)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+    grain = std::max<std::size_t>(grain, 1);
+    const std::size_t chunk_count = (end - begin + grain - 1) / grain;
+    // Not worth waking anyone up for
+    if (chunk_count == 1)
+    {
+        func(begin, end);
+        return;
+    }
+
+    // Rather than queueing a job per chunk, a helper job is queued once per worker that could
+    // take part. Each helper, and the calling thread, then claims chunks off a shared counter
+    // until none are left. Threads that are busy elsewhere simply claim fewer chunks, which
+    // balances uneven workloads without paying for a queue operation per chunk
+    std::atomic<std::size_t> next_chunk(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr exception;
+    auto run_chunks = [&]()
+    {
+        std::size_t chunk;
+        while (!failed.load(std::memory_order_relaxed) && (chunk = next_chunk.fetch_add(1)) < chunk_count)
+        {
+            std::size_t chunk_begin = begin + chunk * grain;
+            try
+            {
+                func(chunk_begin, std::min(chunk_begin + grain, end));
+            }
+            catch (...)
+            {
+                // Only the first exception is kept, the rest of the range is abandoned
+                if (!failed.exchange(true))
+                {
+                    exception = std::current_exception();
+                }
+            }
+        }
+    };
+    // Helpers inherit the priority of whatever job is running the loop
+    Job helper(run_chunks, t_current_job != nullptr ? t_current_job->priority() : Job::NORMAL);
+    const std::size_t helper_count = std::min<std::size_t>(chunk_count - 1, thread_pool()->worker_count());
+    for (std::size_t i = 0; i < helper_count; i++)
+    {
+        helper.Enqueue();
+    }
+    run_chunks();
+    helper.Wait();
+
+    if (exception != nullptr)
+    {
+        std::rethrow_exception(exception);
+    }
+}
 } // namespace internal
 
-Job::Job(Function func)
+Job::Job(Function func, Priority priority)
 {
     func_ = func;
+    priority_ = priority;
     running_.store(0);
+    for (auto& ancestor : ancestors_)
+    {
+        ancestor.store(nullptr);
+    }
+    dependency_count_ = 0;
+    unreleased_count_.store(1);
+    failed_.store(false);
 }
 
 Job::~Job()
 {
-    Wait();
+    Join();
 }
 
 void Job::Enqueue()
 {
-    running_++;
-    internal::g_JobQueue.push(this);
+    // Remembered so threads waiting on any of the running jobs can help with this one
+    const Job* parent = internal::t_current_job;
+    ancestors_[0].store(parent, std::memory_order_relaxed);
+    for (int i = 1; i < kAncestorCount; i++)
+    {
+        ancestors_[i].store(parent != nullptr ? parent->ancestors_[i - 1].load(std::memory_order_relaxed) : nullptr,
+                            std::memory_order_relaxed);
+    }
+    // Errors from the last time this job finished are cleared on the next run
+    if (running_++ == 0 && failed_.load())
+    {
+        exception_ = nullptr;
+        failed_.store(false);
+    }
+    Release();
 }
 
 void Job::Wait()
 {
-    while(running_.load() > 0)
+    Join();
+    if (failed_.load())
     {
-        auto job = internal::g_JobQueue.pop();
+        std::rethrow_exception(exception_);
+    }
+}
+
+void Job::Join()
+{
+    while (running_.load() > 0)
+    {
+        // Help out with anything that brings this job closer to completion
+        auto pool = internal::thread_pool();
+        auto job = pool->FindRelatedJob(this);
         if (job != nullptr)
         {
-            job->Run();
+            pool->RunJob(job, false);
+            continue;
         }
+        // Then sleep until the last invocation finishes
+        auto spot = internal::parking_spot(this);
+        std::unique_lock<std::mutex> lock(spot->mutex);
+        spot->waiters++;
+        spot->condition.wait(lock, [this]() { return running_.load() == 0; });
+        spot->waiters--;
+    }
+}
+
+void Job::AddDependency(Job* dependency)
+{
+    dependency->dependents_.push_back(this);
+    dependency_count_++;
+    unreleased_count_++;
+}
+
+void Job::Then(Job* continuation)
+{
+    continuation->AddDependency(this);
+}
+
+void Job::ConfigureWorkers(int worker_threads, bool pin_affinity)
+{
+    // A worker would end up waiting on its own pool to shut down
+    if (internal::ThreadPool::t_worker_pool != nullptr)
+    {
+        log::Warn("Worker threads can't be reconfigured from inside a job\n");
+        return;
     }
+    std::lock_guard<std::mutex> lock(internal::g_thread_pool_mutex);
+    // The old pool is fully drained before the new one is published, so no job can be left waiting on
+    // work queued in a pool that has stopped running. Its workers keep queueing into it while draining
+    internal::g_thread_pool.store(nullptr, std::memory_order_release);
+    internal::g_thread_pool_storage.reset();
+    internal::g_thread_pool_storage.reset(new internal::ThreadPool(worker_threads, pin_affinity, cvar_background_workers->to<int>()));
+    internal::g_thread_pool.store(internal::g_thread_pool_storage.get(), std::memory_order_release);
+}
+
+int Job::worker_count()
+{
+    return internal::thread_pool()->worker_count();
+}
+
+Job::Priority Job::priority() const
+{
+    return priority_;
 }
 
 void Job::Run()
 {
-    func_();
-    running_--;
+    auto parent_job = internal::t_current_job;
+    internal::t_current_job = this;
+    // Exceptions can't be allowed to unwind a worker thread, so they're handed to Wait() instead
+    try
+    {
+        func_();
+    }
+    catch (...)
+    {
+        // Only the first exception is kept if several invocations fail
+        if (!failed_.exchange(true))
+        {
+            exception_ = std::current_exception();
+        }
+    }
+    internal::t_current_job = parent_job;
+    // Dependents are released before we're marked as finished so this job
+    // can't be destroyed while its dependents are still being touched
+    for (auto& dependent : dependents_)
+    {
+        dependent->Release();
+    }
+    // The job may be destroyed the moment it's marked finished, so find its parking spot beforehand
+    auto spot = internal::parking_spot(this);
+    if (running_.fetch_sub(1) == 1 && spot->waiters.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(spot->mutex);
+        spot->condition.notify_all();
+    }
+}
+
+void Job::Release()
+{
+    // Jobs without dependencies can be enqueued any number of times concurrently
+    if (dependency_count_ == 0)
+    {
+        internal::thread_pool()->push(this);
+    }
+    else if (unreleased_count_.fetch_sub(1) == 1)
+    {
+        // Nobody else touches the counter until the next enqueue, so rearm it before queueing
+        unreleased_count_.store(dependency_count_ + 1);
+        internal::thread_pool()->push(this);
+    }
+}
+
+JobGroup::~JobGroup()
+{
+    for (auto record = jobs_; record != nullptr; record = record->next)
+    {
+        record->job.Join();
+    }
+    internal::t_free_jobs.push(jobs_);
+}
+
+void JobGroup::Enqueue(Job::Function func, Job::Priority priority)
+{
+    auto record = internal::t_free_jobs.pop();
+    record->job.func_ = std::move(func);
+    record->job.priority_ = priority;
+    record->next = jobs_;
+    jobs_ = record;
+    record->job.Enqueue();
+}
+
+void JobGroup::Wait()
+{
+    std::exception_ptr exception;
+    for (auto record = jobs_; record != nullptr; record = record->next)
+    {
+        try
+        {
+            record->job.Wait();
+        }
+        catch (...)
+        {
+            if (exception == nullptr)
+            {
+                exception = std::current_exception();
+            }
+        }
+    }
+    internal::t_free_jobs.push(jobs_);
+    jobs_ = nullptr;
+
+    if (exception != nullptr)
+    {
+        std::rethrow_exception(exception);
+    }
+}
+
+void WhenAll(const std::vector<Job*>& jobs, Job* continuation)
+{
+    for (auto& job : jobs)
+    {
+        continuation->AddDependency(job);
+    }
+}
+
+WhenAny::WhenAny(const std::vector<Job*>& jobs, Job* continuation)
+{
+    triggered_.store(false);
+    first_ = 0;
+    // The continuation is held back by a single dependency, which the first trigger to run releases
+    continuation->dependency_count_++;
+    continuation->unreleased_count_++;
+    for (std::size_t i = 0; i < jobs.size(); i++)
+    {
+        triggers_.emplace_back(new Job([this, i, continuation]()
+        {
+            if (!triggered_.exchange(true))
+            {
+                first_ = i;
+                continuation->Release();
+            }
+        }, continuation->priority()));
+        triggers_.back()->AddDependency(jobs[i]);
+        triggers_.back()->Enqueue();
+    }
+}
+
+WhenAny::~WhenAny()
+{
+    for (auto& trigger : triggers_)
+    {
+        trigger->Join();
+    }
+}
+
+std::size_t WhenAny::first() const
+{
+    return first_;
 }
 } // namespace blons
\ No newline at end of file
@@ -0,0 +1,1273 @@
+////////////////////////////////////////////////////////////////////////////////
+// blonstech
+// Copyright(c) 2017 Dominic Bowden
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <blons/blons.h>
+
+// Includes
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+// Local Includes
+#include <src/graphics/pipeline/stage/lightsector/probenetworksearch.h>
+#include <src/graphics/pipeline/stage/lightsector/probeplacer.h>
+#include <src/graphics/pipeline/stage/lightsector/radiancetransferbaker.h>
+#include <src/graphics/pipeline/stage/lightsector/radiancetransferrelighter.h>
+
+namespace blons
+{
+namespace pipeline
+{
+namespace stage
+{
+namespace temp
+{
+// Defined alongside the other placeholder probe sets in lightsector.cpp
+void GenerateRandomProbes(std::vector<LightSector::Probe>* probes, int num_probes, float scale);
+} // namespace temp
+} // namespace stage
+} // namespace pipeline
+} // namespace blons
+
+namespace
+{
+// Counts every global heap allocation made by the process, for bench:job-alloc
+std::atomic<std::size_t> g_allocation_count(0);
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    g_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* memory = malloc(size > 0 ? size : 1);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+namespace
+{
+// Enqueues (producers * jobs_per_producer) empty jobs from producers running concurrently on the
+// worker pool, plus the calling thread, to measure how well the job queues hold up under contention
+void BenchmarkJobContention(int producers, int jobs_per_producer)
+{
+    std::atomic<int> completed(0);
+    blons::Job tiny_job([&]() { completed.fetch_add(1, std::memory_order_relaxed); });
+    auto produce = [&]()
+    {
+        for (int i = 0; i < jobs_per_producer; i++)
+        {
+            tiny_job.Enqueue();
+        }
+    };
+
+    std::vector<std::unique_ptr<blons::Job>> producer_jobs;
+    for (int i = 0; i < producers; i++)
+    {
+        producer_jobs.emplace_back(new blons::Job(produce));
+    }
+
+    blons::Timer timer;
+    for (auto& job : producer_jobs)
+    {
+        job->Enqueue();
+    }
+    // The calling thread acts as an extra producer from outside of the pool
+    produce();
+    for (auto& job : producer_jobs)
+    {
+        job->Wait();
+    }
+    tiny_job.Wait();
+    auto elapsed = timer.us();
+
+    double jobs_per_second = static_cast<double>(completed.load()) / (static_cast<double>(elapsed) / 1e6);
+    blons::console::out("%i jobs from %i producers in %ims (%.2f million jobs/sec)\n",
+                        completed.load(), producers + 1, blons::units::time::us_to_ms(elapsed), jobs_per_second / 1e6);
+}
+
+// Runs the same ParallelFor and ParallelReduce workloads with 1 to max_workers worker threads
+// and prints the speedup relative to running on the calling thread alone
+void BenchmarkParallelFor(int element_count, int max_workers)
+{
+    const std::size_t kGrain = 4096;
+    std::vector<float> values(element_count);
+    auto run_for = [&]()
+    {
+        blons::ParallelFor(0, values.size(), kGrain, [&](std::size_t i)
+        {
+            float x = static_cast<float>(i);
+            values[i] = std::sqrt(x) * std::sin(x) + std::cos(x * 0.5f);
+        });
+    };
+    auto run_reduce = [&]()
+    {
+        return blons::ParallelReduce(0, values.size(), kGrain, 0.0,
+                                     [&](std::size_t i) { return static_cast<double>(values[i]); },
+                                     [](double a, double b) { return a + b; });
+    };
+
+    // Baseline without any helper threads
+    blons::Timer timer;
+    for (std::size_t i = 0; i < values.size(); i++)
+    {
+        float x = static_cast<float>(i);
+        values[i] = std::sqrt(x) * std::sin(x) + std::cos(x * 0.5f);
+    }
+    auto serial_for = timer.us();
+    timer.Start();
+    double serial_sum = 0.0;
+    for (const auto& v : values)
+    {
+        serial_sum += v;
+    }
+    auto serial_reduce = timer.us();
+    blons::console::out("%i elements, serial: for %ius, reduce %ius\n", element_count, serial_for, serial_reduce);
+
+    for (int workers = 1; workers <= max_workers; workers++)
+    {
+        blons::Job::ConfigureWorkers(workers, false);
+        // Warm up the workers so thread startup isn't measured
+        run_for();
+        timer.Start();
+        run_for();
+        auto parallel_for = timer.us();
+        timer.Start();
+        double sum = run_reduce();
+        auto parallel_reduce = timer.us();
+        blons::console::out("%2i workers: for %6ius (%.2fx), reduce %6ius (%.2fx)%s\n", workers,
+                            parallel_for, static_cast<double>(serial_for) / std::max<double>(static_cast<double>(parallel_for), 1.0),
+                            parallel_reduce, static_cast<double>(serial_reduce) / std::max<double>(static_cast<double>(parallel_reduce), 1.0),
+                            std::abs(sum - serial_sum) > std::abs(serial_sum) * 1e-9 ? " [sum mismatch]" : "");
+    }
+    // Restore the configured pool
+    blons::Job::ConfigureWorkers(blons::console::var<int>("sys:worker-threads"), blons::console::var<int>("sys:worker-affinity") != 0);
+}
+
+// Checks JobFuture results, exceptions rethrown through get(), and which job WhenAny reports finishing first
+void TestJobFutures(int future_count)
+{
+    int failures = 0;
+
+    // Values, gathered by a continuation that waits on all of them
+    std::vector<std::unique_ptr<blons::JobFuture<int>>> squares;
+    std::vector<blons::Job*> square_jobs;
+    for (int i = 0; i < future_count; i++)
+    {
+        squares.emplace_back(new blons::JobFuture<int>([i]() { return i * i; }));
+        square_jobs.push_back(squares.back().get());
+    }
+    blons::JobFuture<int> total([&squares]()
+    {
+        int sum = 0;
+        for (auto& square : squares)
+        {
+            sum += square->get();
+        }
+        return sum;
+    });
+    blons::WhenAll(square_jobs, &total);
+    total.Enqueue();
+    for (auto& square : squares)
+    {
+        square->Enqueue();
+    }
+    int expected_total = 0;
+    for (int i = 0; i < future_count; i++)
+    {
+        expected_total += i * i;
+    }
+    if (total.get() != expected_total)
+    {
+        blons::log::Warn("WhenAll sum was %i, expected %i\n", total.get(), expected_total);
+        failures++;
+    }
+    for (int i = 0; i < future_count; i++)
+    {
+        if (squares[i]->get() != i * i)
+        {
+            blons::log::Warn("Future %i returned %i, expected %i\n", i, squares[i]->get(), i * i);
+            failures++;
+        }
+    }
+
+    // Exceptions thrown by the job come back out of get(), for futures with and without a value
+    const char* kError = "Job future failed on purpose";
+    blons::JobFuture<int> failed_value([kError]() -> int { throw kError; });
+    blons::JobFuture<void> failed_void([kError]() { throw kError; });
+    std::array<blons::Job*, 2> failing_jobs = { &failed_value, &failed_void };
+    for (auto& job : failing_jobs)
+    {
+        job->Enqueue();
+    }
+    std::array<bool, 2> caught = { false, false };
+    try
+    {
+        failed_value.get();
+    }
+    catch (const char* error)
+    {
+        caught[0] = strcmp(error, kError) == 0;
+    }
+    try
+    {
+        failed_void.get();
+    }
+    catch (const char* error)
+    {
+        caught[1] = strcmp(error, kError) == 0;
+    }
+    if (!caught[0] || !caught[1])
+    {
+        blons::log::Warn("Exception wasn't rethrown from JobFuture<%s>::get()\n", caught[0] ? "void" : "int");
+        failures++;
+    }
+
+    // Only one racer is queued until the continuation has run, so it has to be the one reported
+    const std::size_t kWinner = future_count / 2;
+    std::vector<std::unique_ptr<blons::JobFuture<void>>> racers;
+    std::vector<blons::Job*> racer_jobs;
+    for (int i = 0; i < future_count; i++)
+    {
+        racers.emplace_back(new blons::JobFuture<void>([]() {}));
+        racer_jobs.push_back(racers.back().get());
+    }
+    blons::JobFuture<void> finish_line([]() {});
+    {
+        blons::WhenAny any(racer_jobs, &finish_line);
+        finish_line.Enqueue();
+        racers[kWinner]->Enqueue();
+        finish_line.get();
+        if (any.first() != kWinner)
+        {
+            blons::log::Warn("WhenAny reported job %i finishing first, expected %i\n", static_cast<int>(any.first()), static_cast<int>(kWinner));
+            failures++;
+        }
+        // Every racer has to run before the WhenAny can be destroyed
+        for (std::size_t i = 0; i < racers.size(); i++)
+        {
+            if (i != kWinner)
+            {
+                racers[i]->Enqueue();
+            }
+        }
+    }
+
+    blons::console::out("Job futures: %i checks failed\n", failures);
+}
+
+// Fans out job_count small jobs and counts the heap allocations made while submitting and running them
+void BenchmarkJobAllocations(int job_count)
+{
+    std::atomic<int> completed(0);
+    std::array<float, 8> payload = { 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f };
+    auto task = [&completed, payload]()
+    {
+        if (payload[0] > 0.0f)
+        {
+            completed.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+    // Make sure the worker threads are up before we start counting
+    blons::Job::worker_count();
+
+    // One heap allocated Job per task, as you'd write it without pooling
+    auto allocations = g_allocation_count.load();
+    blons::Timer timer;
+    {
+        std::vector<std::unique_ptr<blons::Job>> jobs;
+        jobs.reserve(job_count);
+        for (int i = 0; i < job_count; i++)
+        {
+            jobs.emplace_back(new blons::Job(task));
+            jobs.back()->Enqueue();
+        }
+        for (auto& job : jobs)
+        {
+            job->Wait();
+        }
+    }
+    auto elapsed = timer.us();
+    allocations = g_allocation_count.load() - allocations;
+    blons::console::out("new Job:  %i jobs in %ims, %i allocations (%.3f per job)\n", job_count,
+                        blons::units::time::us_to_ms(elapsed), static_cast<int>(allocations), static_cast<double>(allocations) / job_count);
+
+    // Pooled job records, the first pass fills up the free lists
+    for (int pass = 0; pass < 2; pass++)
+    {
+        allocations = g_allocation_count.load();
+        timer.Start();
+        blons::JobGroup group;
+        for (int i = 0; i < job_count; i++)
+        {
+            group.Enqueue(task);
+        }
+        group.Wait();
+        elapsed = timer.us();
+        allocations = g_allocation_count.load() - allocations;
+        blons::console::out("JobGroup: %i jobs in %ims, %i allocations (%.3f per job)%s\n", job_count,
+                            blons::units::time::us_to_ms(elapsed), static_cast<int>(allocations), static_cast<double>(allocations) / job_count,
+                            pass == 0 ? " [cold]" : "");
+    }
+    if (completed.load() != job_count * 3)
+    {
+        blons::log::Warn("Only %i of %i jobs completed\n", completed.load(), job_count * 3);
+    }
+}
+
+// Saturates the pool with background jobs and measures how long frame jobs of each other priority sit
+// in the queue before starting. High priority jobs should never wait much longer than one background job
+void BenchmarkJobLatency(int frames, int background_job_ms)
+{
+    std::atomic<bool> running(true);
+    std::vector<std::unique_ptr<blons::Job>> background_jobs(blons::Job::worker_count() * 4);
+    for (std::size_t i = 0; i < background_jobs.size(); i++)
+    {
+        // Each background job requeues itself when done, keeping the pool busy for the length of the test
+        background_jobs[i].reset(new blons::Job([&running, &background_jobs, i, background_job_ms]()
+        {
+            blons::Timer busy;
+            while (busy.ms() < static_cast<blons::units::time::ms>(background_job_ms))
+            {
+            }
+            if (running.load())
+            {
+                background_jobs[i]->Enqueue();
+            }
+        }, blons::Job::BACKGROUND));
+    }
+    for (auto& job : background_jobs)
+    {
+        job->Enqueue();
+    }
+
+    const char* priority_names[] = { "high", "normal" };
+    for (int priority = blons::Job::HIGH; priority <= blons::Job::NORMAL; priority++)
+    {
+        blons::Timer queued;
+        std::atomic<bool> started(false);
+        blons::units::time::us latency = 0;
+        blons::Job frame_job([&queued, &latency, &started]()
+        {
+            latency = queued.us();
+            started.store(true, std::memory_order_release);
+        }, static_cast<blons::Job::Priority>(priority));
+        blons::units::time::us total_latency = 0;
+        blons::units::time::us max_latency = 0;
+        for (int i = 0; i < frames; i++)
+        {
+            started.store(false, std::memory_order_relaxed);
+            queued.Start();
+            frame_job.Enqueue();
+            // Waiting straight away would run the job on this thread, so spin until a worker picks it up instead
+            while (!started.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            frame_job.Wait();
+            total_latency += latency;
+            max_latency = std::max(max_latency, latency);
+        }
+        blons::console::out("%6s priority: %i frame jobs, average latency %ius, max latency %ius\n", priority_names[priority], frames,
+                            static_cast<int>(total_latency / std::max<int>(frames, 1)), static_cast<int>(max_latency));
+    }
+    running.store(false);
+    for (auto& job : background_jobs)
+    {
+        job->Wait();
+    }
+    blons::console::out("%i background jobs of %ims each on %i workers\n", static_cast<int>(background_jobs.size()),
+                        background_job_ms, blons::Job::worker_count());
+}
+
+// Reference copy of the hash map surfel clustering that RadianceTransferBaker used before sorting by key,
+// kept to check the sorted path against. Only produces surfels and the brick weight totals of each probe
+void ClusterSurfelsWithHashMap(const std::vector<blons::pipeline::stage::RadianceTransferBaker::SurfelSample>& samples,
+                               const std::vector<blons::pipeline::stage::LightSector::Probe>& probes,
+                               std::vector<blons::pipeline::stage::LightSector::Surfel>* surfels,
+                               std::size_t* brick_count, std::vector<double>* probe_weight_totals)
+{
+    using blons::pipeline::stage::LightSector;
+    struct SurfelIndex
+    {
+        int x, y, z;
+        blons::AxisAlignedNormal direction;
+        struct HashFunc { unsigned int operator()(const SurfelIndex& s) const { return blons::FastHash(&s, sizeof(SurfelIndex)); } };
+        struct CompFunc { bool operator()(const SurfelIndex& a, const SurfelIndex& b) const { return std::tie(a.x, a.y, a.z, a.direction) == std::tie(b.x, b.y, b.z, b.direction); } };
+    };
+    struct BakeSurfel
+    {
+        LightSector::Surfel surfel;
+        std::vector<std::size_t> sample_ids;
+    };
+    std::unordered_map<SurfelIndex, BakeSurfel, SurfelIndex::HashFunc, SurfelIndex::CompFunc> surfel_data;
+    surfel_data.reserve(samples.size());
+    for (std::size_t i = 0; i < samples.size(); i++)
+    {
+        const auto& sample = samples[i];
+        SurfelIndex search_index;
+        search_index.x = static_cast<int>(sample.surfel.pos.x / blons::pipeline::kSurfelSize) + (sample.surfel.pos.x >= 0.0 ? 0 : -1);
+        search_index.y = static_cast<int>(sample.surfel.pos.y / blons::pipeline::kSurfelSize) + (sample.surfel.pos.y >= 0.0 ? 0 : -1);
+        search_index.z = static_cast<int>(sample.surfel.pos.z / blons::pipeline::kSurfelSize) + (sample.surfel.pos.z >= 0.0 ? 0 : -1);
+        search_index.direction = blons::FindGreatestAxis(sample.surfel.normal);
+        auto it = surfel_data.find(search_index);
+        if (it != surfel_data.end())
+        {
+            it->second.surfel.pos += sample.surfel.pos;
+            it->second.surfel.normal += sample.surfel.normal;
+            it->second.surfel.albedo += sample.surfel.albedo;
+            it->second.sample_ids.push_back(i);
+        }
+        else
+        {
+            surfel_data[search_index] = { sample.surfel, { i } };
+        }
+    }
+
+    std::unordered_map<SurfelIndex, std::vector<std::size_t>, SurfelIndex::HashFunc, SurfelIndex::CompFunc> brick_data;
+    for (auto& surfel_it : surfel_data)
+    {
+        auto& s = surfel_it.second;
+        auto sample_count = static_cast<blons::units::world>(s.sample_ids.size());
+        s.surfel.pos /= sample_count;
+        s.surfel.normal /= sample_count;
+        s.surfel.normal = blons::VectorNormalize(s.surfel.normal);
+        s.surfel.albedo /= sample_count;
+        for (const auto& sample_id : s.sample_ids)
+        {
+            int parent_probe = samples[sample_id].parent_probe;
+            if (s.surfel.nearest_probe_id != parent_probe &&
+                blons::VectorLength(probes[parent_probe].pos - s.surfel.pos) < blons::VectorLength(probes[s.surfel.nearest_probe_id].pos - s.surfel.pos))
+            {
+                s.surfel.nearest_probe_id = parent_probe;
+            }
+        }
+        surfels->push_back(s.surfel);
+
+        SurfelIndex search_index = surfel_it.first;
+        search_index.x = (search_index.x + (search_index.x >= 0 ? 0 : -blons::pipeline::kSurfelsPerBrick + 1)) / blons::pipeline::kSurfelsPerBrick;
+        search_index.y = (search_index.y + (search_index.y >= 0 ? 0 : -blons::pipeline::kSurfelsPerBrick + 1)) / blons::pipeline::kSurfelsPerBrick;
+        search_index.z = (search_index.z + (search_index.z >= 0 ? 0 : -blons::pipeline::kSurfelsPerBrick + 1)) / blons::pipeline::kSurfelsPerBrick;
+        auto& brick_samples = brick_data[search_index];
+        brick_samples.insert(brick_samples.end(), s.sample_ids.begin(), s.sample_ids.end());
+    }
+    *brick_count = brick_data.size();
+
+    probe_weight_totals->assign(probes.size(), 0.0);
+    for (const auto& brick : brick_data)
+    {
+        for (const auto& sample_id : brick.second)
+        {
+            const auto& sample = samples[sample_id];
+            for (const auto& weight : sample.parent_probe_weights)
+            {
+                (*probe_weight_totals)[sample.parent_probe] += weight;
+            }
+        }
+    }
+}
+
+// Clusters sample_count random surfel samples gathered by random probes, timing the sorted clustering
+// against the old hash map clustering and checking that both produce the same surfels
+void BenchmarkSurfelClustering(int sample_count)
+{
+    using blons::pipeline::stage::LightSector;
+    using blons::pipeline::stage::RadianceTransferBaker;
+    const int kProbeCount = 256;
+    const float kSceneScale = 50.0f;
+
+    std::mt19937 random_algorithm;
+    random_algorithm.seed(1);
+    std::uniform_real_distribution<float> position_distribution(-kSceneScale, kSceneScale);
+    std::uniform_real_distribution<float> unit_distribution(-1.0f, 1.0f);
+    std::vector<LightSector::Probe> probes;
+    for (int i = 0; i < kProbeCount; i++)
+    {
+        LightSector::Probe probe { i, blons::Vector3(position_distribution(random_algorithm),
+                                                     position_distribution(random_algorithm),
+                                                     position_distribution(random_algorithm)) };
+        probe.brick_factor_range_start = 0;
+        probe.brick_factor_count = 0;
+        probes.push_back(probe);
+    }
+    // Samples are scattered around their parent probe the way environment map texels would be
+    std::vector<RadianceTransferBaker::SurfelSample> samples(sample_count);
+    for (auto& sample : samples)
+    {
+        sample.parent_probe = random_algorithm() % kProbeCount;
+        auto direction = blons::VectorNormalize(blons::Vector3(unit_distribution(random_algorithm),
+                                                               unit_distribution(random_algorithm),
+                                                               unit_distribution(random_algorithm)));
+        sample.surfel.nearest_probe_id = sample.parent_probe;
+        sample.surfel.pos = probes[sample.parent_probe].pos + direction * (unit_distribution(random_algorithm) + 1.0f) * 8.0f;
+        sample.surfel.normal = direction * -1.0f;
+        sample.surfel.albedo = blons::Vector3(0.5f);
+        sample.surfel.radiance = blons::Vector3(0.0f);
+        for (auto& weight : sample.parent_probe_weights)
+        {
+            weight = unit_distribution(random_algorithm) + 1.0f;
+        }
+    }
+
+    auto sorted_probes = probes;
+    std::vector<LightSector::Surfel> sorted_surfels;
+    std::vector<LightSector::SurfelBrick> sorted_bricks;
+    std::vector<LightSector::SurfelBrickFactor> sorted_brick_factors;
+    blons::Timer timer;
+    RadianceTransferBaker::ClusterSurfelSamples(samples, &sorted_probes, &sorted_surfels, &sorted_bricks, &sorted_brick_factors);
+    auto sorted_time = timer.ms();
+
+    std::vector<LightSector::Surfel> hashed_surfels;
+    std::size_t hashed_brick_count;
+    std::vector<double> hashed_weight_totals;
+    timer.Start();
+    ClusterSurfelsWithHashMap(samples, probes, &hashed_surfels, &hashed_brick_count, &hashed_weight_totals);
+    auto hashed_time = timer.ms();
+
+    // The baker sums each probe's samples before adding probes together, while the hash map sums samples in order,
+    // so surfels should only differ by rounding once put in the same order
+    auto surfel_less = [](const LightSector::Surfel& a, const LightSector::Surfel& b)
+    {
+        return std::tie(a.pos.x, a.pos.y, a.pos.z, a.normal.x, a.normal.y, a.normal.z, a.nearest_probe_id) <
+               std::tie(b.pos.x, b.pos.y, b.pos.z, b.normal.x, b.normal.y, b.normal.z, b.nearest_probe_id);
+    };
+    auto surfel_equal = [](const LightSector::Surfel& a, const LightSector::Surfel& b)
+    {
+        const float kTolerance = 1e-4f;
+        return blons::VectorLength(a.pos - b.pos) < kTolerance && blons::VectorLength(a.normal - b.normal) < kTolerance &&
+               blons::VectorLength(a.albedo - b.albedo) < kTolerance && a.nearest_probe_id == b.nearest_probe_id;
+    };
+    auto sorted_surfels_copy = sorted_surfels;
+    std::sort(sorted_surfels_copy.begin(), sorted_surfels_copy.end(), surfel_less);
+    std::sort(hashed_surfels.begin(), hashed_surfels.end(), surfel_less);
+    bool surfels_match = std::equal(sorted_surfels_copy.begin(), sorted_surfels_copy.end(),
+                                    hashed_surfels.begin(), hashed_surfels.end(), surfel_equal);
+    // Brick weights are summed in a different order, so only expect them to be close
+    double max_weight_error = 0.0;
+    for (const auto& probe : sorted_probes)
+    {
+        double total = 0.0;
+        for (int i = 0; i < probe.brick_factor_count; i++)
+        {
+            for (const auto& weight : sorted_brick_factors[probe.brick_factor_range_start + i].brick_weights)
+            {
+                total += weight;
+            }
+        }
+        max_weight_error = std::max(max_weight_error, std::abs(total - hashed_weight_totals[probe.id]) / std::max(hashed_weight_totals[probe.id], 1.0));
+    }
+
+    blons::console::out("%i samples into %i surfels, %i bricks, %i brick factors\n", sample_count,
+                        static_cast<int>(sorted_surfels.size()), static_cast<int>(sorted_bricks.size()), static_cast<int>(sorted_brick_factors.size()));
+    blons::console::out("sorted: %ims, hash map: %ims (%.2fx)\n", static_cast<int>(sorted_time), static_cast<int>(hashed_time),
+                        static_cast<double>(hashed_time) / std::max<double>(static_cast<double>(sorted_time), 1.0));
+    blons::console::out("surfels %s, bricks %s, max probe weight error %g\n", surfels_match ? "match" : "MISMATCH",
+                        sorted_bricks.size() == hashed_brick_count ? "match" : "MISMATCH", max_weight_error);
+}
+
+// Triangulates 1k, 10k, and 100k random probes (or just probe_count of them). Small sets are also checked
+// for any probe lying inside of a tetrahedron's circumsphere, which a Delaunay triangulation never has
+void BenchmarkDelaunay(int probe_count)
+{
+    using blons::pipeline::stage::LightSector;
+    using blons::pipeline::stage::RadianceTransferBaker;
+    std::vector<int> probe_counts = { 1000, 10000, 100000 };
+    if (probe_count > 0)
+    {
+        probe_counts = { probe_count };
+    }
+    for (const auto& count : probe_counts)
+    {
+        std::vector<LightSector::Probe> probes;
+        blons::pipeline::stage::temp::GenerateRandomProbes(&probes, count, 50.0f);
+
+        blons::Timer timer;
+        auto tetrahedrons = RadianceTransferBaker::TriangulateProbeNetwork(probes);
+        auto elapsed = timer.ms();
+
+        const char* validation = "unchecked";
+        if (count <= 2000)
+        {
+            bool delaunay = true;
+            for (const auto& tetrahedron : tetrahedrons)
+            {
+                auto circumsphere = blons::TetrahedronCircumsphere({ { probes[tetrahedron[0]].pos, probes[tetrahedron[1]].pos,
+                                                                       probes[tetrahedron[2]].pos, probes[tetrahedron[3]].pos } });
+                for (const auto& probe : probes)
+                {
+                    if (blons::VectorDistance(circumsphere.center, probe.pos) < circumsphere.radius - 1e-3)
+                    {
+                        delaunay = false;
+                    }
+                }
+            }
+            validation = delaunay ? "delaunay" : "NOT DELAUNAY";
+        }
+        blons::console::out("%6i probes: %7i tetrahedrons in %ims (%s)\n", count, static_cast<int>(tetrahedrons.size()),
+                            static_cast<int>(elapsed), validation);
+    }
+}
+
+// Builds a BVH over the scene models and times closest hit raycasts, segment tests, and nearest point queries
+// against random rays inside the scene bounds. The first few rays are checked against a brute force search
+void BenchmarkBVH(const std::vector<blons::Model*>& models, int ray_count)
+{
+    blons::Timer timer;
+    blons::BVH bvh(models);
+    auto build_time = timer.ms();
+    blons::console::out("%i triangles, %i nodes, built in %ims\n", static_cast<int>(bvh.triangle_count()),
+                        static_cast<int>(bvh.node_count()), static_cast<int>(build_time));
+
+    // World space triangles for the brute force check, which also gives us the scene bounds
+    std::vector<std::array<blons::Vector3, 3>> triangles;
+    blons::Vector3 scene_min(std::numeric_limits<float>::max());
+    blons::Vector3 scene_max(-std::numeric_limits<float>::max());
+    for (const auto& model : models)
+    {
+        const auto& mesh = model->mesh();
+        if (mesh.draw_mode != blons::TRIANGLES)
+        {
+            continue;
+        }
+        auto world_matrix = model->world_matrix();
+        for (std::size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            std::array<blons::Vector3, 3> triangle;
+            for (int v = 0; v < 3; v++)
+            {
+                const auto& pos = mesh.vertices[mesh.indices[i + v]].pos;
+                blons::Vector4 world_pos = blons::Vector4(pos.x, pos.y, pos.z, 1.0f) * world_matrix;
+                triangle[v] = blons::Vector3(world_pos.x, world_pos.y, world_pos.z);
+                scene_min = blons::Vector3(std::min(scene_min.x, triangle[v].x), std::min(scene_min.y, triangle[v].y), std::min(scene_min.z, triangle[v].z));
+                scene_max = blons::Vector3(std::max(scene_max.x, triangle[v].x), std::max(scene_max.y, triangle[v].y), std::max(scene_max.z, triangle[v].z));
+            }
+            triangles.push_back(triangle);
+        }
+    }
+    if (triangles.empty())
+    {
+        blons::console::out("No triangles to trace\n");
+        return;
+    }
+    const float max_distance = blons::VectorDistance(scene_min, scene_max);
+
+    std::mt19937 random_algorithm;
+    random_algorithm.seed(1);
+    std::uniform_real_distribution<float> unit_distribution(0.0f, 1.0f);
+    std::normal_distribution<float> direction_distribution;
+    std::vector<blons::Vector3> origins(ray_count), directions(ray_count);
+    for (int i = 0; i < ray_count; i++)
+    {
+        origins[i] = scene_min + (scene_max - scene_min) * blons::Vector3(unit_distribution(random_algorithm),
+                                                                          unit_distribution(random_algorithm),
+                                                                          unit_distribution(random_algorithm));
+        directions[i] = blons::VectorNormalize(blons::Vector3(direction_distribution(random_algorithm),
+                                                              direction_distribution(random_algorithm),
+                                                              direction_distribution(random_algorithm)));
+    }
+    auto rate = [](int count, blons::units::time::us elapsed)
+    {
+        return static_cast<double>(count) / std::max<double>(static_cast<double>(elapsed), 1.0);
+    };
+
+    // Closest hits, single threaded and then across every worker
+    timer.Start();
+    int hits = 0;
+    for (int i = 0; i < ray_count; i++)
+    {
+        hits += bvh.Raycast(origins[i], directions[i], max_distance, nullptr) ? 1 : 0;
+    }
+    auto serial_time = timer.us();
+    std::vector<char> parallel_hits(ray_count);
+    timer.Start();
+    blons::ParallelFor(0, ray_count, 1024, [&](std::size_t i)
+    {
+        parallel_hits[i] = bvh.Raycast(origins[i], directions[i], max_distance, nullptr) ? 1 : 0;
+    });
+    auto parallel_time = timer.us();
+    blons::console::out("raycast: %i/%i hits, %.2f million rays/sec on 1 thread, %.2f on %i workers\n", hits, ray_count,
+                        rate(ray_count, serial_time), rate(ray_count, parallel_time), blons::Job::worker_count());
+
+    // Segments a tenth of the scene across, as visibility checks would use
+    timer.Start();
+    int blocked = 0;
+    for (int i = 0; i < ray_count; i++)
+    {
+        blocked += bvh.SegmentIntersects(origins[i], origins[i] + directions[i] * (max_distance * 0.1f)) ? 1 : 0;
+    }
+    auto segment_time = timer.us();
+    blons::console::out("segment: %i/%i blocked, %.2f million segments/sec on 1 thread\n", blocked, ray_count, rate(ray_count, segment_time));
+
+    int nearest_count = std::max(ray_count / 10, 1);
+    timer.Start();
+    for (int i = 0; i < nearest_count; i++)
+    {
+        bvh.NearestPoint(origins[i], max_distance, nullptr);
+    }
+    auto nearest_time = timer.us();
+    blons::console::out("nearest point: %.2f million queries/sec on 1 thread\n", rate(nearest_count, nearest_time));
+
+    // Brute force a handful of rays to make sure the tree finds the same hits
+    const int kValidationRays = std::min(ray_count, 64);
+    int mismatches = 0;
+    for (int i = 0; i < kValidationRays; i++)
+    {
+        float closest = max_distance;
+        bool brute_hit = false;
+        for (const auto& triangle : triangles)
+        {
+            blons::Vector3 edge1 = triangle[1] - triangle[0];
+            blons::Vector3 edge2 = triangle[2] - triangle[0];
+            blons::Vector3 p = blons::VectorCross(directions[i], edge2);
+            float det = blons::VectorDot(edge1, p);
+            if (std::abs(det) < 1e-12f)
+            {
+                continue;
+            }
+            blons::Vector3 s = origins[i] - triangle[0];
+            float u = blons::VectorDot(s, p) / det;
+            blons::Vector3 q = blons::VectorCross(s, edge1);
+            float v = blons::VectorDot(directions[i], q) / det;
+            float t = blons::VectorDot(edge2, q) / det;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t <= closest)
+            {
+                closest = t;
+                brute_hit = true;
+            }
+        }
+        blons::BVH::Hit hit;
+        bool bvh_hit = bvh.Raycast(origins[i], directions[i], max_distance, &hit);
+        if (bvh_hit != brute_hit || (bvh_hit && std::abs(hit.distance - closest) > 1e-3f * std::max(closest, 1.0f)))
+        {
+            mismatches++;
+        }
+    }
+    blons::console::out("%i/%i rays match brute force\n", kValidationRays - mismatches, kValidationRays);
+}
+
+// Places probes over the scene models with the light:probe-* settings and the given budget, timing it for each
+// subdivision level. Placement runs twice per level to make sure the worker threads don't change the results
+void BenchmarkProbePlacement(const std::vector<blons::Model*>& models, int max_probes)
+{
+    blons::pipeline::Scene scene;
+    scene.models = models;
+    blons::Timer timer;
+    blons::pipeline::stage::ProbePlacer placer(scene);
+    blons::console::out("BVH built in %ims\n", static_cast<int>(timer.ms()));
+
+    const float spacing = blons::console::var<float>("light:probe-spacing");
+    const int max_subdivisions = blons::console::var<int>("light:probe-subdivisions");
+    for (int subdivisions = 0; subdivisions <= max_subdivisions; subdivisions++)
+    {
+        timer.Start();
+        auto probes = placer.Place(spacing, subdivisions, max_probes);
+        auto elapsed = timer.ms();
+        auto repeat = placer.Place(spacing, subdivisions, max_probes);
+        bool deterministic = probes.size() == repeat.size() &&
+                             (probes.empty() || memcmp(probes.data(), repeat.data(), probes.size() * sizeof(blons::Vector3)) == 0);
+        blons::console::out("%i subdivisions: %i probes in %ims (%s)\n", subdivisions, static_cast<int>(probes.size()),
+                            static_cast<int>(elapsed), deterministic ? "deterministic" : "NOT DETERMINISTIC");
+    }
+}
+
+// Moves query_count points around a grid of probes for a few frames, finding their probe weights each frame by
+// walking from the first cell, from the search grid, and in batches with and without last frame's cells as hints
+void BenchmarkProbeSearch(int query_count)
+{
+    using blons::pipeline::stage::LightSector;
+    using blons::pipeline::stage::ProbeNetworkSearch;
+    using blons::pipeline::stage::RadianceTransferBaker;
+    const int kProbesPerSide = 10;
+    const int kFrames = 8;
+    const float kProbeSpacing = 4.0f;
+    const float kProbeScale = kProbeSpacing * (kProbesPerSide - 1) / 2.0f;
+    // Laid out on a grid like the built in probe sets, random layouts tend to have hulls too jagged to bake
+    std::vector<LightSector::Probe> probes;
+    for (int i = 0; i < kProbesPerSide * kProbesPerSide * kProbesPerSide; i++)
+    {
+        LightSector::Probe probe { i, blons::Vector3(static_cast<float>(i % kProbesPerSide),
+                                                     static_cast<float>(i / kProbesPerSide % kProbesPerSide),
+                                                     static_cast<float>(i / kProbesPerSide / kProbesPerSide)) * kProbeSpacing - kProbeScale };
+        probe.brick_factor_range_start = 0;
+        probe.brick_factor_count = 0;
+        probes.push_back(probe);
+    }
+    blons::Timer timer;
+    auto network = RadianceTransferBaker::BuildProbeNetwork(probes);
+    auto network_time = timer.ms();
+    timer.Start();
+    ProbeNetworkSearch search(probes, network);
+    blons::console::out("%i probes: %i cells built in %ims, search grid in %ims\n", static_cast<int>(probes.size()), static_cast<int>(network.size()),
+                        static_cast<int>(network_time), static_cast<int>(timer.ms()));
+
+    // Points start anywhere around the probes, some outside of the hull, and drift a little every frame
+    std::mt19937 random_algorithm;
+    random_algorithm.seed(1);
+    std::uniform_real_distribution<float> pos_distribution(-kProbeScale * 1.2f, kProbeScale * 1.2f);
+    std::uniform_real_distribution<float> velocity_distribution(-0.05f, 0.05f);
+    std::vector<blons::Vector3> points(query_count);
+    std::vector<blons::Vector3> velocities(query_count);
+    for (int i = 0; i < query_count; i++)
+    {
+        points[i] = blons::Vector3(pos_distribution(random_algorithm), pos_distribution(random_algorithm), pos_distribution(random_algorithm));
+        velocities[i] = blons::Vector3(velocity_distribution(random_algorithm), velocity_distribution(random_algorithm), velocity_distribution(random_algorithm));
+    }
+
+    std::vector<LightSector::ProbeSearchResult> first_cell_results(query_count);
+    std::vector<LightSector::ProbeSearchResult> grid_results(query_count);
+    std::vector<LightSector::ProbeSearchResult> batch_results(query_count);
+    std::vector<LightSector::ProbeSearchResult> hinted_results(query_count);
+    std::vector<int> hint_cells(query_count, LightSector::INVALID_ID);
+    blons::units::time::us first_cell_time = 0;
+    blons::units::time::us grid_time = 0;
+    blons::units::time::us batch_time = 0;
+    blons::units::time::us hinted_time = 0;
+    // Points on the border of two cells can be found in either, so results are compared by the weights they end up with.
+    // Outside of the hull the extruded outer cells overlap, and points there can have more than one right answer
+    const float kMaxDifference = 0.1f;
+    auto weight_difference = [](const LightSector::ProbeSearchWeights& a, const LightSector::ProbeSearchWeights& b)
+    {
+        float difference = 0.0f;
+        for (const auto& weight : a)
+        {
+            float matching_weight = 0.0f;
+            for (const auto& other : b)
+            {
+                if (other.id == weight.id && other.weight > 0.0f)
+                {
+                    matching_weight = other.weight;
+                }
+            }
+            difference += std::abs(weight.weight - matching_weight);
+        }
+        return difference;
+    };
+    int found = 0;
+    int inside = 0;
+    int mismatches = 0;
+    for (int frame = 0; frame < kFrames; frame++)
+    {
+        for (int i = 0; i < query_count; i++)
+        {
+            points[i] += velocities[i];
+        }
+        timer.Start();
+        for (int i = 0; i < query_count; i++)
+        {
+            search.Find(points[i], 0, &first_cell_results[i]);
+        }
+        first_cell_time += timer.us();
+        timer.Start();
+        for (int i = 0; i < query_count; i++)
+        {
+            search.Find(points[i], LightSector::INVALID_ID, &grid_results[i]);
+        }
+        grid_time += timer.us();
+        timer.Start();
+        search.Find(points.data(), nullptr, query_count, batch_results.data());
+        batch_time += timer.us();
+        timer.Start();
+        search.Find(points.data(), hint_cells.data(), query_count, hinted_results.data());
+        hinted_time += timer.us();
+        for (int i = 0; i < query_count; i++)
+        {
+            hint_cells[i] = hinted_results[i].cell_id;
+        }
+
+        for (int i = 0; i < query_count; i++)
+        {
+            found += hinted_results[i].cell_id != LightSector::INVALID_ID;
+            if (std::abs(points[i].x) > kProbeScale || std::abs(points[i].y) > kProbeScale || std::abs(points[i].z) > kProbeScale)
+            {
+                continue;
+            }
+            inside++;
+            if ((first_cell_results[i].cell_id == LightSector::INVALID_ID) != (hinted_results[i].cell_id == LightSector::INVALID_ID) ||
+                weight_difference(first_cell_results[i].weights, grid_results[i].weights) > kMaxDifference ||
+                weight_difference(first_cell_results[i].weights, batch_results[i].weights) > kMaxDifference ||
+                weight_difference(first_cell_results[i].weights, hinted_results[i].weights) > kMaxDifference)
+            {
+                mismatches++;
+            }
+        }
+    }
+
+    auto queries_per_second = [&](blons::units::time::us time)
+    {
+        return static_cast<double>(query_count) * kFrames / std::max<double>(static_cast<double>(time), 1.0);
+    };
+    blons::console::out("%i queries x%i frames\n", query_count, kFrames);
+    blons::console::out("from first cell: %.2fM/s (%.2fms/frame)\n", queries_per_second(first_cell_time), first_cell_time / 1000.0 / kFrames);
+    blons::console::out("from grid: %.2fM/s (%.2fms/frame)\n", queries_per_second(grid_time), grid_time / 1000.0 / kFrames);
+    blons::console::out("batched: %.2fM/s (%.2fms/frame)\n", queries_per_second(batch_time), batch_time / 1000.0 / kFrames);
+    blons::console::out("batched with hints: %.2fM/s (%.2fms/frame)\n", queries_per_second(hinted_time), hinted_time / 1000.0 / kFrames);
+    blons::console::out("%i/%i found, %i/%i inside the network match the first cell walk\n", found, query_count * kFrames,
+                        inside - mismatches, inside);
+}
+
+// Projects direction_count random weighted directions onto SH coefficients one at a time and in batches,
+// timing both and checking the batches against the one at a time sum
+void BenchmarkSHProjection(int direction_count)
+{
+    const int kRepeats = 16;
+    std::mt19937 random_algorithm;
+    random_algorithm.seed(1);
+    std::uniform_real_distribution<float> unit_distribution(-1.0f, 1.0f);
+    std::vector<blons::Vector3> directions(direction_count);
+    std::vector<float> weights(direction_count);
+    for (int i = 0; i < direction_count; i++)
+    {
+        directions[i] = blons::VectorNormalize(blons::Vector3(unit_distribution(random_algorithm),
+                                                              unit_distribution(random_algorithm),
+                                                              unit_distribution(random_algorithm)));
+        weights[i] = unit_distribution(random_algorithm) + 1.0f;
+    }
+
+    blons::SHCoeffs3 scalar_sh;
+    blons::Timer timer;
+    for (int repeat = 0; repeat < kRepeats; repeat++)
+    {
+        scalar_sh = blons::SHCoeffs3();
+        for (int i = 0; i < direction_count; i++)
+        {
+            scalar_sh += blons::SHProjectDirection3(directions[i]) * weights[i];
+        }
+    }
+    auto scalar_time = timer.us();
+
+    blons::SHCoeffs3 batch_sh;
+    timer.Start();
+    for (int repeat = 0; repeat < kRepeats; repeat++)
+    {
+        batch_sh = blons::SHCoeffs3();
+        blons::SHProjectDirections3(directions.data(), weights.data(), direction_count, &batch_sh);
+    }
+    auto batch_time = timer.us();
+
+    // Both are float sums in a different order, so measure them against a double precision sum
+    double reference[9] = {};
+    for (int i = 0; i < direction_count; i++)
+    {
+        auto sh = blons::SHProjectDirection3(directions[i]);
+        for (int c = 0; c < 9; c++)
+        {
+            reference[c] += static_cast<double>(sh.coeffs[c]) * weights[i];
+        }
+    }
+    double scalar_error = 0.0;
+    double batch_error = 0.0;
+    double batch_difference = 0.0;
+    for (int c = 0; c < 9; c++)
+    {
+        scalar_error = std::max(scalar_error, std::abs(scalar_sh.coeffs[c] - reference[c]));
+        batch_error = std::max(batch_error, std::abs(batch_sh.coeffs[c] - reference[c]));
+        batch_difference = std::max(batch_difference, static_cast<double>(std::abs(batch_sh.coeffs[c] - scalar_sh.coeffs[c])));
+    }
+
+    auto directions_per_second = [&](blons::units::time::us time)
+    {
+        return static_cast<double>(direction_count) * kRepeats / std::max<double>(static_cast<double>(time), 1.0);
+    };
+    blons::console::out("%i directions x%i\n", direction_count, kRepeats);
+    blons::console::out("scalar: %.2fM/s, batched: %.2fM/s (%.2fx)\n", directions_per_second(scalar_time), directions_per_second(batch_time),
+                        static_cast<double>(scalar_time) / std::max<double>(static_cast<double>(batch_time), 1.0));
+    blons::console::out("max error vs double: scalar %g, batched %g, max batched vs scalar difference %g\n",
+                        scalar_error, batch_error, batch_difference);
+}
+
+// Relights a synthetic sector with 8 surfels per brick on the CPU, checking the results don't depend on worker count
+void BenchmarkRelight(int brick_count)
+{
+    using blons::pipeline::stage::LightSector;
+    using blons::pipeline::stage::RadianceTransferRelighter;
+    const int kSurfelsPerBrick = 8;
+    const int kBricksPerProbe = 16;
+    const int kFactorsPerProbe = 32;
+    const int kShadowMapResolution = 1024;
+    const int kFrames = 8;
+    const float kSceneSize = 64.0f;
+    std::mt19937 random_algorithm;
+    random_algorithm.seed(1);
+    std::uniform_real_distribution<float> unit_distribution(0.0f, 1.0f);
+    auto random_vector = [&]() { return blons::Vector3(unit_distribution(random_algorithm), unit_distribution(random_algorithm), unit_distribution(random_algorithm)); };
+
+    int probe_count = std::max(brick_count / kBricksPerProbe, 1);
+    std::vector<LightSector::Probe> initial_probes;
+    for (int i = 0; i < probe_count; i++)
+    {
+        LightSector::Probe probe{ i, random_vector() * kSceneSize };
+        for (int c = 0; c < 9; c++)
+        {
+            probe.sh_sky_visibility.coeffs[c] = unit_distribution(random_algorithm) - 0.25f;
+        }
+        probe.brick_factor_range_start = i * kFactorsPerProbe;
+        probe.brick_factor_count = kFactorsPerProbe;
+        initial_probes.push_back(probe);
+    }
+    std::vector<LightSector::Surfel> initial_surfels;
+    std::vector<LightSector::SurfelBrick> initial_bricks;
+    for (int i = 0; i < brick_count; i++)
+    {
+        blons::Vector3 brick_pos = random_vector() * kSceneSize;
+        initial_bricks.push_back({ static_cast<int>(initial_surfels.size()), kSurfelsPerBrick, blons::Vector3(0.0f) });
+        for (int j = 0; j < kSurfelsPerBrick; j++)
+        {
+            LightSector::Surfel surfel;
+            surfel.nearest_probe_id = static_cast<int>(unit_distribution(random_algorithm) * (probe_count - 1));
+            surfel.pos = brick_pos + random_vector();
+            surfel.normal = blons::VectorNormalize(random_vector() - blons::Vector3(0.5f));
+            surfel.albedo = random_vector();
+            surfel.radiance = blons::Vector3(0.0f);
+            initial_surfels.push_back(surfel);
+        }
+    }
+    std::vector<LightSector::SurfelBrickFactor> brick_factors(probe_count * kFactorsPerProbe);
+    for (auto& factor : brick_factors)
+    {
+        factor.brick_id = static_cast<int>(unit_distribution(random_algorithm) * (brick_count - 1));
+        for (auto& weight : factor.brick_weights)
+        {
+            weight = unit_distribution(random_algorithm) * 0.1f;
+        }
+    }
+
+    // Moments of a noisy depth map, so that surfels land on both sides of the shadows
+    blons::PixelData shadow_map;
+    shadow_map.width = kShadowMapResolution;
+    shadow_map.height = kShadowMapResolution;
+    shadow_map.type = blons::TextureType(blons::TextureType::R16G16_UNORM, blons::TextureType::LINEAR, blons::TextureType::REPEAT);
+    shadow_map.pixels.resize(kShadowMapResolution * kShadowMapResolution * 2 * sizeof(float));
+    float* moments = reinterpret_cast<float*>(shadow_map.pixels.data());
+    for (int i = 0; i < kShadowMapResolution * kShadowMapResolution; i++)
+    {
+        float depth = unit_distribution(random_algorithm);
+        moments[i * 2] = depth;
+        moments[i * 2 + 1] = depth * depth;
+    }
+
+    RadianceTransferRelighter::Inputs inputs;
+    blons::Vector3 sun_dir = blons::VectorNormalize(blons::Vector3(0.3f, -1.0f, 0.2f));
+    inputs.light_vp_matrix = blons::MatrixLookAt(sun_dir * -kSceneSize, blons::Vector3(0.0f), blons::Vector3(0.0f, 1.0f, 0.0f)) *
+                             blons::MatrixOrthographic(-kSceneSize, kSceneSize, -kSceneSize, kSceneSize, 0.0f, kSceneSize * 2.0f);
+    inputs.light_depth = &shadow_map;
+    inputs.sun_dir = sun_dir;
+    inputs.sun_colour = blons::Vector3(1.0f, 0.9f, 0.8f);
+    inputs.sun_luminance = 10.0f;
+    inputs.metalness = blons::Vector3(0.0f);
+    inputs.gi_boost = 1.0f;
+    for (int c = 0; c < 9; c++)
+    {
+        inputs.sky_box.r.coeffs[c] = unit_distribution(random_algorithm);
+        inputs.sky_box.g.coeffs[c] = unit_distribution(random_algorithm);
+        inputs.sky_box.b.coeffs[c] = unit_distribution(random_algorithm);
+    }
+    inputs.sky_luminance = 1.0f;
+
+    // Several frames in a row so that the probes' bounce lighting feeds back into the surfels
+    struct RelightResult
+    {
+        std::vector<LightSector::Probe> probes;
+        std::vector<LightSector::SurfelBrick> bricks;
+        blons::units::time::us time;
+    };
+    auto relight = [&]()
+    {
+        std::vector<LightSector::Surfel> surfels(initial_surfels);
+        RelightResult result = { initial_probes, initial_bricks, 0 };
+        blons::Timer timer;
+        for (int frame = 0; frame < kFrames; frame++)
+        {
+            RadianceTransferRelighter::Relight(inputs, brick_factors, &surfels, &result.bricks, &result.probes);
+        }
+        result.time = timer.us() / kFrames;
+        return result;
+    };
+
+    int max_workers = std::max<int>(std::thread::hardware_concurrency(), 1);
+    blons::Job::ConfigureWorkers(1, false);
+    auto serial = relight();
+    blons::Job::ConfigureWorkers(max_workers, false);
+    relight();
+    auto parallel = relight();
+    blons::Job::ConfigureWorkers(blons::console::var<int>("sys:worker-threads"), blons::console::var<int>("sys:worker-affinity") != 0);
+
+    bool bricks_match = memcmp(serial.bricks.data(), parallel.bricks.data(), serial.bricks.size() * sizeof(LightSector::SurfelBrick)) == 0;
+    bool probes_match = memcmp(serial.probes.data(), parallel.probes.data(), serial.probes.size() * sizeof(LightSector::Probe)) == 0;
+    blons::console::out("%i surfels, %i bricks, %i probes, %i factors\n", static_cast<int>(initial_surfels.size()), brick_count,
+                        probe_count, static_cast<int>(brick_factors.size()));
+    blons::console::out("1 worker: %ius/frame, %i workers: %ius/frame (%.2fx)%s\n", serial.time, max_workers, parallel.time,
+                        static_cast<double>(serial.time) / std::max<double>(static_cast<double>(parallel.time), 1.0),
+                        bricks_match && probes_match ? "" : " [results differ]");
+}
+
+// Walks a camera around a loop for the given number of 60Hz frames, relighting an irradiance volume from the scene's
+// baked probes each frame. Reports the CPU and GPU time of the moving frames against the first full fill, along with
+// the memory of each level and how many voxels it updates as the camera moves
+void BenchmarkIrradianceClipmap(const std::vector<blons::Model*>& models, int frame_count)
+{
+    using blons::pipeline::stage::IrradianceVolume;
+    using blons::pipeline::stage::LightSector;
+    const int level_voxels = blons::pipeline::kIrradianceVolumeWidth * blons::pipeline::kIrradianceVolumeHeight *
+                             blons::pipeline::kIrradianceVolumeDepth;
+    // Running pace around a loop the size of sponza, bobbing up and down a storey
+    const float kSpeed = 6.0f;
+    const float kRadius = 15.0f;
+    auto camera_pos = [&](int frame)
+    {
+        float angle = static_cast<float>(frame) / 60.0f * kSpeed / kRadius;
+        return blons::Vector3(std::cos(angle) * kRadius, 4.0f + std::sin(angle * 3.0f) * 3.0f, std::sin(angle) * kRadius);
+    };
+
+    // The volume samples a sector baked from the scene. It's never relit, so only the camera moving updates voxels
+    blons::Light sun(blons::Light::DIRECTIONAL);
+    blons::pipeline::Scene scene;
+    scene.models = models;
+    scene.lights.push_back(&sun);
+    LightSector sector;
+    sector.BakeRadianceTransfer(scene);
+    while (sector.bake_progress() < 1.0f)
+    {
+        sector.ContinueBake(scene);
+        std::this_thread::yield();
+    }
+    if (!sector.baked())
+    {
+        blons::console::out("Couldn't bake the scene\n");
+        return;
+    }
+
+    blons::console::out("%i frames at %.1fm/s, %ix%ix%i voxels per level\n", frame_count, kSpeed,
+                        blons::pipeline::kIrradianceVolumeWidth, blons::pipeline::kIrradianceVolumeHeight,
+                        blons::pipeline::kIrradianceVolumeDepth);
+    IrradianceVolume volume;
+    auto context = blons::render::context();
+    std::vector<std::unique_ptr<blons::TimerResource>> gpu_starts(frame_count + 1);
+    std::vector<std::unique_ptr<blons::TimerResource>> gpu_ends(frame_count + 1);
+    std::vector<blons::units::time::us> cpu_times(frame_count + 1);
+    std::array<long long, blons::pipeline::kIrradianceClipmapLevels> total_voxels = {};
+    std::array<int, blons::pipeline::kIrradianceClipmapLevels> peak_voxels = {};
+    std::array<int, blons::pipeline::kIrradianceClipmapLevels> update_frames = {};
+    std::array<int, blons::pipeline::kIrradianceClipmapLevels> dispatches = {};
+    // The first frame fills every voxel, after that only those scrolling into a level should be
+    for (int frame = 0; frame <= frame_count; frame++)
+    {
+        blons::Timer timer;
+        gpu_starts[frame].reset(context->RegisterTimestamp());
+        if (!volume.Relight(sector, camera_pos(frame)))
+        {
+            blons::console::out("Failed to relight irradiance volume\n");
+            return;
+        }
+        gpu_ends[frame].reset(context->RegisterTimestamp());
+        cpu_times[frame] = timer.us();
+        if (frame == 0)
+        {
+            continue;
+        }
+        for (int level = 0; level < blons::pipeline::kIrradianceClipmapLevels; level++)
+        {
+            const auto& stats = volume.level_stats()[level];
+            total_voxels[level] += stats.updated_voxels;
+            peak_voxels[level] = std::max(peak_voxels[level], stats.updated_voxels);
+            update_frames[level] += stats.updated_voxels > 0 ? 1 : 0;
+            dispatches[level] += stats.updated_regions;
+        }
+    }
+
+    // Timestamps come back once the GPU catches up, which is given a second before giving up on them
+    blons::Timer gpu_wait;
+    while (context->GetTimestamp(gpu_ends[frame_count].get()) == 0 && gpu_wait.ms() < 1000)
+    {
+        std::this_thread::yield();
+    }
+    auto gpu_time = [&](int frame)
+    {
+        auto start = context->GetTimestamp(gpu_starts[frame].get());
+        auto end = context->GetTimestamp(gpu_ends[frame].get());
+        return start != 0 && end != 0 ? static_cast<double>(end - start) : -1.0;
+    };
+    double cpu_total = 0.0;
+    double gpu_total = 0.0;
+    for (int frame = 1; frame <= frame_count; frame++)
+    {
+        cpu_total += static_cast<double>(cpu_times[frame]);
+        gpu_total += std::max(gpu_time(frame), 0.0);
+    }
+    const double frames = static_cast<double>(std::max(frame_count, 1));
+    blons::console::out("Full fill: %ius CPU, %.0fus GPU\n", static_cast<int>(cpu_times[0]), gpu_time(0));
+    blons::console::out("Moving: %.1fus CPU, %.1fus GPU per frame\n", cpu_total / frames, gpu_total / frames);
+    for (int level = 0; level < blons::pipeline::kIrradianceClipmapLevels; level++)
+    {
+        const auto& stats = volume.level_stats()[level];
+        double average_voxels = static_cast<double>(total_voxels[level]) / frames;
+        blons::console::out("Level %i (%.2fm voxels): %.2fMB, %.1f voxels/frame (%.2f%% of a full update), "
+                            "peak %i, updated on %i frames with %i dispatches\n",
+                            level, stats.voxel_size, static_cast<float>(stats.memory) / (1024.0f * 1024.0f), average_voxels,
+                            average_voxels * 100.0 / level_voxels, peak_voxels[level], update_frames[level], dispatches[level]);
+    }
+}
+} // namespace
+
+void InitBenchmarkConsole(const std::vector<blons::Model*>& scene_models)
+{
+    blons::console::RegisterFunction("bench:jobs", []() { BenchmarkJobContention(16, 250000); });
+    blons::console::RegisterFunction("bench:jobs", [](int producers, int jobs_per_producer) { BenchmarkJobContention(producers, jobs_per_producer); });
+    blons::console::RegisterFunction("bench:parallel-for", []() { BenchmarkParallelFor(1 << 22, std::max<int>(std::thread::hardware_concurrency(), 1)); });
+    blons::console::RegisterFunction("bench:parallel-for", [](int element_count, int max_workers) { BenchmarkParallelFor(element_count, max_workers); });
+    blons::console::RegisterFunction("bench:job-alloc", []() { BenchmarkJobAllocations(100000); });
+    blons::console::RegisterFunction("bench:job-alloc", [](int job_count) { BenchmarkJobAllocations(job_count); });
+    blons::console::RegisterFunction("bench:job-latency", []() { BenchmarkJobLatency(200, 20); });
+    blons::console::RegisterFunction("bench:job-latency", [](int frames, int background_job_ms) { BenchmarkJobLatency(frames, background_job_ms); });
+    blons::console::RegisterFunction("test:job-future", []() { TestJobFutures(16); });
+    blons::console::RegisterFunction("bench:surfel-cluster", []() { BenchmarkSurfelClustering(4000000); });
+    blons::console::RegisterFunction("bench:surfel-cluster", [](int sample_count) { BenchmarkSurfelClustering(sample_count); });
+    blons::console::RegisterFunction("bench:delaunay", []() { BenchmarkDelaunay(0); });
+    blons::console::RegisterFunction("bench:delaunay", [](int probe_count) { BenchmarkDelaunay(probe_count); });
+    blons::console::RegisterFunction("bench:bvh", [=]() { BenchmarkBVH(scene_models, 1000000); });
+    blons::console::RegisterFunction("bench:bvh", [=](int ray_count) { BenchmarkBVH(scene_models, ray_count); });
+    blons::console::RegisterFunction("bench:probe-placement", [=]() { BenchmarkProbePlacement(scene_models, blons::console::var<int>("light:probe-budget")); });
+    blons::console::RegisterFunction("bench:probe-placement", [=](int max_probes) { BenchmarkProbePlacement(scene_models, max_probes); });
+    blons::console::RegisterFunction("bench:probe-search", []() { BenchmarkProbeSearch(100000); });
+    blons::console::RegisterFunction("bench:probe-search", [](int query_count) { BenchmarkProbeSearch(query_count); });
+    blons::console::RegisterFunction("bench:sh-project", []() { BenchmarkSHProjection(1 << 20); });
+    blons::console::RegisterFunction("bench:sh-project", [](int direction_count) { BenchmarkSHProjection(direction_count); });
+    blons::console::RegisterFunction("bench:relight", []() { BenchmarkRelight(65536); });
+    blons::console::RegisterFunction("bench:relight", [](int brick_count) { BenchmarkRelight(brick_count); });
+    blons::console::RegisterFunction("bench:irradiance-clipmap", [=]() { BenchmarkIrradianceClipmap(scene_models, 3600); });
+    blons::console::RegisterFunction("bench:irradiance-clipmap", [=](int frame_count) { BenchmarkIrradianceClipmap(scene_models, frame_count); });
+}
\ No newline at end of file
@@ -26,6 +26,7 @@
 
 void InitTestUI(blons::gui::Manager* gui);
 void InitTestConsole(blons::Graphics* graphics, blons::Client::Info info);
+void InitBenchmarkConsole(const std::vector<blons::Model*>& scene_models);
 void SetRenderingOutput(blons::Graphics* graphics);
 
 int WINAPI WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_line, int cmd_show)
@@ -60,6 +61,44 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR cmd_line,
     graphics->BakeRadianceTransfer();
 
     InitTestConsole(graphics.get(), info);
+    std::vector<blons::Model*> scene_models;
+    for (const auto& model : models)
+    {
+        scene_models.push_back(model.get());
+    }
+    InitBenchmarkConsole(scene_models);
+
+    // Moves the sphere and rebakes around it, checking the results against a full bake
+    auto sphere = models.back().get();
+    auto graphics_handle = graphics.get();
+    // Validation runs when the rebake finishes, so the rebake is forced to finish before this returns
+    auto validated_rebake = [=]()
+    {
+        if (graphics_handle->bake_progress() < 1.0f)
+        {
+            blons::log::Warn("Can't validate a rebake while another bake is running\n");
+            return;
+        }
+        auto validate = blons::console::var<int>("light:rebake-validate");
+        auto progressive = blons::console::var<int>("light:bake-progressive");
+        blons::console::set_var("light:rebake-validate", 1);
+        blons::console::set_var("light:bake-progressive", 0);
+        graphics_handle->RebakeRadianceTransfer();
+        blons::console::set_var("light:rebake-validate", validate);
+        blons::console::set_var("light:bake-progressive", progressive);
+    };
+    blons::console::RegisterFunction("test:rebake", [=](float x, float y, float z)
+    {
+        sphere->set_pos(x, y, z);
+        validated_rebake();
+    });
+    // Switches to placed probes at the given spacing and rebakes, checking a changed probe layout against a full bake
+    blons::console::RegisterFunction("test:rebake-probes", [=](float spacing)
+    {
+        blons::console::set_var("light:probe-placement", 1);
+        blons::console::set_var("light:probe-spacing", spacing);
+        validated_rebake();
+    });
 
     bool quit = false;
     while (!quit)
@@ -137,6 +176,12 @@ void InitTestConsole(blons::Graphics* graphics, blons::Client::Info info)
     auto v_c = blons::console::var<std::string>("sv:greeting");
 
     blons::console::RegisterFunction("gfx:reload", [=](){ graphics->Reload(info); graphics->BakeRadianceTransfer(); });
+    blons::console::RegisterFunction("gfx:rebake", [=](){ graphics->RebakeRadianceTransfer(); });
+    blons::console::RegisterFunction("sys:reload-workers", []()
+    {
+        blons::Job::ConfigureWorkers(blons::console::var<int>("sys:worker-threads"), blons::console::var<int>("sys:worker-affinity") != 0);
+        blons::console::out("Running %i worker threads\n", blons::Job::worker_count());
+    });
     blons::console::RegisterVariable("dbg:target", 0);
     blons::console::RegisterVariable("dbg:alt-target", 1);
 